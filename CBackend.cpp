@@ -0,0 +1,512 @@
+#include "stdafx.h"
+#include "CBackend.h"
+#include "Type.h"
+#include "Expression.h"
+#include "Statement.h"
+#include "Declaration.h"
+#include "Visitor.h"
+#include "ConstantEvaluator.h"
+#include "DeadCode.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// Signed overflow is undefined in C, so wrapping operations go through
+// unsigned arithmetic.
+static const char* prelude =
+	"#include <math.h>\n"
+	"#include <stdbool.h>\n"
+	"#include <stdint.h>\n"
+	"\n"
+	"static inline int32_t int_add(int32_t a, int32_t b) { return (int32_t)((uint32_t)a + (uint32_t)b); }\n"
+	"static inline int32_t int_sub(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }\n"
+	"static inline int32_t int_mul(int32_t a, int32_t b) { return (int32_t)((uint32_t)a * (uint32_t)b); }\n"
+	"static inline int32_t int_neg(int32_t a) { return (int32_t)(0u - (uint32_t)a); }\n"
+	"static inline int32_t int_shl(int32_t a, int32_t b) { return (int32_t)((uint32_t)a << (b & 31)); }\n"
+	"static inline int32_t int_shr(int32_t a, int32_t b) { return a >> (b & 31); }\n";
+
+std::string getCName(const Declaration* d)
+{
+	return *d->getName() + '_' + std::to_string(d->getIndex());
+}
+
+static const char* getCType(const Type* t)
+{
+	switch (t->getObjectType()->getKind()) {
+	case Type::bool_kind: return "bool";
+	case Type::char_kind: return "unsigned char";
+	case Type::int_kind: return "int32_t";
+	case Type::float_kind: return "float";
+	default: throw std::logic_error("Type has no C equivalent");
+	}
+}
+
+// Floats are single precision, as in the other lowerings. Nine digits
+// give back the same float.
+static void writeFloat(std::ostream& os, double d)
+{
+	char buffer[32];
+	std::snprintf(buffer, sizeof buffer, "%.9g", static_cast<float>(d));
+	std::string s = buffer;
+	if (s.find_first_of(".e") == std::string::npos)
+		s += ".0";
+	os << s << 'f';
+}
+
+// The most negative int has no literal in C.
+static void writeInt(std::ostream& os, std::int32_t i)
+{
+	if (i == INT32_MIN)
+		os << "INT32_MIN";
+	else
+		os << i;
+}
+
+// An expression whose parts are being written by the expression writer.
+// Stage counts the parts written so far. The first operands may be stored
+// in temporaries before the expression itself is written: stored counts
+// them, and temp is the number of the first temporary.
+struct CExpressionTask {
+	const Expression* expr;
+	std::size_t stage;
+	std::size_t temp;
+	std::size_t stored;
+};
+
+// Writes an expression with its own stack of tasks, like the walkers of
+// the other lowerings. Each node writes the text before its first operand,
+// between its operands and after its last one in turn, and everything is
+// parenthesized. The C types of the temporaries it uses are added to
+// temps.
+class CExpressionWriter : public ExpressionVisitor<CExpressionWriter> {
+public:
+	CExpressionWriter(std::ostream& os, std::vector<const char*>& temps)
+		: os(os), temps(temps), i(0), stage(0) {}
+
+	void run(const Expression* e) {
+		tasks.push_back({ e, 0, 0, 0 });
+		while (!tasks.empty()) {
+			i = tasks.size() - 1;
+			stage = tasks[i].stage++;
+			visit(tasks[i].expr);
+		}
+	}
+
+	void visitBoolExpression(const BoolExpression* e) {
+		os << (e->getValue() ? "true" : "false");
+		tasks.pop_back();
+	}
+
+	void visitIntExpression(const IntExpression* e) {
+		writeInt(os, e->getValue());
+		tasks.pop_back();
+	}
+
+	void visitFloatExpression(const FloatExpression* e) {
+		writeFloat(os, e->getValue());
+		tasks.pop_back();
+	}
+
+	void visitIdExpression(const IdExpression* e) {
+		os << getCName(e->getDeclaration());
+		tasks.pop_back();
+	}
+
+	void visitUnopExpression(const UnopExpression* u) {
+		if (stage == 0) {
+			switch (u->getOperator()) {
+			case uo_pos: os << "("; break;
+			case uo_neg: os << (u->isFloat() ? "(-" : "int_neg("); break;
+			case uo_cmp: os << "(~"; break;
+			case uo_not: os << (u->isBool() ? "(!" : "(~"); break;
+			default: throw std::logic_error("Unsupported operator");
+			}
+			return operand(u->getOperand());
+		}
+		finish(")");
+	}
+
+	void visitBinopExpression(const BinopExpression* b) {
+		// Wrapping operations are calls into the prelude.
+		static const char* calls[] = { "int_add(", "int_sub(", "int_mul(", nullptr, nullptr, nullptr, nullptr, nullptr, "int_shl(", "int_shr(" };
+		static const char* infixes[] = { " + ", " - ", " * ", " / ", " % ", " & ", " | ", " ^ ", " << ", " >> ",
+			" && ", " || ", " == ", " != ", " < ", " > ", " <= ", " >= " };
+
+		binop op = b->getOperator();
+		bool floats = b->getLHS()->isFloat();
+		const char* call = !floats && op <= bo_shr ? calls[op] : floats && op == bo_rem ? "fmodf(" : nullptr;
+		// C orders the operands of && and || itself.
+		const Expression* operands[] = { b->getLHS(), b->getRHS() };
+		if (op != bo_land && op != bo_lor && store(operands, 2)) {
+			return;
+		}
+		if (stage == 0) {
+			os << (call ? call : "(");
+			return operand(0, b->getLHS());
+		}
+		if (stage == 1) {
+			os << (call ? ", " : infixes[op]);
+			return operand(1, b->getRHS());
+		}
+		finish(")");
+	}
+
+	void visitCallExpression(const CallExpression* c) {
+		const ExpressionList& args = c->getArguments();
+		if (store(args.data(), args.size())) {
+			return;
+		}
+		if (stage == 0) {
+			return operand(c->getCallee());
+		}
+		if (stage <= args.size()) {
+			os << (stage == 1 ? "(" : ", ");
+			return operand(stage - 1, args[stage - 1]);
+		}
+		finish(args.empty() ? "()" : ")");
+	}
+
+	// The checker has already converted the operand.
+	void visitCastExpression(const CastExpression* c) {
+		if (stage == 0) {
+			return operand(c->source);
+		}
+		tasks.pop_back();
+	}
+
+	void visitAssignmentExpression(const AssignmentExpression* a) {
+		if (stage == 0) {
+			os << "(";
+			return operand(a->getLHS());
+		}
+		if (stage == 1) {
+			os << " = ";
+			return operand(a->getRHS());
+		}
+		finish(")");
+	}
+
+	void visitConditionalExpression(const ConditionalExpression* c) {
+		if (stage == 0) {
+			os << "(";
+			return operand(c->getCondition());
+		}
+		if (stage == 1) {
+			os << " ? ";
+			return operand(c->getPassValue());
+		}
+		if (stage == 2) {
+			os << " : ";
+			return operand(c->getFailValue());
+		}
+		finish(")");
+	}
+
+	// A reference is an lvalue in C, so reading one needs nothing.
+	void visitConversionExpression(const ConversionExpression* c) {
+		const Expression* source = c->getSource();
+		Conversion k = c->getConversion();
+		if (stage == 0) {
+			switch (k) {
+			case conv_identity:
+			case conv_value:
+				break;
+			case conv_bool:
+				os << "(";
+				break;
+			case conv_char:
+				os << "((unsigned char)";
+				break;
+			case conv_int:
+			case conv_trunc:
+				os << "((int32_t)";
+				break;
+			case conv_ext:
+				os << "((float)";
+				break;
+			}
+			return operand(source);
+		}
+		if (k == conv_identity || k == conv_value) {
+			tasks.pop_back();
+		}
+		else if (k == conv_bool) {
+			finish(source->isFloat() ? " != 0.0f)" : " != 0)");
+		}
+		else {
+			finish(")");
+		}
+	}
+
+	void visitExpression(const Expression*) {
+		throw std::logic_error("Unsupported expression");
+	}
+
+private:
+	// C leaves the order of operands open. When an operand has effects, it
+	// and the operands before it are stored in temporaries first, from left
+	// to right, so that they run in the order of the other lowerings; the
+	// last operand stays in place. Returns true while the stages go to
+	// storing, and leaves stage counting the parts of the node itself.
+	bool store(const Expression* const* operands, std::size_t n) {
+		CExpressionTask& t = tasks[i];
+		if (stage == 0) {
+			std::size_t k = n;
+			while (k > 0 && !hasEffects(operands[k - 1]))
+				--k;
+			t.stored = n ? std::min(k, n - 1) : 0;
+			t.temp = temps.size();
+			for (std::size_t j = 0; j < t.stored; ++j)
+				temps.push_back(getCType(operands[j]->getType()));
+		}
+		if (stage < t.stored) {
+			os << (stage == 0 ? "(" : ", ") << "tmp" << t.temp + stage << " = ";
+			operand(operands[stage]);
+			return true;
+		}
+		if (stage == t.stored && t.stored)
+			os << ", ";
+		stage -= t.stored;
+		return false;
+	}
+
+	void operand(const Expression* e) {
+		tasks.push_back({ e, 0, 0, 0 });
+	}
+
+	// Writes operand k, or the temporary it is stored in. The node is
+	// visited again for its next stage.
+	void operand(std::size_t k, const Expression* e) {
+		if (k < tasks[i].stored)
+			os << "tmp" << tasks[i].temp + k;
+		else
+			operand(e);
+	}
+
+	void finish(const char* s) {
+		os << s;
+		if (tasks[i].stored)
+			os << ')';
+		tasks.pop_back();
+	}
+
+	std::ostream& os;
+	std::vector<const char*>& temps;
+	std::vector<CExpressionTask> tasks;
+	std::size_t i;
+	std::size_t stage;
+};
+
+// A statement whose sub-statements are being written by the statement
+// writer. Stage counts the sub-statements started so far.
+struct CStatementTask {
+	const Statement* stmt;
+	std::size_t stage;
+};
+
+// Writes the statements of a function body with its own stack of tasks.
+// Every sub-statement of an if, when or while is written as a braced
+// block, since C does not allow a bare declaration there. The temporaries
+// of an expression are declared just before its statement, and numbered
+// through the function.
+class CStatementWriter : public StatementVisitor<CStatementWriter> {
+public:
+	CStatementWriter(std::ostream& os)
+		: os(os), i(0), stage(0), depth(1) {}
+
+	void run(const Statement* s) {
+		tasks.push_back({ s, 0 });
+		while (!tasks.empty()) {
+			i = tasks.size() - 1;
+			stage = tasks[i].stage++;
+			visit(tasks[i].stmt);
+		}
+	}
+
+	void visitBlockStatement(const BlockStatement* b) {
+		const StatementList& stmts = b->getStatements();
+		if (stage < stmts.size()) {
+			return tasks.push_back({ stmts[stage], 0 });
+		}
+		tasks.pop_back();
+	}
+
+	void visitWhenStatement(const WhenStatement* w) {
+		if (stage == 0) {
+			std::string c = expression(w->getCondition());
+			indent() << "if (" << c;
+			return open(w->getBody());
+		}
+		close();
+		tasks.pop_back();
+	}
+
+	void visitIfStatement(const IfStatement* f) {
+		if (stage == 0) {
+			std::string c = expression(f->getCondition());
+			indent() << "if (" << c;
+			return open(f->getPassValue());
+		}
+		if (stage == 1) {
+			--depth;
+			indent() << "} else {\n";
+			++depth;
+			return tasks.push_back({ f->getFailValue(), 0 });
+		}
+		close();
+		tasks.pop_back();
+	}
+
+	void visitWhileStatement(const WhileStatement* w) {
+		if (stage == 0) {
+			std::string c = expression(w->getCondition());
+			indent() << "while (" << c;
+			return open(w->getBody());
+		}
+		close();
+		tasks.pop_back();
+	}
+
+	void visitBreakStatement(const BreakStatement*) {
+		indent() << "break;\n";
+		tasks.pop_back();
+	}
+
+	void visitContinueStatement(const ContinueStatement*) {
+		indent() << "continue;\n";
+		tasks.pop_back();
+	}
+
+	void visitReturnStatement(const ReturnStatement* s) {
+		std::string v = expression(s->getValue());
+		indent() << "return " << v << ";\n";
+		tasks.pop_back();
+	}
+
+	void visitDeclareStatement(const DeclareStatement* s) {
+		const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(s->getDeclaration());
+		if (!o) {
+			throw std::logic_error("Invalid local declaration");
+		}
+		std::string v = o->getInit() ? expression(o->getInit()) : "0";
+		indent() << getCType(o->getType()) << ' ' << getCName(o) << " = " << v << ";\n";
+		tasks.pop_back();
+	}
+
+	void visitExpressionStatement(const ExpressionStatement* s) {
+		std::string e = expression(s->getExpression());
+		indent() << e << ";\n";
+		tasks.pop_back();
+	}
+
+	void visitStatement(const Statement*) {
+		throw std::logic_error("Unsupported statement");
+	}
+
+private:
+	// Writes e to a string, and declares the temporaries it uses.
+	std::string expression(const Expression* e) {
+		std::ostringstream text;
+		std::size_t first = temps.size();
+		CExpressionWriter(text, temps).run(e);
+		for (std::size_t k = first; k < temps.size(); ++k)
+			indent() << temps[k] << " tmp" << k << ";\n";
+		return text.str();
+	}
+
+	std::ostream& indent() {
+		for (unsigned k = 0; k < depth; ++k)
+			os << '\t';
+		return os;
+	}
+
+	// Ends the condition, opens a block and starts s in it.
+	void open(const Statement* s) {
+		os << ") {\n";
+		++depth;
+		tasks.push_back({ s, 0 });
+	}
+
+	void close() {
+		--depth;
+		indent() << "}\n";
+	}
+
+	std::ostream& os;
+	std::vector<const char*> temps;
+	std::vector<CStatementTask> tasks;
+	std::size_t i;
+	std::size_t stage;
+	unsigned depth;
+};
+
+static void writePrototype(std::ostream& os, const FunctionDeclaration* f)
+{
+	os << getCType(f->getReturnType()) << ' ' << getCName(f) << '(';
+	const DeclarationList& params = f->getParameters();
+	for (std::size_t k = 0; k < params.size(); ++k) {
+		const ParameterDeclaration* p = cast<ParameterDeclaration>(params[k]);
+		os << (k ? ", " : "") << getCType(p->getType()) << ' ' << getCName(p);
+	}
+	os << (params.empty() ? "void)" : ")");
+}
+
+void writeCProgram(const ProgramDeclaration* p, std::ostream& os)
+{
+	TraceSpan span("writeCProgram");
+	os << prelude;
+
+	// Prototypes first, so that functions can call those defined later.
+	os << '\n';
+	for (const Declaration* d : p->getDeclarations()) {
+		if (const FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d)) {
+			writePrototype(os, f);
+			os << ";\n";
+		}
+	}
+
+	// The checker requires the initializers of globals to be constants.
+	bool first = true;
+	for (const Declaration* d : p->getDeclarations()) {
+		const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d);
+		if (!o)
+			continue;
+		os << (first ? (first = false, "\n") : "");
+		if (!isa<VariableDeclaration>(o))
+			os << "static const ";
+		os << getCType(o->getType()) << ' ' << getCName(o);
+		if (o->getInit()) {
+			ConstantValue v;
+			if (!evaluateConstant(o->getInit(), v))
+				throw std::logic_error("Invalid global initializer");
+			os << " = ";
+			if (v.kind == Type::float_kind)
+				writeFloat(os, v.real);
+			else if (v.kind == Type::bool_kind)
+				os << (v.integer ? "true" : "false");
+			else
+				writeInt(os, v.integer);
+		}
+		os << ";\n";
+	}
+
+	// A body that was skimmed and never parsed leaves only the prototype.
+	for (const Declaration* d : p->getDeclarations()) {
+		const FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d);
+		if (!f || !f->getBody())
+			continue;
+		TraceSpan function("writeCFunction", *f->getName());
+		os << '\n';
+		writePrototype(os, f);
+		os << "\n{\n";
+		CStatementWriter(os).run(f->getBody());
+		os << "}\n";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include <iosfwd>
+#include <string>
+
+class Declaration;
+struct ProgramDeclaration;
+
+// Writes a checked program as a single C99 translation unit, for machines
+// where the system C compiler is available but LLVM is not. Integer
+// arithmetic wraps and shift counts are taken modulo 32, as in the x86
+// backends.
+void writeCProgram(const ProgramDeclaration* p, std::ostream& os);
+
+// The C name of a function, global, parameter or local. Names carry the
+// dense index of the declaration, so overloads and shadowed locals stay
+// apart and no name can collide with C keywords or the runtime.
+std::string getCName(const Declaration* d);
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+#include <cassert>
+#include <type_traits>
+
+// Checked conversions between node classes, in the style of LLVM. Each
+// class provides a static classof that tests the kind of a node, so no RTTI
+// is involved.
+
+template<typename To, typename From>
+using CastResult = typename std::conditional<std::is_const<From>::value, const To, To>::type;
+
+template<typename To, typename From>
+inline bool isa(From* p) {
+	assert(p);
+	return To::classof(p);
+}
+
+template<typename To, typename From>
+inline CastResult<To, From>* cast(From* p) {
+	assert(isa<To>(p));
+	return static_cast<CastResult<To, From>*>(p);
+}
+
+template<typename To, typename From>
+inline CastResult<To, From>* dyn_cast(From* p) {
+	return isa<To>(p) ? static_cast<CastResult<To, From>*>(p) : nullptr;
+}
+
+template<typename To, typename From>
+inline CastResult<To, From>* dyn_cast_or_null(From* p) {
+	return p && isa<To>(p) ? static_cast<CastResult<To, From>*>(p) : nullptr;
+}
\ No newline at end of file
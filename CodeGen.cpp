@@ -3,6 +3,10 @@
 #include "Expression.h"
 #include "Declaration.h"
 #include "Statement.h"
+#include "Visitor.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include "MemoryProfile.h"
 
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
@@ -13,31 +17,33 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include <sstream>
-#include <unordered_map>
-
-using VariableMap = std::unordered_map<const Declaration*, llvm::Value*>;
+#include <algorithm>
+#include <cassert>
 
 std::string Context::getName(const Declaration* d) {
 	return *d->getName();
 }
 
+// Forwards each kind of type to the context member that lowers it.
+class TypeLowering : public TypeVisitor<TypeLowering, llvm::Type*> {
+public:
+	TypeLowering(Context& c)
+		: cxt(c) {}
+
+	llvm::Type* visitBoolType(const BoolType* t) { return cxt.getBoolType(t); }
+	llvm::Type* visitCharType(const CharType* t) { return cxt.getCharType(t); }
+	llvm::Type* visitIntType(const IntType* t) { return cxt.getIntType(t); }
+	llvm::Type* visitFloatType(const FloatType* t) { return cxt.getFloatType(t); }
+	llvm::Type* visitReferenceType(const ReferenceType* t) { return cxt.getReferenceType(t); }
+	llvm::Type* visitFunctionType(const FunctionType* t) { return cxt.getFunctionType(t); }
+
+private:
+	Context& cxt;
+};
+
 llvm::Type* Context::getType(const Type* t)
 {
-	switch (t->getKind()) {
-	case Type::bool_kind:
-		return getBoolType(static_cast<const BoolType*>(t));
-	case Type::char_kind:
-		return getCharType(static_cast<const CharType*>(t));
-	case Type::int_kind:
-		return getIntType(static_cast<const IntType*>(t));
-	case Type::float_kind:
-		return getFloatType(static_cast<const FloatType*>(t));
-	case Type::reference_kind:
-		return getReferenceType(static_cast<const ReferenceType*>(t));
-	case Type::function_kind:
-		return getFunctionType(static_cast<const FunctionType*>(t));
-
-	}
+	return TypeLowering(*this).visit(t);
 }
 
 llvm::Type* Context::getBoolType(const BoolType* b)
@@ -52,7 +58,7 @@ llvm::Type* Context::getCharType(const CharType* c)
 
 llvm::Type* Context::getIntType(const IntType* i)
 {
-	return llvm::Type::getInt32Ty(*context)
+	return llvm::Type::getInt32Ty(*context);
 }
 
 llvm::Type* Context::getFloatType(const FloatType* f)
@@ -85,40 +91,43 @@ llvm::Type* Context::getType(const TypedDeclaration* d)
 }
 
 Module::Module(Context& c, const ProgramDeclaration* p)
-	: parent(&c), program(p), mod(new llvm::Module("a.ll", *getContext())) {}
+	: parent(&c), program(p), mod(new llvm::Module("a.ll", *getContext())),
+	globalVariables(p->getGlobalCount()) {}
 
 void Module::declare(const Declaration* d, llvm::GlobalValue* v)
 {
-	globalVariables.emplace(d, v);
+	assert(!d->isLocal());
+	globalVariables[d->getIndex()] = v;
 }
 
 llvm::GlobalValue* Module::lookup(const Declaration* d) const
 {
-	auto iterator = globalVariables.find(d);
-	if (iterator != globalVariables.end())
-		return llvm::cast<llvm::GlobalValue>(iterator->second);
-	else
-		return nullptr;
+	assert(!d->isLocal());
+	return globalVariables[d->getIndex()];
 }
 
 void Module::generate()
 {
-	for (const Declaration* d : program->getDeclarations())
+	TraceSpan span("Module::generate");
+	PerfPhase phase(PerfCounters::codegen_phase);
+	MemoryPhase memory("codegen");
+	for (const Declaration* d : program->getDeclarations())
 		generate(d);
 }
 
 void Module::generate(const Declaration* d)
 {
-	switch (d->getKind()) {
-	case Declaration::variable_kind:
-		return generateVariableDeclaration(static_cast<const VariableDeclaration*>(d));
-	case Declaration::function_kind:
-		return generateFunctionDeclaration(static_cast<const FunctionDeclaration*>(d));
+	if (const VariableDeclaration* v = dyn_cast<VariableDeclaration>(d)) {
+		return generateVariableDeclaration(v);
+	}
+	if (const FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d)) {
+		return generateFunctionDeclaration(f);
 	}
 }
 
 void Module::generateVariableDeclaration(const VariableDeclaration* d)
 {
+	TraceSpan span("Module::generateVariableDeclaration", *d->getName());
 	std::string n = getName(d);
 	llvm::Type* t = getType(d->getType());
 	llvm::Constant* c = llvm::Constant::getNullValue(t);
@@ -138,10 +147,10 @@ static llvm::FunctionType* getFunctionType(llvm::Type* t) {
 }
 
 Function::Function(Module& m, const FunctionDeclaration* f)
-	: parent(&m), source(f) {
+	: parent(&m), source(f), locals(f->getLocalCount()) {
 	std::string n = getName(f);
-	llvm::Type* t = getType(f);
-	function = llvm::Function::Create(getFunctionType(f), llvm::Function::ExternalLinkage, n, getModule());
+	llvm::Type* t = get_type(f);
+	function = llvm::Function::Create(getFunctionType(t), llvm::Function::ExternalLinkage, n, getModule());
 
 	parent->declare(f, function);
 
@@ -152,8 +161,8 @@ Function::Function(Module& m, const FunctionDeclaration* f)
 
 	auto pi = f->getParameters().begin();
 	auto ai = function->arg_begin();
-	while (ai != fn->arg_end()) {
-		const ParameterDeclaration* param = static_cast<const ParameterDeclaration*>(*pi);
+	while (ai != function->arg_end()) {
+		const ParameterDeclaration* param = cast<ParameterDeclaration>(*pi);
 		llvm::Argument& arg = *ai;
 
 		// Configure each parameter.
@@ -172,18 +181,18 @@ Function::Function(Module& m, const FunctionDeclaration* f)
 	}
 }
 
-void Function::declare(const Declaration* d, llvm::Value* v)
-{
-	localVariables.emplace(d, v);
-}
-
-llvm::Value* Function::lookup(const Declaration* d) const
-{
-	auto iter = localVariables.find(d);
-	if (iter != localVariables.end())
-		return iter->second;
-	else
-		return parent->lookup(d);
+void Function::declare(const Declaration* d, llvm::Value* v)
+{
+	assert(d->isLocal());
+	locals[d->getIndex()] = v;
+}
+
+llvm::Value* Function::lookup(const Declaration* d) const
+{
+	if (d->isLocal())
+		return locals[d->getIndex()];
+	else
+		return parent->lookup(d);
 }
 
 llvm::BasicBlock* Function::makeBlock(const char* c)
@@ -197,8 +206,604 @@ void Function::emitBlock(llvm::BasicBlock* b)
 	current = b;
 }
 
-void Function::define()
-{
-	generateStatement(source->getBody());
+void Function::define()
+{
+	TraceSpan span("Function::define", *source->getName());
+	// A body that was skimmed and never parsed leaves only a declaration.
+	if (!source->getBody()) {
+		function->deleteBody();
+		return;
+	}
+
+	generateStatement(source->getBody());
+
+	// Control can reach the end of a function only when a return was
+	// missed; the checker does not diagnose that yet.
+	if (!getCurrentBlock()->getTerminator()) {
+		llvm::IRBuilder<> ir(getCurrentBlock());
+		ir.CreateUnreachable();
+	}
+}
+
+// An expression whose operands are being generated by the expression
+// walker. Stage counts the operands generated so far; the blocks are used
+// by operators that introduce control flow.
+struct ExpressionTask {
+	const Expression* expr;
+	int stage;
+	llvm::Value* value;
+	llvm::BasicBlock* block;
+	llvm::BasicBlock* join;
+};
+
+// Generates an expression with its own stack of tasks. Each step visits the
+// task on top of the stack, which either pushes its next operand or takes
+// the values of its operands and produces its own.
+class ExpressionWalker : public ExpressionVisitor<ExpressionWalker> {
+public:
+	ExpressionWalker(Function& f)
+		: fn(f), i(0), stage(0) {}
+
+	llvm::Value* run(const Expression* e) {
+		tasks.push_back({ e, 0, nullptr, nullptr, nullptr });
+		while (!tasks.empty()) {
+			i = tasks.size() - 1;
+			stage = tasks[i].stage++;
+			visit(tasks[i].expr);
+		}
+		assert(values.size() == 1);
+		return values.back();
+	}
+
+	void visitBoolExpression(const BoolExpression* e) {
+		finish(fn.generateBoolExpression(e));
+	}
+
+	void visitIntExpression(const IntExpression* e) {
+		finish(fn.generateIntegerExpression(e));
+	}
+
+	void visitFloatExpression(const FloatExpression* e) {
+		finish(fn.generateFloatExpression(e));
+	}
+
+	void visitIdExpression(const IdExpression* e) {
+		finish(fn.generateIdExpression(e));
+	}
+
+	void visitUnopExpression(const UnopExpression* u) {
+		if (stage == 0) {
+			return operand(u->getOperand());
+		}
+		llvm::Value* v = pop();
+		finish(fn.generateUnopExpression(u, v));
+	}
+
+	void visitBinopExpression(const BinopExpression* b) {
+		binop op = b->getOperator();
+		if (op == bo_land || op == bo_lor) {
+			return logical(b, op);
+		}
+		if (stage == 0) {
+			return operand(b->getLHS());
+		}
+		if (stage == 1) {
+			return operand(b->getRHS());
+		}
+		llvm::Value* v2 = pop();
+		llvm::Value* v1 = pop();
+		finish(fn.generateBinopExpression(b, v1, v2));
+	}
+
+	// Evaluates the right operand only when the left one does not decide
+	// the result, then merges both paths.
+	void logical(const BinopExpression* b, binop op) {
+		llvm::IRBuilder<> ir(fn.getCurrentBlock());
+		if (stage == 0) {
+			return operand(b->getLHS());
+		}
+		if (stage == 1) {
+			llvm::Value* v1 = pop();
+			llvm::BasicBlock* rhs = fn.makeBlock(op == bo_land ? "and.rhs" : "or.rhs");
+			llvm::BasicBlock* join = fn.makeBlock(op == bo_land ? "and.end" : "or.end");
+			if (op == bo_land) {
+				ir.CreateCondBr(v1, rhs, join);
+			}
+			else {
+				ir.CreateCondBr(v1, join, rhs);
+			}
+			tasks[i].block = fn.getCurrentBlock();
+			tasks[i].join = join;
+			fn.emitBlock(rhs);
+			return operand(b->getRHS());
+		}
+		llvm::Value* v2 = pop();
+		ir.CreateBr(tasks[i].join);
+		llvm::BasicBlock* rhs = fn.getCurrentBlock();
+		fn.emitBlock(tasks[i].join);
+		llvm::IRBuilder<> join(fn.getCurrentBlock());
+		llvm::PHINode* phi = join.CreatePHI(v2->getType(), 2);
+		phi->addIncoming(join.getInt1(op == bo_lor), tasks[i].block);
+		phi->addIncoming(v2, rhs);
+		finish(phi);
+	}
+
+	void visitCallExpression(const CallExpression* c) {
+		const ExpressionList& args = c->getArguments();
+		if (stage == 0) {
+			return operand(c->getCallee());
+		}
+		if (stage <= static_cast<int>(args.size())) {
+			return operand(args[stage - 1]);
+		}
+		std::vector<llvm::Value*> operands(values.end() - args.size(), values.end());
+		values.resize(values.size() - args.size());
+		llvm::Value* callee = pop();
+		finish(fn.generateCallExpression(c, callee, operands));
+	}
+
+	// The checker has already converted the operand.
+	void visitCastExpression(const CastExpression* c) {
+		if (stage == 0) {
+			return operand(c->source);
+		}
+		tasks.pop_back();
+	}
+
+	void visitAssignmentExpression(const AssignmentExpression* a) {
+		if (stage == 0) {
+			return operand(a->getLHS());
+		}
+		if (stage == 1) {
+			return operand(a->getRHS());
+		}
+		llvm::Value* v = pop();
+		llvm::Value* ref = pop();
+		finish(fn.generateAssignmentExpression(a, ref, v));
+	}
+
+	void visitConditionalExpression(const ConditionalExpression* c) {
+		llvm::IRBuilder<> ir(fn.getCurrentBlock());
+		if (stage == 0) {
+			return operand(c->getCondition());
+		}
+		if (stage == 1) {
+			llvm::Value* v = pop();
+			llvm::BasicBlock* pass = fn.makeBlock("cond.pass");
+			llvm::BasicBlock* fail = fn.makeBlock("cond.fail");
+			tasks[i].block = fail;
+			tasks[i].join = fn.makeBlock("cond.end");
+			ir.CreateCondBr(v, pass, fail);
+			fn.emitBlock(pass);
+			return operand(c->getPassValue());
+		}
+		if (stage == 2) {
+			tasks[i].value = pop();
+			ir.CreateBr(tasks[i].join);
+			llvm::BasicBlock* fail = tasks[i].block;
+			tasks[i].block = fn.getCurrentBlock();
+			fn.emitBlock(fail);
+			return operand(c->getFailValue());
+		}
+		llvm::Value* v2 = pop();
+		ir.CreateBr(tasks[i].join);
+		llvm::BasicBlock* fail = fn.getCurrentBlock();
+		fn.emitBlock(tasks[i].join);
+		llvm::IRBuilder<> join(fn.getCurrentBlock());
+		llvm::PHINode* phi = join.CreatePHI(v2->getType(), 2);
+		phi->addIncoming(tasks[i].value, tasks[i].block);
+		phi->addIncoming(v2, fail);
+		finish(phi);
+	}
+
+	void visitConversionExpression(const ConversionExpression* c) {
+		if (stage == 0) {
+			return operand(c->getSource());
+		}
+		llvm::Value* v = pop();
+		finish(fn.generateConversionExpression(c, v));
+	}
+
+	void visitExpression(const Expression*) {
+		throw std::logic_error("Unsupported expression");
+	}
+
+private:
+	void operand(const Expression* e) {
+		tasks.push_back({ e, 0, nullptr, nullptr, nullptr });
+	}
+
+	void finish(llvm::Value* v) {
+		values.push_back(v);
+		tasks.pop_back();
+	}
+
+	llvm::Value* pop() {
+		llvm::Value* v = values.back();
+		values.pop_back();
+		return v;
+	}
+
+	Function& fn;
+	std::vector<ExpressionTask> tasks;
+	std::vector<llvm::Value*> values;
+	std::size_t i;
+	int stage;
+};
+
+llvm::Value* Function::generateExpression(const Expression* e)
+{
+	return ExpressionWalker(*this).run(e);
+}
+
+llvm::Value* Function::generateBoolExpression(const BoolExpression* e)
+{
+	return llvm::ConstantInt::get(get_type(e), e->getValue());
+}
+
+llvm::Value* Function::generateIntegerExpression(const IntExpression* e)
+{
+	return llvm::ConstantInt::get(get_type(e), e->getValue(), true);
+}
+
+llvm::Value* Function::generateFloatExpression(const FloatExpression* e)
+{
+	return llvm::ConstantFP::get(get_type(e), e->getValue());
+}
+
+llvm::Value* Function::generateIdExpression(const IdExpression* e)
+{
+	const Declaration* d = e->getDeclaration();
+	llvm::Value* v = lookup(d);
+	if (d->getKind() == Declaration::function_kind || e->getType()->isReference()) {
+		return v;
+	}
+	// Constants, values and parameters live in stack slots as well; a name
+	// that is not a reference denotes the stored value.
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	return ir.CreateLoad(get_type(e), v);
+}
+
+llvm::Value* Function::generateUnopExpression(const UnopExpression* e, llvm::Value* v)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	switch (e->getOperator()) {
+	case uo_pos:
+		return v;
+	case uo_neg:
+		if (e->isFloat()) {
+			return ir.CreateFNeg(v);
+		}
+		return ir.CreateNeg(v);
+	case uo_cmp:
+	case uo_not:
+		return ir.CreateNot(v);
+	default:
+		throw std::logic_error("Unsupported operator");
+	}
+}
+
+llvm::Value* Function::generateBinopExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2)
+{
+	switch (e->getOperator()) {
+	case bo_eq:
+	case bo_ne:
+	case bo_lt:
+	case bo_gt:
+	case bo_le:
+	case bo_ge:
+		return generateRelationalExpression(e, v1, v2);
+	default:
+		if (e->getLHS()->isFloat()) {
+			return generateFloatExpression(e, v1, v2);
+		}
+		return generateIntegerExpression(e, v1, v2);
+	}
+}
+
+llvm::Value* Function::generateIntegerExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	switch (e->getOperator()) {
+	case bo_add: return ir.CreateAdd(v1, v2);
+	case bo_sub: return ir.CreateSub(v1, v2);
+	case bo_mul: return ir.CreateMul(v1, v2);
+	case bo_quo: return ir.CreateSDiv(v1, v2);
+	case bo_rem: return ir.CreateSRem(v1, v2);
+	case bo_and: return ir.CreateAnd(v1, v2);
+	case bo_ior: return ir.CreateOr(v1, v2);
+	case bo_xor: return ir.CreateXor(v1, v2);
+	case bo_shl: return ir.CreateShl(v1, v2);
+	case bo_shr: return ir.CreateAShr(v1, v2);
+	default:
+		throw std::logic_error("Invalid operator");
+	}
+}
+
+llvm::Value* Function::generateFloatExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	switch (e->getOperator()) {
+	case bo_add: return ir.CreateFAdd(v1, v2);
+	case bo_sub: return ir.CreateFSub(v1, v2);
+	case bo_mul: return ir.CreateFMul(v1, v2);
+	case bo_quo: return ir.CreateFDiv(v1, v2);
+	case bo_rem: return ir.CreateFRem(v1, v2);
+	default:
+		throw std::logic_error("Invalid operator");
+	}
+}
+
+llvm::Value* Function::generateRelationalExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	if (e->getLHS()->isFloat()) {
+		switch (e->getOperator()) {
+		case bo_eq: return ir.CreateFCmpOEQ(v1, v2);
+		case bo_ne: return ir.CreateFCmpUNE(v1, v2);
+		case bo_lt: return ir.CreateFCmpOLT(v1, v2);
+		case bo_gt: return ir.CreateFCmpOGT(v1, v2);
+		case bo_le: return ir.CreateFCmpOLE(v1, v2);
+		case bo_ge: return ir.CreateFCmpOGE(v1, v2);
+		default: break;
+		}
+	}
+	else if (e->getLHS()->isInt()) {
+		switch (e->getOperator()) {
+		case bo_eq: return ir.CreateICmpEQ(v1, v2);
+		case bo_ne: return ir.CreateICmpNE(v1, v2);
+		case bo_lt: return ir.CreateICmpSLT(v1, v2);
+		case bo_gt: return ir.CreateICmpSGT(v1, v2);
+		case bo_le: return ir.CreateICmpSLE(v1, v2);
+		case bo_ge: return ir.CreateICmpSGE(v1, v2);
+		default: break;
+		}
+	}
+	else {
+		switch (e->getOperator()) {
+		case bo_eq: return ir.CreateICmpEQ(v1, v2);
+		case bo_ne: return ir.CreateICmpNE(v1, v2);
+		case bo_lt: return ir.CreateICmpULT(v1, v2);
+		case bo_gt: return ir.CreateICmpUGT(v1, v2);
+		case bo_le: return ir.CreateICmpULE(v1, v2);
+		case bo_ge: return ir.CreateICmpUGE(v1, v2);
+		default: break;
+		}
+	}
+	throw std::logic_error("Invalid operator");
+}
+
+llvm::Value* Function::generateCallExpression(const CallExpression* e, llvm::Value* callee, const std::vector<llvm::Value*>& args)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	llvm::FunctionType* t = getFunctionType(getType(e->getCallee()->getType()));
+	return ir.CreateCall(t, callee, args);
+}
+
+llvm::Value* Function::generateAssignmentExpression(const AssignmentExpression*, llvm::Value* ref, llvm::Value* v)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	ir.CreateStore(v, ref);
+	return ref;
+}
+
+llvm::Value* Function::generateConversionExpression(const ConversionExpression* e, llvm::Value* v)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	const Expression* source = e->getSource();
+	switch (e->getConversion()) {
+	case conv_identity:
+		return v;
+	case conv_value:
+		return ir.CreateLoad(get_type(e), v);
+	case conv_bool:
+		if (source->isFloat()) {
+			return ir.CreateFCmpUNE(v, llvm::ConstantFP::get(v->getType(), 0.0));
+		}
+		return ir.CreateICmpNE(v, llvm::Constant::getNullValue(v->getType()));
+	case conv_char:
+		return ir.CreateTrunc(v, get_type(e));
+	case conv_int:
+		return ir.CreateZExt(v, get_type(e));
+	case conv_ext:
+		return ir.CreateSIToFP(v, get_type(e));
+	case conv_trunc:
+		return ir.CreateFPToSI(v, get_type(e));
+	}
+	throw std::logic_error("Invalid conversion");
+}
+
+// A statement whose sub-statements are being generated by the statement
+// walker. Stage counts the sub-statements started so far.
+struct StatementTask {
+	const Statement* stmt;
+	std::size_t stage;
+	llvm::BasicBlock* next;
+	llvm::BasicBlock* join;
+};
+
+// Generates a statement with its own stack of tasks, in the same way as
+// the expression walker.
+class StatementWalker : public StatementVisitor<StatementWalker> {
+public:
+	StatementWalker(Function& f)
+		: fn(f), i(0), stage(0) {}
+
+	void run(const Statement* s) {
+		tasks.push_back({ s, 0, nullptr, nullptr });
+		while (!tasks.empty()) {
+			i = tasks.size() - 1;
+			stage = tasks[i].stage++;
+			visit(tasks[i].stmt);
+		}
+	}
+
+	void visitBlockStatement(const BlockStatement* b) {
+		const StatementList& stmts = b->getStatements();
+		if (stage < stmts.size()) {
+			return tasks.push_back({ stmts[stage], 0, nullptr, nullptr });
+		}
+		tasks.pop_back();
+	}
+
+	void visitWhenStatement(const WhenStatement* w) {
+		if (stage == 0) {
+			llvm::Value* c = fn.generateExpression(w->getCondition());
+			llvm::BasicBlock* pass = fn.makeBlock("when.pass");
+			tasks[i].join = fn.makeBlock("when.end");
+			llvm::IRBuilder<> ir(fn.getCurrentBlock());
+			ir.CreateCondBr(c, pass, tasks[i].join);
+			fn.emitBlock(pass);
+			return tasks.push_back({ w->getBody(), 0, nullptr, nullptr });
+		}
+		branchTo(tasks[i].join);
+		fn.emitBlock(tasks[i].join);
+		tasks.pop_back();
+	}
+
+	void visitIfStatement(const IfStatement* f) {
+		if (stage == 0) {
+			llvm::Value* c = fn.generateExpression(f->getCondition());
+			llvm::BasicBlock* pass = fn.makeBlock("if.pass");
+			tasks[i].next = fn.makeBlock("if.fail");
+			tasks[i].join = fn.makeBlock("if.end");
+			llvm::IRBuilder<> ir(fn.getCurrentBlock());
+			ir.CreateCondBr(c, pass, tasks[i].next);
+			fn.emitBlock(pass);
+			return tasks.push_back({ f->getPassValue(), 0, nullptr, nullptr });
+		}
+		branchTo(tasks[i].join);
+		if (stage == 1) {
+			fn.emitBlock(tasks[i].next);
+			return tasks.push_back({ f->getFailValue(), 0, nullptr, nullptr });
+		}
+		fn.emitBlock(tasks[i].join);
+		tasks.pop_back();
+	}
+
+	void visitWhileStatement(const WhileStatement* w) {
+		if (stage == 0) {
+			llvm::BasicBlock* head = fn.makeBlock("while.cond");
+			llvm::BasicBlock* body = fn.makeBlock("while.body");
+			llvm::BasicBlock* exit = fn.makeBlock("while.end");
+			llvm::IRBuilder<> ir(fn.getCurrentBlock());
+			ir.CreateBr(head);
+			fn.emitBlock(head);
+			llvm::Value* c = fn.generateExpression(w->getCondition());
+			llvm::IRBuilder<> cond(fn.getCurrentBlock());
+			cond.CreateCondBr(c, body, exit);
+			fn.emitBlock(body);
+			fn.loops.push_back({ head, exit });
+			return tasks.push_back({ w->getBody(), 0, nullptr, nullptr });
+		}
+		Function::Loop loop = fn.loops.back();
+		fn.loops.pop_back();
+		branchTo(loop.head);
+		fn.emitBlock(loop.exit);
+		tasks.pop_back();
+	}
+
+	void visitBreakStatement(const BreakStatement* s) {
+		fn.generateBreakStatement(s);
+		tasks.pop_back();
+	}
+
+	void visitContinueStatement(const ContinueStatement* s) {
+		fn.generateContinueStatement(s);
+		tasks.pop_back();
+	}
+
+	void visitReturnStatement(const ReturnStatement* s) {
+		fn.generateReturnStatement(s);
+		tasks.pop_back();
+	}
+
+	void visitDeclareStatement(const DeclareStatement* s) {
+		fn.generateDeclarationStatement(s);
+		tasks.pop_back();
+	}
+
+	void visitExpressionStatement(const ExpressionStatement* s) {
+		fn.generateExpressionStatement(s);
+		tasks.pop_back();
+	}
+
+	void visitStatement(const Statement*) {
+		throw std::logic_error("Unsupported statement");
+	}
+
+private:
+	// Falls through to b unless the current block already ends in a jump.
+	void branchTo(llvm::BasicBlock* b) {
+		if (!fn.getCurrentBlock()->getTerminator()) {
+			llvm::IRBuilder<> ir(fn.getCurrentBlock());
+			ir.CreateBr(b);
+		}
+	}
+
+	Function& fn;
+	std::vector<StatementTask> tasks;
+	std::size_t i;
+	std::size_t stage;
+};
+
+void Function::generateStatement(const Statement* s)
+{
+	StatementWalker(*this).run(s);
+}
+
+void Function::generateBreakStatement(const BreakStatement*)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	ir.CreateBr(loops.back().exit);
+	emitBlock(makeBlock("after.break"));
+}
+
+void Function::generateContinueStatement(const ContinueStatement*)
+{
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	ir.CreateBr(loops.back().head);
+	emitBlock(makeBlock("after.continue"));
+}
+
+void Function::generateReturnStatement(const ReturnStatement* s)
+{
+	llvm::Value* v = generateExpression(s->getValue());
+	llvm::IRBuilder<> ir(getCurrentBlock());
+	ir.CreateRet(v);
+	emitBlock(makeBlock("after.return"));
+}
+
+void Function::generateDeclarationStatement(const DeclareStatement* s)
+{
+	generateDeclaration(s->getDeclaration());
+}
+
+void Function::generateExpressionStatement(const ExpressionStatement* s)
+{
+	generateExpression(s->getExpression());
+}
+
+void Function::generateDeclaration(const Declaration* d)
+{
+	if (const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d)) {
+		return generateObjectDeclaration(o);
+	}
+	throw std::logic_error("Invalid local declaration");
+}
+
+void Function::generateObjectDeclaration(const ObjectDeclaration* d)
+{
+	// Allocate the object in the entry block so that it can be promoted
+	// to a register.
+	llvm::IRBuilder<> prologue(getEntryBlock(), getEntryBlock()->begin());
+	llvm::Value* var = prologue.CreateAlloca(get_type(d), nullptr, getName(d));
+	declare(d, var);
+
+	if (const Expression* e = d->getInit()) {
+		llvm::Value* v = generateExpression(e);
+		llvm::IRBuilder<> ir(getCurrentBlock());
+		ir.CreateStore(v, var);
+	}
 }
 
@@ -1,4 +1,16 @@
 #pragma once
+#include "Type.h"
+#include "Expression.h"
+#include "Statement.h"
+#include "Declaration.h"
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/BasicBlock.h>
+
+#include <string>
+#include <vector>
 
 class Type;
 class Expression;
@@ -35,10 +47,10 @@ public:
 	Module(Context& c, const ProgramDeclaration* p);
 
 	llvm::LLVMContext* getContext() const { return parent->getContext(); }
-	llvm::LLVMModule* getModule() const { return mod; }
+	llvm::Module* getModule() const { return mod; }
 	std::string getName(const Declaration* d) { return parent->getName(d); }
 	llvm::Type* getType(const Type* t) { return parent->getType(t); }
-	llvm::Type* getType(const TypedDeclaration* t) { return parent->getType(d); }
+	llvm::Type* getType(const TypedDeclaration* t) { return parent->getType(t); }
 
 	void declare(const Declaration* d, llvm::GlobalValue* v);
 
@@ -53,10 +65,13 @@ private:
 	Context * parent;
 	const ProgramDeclaration* program;
 	llvm::Module* mod;
-	VariableMap globalVariables;
+
+	// Indexed by the numbers given to globals during semantic analysis.
+	std::vector<llvm::GlobalValue*> globalVariables;
 };
 
 class Function {
+public:
 	Function(Module& m, const FunctionDeclaration* f);
 
 	llvm::LLVMContext* getContext() const { return parent->getContext(); }
@@ -81,62 +96,56 @@ class Function {
 
 	void emitBlock(llvm::BasicBlock* b);
 
-	llvm::Value* generateExpression(const Expression* e);
-	llvm::Value* generateBoolExpression(const BoolExpression* e);
-	llvm::Value* generateIntegerExpression(const IntExpression* e);
-	llvm::Value* generateFloatExpression(const FloatExpression* e);
-	llvm::Value* generateIdExpression(const IdExpression* e);
-	llvm::Value* generateUnopExpression(const UnopExpression* e);
-	llvm::Value* generateArithmeticExpression(const UnopExpression* e);
-	llvm::Value* generateIntegerExpression(const UnopExpression* e);
-	llvm::Value* generateFloatExpression(const UnopExpression* e);
-	llvm::Value* generateBitwiseExpression(const UnopExpression* e);
-	llvm::Value* generateLogicalExpression(const UnopExpression* e);
-	llvm::Value* generateAddressExpression(const UnopExpression* e);
-	llvm::Value* generateDereferenceExpression(const UnopExpression* e);
-	llvm::Value* generateBinopExpression(const BinopExpression* e);
-	llvm::Value* generateArithmeticExpression(const BinopExpression* e);
-	llvm::Value* generateIntegerExpression(const BinopExpression* e);
-	llvm::Value* generateFloatExpression(const BinopExpression* e);
-	llvm::Value* generateBitwiseExpression(const BinopExpression* e);
-	llvm::Value* generateLogicalExpression(const BinopExpression* e);
-	llvm::Value* generateAndExpression(const BinopExpression* e);
-	llvm::Value* generateOrExpression(const BinopExpression* e);
-	llvm::Value* generateRelationalExpression(const BinopExpression* e);
-	llvm::Value* generateCallExpression(const CallExpression* e);
-	llvm::Value* generateIndexExpression(const IndexExpression* e);
-	llvm::Value* generateCastExpression(const CastExpression* e);
-	llvm::Value* generateConditionalExpression(const ConditionalExpression* e);
-	llvm::Value* generateAssignmentExpression(const AssignmentExpression* e);
-	llvm::Value* generateConversionExpression(const ConversionExpression* e);
-
-	// Statements
-	void generateStatement(const Statement* s);
-	void generateBlockStatement(const BlockStatement* s);
-	void generateWhen(const WhenStatement* s);
-	void generateIfStatement(const IfStatement* s);
-	void generateWhileStatement(const WhileStatement* s);
-	void generateBreakStatement(const BreakStatement* s);
-	void generateContinueStatement(const ContinueStatement* s);
-	void generateReturnStatement(const ReturnStatement* s);
-	void generateDeclarationStatement(const DeclareStatement* s);
-	void generateExpressionStatement(const ExpressionStatement* s);
-
-	// Local declarations
-	void generateDeclaration(const Declaration* d);
-	void generateVariableDeclaration(const VariableDeclaration* d);
-
-	void makeVariable(const VariableDeclaration* d);
-	void makeReference(const VariableDeclaration* d);
+	// Expressions and statements are generated by walkers that keep their
+	// own stacks; the functions below handle a single node whose operands
+	// have already been generated.
+	llvm::Value* generateExpression(const Expression* e);
+	llvm::Value* generateBoolExpression(const BoolExpression* e);
+	llvm::Value* generateIntegerExpression(const IntExpression* e);
+	llvm::Value* generateFloatExpression(const FloatExpression* e);
+	llvm::Value* generateIdExpression(const IdExpression* e);
+	llvm::Value* generateUnopExpression(const UnopExpression* e, llvm::Value* v);
+	llvm::Value* generateBinopExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2);
+	llvm::Value* generateIntegerExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2);
+	llvm::Value* generateFloatExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2);
+	llvm::Value* generateRelationalExpression(const BinopExpression* e, llvm::Value* v1, llvm::Value* v2);
+	llvm::Value* generateCallExpression(const CallExpression* e, llvm::Value* callee, const std::vector<llvm::Value*>& args);
+	llvm::Value* generateAssignmentExpression(const AssignmentExpression* e, llvm::Value* ref, llvm::Value* v);
+	llvm::Value* generateConversionExpression(const ConversionExpression* e, llvm::Value* v);
+
+	// Statements
+	void generateStatement(const Statement* s);
+	void generateBreakStatement(const BreakStatement* s);
+	void generateContinueStatement(const ContinueStatement* s);
+	void generateReturnStatement(const ReturnStatement* s);
+	void generateDeclarationStatement(const DeclareStatement* s);
+	void generateExpressionStatement(const ExpressionStatement* s);
+
+	// Local declarations
+	void generateDeclaration(const Declaration* d);
+	void generateObjectDeclaration(const ObjectDeclaration* d);
 
 
 private:
-	Module * parent;
+	friend class StatementWalker;
+
+	Module * parent;
 	const FunctionDeclaration* source;
 	llvm::Function* function;
 	llvm::BasicBlock* entry;
-	llvm::BasicBlock* current;
-	VariableMap locals;
+	llvm::BasicBlock* current;
+
+	// Indexed by the numbers given to parameters and locals during
+	// semantic analysis.
+	std::vector<llvm::Value*> locals;
+
+	// Branch targets of the enclosing while statements.
+	struct Loop {
+		llvm::BasicBlock* head;
+		llvm::BasicBlock* exit;
+	};
+
+	std::vector<Loop> loops;
 };
 
 
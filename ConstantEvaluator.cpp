@@ -0,0 +1,497 @@
+#include "stdafx.h"
+#include "ConstantEvaluator.h"
+#include "Expression.h"
+#include "Statement.h"
+#include "Declaration.h"
+#include "Type.h"
+#include "Visitor.h"
+#include "Trace.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Limits on the nodes run for one call and on the calls open at once.
+// The evaluator keeps its own stacks, so nesting does not use the native
+// stack.
+static const unsigned constantStepLimit = 100000;
+static const unsigned constantCallLimit = 512;
+
+// Thrown when a call cannot be evaluated, to leave it as it is.
+struct ConstantAbort {};
+
+enum ConstantFlow {
+	flow_next,
+	flow_break,
+	flow_continue,
+	flow_return
+};
+
+// A node being evaluated: an expression, whose value is left on the stack
+// of values, or a statement, which leaves how control goes on in flow.
+// Stage counts the visits to the node.
+struct ConstantTask {
+	const Expression* expr;
+	const Statement* stmt;
+	std::size_t stage;
+};
+
+// Runs calls on the checked tree with the semantics of the lowering: int
+// arithmetic wraps, shift counts are taken modulo 32, and compares are
+// signed for ints only. Nodes are evaluated with a stack of tasks, in the
+// same way as the walkers of the lowering, and each call pushes a frame
+// for its locals.
+class ConstantEvaluator : public ExpressionVisitor<ConstantEvaluator>, public StatementVisitor<ConstantEvaluator> {
+public:
+	ConstantEvaluator(bool run)
+		: runCalls(run), flow(flow_next), stage(0), steps(0), calls(0) {}
+
+	bool evaluate(const Expression* e, ConstantValue& v) {
+		tasks.clear();
+		values.clear();
+		frames.clear();
+		steps = 0;
+		calls = 0;
+		try {
+			operand(e);
+			while (!tasks.empty()) {
+				stage = tasks.back().stage++;
+				if (const Expression* x = tasks.back().expr)
+					visit(x);
+				else
+					visit(tasks.back().stmt);
+			}
+			v = values.back();
+			return true;
+		}
+		catch (ConstantAbort&) {
+			return false;
+		}
+	}
+
+	using ExpressionVisitor<ConstantEvaluator>::visit;
+	using StatementVisitor<ConstantEvaluator>::visit;
+
+	void visitBoolExpression(const BoolExpression* e) {
+		finish(make(Type::bool_kind, e->getValue()));
+	}
+
+	void visitIntExpression(const IntExpression* e) {
+		finish(make(Type::int_kind, e->getValue()));
+	}
+
+	void visitFloatExpression(const FloatExpression* e) {
+		finish(makeFloat(static_cast<float>(e->getValue())));
+	}
+
+	// Outside a call only the def and const locals can be read, through
+	// their initializers, since nothing can change them.
+	void visitIdExpression(const IdExpression* e) {
+		const Declaration* d = e->getDeclaration();
+		if (!d->isLocal())
+			throw ConstantAbort();
+		if (!frames.empty())
+			return finish(frames.back()[d->getIndex()]);
+		if (stage == 0) {
+			const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d);
+			if (!o || !o->getInit() || !(isa<ValueDeclaration>(o) || isa<ConstantDeclaration>(o)))
+				throw ConstantAbort();
+			return operand(o->getInit());
+		}
+		tasks.pop_back();
+	}
+
+	void visitUnopExpression(const UnopExpression* e) {
+		if (stage == 0)
+			return operand(e->getOperand());
+		ConstantValue v = pop();
+		switch (e->getOperator()) {
+		case uo_pos:
+			return finish(v);
+		case uo_neg:
+			if (v.kind == Type::float_kind)
+				return finish(makeFloat(-v.real));
+			return finish(make(v.kind, -static_cast<std::int64_t>(v.integer)));
+		case uo_cmp:
+		case uo_not:
+			if (v.kind == Type::float_kind)
+				throw ConstantAbort();
+			return finish(make(v.kind, ~static_cast<std::int64_t>(v.integer)));
+		default:
+			throw ConstantAbort();
+		}
+	}
+
+	void visitBinopExpression(const BinopExpression* e) {
+		binop op = e->getOperator();
+		if (stage == 0)
+			return operand(e->getLHS());
+		if (op == bo_land || op == bo_lor) {
+			// The value of the operand that decides is the result.
+			if (stage == 2 || (values.back().integer != 0) == (op == bo_lor))
+				return tasks.pop_back();
+			values.pop_back();
+			return operand(e->getRHS());
+		}
+		if (stage == 1)
+			return operand(e->getRHS());
+		ConstantValue b = pop();
+		ConstantValue a = pop();
+		finish(binary(op, a, b));
+	}
+
+	// The arguments are evaluated in the caller's frame, and then the body
+	// in a frame of its own.
+	void visitCallExpression(const CallExpression* c) {
+		const IdExpression* id = dyn_cast<IdExpression>(c->getCallee());
+		const FunctionDeclaration* f = id ? dyn_cast<FunctionDeclaration>(id->getDeclaration()) : nullptr;
+		if (!runCalls || !f || !f->getBody())
+			throw ConstantAbort();
+		const DeclarationList& params = f->getParameters();
+		if (stage < params.size())
+			return operand(c->getArguments()[stage]);
+		if (stage == params.size()) {
+			if (++calls > constantCallLimit)
+				throw ConstantAbort();
+			std::vector<ConstantValue> locals(f->getLocalCount(), make(Type::int_kind, 0));
+			for (std::size_t k = params.size(); k-- > 0;)
+				locals[params[k]->getIndex()] = pop();
+			frames.push_back(locals);
+			return statement(f->getBody());
+		}
+		// Control that reaches the end of the body traps when the program
+		// runs.
+		if (flow != flow_return)
+			throw ConstantAbort();
+		frames.pop_back();
+		--calls;
+		finish(result);
+	}
+
+	void visitAssignmentExpression(const AssignmentExpression* e) {
+		const IdExpression* id = dyn_cast<IdExpression>(e->getLHS());
+		if (frames.empty() || !id || !id->getDeclaration()->isLocal())
+			throw ConstantAbort();
+		if (stage == 0)
+			return operand(e->getRHS());
+		frames.back()[id->getDeclaration()->getIndex()] = values.back();
+		tasks.pop_back();
+	}
+
+	// The checker has already converted the operand.
+	void visitCastExpression(const CastExpression* e) {
+		if (stage == 0)
+			return operand(e->source);
+		tasks.pop_back();
+	}
+
+	void visitConditionalExpression(const ConditionalExpression* e) {
+		if (stage == 0)
+			return operand(e->getCondition());
+		if (stage == 1)
+			return operand(pop().integer ? e->getPassValue() : e->getFailValue());
+		tasks.pop_back();
+	}
+
+	void visitConversionExpression(const ConversionExpression* e) {
+		if (stage == 0)
+			return operand(e->getSource());
+		ConstantValue v = pop();
+		switch (e->getConversion()) {
+		case conv_identity:
+		case conv_value:
+			return finish(v);
+		case conv_bool:
+			if (v.kind == Type::float_kind)
+				return finish(make(Type::bool_kind, v.real != 0.0f));
+			return finish(make(Type::bool_kind, v.integer != 0));
+		case conv_char:
+			return finish(make(Type::char_kind, v.integer));
+		case conv_int:
+			return finish(make(Type::int_kind, v.integer));
+		case conv_ext:
+			return finish(makeFloat(static_cast<float>(v.integer)));
+		case conv_trunc:
+			// Out of range the conversion gives the machine's answer.
+			if (!(v.real > -2147483648.0f && v.real < 2147483648.0f))
+				throw ConstantAbort();
+			return finish(make(Type::int_kind, static_cast<std::int32_t>(v.real)));
+		}
+		throw ConstantAbort();
+	}
+
+	void visitExpression(const Expression*) {
+		throw ConstantAbort();
+	}
+
+	void visitBlockStatement(const BlockStatement* b) {
+		const StatementList& stmts = b->getStatements();
+		if (stage > 0 && flow != flow_next)
+			return tasks.pop_back();
+		if (stage < stmts.size())
+			return statement(stmts[stage]);
+		done(flow_next);
+	}
+
+	void visitWhenStatement(const WhenStatement* w) {
+		if (stage == 0)
+			return operand(w->getCondition());
+		if (stage == 1) {
+			if (!pop().integer)
+				return done(flow_next);
+			return statement(w->getBody());
+		}
+		tasks.pop_back();
+	}
+
+	void visitIfStatement(const IfStatement* i) {
+		if (stage == 0)
+			return operand(i->getCondition());
+		if (stage == 1)
+			return statement(pop().integer ? i->getPassValue() : i->getFailValue());
+		tasks.pop_back();
+	}
+
+	// The stages alternate between the condition and the body, so the
+	// stage goes back to the condition after each pass.
+	void visitWhileStatement(const WhileStatement* w) {
+		if (stage == 0)
+			return operand(w->getCondition());
+		if (stage == 1) {
+			if (!pop().integer)
+				return done(flow_next);
+			return statement(w->getBody());
+		}
+		if (flow == flow_break)
+			return done(flow_next);
+		if (flow == flow_return)
+			return tasks.pop_back();
+		tasks.back().stage = 1;
+		operand(w->getCondition());
+	}
+
+	void visitBreakStatement(const BreakStatement*) {
+		done(flow_break);
+	}
+
+	void visitContinueStatement(const ContinueStatement*) {
+		done(flow_continue);
+	}
+
+	void visitReturnStatement(const ReturnStatement* r) {
+		if (stage == 0)
+			return operand(r->getValue());
+		result = pop();
+		done(flow_return);
+	}
+
+	void visitDeclareStatement(const DeclareStatement* d) {
+		const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d->getDeclaration());
+		if (!o)
+			throw ConstantAbort();
+		if (stage == 0 && o->getInit())
+			return operand(o->getInit());
+		frames.back()[o->getIndex()] = o->getInit() ? pop() : make(o->getType()->getObjectType()->getKind(), 0);
+		done(flow_next);
+	}
+
+	void visitExpressionStatement(const ExpressionStatement* e) {
+		if (stage == 0)
+			return operand(e->getExpression());
+		values.pop_back();
+		done(flow_next);
+	}
+
+	void visitStatement(const Statement*) {
+		throw ConstantAbort();
+	}
+
+private:
+	static ConstantValue make(Type::Kind k, std::int64_t i) {
+		switch (k) {
+		case Type::bool_kind:
+			return { k, static_cast<std::int32_t>(i & 1), 0 };
+		case Type::char_kind:
+			return { k, static_cast<std::int32_t>(i & 0xff), 0 };
+		case Type::int_kind:
+			return { k, static_cast<std::int32_t>(static_cast<std::uint32_t>(i)), 0 };
+		case Type::float_kind:
+			return { k, 0, static_cast<float>(i) };
+		default:
+			throw ConstantAbort();
+		}
+	}
+
+	static ConstantValue makeFloat(float f) {
+		return { Type::float_kind, 0, f };
+	}
+
+	static ConstantValue binary(binop op, const ConstantValue& a, const ConstantValue& b) {
+		if (op >= bo_eq && op <= bo_ge) {
+			int c;
+			if (a.kind == Type::float_kind) {
+				if (std::isnan(a.real) || std::isnan(b.real))
+					return make(Type::bool_kind, op == bo_ne);
+				c = a.real < b.real ? -1 : a.real > b.real ? 1 : 0;
+			}
+			else if (a.kind == Type::int_kind)
+				c = a.integer < b.integer ? -1 : a.integer > b.integer ? 1 : 0;
+			else {
+				std::uint32_t x = static_cast<std::uint32_t>(a.integer), y = static_cast<std::uint32_t>(b.integer);
+				c = x < y ? -1 : x > y ? 1 : 0;
+			}
+			static const bool results[][3] = {
+				{ false, true, false },
+				{ true, false, true },
+				{ true, false, false },
+				{ false, false, true },
+				{ true, true, false },
+				{ false, true, true }
+			};
+			return make(Type::bool_kind, results[op - bo_eq][c + 1]);
+		}
+		if (a.kind == Type::float_kind) {
+			switch (op) {
+			case bo_add: return makeFloat(a.real + b.real);
+			case bo_sub: return makeFloat(a.real - b.real);
+			case bo_mul: return makeFloat(a.real * b.real);
+			case bo_quo: return makeFloat(a.real / b.real);
+			case bo_rem: return makeFloat(std::fmod(a.real, b.real));
+			default: throw ConstantAbort();
+			}
+		}
+		std::int64_t x = a.integer, y = b.integer;
+		switch (op) {
+		case bo_add: return make(a.kind, x + y);
+		case bo_sub: return make(a.kind, x - y);
+		case bo_mul: return make(a.kind, x * y);
+		case bo_quo:
+		case bo_rem:
+			// These trap when the program runs.
+			if (a.kind != Type::int_kind || y == 0 || (x == INT32_MIN && y == -1))
+				throw ConstantAbort();
+			return make(a.kind, op == bo_quo ? x / y : x % y);
+		case bo_and: return make(a.kind, x & y);
+		case bo_ior: return make(a.kind, x | y);
+		case bo_xor: return make(a.kind, x ^ y);
+		case bo_shl: return make(a.kind, static_cast<std::uint32_t>(x) << (y & 31));
+		case bo_shr: return make(a.kind, x >> (y & 31));
+		default: throw ConstantAbort();
+		}
+	}
+
+	// Each node pushed counts against the step limit.
+	void operand(const Expression* e) {
+		if (++steps > constantStepLimit)
+			throw ConstantAbort();
+		tasks.push_back({ e, nullptr, 0 });
+	}
+
+	void statement(const Statement* s) {
+		if (++steps > constantStepLimit)
+			throw ConstantAbort();
+		tasks.push_back({ nullptr, s, 0 });
+	}
+
+	ConstantValue pop() {
+		ConstantValue v = values.back();
+		values.pop_back();
+		return v;
+	}
+
+	void finish(const ConstantValue& v) {
+		values.push_back(v);
+		tasks.pop_back();
+	}
+
+	void done(ConstantFlow f) {
+		flow = f;
+		tasks.pop_back();
+	}
+
+	bool runCalls;
+	std::vector<ConstantTask> tasks;
+	std::vector<ConstantValue> values;
+	std::vector<std::vector<ConstantValue>> frames;
+	ConstantValue result;
+	ConstantFlow flow;
+	std::size_t stage;
+	unsigned steps;
+	unsigned calls;
+};
+
+// Lists the fields that hold the expressions in s, each before the fields
+// of its operands.
+static std::vector<Expression**> getSlots(Statement* s)
+{
+	std::vector<Expression**> slots;
+	std::vector<Expression**> exprs;
+	std::vector<Statement*> stmts{ s };
+	auto pushExpression = [&](Expression*& e) { exprs.push_back(&e); };
+	auto pushStatement = [&](Statement*& t) { stmts.push_back(t); };
+	while (!exprs.empty() || !stmts.empty()) {
+		if (!exprs.empty()) {
+			Expression** e = exprs.back();
+			exprs.pop_back();
+			slots.push_back(e);
+			visitOperands(*e, pushExpression);
+			continue;
+		}
+		Statement* t = stmts.back();
+		stmts.pop_back();
+		visitChildren(t, pushExpression, pushStatement);
+	}
+	return slots;
+}
+
+// Builds the literal for v with the type of the call it replaces. There
+// are no char literals, so a char is converted from an int, whose type is
+// made on first use and shared by the later ones.
+static Expression* makeLiteral(const ConstantValue& v, Type* t, Type*& intType)
+{
+	switch (v.kind) {
+	case Type::bool_kind:
+		return new BoolExpression(t, v.integer != 0);
+	case Type::char_kind:
+		if (!intType)
+			intType = new IntType();
+		return new ConversionExpression(new IntExpression(intType, v.integer), conv_char, t);
+	case Type::int_kind:
+		return new IntExpression(t, v.integer);
+	case Type::float_kind:
+		return new FloatExpression(t, v.real);
+	default:
+		return nullptr;
+	}
+}
+
+bool evaluateConstant(const Expression* e, ConstantValue& v)
+{
+	return ConstantEvaluator(false).evaluate(e, v);
+}
+
+void evaluateConstantCalls(ProgramDeclaration* p)
+{
+	TraceSpan span("evaluateConstantCalls");
+	ConstantEvaluator eval(true);
+	Type* intType = nullptr;
+	for (Declaration* d : p->getDeclarations()) {
+		FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d);
+		if (!f || !f->getBody())
+			continue;
+		// Operands come after their expression, so going backward folds
+		// the inner calls first.
+		std::vector<Expression**> slots = getSlots(f->getBody());
+		for (std::size_t k = slots.size(); k-- > 0;) {
+			const CallExpression* c = dyn_cast<CallExpression>(*slots[k]);
+			ConstantValue v;
+			if (!c || !eval.evaluate(c, v))
+				continue;
+			// Literals cannot spell infinities or NaN.
+			if (v.kind == Type::float_kind && !std::isfinite(v.real))
+				continue;
+			if (Expression* e = makeLiteral(v, c->getType(), intType))
+				*slots[k] = e;
+		}
+	}
+}
\ No newline at end of file
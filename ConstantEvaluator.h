@@ -0,0 +1,28 @@
+#pragma once
+#include "Type.h"
+
+#include <cstdint>
+
+class Expression;
+struct ProgramDeclaration;
+
+// A bool, char or int is held in integer, as 0 or 1, 0 to 255, or any
+// int; a float in real.
+struct ConstantValue {
+	Type::Kind kind;
+	std::int32_t integer;
+	float real;
+};
+
+// Computes the value of e, which may not read objects or call functions.
+// Returns false when e is not constant or traps.
+bool evaluateConstant(const Expression* e, ConstantValue& v);
+
+// Replaces the calls whose arguments are constants with the values they
+// return, by running the callee on the checked tree. A call is replaced
+// only when the run neither reads nor writes a global, does not trap, and
+// finishes within fixed limits on steps, open calls and nesting; any
+// other call is left to run as before. Arguments are constant when they
+// are literals, or are built from literals and the def and const locals
+// whose initializers are.
+void evaluateConstantCalls(ProgramDeclaration* p);
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "stdafx.h"
+#include "DeadCode.h"
+#include "Expression.h"
+#include "Statement.h"
+#include "Declaration.h"
+#include "Visitor.h"
+#include "Trace.h"
+
+#include <vector>
+
+// Lists the declarations that the expressions and statements refer to.
+static std::vector<const Declaration*> getReferences(std::vector<const Expression*> exprs, std::vector<const Statement*> stmts)
+{
+	std::vector<const Declaration*> refs;
+	auto pushExpression = [&](const Expression* e) { exprs.push_back(e); };
+	auto pushStatement = [&](const Statement* s) { stmts.push_back(s); };
+	while (!exprs.empty() || !stmts.empty()) {
+		if (!stmts.empty()) {
+			const Statement* s = stmts.back();
+			stmts.pop_back();
+			visitChildren(s, pushExpression, pushStatement);
+			continue;
+		}
+		const Expression* e = exprs.back();
+		exprs.pop_back();
+		if (const IdExpression* id = dyn_cast<IdExpression>(e))
+			refs.push_back(id->getDeclaration());
+		visitOperands(e, pushExpression);
+	}
+	return refs;
+}
+
+bool hasEffects(const Expression* e)
+{
+	std::vector<const Expression*> work{ e };
+	auto push = [&](const Expression* x) { work.push_back(x); };
+	while (!work.empty()) {
+		const Expression* x = work.back();
+		work.pop_back();
+		if (x->getKind() == Expression::call_kind || x->getKind() == Expression::assign_kind)
+			return true;
+		visitOperands(x, push);
+	}
+	return false;
+}
+
+// A statement in a block whose statements are being pruned. Stage counts
+// the statements looked at so far.
+struct DeadCodeTask {
+	Statement* stmt;
+	std::size_t stage;
+};
+
+// Drops the statements of each block that follow one that cannot complete
+// normally, with a stack of tasks. A statement cannot complete when it is
+// a return, break or continue, an if whose branches both cannot, or a
+// block that ends in one that cannot. Blocks are changed through their
+// tasks, which hold the statements as the function owns them.
+class UnreachablePruner : public StatementVisitor<UnreachablePruner> {
+public:
+	UnreachablePruner()
+		: stage(0), completes(true) {}
+
+	// Returns whether s can complete.
+	bool run(Statement* s) {
+		tasks.push_back({ s, 0 });
+		while (!tasks.empty()) {
+			stage = tasks.back().stage++;
+			visit(tasks.back().stmt);
+		}
+		return completes;
+	}
+
+	void visitBlockStatement(const BlockStatement*) {
+		StatementList& list = cast<BlockStatement>(tasks.back().stmt)->getStatements();
+		if (stage > 0 && !completes) {
+			StatementList kept;
+			for (std::size_t k = 0; k < stage; ++k)
+				kept.push_back(list[k]);
+			list = kept;
+			return tasks.pop_back();
+		}
+		if (stage < list.size())
+			return tasks.push_back({ list[stage], 0 });
+		finish(true);
+	}
+
+	void visitIfStatement(const IfStatement* f) {
+		if (stage == 0)
+			return tasks.push_back({ f->getPassValue(), 0 });
+		if (stage == 1) {
+			// The stage counter keeps whether the first branch completes.
+			tasks.back().stage = completes ? 2 : 3;
+			return tasks.push_back({ f->getFailValue(), 0 });
+		}
+		finish(completes || stage == 2);
+	}
+
+	void visitWhenStatement(const WhenStatement* w) { body(w->getBody()); }
+	void visitWhileStatement(const WhileStatement* w) { body(w->getBody()); }
+	void visitBreakStatement(const BreakStatement*) { finish(false); }
+	void visitContinueStatement(const ContinueStatement*) { finish(false); }
+	void visitReturnStatement(const ReturnStatement*) { finish(false); }
+	void visitStatement(const Statement*) { finish(true); }
+
+private:
+	// A when or while can complete whether or not its body can.
+	void body(Statement* s) {
+		if (stage == 0)
+			return tasks.push_back({ s, 0 });
+		finish(true);
+	}
+
+	void finish(bool c) {
+		completes = c;
+		tasks.pop_back();
+	}
+
+	std::vector<DeadCodeTask> tasks;
+	std::size_t stage;
+	bool completes;
+};
+
+// Drops the declarations of locals that are never referenced and whose
+// initializers have no effects. Dropping one can leave the locals its
+// initializer read unreferenced, so this repeats until nothing changes.
+static void pruneLocals(FunctionDeclaration* f)
+{
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		std::vector<char> locals(f->getLocalCount());
+		for (const Declaration* d : getReferences({}, { f->getBody() })) {
+			if (d->isLocal())
+				locals[d->getIndex()] = 1;
+		}
+
+		std::vector<Statement*> work{ f->getBody() };
+		while (!work.empty()) {
+			Statement* s = work.back();
+			work.pop_back();
+			if (BlockStatement* b = dyn_cast<BlockStatement>(s)) {
+				StatementList kept;
+				for (Statement* c : b->getStatements()) {
+					const DeclareStatement* d = dyn_cast<DeclareStatement>(c);
+					const ObjectDeclaration* o = d ? dyn_cast<ObjectDeclaration>(d->getDeclaration()) : nullptr;
+					if (o && !locals[o->getIndex()] && !(o->getInit() && hasEffects(o->getInit()))) {
+						changed = true;
+						continue;
+					}
+					kept.push_back(c);
+					work.push_back(c);
+				}
+				b->getStatements() = kept;
+			}
+			else {
+				visitChildren(s, [](Expression*) {}, [&](Statement* c) { work.push_back(c); });
+			}
+		}
+	}
+}
+
+void removeDeadCode(ProgramDeclaration* p, const std::string& entry)
+{
+	TraceSpan span("removeDeadCode");
+	std::vector<char> reached(p->getGlobalCount());
+	std::vector<const Declaration*> work;
+	for (Declaration* d : p->getDeclarations()) {
+		FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d);
+		if (!f)
+			continue;
+		if (*f->getName() == entry) {
+			reached[f->getIndex()] = 1;
+			work.push_back(f);
+		}
+		if (f->getBody()) {
+			UnreachablePruner().run(f->getBody());
+			pruneLocals(f);
+		}
+	}
+	if (work.empty())
+		return;
+
+	while (!work.empty()) {
+		const Declaration* d = work.back();
+		work.pop_back();
+		std::vector<const Declaration*> refs;
+		if (const FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d)) {
+			if (f->getBody())
+				refs = getReferences({}, { f->getBody() });
+		}
+		else if (const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d)) {
+			if (o->getInit())
+				refs = getReferences({ o->getInit() }, {});
+		}
+		for (const Declaration* r : refs) {
+			if (!r->isLocal() && !reached[r->getIndex()]) {
+				reached[r->getIndex()] = 1;
+				work.push_back(r);
+			}
+		}
+	}
+
+	DeclarationList kept;
+	for (Declaration* d : p->getDeclarations()) {
+		if (reached[d->getIndex()])
+			kept.push_back(d);
+	}
+	p->getDeclarations() = kept;
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+
+class Expression;
+struct ProgramDeclaration;
+
+// Whether evaluating e can change the state of the program. Calls and
+// assignments are the only expressions with effects.
+bool hasEffects(const Expression* e);
+
+// Removes what cannot affect the program: statements that follow a
+// return, break or continue, locals that are never read whose
+// initializers have no effects, and the functions and globals that the
+// functions named entry do not reach. When no function has that name
+// every declaration is kept, since any of them may be called from
+// outside.
+void removeDeadCode(ProgramDeclaration* p, const std::string& entry);
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "Expression.h"
 #include "Statement.h"
 #include "Declaration.h"
+#include "Visitor.h"
 
 struct NodeFont {
 	NodeFont(const char* c)
@@ -84,144 +85,164 @@ static const char* getNodeName(const Statement* s) {
 	}
 }
 
-static void debugChildren(DebugPrinter& d, const StatementList& stmts) {
-	d.indent();
-	for (const Statement* s : stmts) {
-		debug(d, s);
+static const char* getNodeName(const Declaration* d) {
+	switch (d->getKind()) {
+	case Declaration::program_kind: return "program-decl";
+	case Declaration::variable_kind: return "variable-decl";
+	case Declaration::constant_kind: return "constant-decl";
+	case Declaration::value_kind: return "value-decl";
+	case Declaration::parameter_kind: return "parameter-decl";
+	case Declaration::function_kind: return "function-decl";
 	}
-	d.undent();
 }
 
-void debugStatement(DebugPrinter& d, const BlockStatement* s) {
-	debugChildren(d, s->getStatements());
+static void debugNode(DebugPrinter& d, const char* node, const Declaration* dc) {
+	std::string tab(d.nesting() * 2, ' ');
+	d.getStream() << tab << NodeFont(node) << AddressFont(dc);
+	if (dc->getName())
+		d.getStream() << ' ' << "name=" << *dc->getName();
+	d.getStream() << '\n';
 }
 
-void debugStatement(DebugPrinter& d, const WhenStatement* s) {
-	d.indent();
-	debug(d, s->getCondition());
-	debug(d, s->getBody());
-	d.undent();
-}
+// A node waiting to be printed by the tree walker. The walker keeps its
+// own stack so that deeply nested trees do not exhaust the native stack.
+struct DebugItem {
+	enum Kind {
+		type_item,
+		expr_item,
+		stmt_item,
+		decl_item
+	};
 
-void debugStatement(DebugPrinter& d, const IfStatement* s) {
-	d.indent();
-	debug(d, s->getCondition());
-	debug(d, s->getPassValue());
-	debug(d, s->getFailValue());
-	d.undent();
-}
+	Kind kind;
+	const void* node;
+	int depth;
+};
+
+using DebugStack = std::vector<DebugItem>;
 
-void debugStatement(DebugPrinter& d, const WhileStatement* s) {
-	d.indent();
-	debug(d, s->getCondition());
-	debug(d, s->getBody());
-	d.undent();
+static void push(DebugStack& stack, int depth, const Type* t) {
+	stack.push_back({ DebugItem::type_item, t, depth });
 }
 
-void debugStatement(DebugPrinter& d, const ReturnStatement* s) {
-	d.indent();
-	debug(d, s->getValue());
-	d.undent();
+static void push(DebugStack& stack, int depth, const Expression* e) {
+	stack.push_back({ DebugItem::expr_item, e, depth });
 }
 
-void debugStatement(DebugPrinter& d, const DeclareStatement* s) {
-	d.indent();
-	debug(d, s->getDeclaration());
-	d.undent();
+static void push(DebugStack& stack, int depth, const Statement* s) {
+	stack.push_back({ DebugItem::stmt_item, s, depth });
 }
 
-void debugStatement(DebugPrinter& d, const ExpressionStatement* s) {
-	d.indent();
-	debug(d, s->getExpression());
-	d.undent();
+static void push(DebugStack& stack, int depth, const Declaration* dc) {
+	stack.push_back({ DebugItem::decl_item, dc, depth });
 }
 
-void debug(DebugPrinter& d, const Statement* s) {
-	debugNode(d, getNodeName(s), s);
-	switch (s->getKind()) {
-	case Statement::block_kind:
-		return debugStatement(d, static_cast<const BlockStatement*>(s));
-	case Statement::when_kind:
-		return debugStatement(d, static_cast<const WhenStatement*>(s));
-	case Statement::if_kind:
-		return debugStatement(d, static_cast<const IfStatement*>(s));
-	case Statement::while_kind:
-		return debugStatement(d, static_cast<const WhileStatement*>(s));
-	case Statement::break_kind:
-		return; //todo
-	case Statement::cont_kind:
-		return; //todo
-	case Statement::ret_kind:
-		return debugStatement(d, static_cast<const ReturnStatement*>(s));
-	case Statement::decl_kind:
-		return debugStatement(d, static_cast<const DeclareStatement*>(s));
-	case Statement::expr_kind:
-		return debugStatement(d, static_cast<const ExpressionStatement*>(s));
+// Pushes the children of a statement or declaration. Children are pushed
+// in reverse so that they are printed in order.
+struct ChildPusher : StatementVisitor<ChildPusher>, DeclarationVisitor<ChildPusher> {
+	ChildPusher(DebugStack& s, int d)
+		: stack(s), depth(d) {}
+
+	using StatementVisitor<ChildPusher>::visit;
+	using DeclarationVisitor<ChildPusher>::visit;
+
+	template<typename List>
+	void pushList(const List& list) {
+		for (auto i = list.rbegin(); i != list.rend(); ++i) {
+			push(stack, depth, *i);
+		}
 	}
-}
 
-static const char* getNodeName(const Declaration* d) {
-	switch (d->getKind()) {
-	case Declaration::program_kind: return "program-decl";
-	case Declaration::variable_kind: return "variable-decl";
-	case Declaration::constant_kind: return "constant-decl";
-	case Declaration::value_kind: return "value-decl";
-	case Declaration::parameter_kind: return "parameter-decl";
-	case Declaration::function_kind: return "function-decl";
+	void visitBlockStatement(const BlockStatement* s) {
+		pushList(s->getStatements());
 	}
-}
 
-static void debugNode(DebugPrinter& d, const char* node, Declaration* dc) {
-	std::string tab(d.nesting() * 2, ' ');
-	d.getStream() << tab << NodeFont(node) << AddressFont(dc);
-	if (dc->getName())
-		d.getStream() << ' ' << "name=" << *dc->getName();
-	d.getStream() << '\n';
-}
+	void visitWhenStatement(const WhenStatement* s) {
+		push(stack, depth, s->getBody());
+		push(stack, depth, s->getCondition());
+	}
 
-static void debugChildren(DebugPrinter& d, const DeclarationList& dl) {
-	d.indent();
-	for (const Declaration* dc : dl) {
-		debug(d, dc);
+	void visitIfStatement(const IfStatement* s) {
+		push(stack, depth, s->getFailValue());
+		push(stack, depth, s->getPassValue());
+		push(stack, depth, s->getCondition());
 	}
-	d.undent();
-}
 
-static void debugDeclaration(DebugPrinter& d, const ProgramDeclaration* p) {
-	debugChildren(d, p->getDeclarations());
-}
+	void visitWhileStatement(const WhileStatement* s) {
+		push(stack, depth, s->getBody());
+		push(stack, depth, s->getCondition());
+	}
+
+	void visitReturnStatement(const ReturnStatement* s) {
+		push(stack, depth, s->getValue());
+	}
 
-static void debugDeclaration(DebugPrinter& d, const ObjectDeclaration* o) {
-	d.indent();
-	debug(d, o->getType());
-	if (const Expression* e = o->getInit()) {
-		debug(d, e);
+	void visitDeclareStatement(const DeclareStatement* s) {
+		push(stack, depth, s->getDeclaration());
 	}
-	d.undent();
+
+	void visitExpressionStatement(const ExpressionStatement* s) {
+		push(stack, depth, s->getExpression());
+	}
+
+	void visitProgramDeclaration(const ProgramDeclaration* p) {
+		pushList(p->getDeclarations());
+	}
+
+	void visitObjectDeclaration(const ObjectDeclaration* o) {
+		if (const Expression* e = o->getInit()) {
+			push(stack, depth, e);
+		}
+		push(stack, depth, o->getType());
+	}
+
+	void visitFunctionDeclaration(const FunctionDeclaration* f) {
+		if (const Statement* s = f->getBody()) {
+			push(stack, depth, s);
+		}
+		push(stack, depth, f->getReturnType());
+		pushList(f->getParameters());
+	}
+
+	DebugStack& stack;
+	int depth;
+};
+
+static void debugTree(DebugPrinter& d, DebugItem root) {
+	int base = d.nesting();
+	DebugStack stack{ root };
+	while (!stack.empty()) {
+		DebugItem item = stack.back();
+		stack.pop_back();
+		d.depth = item.depth;
+		switch (item.kind) {
+		case DebugItem::type_item:
+			debug(d, static_cast<const Type*>(item.node));
+			break;
+		case DebugItem::expr_item:
+			debug(d, static_cast<const Expression*>(item.node));
+			break;
+		case DebugItem::stmt_item: {
+			const Statement* s = static_cast<const Statement*>(item.node);
+			debugNode(d, getNodeName(s), s);
+			ChildPusher(stack, item.depth + 1).visit(s);
+			break;
+		}
+		case DebugItem::decl_item: {
+			const Declaration* dc = static_cast<const Declaration*>(item.node);
+			debugNode(d, getNodeName(dc), dc);
+			ChildPusher(stack, item.depth + 1).visit(dc);
+			break;
+		}
+		}
+	}
+	d.depth = base;
 }
 
-static void debugDeclaration(DebugPrinter& d, const FunctionDeclaration* f) {
-	debugChildren(d, f->getParameters());
-	d.indent();
-	debug(d, f->getReturnType());
-	debug(d, f->getBody());
-	d.undent();
+void debug(DebugPrinter& d, const Statement* s) {
+	debugTree(d, { DebugItem::stmt_item, s, d.nesting() });
 }
 
 void debug(DebugPrinter& d, const Declaration* dc) {
-	debugNode(d, getNodeName(dc), dc);
-	switch (dc->getKind()) {
-	case Declaration::program_kind:
-		return debugDeclaration(d, static_cast<const ProgramDeclaration*>(dc));
-	case Declaration::variable_kind:
-		return debugDeclaration(d, static_cast<const VariableDeclaration*>(dc));
-	case Declaration::constant_kind:
-		return debugDeclaration(d, static_cast<const ConstantDeclaration*>(dc));
-	case Declaration::value_kind:
-		return debugDeclaration(d, static_cast<const ValueDeclaration*>(dc));
-	case Declaration::parameter_kind:
-		return debugDeclaration(d, static_cast<const ParameterDeclaration*>(dc));
-	case Declaration::function_kind:
-		return debugDeclaration(d, static_cast<const FunctionDeclaration*>(dc));
-	}
-}
\ No newline at end of file
+	debugTree(d, { DebugItem::decl_item, dc, d.nesting() });
+}
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "Declaration.h"
+#include "Casting.h"
 #include "Type.h"
 #include "Debug.h"
 
@@ -16,7 +17,7 @@ bool ObjectDeclaration::isReference() const {
 }
 
 FunctionType* FunctionDeclaration::getType() const {
-	return static_cast<FunctionType*>(type);
+	return cast<FunctionType>(type);
 }
 
 Type* FunctionDeclaration::getReturnType() const {
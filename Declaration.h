@@ -1,6 +1,7 @@
 #pragma once
 #include "Symbol.h"
-#include <vector>
+#include "SmallVector.h"
+#include "MemoryProfile.h"
 
 class Type;
 class FunctionType;
@@ -20,9 +21,12 @@ public:
 
 protected:
 	Declaration(Kind k, Symbol s)
-		: kind(k), name(s) {}
+		: kind(k), name(s), index(0), local(false) { MemoryProfile::countNode(MemoryProfile::declaration_nodes, k); }
 
 public:
+	static void* operator new(std::size_t n) { return MemoryProfile::allocate(n); }
+	static void operator delete(void* p) { ::operator delete(p); }
+
 	virtual ~Declaration() = default;
 
 	Kind getKind() const { return kind; }
@@ -32,23 +36,37 @@ public:
 	
 	Symbol getName() const { return name; }
 
+	// The dense number of the declaration among the globals of the program,
+	// or among the parameters and locals of its function when it is local.
+	// Code generation indexes flat tables with it.
+	unsigned getIndex() const { return index; }
+	bool isLocal() const { return local; }
+	void setIndex(unsigned i, bool l) { index = i; local = l; }
+
 	void debug() const;
 
 private:
 	Kind kind;
 	Symbol name;
+	unsigned index;
+	bool local;
 };
 
-using DeclarationList = std::vector<Declaration*>;
+using DeclarationList = SmallVector<Declaration*, 4>;
 
 struct ProgramDeclaration : Declaration {
-	ProgramDeclaration(const DeclarationList& d)
-		: Declaration(program_kind, nullptr), declarations(d) {}
+	ProgramDeclaration(const DeclarationList& d, unsigned globals = 0)
+		: Declaration(program_kind, nullptr), declarations(d), globals(globals) {}
+
+	static bool classof(const Declaration* n) { return n->getKind() == program_kind; }
 
 	const DeclarationList& getDeclarations() const { return declarations; }
 	 DeclarationList& getDeclarations()  { return declarations; }
 
+	unsigned getGlobalCount() const { return globals; }
+
 	DeclarationList declarations;
+	unsigned globals;
 };
 
 struct TypedDeclaration : Declaration {
@@ -57,6 +75,8 @@ protected:
 		: Declaration(k, s), type(t) {}
 
 public:
+	static bool classof(const Declaration* n) { return n->getKind() != program_kind; }
+
 	Type * getType() const { return type; }
 	void setType(Type* t) { type = t; }
 
@@ -70,9 +90,12 @@ protected:
 		: TypedDeclaration(k, s, t), init(e) {}
 
 public:
+	static bool classof(const Declaration* n) { return n->getKind() != program_kind && n->getKind() != function_kind; }
+
 	bool isReference() const;
 
 	Expression* getInit() const { return init; }
+	Expression*& getInit() { return init; }
 
 	void setInit(Expression* e) { init = e; }
 
@@ -83,26 +106,36 @@ protected:
 struct VariableDeclaration : ObjectDeclaration {
 	VariableDeclaration(Symbol s, Type* t, Expression* e = nullptr)
 		: ObjectDeclaration(variable_kind, s, t, e) {}
+
+	static bool classof(const Declaration* n) { return n->getKind() == variable_kind; }
 };
 
 struct ConstantDeclaration : ObjectDeclaration {
 	ConstantDeclaration(Symbol s, Type* t, Expression* e = nullptr)
 		: ObjectDeclaration(constant_kind, s, t, e) {}
+
+	static bool classof(const Declaration* n) { return n->getKind() == constant_kind; }
 };
 
 struct ValueDeclaration : ObjectDeclaration {
 	ValueDeclaration(Symbol s, Type* t, Expression* e = nullptr)
 		: ObjectDeclaration(value_kind, s, t, e) {}
+
+	static bool classof(const Declaration* n) { return n->getKind() == value_kind; }
 };
 
 struct ParameterDeclaration : ObjectDeclaration {
 	ParameterDeclaration(Symbol s, Type* t)
 		: ObjectDeclaration(parameter_kind, s, t, nullptr) {}
+
+	static bool classof(const Declaration* n) { return n->getKind() == parameter_kind; }
 };
 
 struct FunctionDeclaration : TypedDeclaration {
 	FunctionDeclaration(Symbol s, Type* t, const DeclarationList& params, Statement* stmt = nullptr)
-		: TypedDeclaration(function_kind, s, t), params(params), body(stmt) {}
+		: TypedDeclaration(function_kind, s, t), params(params), body(stmt), locals(0) {}
+
+	static bool classof(const Declaration* n) { return n->getKind() == function_kind; }
 
 	const DeclarationList& getParameters() const { return params; }
 	DeclarationList& getParameters() { return params; }
@@ -114,6 +147,11 @@ struct FunctionDeclaration : TypedDeclaration {
 	Statement* getBody() const { return body; }
 	void setBody(Statement* s) { body = s; }
 
+	// Parameters and locals, numbered in order of declaration.
+	unsigned getLocalCount() const { return locals; }
+	unsigned addLocal() { return locals++; }
+
 	DeclarationList params;
 	Statement* body;
+	unsigned locals;
 };
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include "stdafx.h"
+#include "Diagnostics.h"
+#include <algorithm>
+#include <iostream>
+
+void Diagnostics::error(Location l, const std::string& msg) {
+	list.push_back({ l, msg });
+}
+
+void Diagnostics::append(const Diagnostics& d) {
+	list.insert(list.end(), d.list.begin(), d.list.end());
+}
+
+void Diagnostics::sort() {
+	std::stable_sort(list.begin(), list.end(), [](const Diagnostic& a, const Diagnostic& b) {
+		if (a.location.line != b.location.line)
+			return a.location.line < b.location.line;
+		return a.location.column < b.location.column;
+	});
+}
+
+std::ostream& operator<<(std::ostream& os, const Diagnostic& d) {
+	return os << d.location << ": error: " << d.message;
+}
+
+std::ostream& operator<<(std::ostream& os, const Diagnostics& d) {
+	for (const Diagnostic& e : d.getDiagnostics()) {
+		os << e << '\n';
+	}
+	return os;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+#include "Location.h"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+struct Diagnostic {
+	Location location;
+	std::string message;
+};
+
+// Collects the errors found while compiling so that all of them can be
+// reported at once instead of stopping at the first.
+class Diagnostics {
+public:
+	void error(Location l, const std::string& msg);
+	void append(const Diagnostics& d);
+	void clear() { list.clear(); }
+
+	// Orders the diagnostics by location, keeping the order of those
+	// reported at the same place.
+	void sort();
+
+	bool hasErrors() const { return !list.empty(); }
+	const std::vector<Diagnostic>& getDiagnostics() const { return list; }
+
+private:
+	std::vector<Diagnostic> list;
+};
+
+std::ostream& operator<<(std::ostream& os, const Diagnostic& d);
+std::ostream& operator<<(std::ostream& os, const Diagnostics& d);
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include "stdafx.h"
+#include "ExecutableMemory.h"
+
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+ExecutableMemory::ExecutableMemory(std::size_t n)
+	: base(nullptr), size(n ? n : 1)
+{
+#ifdef _WIN32
+	void* p = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!p)
+		throw std::bad_alloc();
+#else
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		throw std::bad_alloc();
+#endif
+	base = static_cast<unsigned char*>(p);
+}
+
+ExecutableMemory& ExecutableMemory::operator=(ExecutableMemory&& x) noexcept
+{
+	if (this != &x) {
+		release();
+		base = x.base;
+		size = x.size;
+		x.base = nullptr;
+		x.size = 0;
+	}
+	return *this;
+}
+
+ExecutableMemory::~ExecutableMemory()
+{
+	release();
+}
+
+void ExecutableMemory::protect()
+{
+#ifdef _WIN32
+	DWORD old;
+	if (!VirtualProtect(base, size, PAGE_EXECUTE_READ, &old))
+		throw std::runtime_error("Cannot make code executable");
+	FlushInstructionCache(GetCurrentProcess(), base, size);
+#else
+	if (mprotect(base, size, PROT_READ | PROT_EXEC) != 0)
+		throw std::runtime_error("Cannot make code executable");
+#endif
+}
+
+void ExecutableMemory::release()
+{
+	if (!base)
+		return;
+#ifdef _WIN32
+	VirtualFree(base, 0, MEM_RELEASE);
+#else
+	munmap(base, size);
+#endif
+	base = nullptr;
+	size = 0;
+}
\ No newline at end of file
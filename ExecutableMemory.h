@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+
+// Pages that hold generated machine code. They are writable until protect
+// is called and executable after, never both at once.
+class ExecutableMemory {
+public:
+	ExecutableMemory()
+		: base(nullptr), size(0) {}
+
+	explicit ExecutableMemory(std::size_t n);
+
+	ExecutableMemory(const ExecutableMemory&) = delete;
+	ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+
+	ExecutableMemory(ExecutableMemory&& x) noexcept
+		: base(x.base), size(x.size) { x.base = nullptr; x.size = 0; }
+
+	ExecutableMemory& operator=(ExecutableMemory&& x) noexcept;
+
+	~ExecutableMemory();
+
+	unsigned char* getBase() const { return base; }
+	std::size_t getSize() const { return size; }
+
+	// Makes the pages executable and read-only.
+	void protect();
+
+private:
+	void release();
+
+	unsigned char* base;
+	std::size_t size;
+};
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "Token.h"
-#include <vector>
+#include "SmallVector.h"
+#include "MemoryProfile.h"
 
 class Type;
 class Declaration;
@@ -25,12 +26,15 @@ public:
 
 protected:
 	Expression(Kind k)
-		: kind(k), type() {}
+		: kind(k), type() { MemoryProfile::countNode(MemoryProfile::expression_nodes, k); }
 
 	Expression(Kind k, Type* t)
-		: kind(k), type(t) {}
+		: kind(k), type(t) { MemoryProfile::countNode(MemoryProfile::expression_nodes, k); }
 
 public:
+	static void* operator new(std::size_t n) { return MemoryProfile::allocate(n); }
+	static void operator delete(void* p) { ::operator delete(p); }
+
 	virtual ~Expression() = default;
 
 	Kind getKind() const { return kind; }
@@ -52,12 +56,14 @@ private:
 	Type* type;
 };
 
-using ExpressionList = std::vector<Expression*>;
+using ExpressionList = SmallVector<Expression*, 4>;
 
 struct BoolExpression : Expression {
 	BoolExpression(Type* t, bool b)
 		: Expression(bool_kind, t), val(b) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == bool_kind; }
+
 	bool getValue() const { return val; }
 
 	bool val;
@@ -67,6 +73,8 @@ struct IntExpression : Expression {
 	IntExpression(Type* t, int i)
 		: Expression(int_kind, t), val(i) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == int_kind; }
+
 	int getValue() const { return val; }
 
 	int val;
@@ -76,6 +84,8 @@ struct FloatExpression : Expression {
 	FloatExpression(Type* t, double d)
 		: Expression(float_kind, t), val(d) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == float_kind; }
+
 	double getValue() const { return val; }
 
 	double val;
@@ -85,6 +95,8 @@ struct IdExpression : Expression {
 	IdExpression(Type* t, Declaration* d)
 		: Expression(id_kind, t), ref(d) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == id_kind; }
+
 	Declaration* getDeclaration() const { return ref; }
 
 	Declaration* ref;
@@ -100,8 +112,10 @@ enum unop {
 };
 
 struct UnopExpression : Expression {
-	UnopExpression(unop op, Expression* e)
-		: Expression(unop_kind), op(op), arg(e) {}
+	UnopExpression(Type* t, unop op, Expression* e)
+		: Expression(unop_kind, t), op(op), arg(e) {}
+
+	static bool classof(const Expression* n) { return n->getKind() == unop_kind; }
 
 	unop getOperator() const { return op; }
 	Expression* getOperand() const { return arg; }
@@ -135,6 +149,8 @@ struct BinopExpression : Expression {
 	BinopExpression(Type* t, binop op, Expression* e1, Expression* e2)
 		: Expression(binop_kind, t), op(op), lhs(e1), rhs(e2) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == binop_kind; }
+
 	binop getOperator() const { return op; }
 
 	Expression* getLHS() const { return lhs; }
@@ -147,7 +163,9 @@ struct BinopExpression : Expression {
 
 struct PostfixExpression : Expression {
 	PostfixExpression(Kind k, Type* t, Expression* e, const ExpressionList& args)
-		: Expression(k), base(e), args(args) {}
+		: Expression(k, t), base(e), args(args) {}
+
+	static bool classof(const Expression* n) { return n->getKind() == call_kind || n->getKind() == index_kind; }
 
 	const ExpressionList& getArguments() const { return args; }
 	ExpressionList& getArguments() { return args; }
@@ -160,25 +178,33 @@ struct CallExpression : PostfixExpression {
 	CallExpression(Type* t, Expression* e, const ExpressionList& args)
 		: PostfixExpression(call_kind, t, e, args) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == call_kind; }
+
 	Expression* getCallee() const { return base; }
 };
 
 struct IndexExpression : PostfixExpression {
 	IndexExpression(Type* t, Expression* e, const ExpressionList& args)
 		: PostfixExpression(index_kind, t, e, args) {}
+
+	static bool classof(const Expression* n) { return n->getKind() == index_kind; }
 };
 
 struct CastExpression : Expression {
 	CastExpression(Expression* e, Type* t)
 		: Expression(cast_kind, t), source(e), destination(t) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == cast_kind; }
+
 	Expression* source;
 	Type* destination;
 };
 
 struct AssignmentExpression : Expression {
 	AssignmentExpression(Type* t, Expression* e1, Expression* e2)
-		: Expression(assign_kind), lhs(e1), rhs(e2) {}
+		: Expression(assign_kind, t), lhs(e1), rhs(e2) {}
+
+	static bool classof(const Expression* n) { return n->getKind() == assign_kind; }
 
 	Expression* getLHS() const { return lhs; }
 	Expression* getRHS() const { return rhs; }
@@ -191,6 +217,8 @@ struct ConditionalExpression : Expression {
 	ConditionalExpression(Type* t, Expression* e1, Expression* e2, Expression* e3)
 		: Expression(cond_kind, t), condition(e1), pass(e2), fail(e3) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == cond_kind; }
+
 	Expression* getCondition() const { return condition; }
 	Expression* getPassValue() const { return pass; }
 	Expression* getFailValue() const { return fail; }
@@ -214,6 +242,8 @@ struct ConversionExpression : Expression {
 	ConversionExpression(Expression* e1, Conversion c, Type* t)
 		: Expression(conv_kind, t), source(e1), conversion(c) {}
 
+	static bool classof(const Expression* n) { return n->getKind() == conv_kind; }
+
 	Conversion getConversion() const { return conversion; }
 	Expression* getSource() const { return source; }
 
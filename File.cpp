@@ -1,20 +1,186 @@
 #include "stdafx.h"
 #include "File.h"
-#include <iterator>
+#include "Trace.h"
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FILE_USE_SSE2 1
+#endif
+
+static bool startsWith(const std::string& s, const char* bom, std::size_t n) {
+	return s.size() >= n && std::memcmp(s.data(), bom, n) == 0;
+}
+
+static int countTrailingZeros(unsigned m) {
+	int n = 0;
+	while (!(m & 1)) {
+		m >>= 1;
+		++n;
+	}
+	return n;
+}
+
+// The runs between carriage returns are found with memchr and moved as a
+// whole.
+void normalizeNewlines(std::string& text) {
+	char* first = &text[0];
+	char* last = first + text.size();
+	char* out = static_cast<char*>(std::memchr(first, '\r', last - first));
+	if (!out) {
+		return;
+	}
+	char* p = out;
+	while (p != last) {
+		*out++ = '\n';
+		if (++p != last && *p == '\n') {
+			++p;
+		}
+		char* cr = static_cast<char*>(std::memchr(p, '\r', last - p));
+		if (!cr) {
+			cr = last;
+		}
+		std::memmove(out, p, cr - p);
+		out += cr - p;
+		p = cr;
+	}
+	text.resize(out - first);
+}
+
+static char* encodeUtf8(unsigned c, char* out) {
+	if (c < 0x800) {
+		*out++ = static_cast<char>(0xC0 | c >> 6);
+	}
+	else if (c < 0x10000) {
+		*out++ = static_cast<char>(0xE0 | c >> 12);
+		*out++ = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+	}
+	else {
+		*out++ = static_cast<char>(0xF0 | c >> 18);
+		*out++ = static_cast<char>(0x80 | (c >> 12 & 0x3F));
+		*out++ = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+	}
+	*out++ = static_cast<char>(0x80 | (c & 0x3F));
+	return out;
+}
+
+// Runs of ASCII are narrowed eight code units at a time; everything else
+// is decoded one code point at a time. Unpaired surrogates and a trailing
+// odd byte become U+FFFD.
+std::string decodeUtf16(const char* first, const char* last, bool bigEndian) {
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(first);
+	const unsigned char* end = p + (last - first) / 2 * 2;
+	std::string text((end - p) / 2 * 3 + 3, '\0');
+	char* out = &text[0];
+	auto unit = [bigEndian](const unsigned char* q) -> unsigned {
+		return bigEndian ? (q[0] << 8 | q[1]) : (q[1] << 8 | q[0]);
+	};
+
+	bool cr = false;
+	while (p != end) {
+#ifdef FILE_USE_SSE2
+		if (!cr && end - p >= 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if (bigEndian) {
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			}
+			__m128i high = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xFF80)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF) {
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(v, v));
+				unsigned crs = _mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_set1_epi16('\r')));
+				int n = crs ? countTrailingZeros(crs) / 2 : 8;
+				out += n;
+				p += 2 * n;
+				if (n) {
+					continue;
+				}
+			}
+		}
+#endif
+		unsigned c = unit(p);
+		p += 2;
+		if (c >= 0xD800 && c < 0xE000) {
+			if (c < 0xDC00 && p != end && (unit(p) & 0xFC00) == 0xDC00) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (unit(p) - 0xDC00);
+				p += 2;
+			}
+			else {
+				c = 0xFFFD;
+			}
+		}
+		if (c >= 0x80) {
+			cr = false;
+			out = encodeUtf8(c, out);
+		}
+		else if (c == '\n' && cr) {
+			cr = false;
+		}
+		else {
+			cr = c == '\r';
+			*out++ = cr ? '\n' : static_cast<char>(c);
+		}
+	}
+	if (end != reinterpret_cast<const unsigned char*>(last)) {
+		out = encodeUtf8(0xFFFD, out);
+	}
+	text.resize(out - &text[0]);
+	return text;
+}
 
 File::File(const std::string& path) 
-	: path(path) {
-	std::ifstream inFile(path);
-	std::istreambuf_iterator<char> first{ inFile };
-	std::istreambuf_iterator<char> last{};
-	text = std::string(first, last);
+	: path(path), open(false) {
+	TraceSpan span("File::File", path);
+	std::ifstream inFile(path, std::ios::binary);
+	if (!inFile) {
+		return;
+	}
+	// Pipes and other streams that cannot seek have no size, and are read
+	// to their end instead.
+	std::streamoff size = -1;
+	if (inFile.seekg(0, std::ios::end)) {
+		size = inFile.tellg();
+	}
+	if (size >= 0 && inFile.seekg(0)) {
+		text.resize(static_cast<std::size_t>(size));
+		inFile.read(&text[0], text.size());
+		text.resize(static_cast<std::size_t>(inFile.gcount()));
+	}
+	else {
+		inFile.clear();
+		text.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+	}
+	if (inFile.bad()) {
+		text.clear();
+		return;
+	}
+	open = true;
+
+	// Sources saved by Windows editors are often UTF-16 with a byte order
+	// mark and CRLF line endings; the lexer expects UTF-8 and LF.
+	if (startsWith(text, "\xFF\xFE", 2) || startsWith(text, "\xFE\xFF", 2)) {
+		text = decodeUtf16(text.data() + 2, text.data() + text.size(), text[0] == '\xFE');
+		return;
+	}
+	if (startsWith(text, "\xEF\xBB\xBF", 3)) {
+		text.erase(0, 3);
+	}
+	normalizeNewlines(text);
 }
 
+File::File(const std::string& path, std::string text)
+	: path(path), text(std::move(text)), open(true) {}
+
 const std::string& File::getPath() const {
 	return path;
 }
 
 const std::string& File::getText() const {
 	return text;
+}
+
+bool File::isOpen() const {
+	return open;
 }
\ No newline at end of file
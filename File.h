@@ -5,10 +5,24 @@ class File {
 public:
 	File(const std::string& path);
 
+	// Names input whose text is already in memory, or is read elsewhere.
+	File(const std::string& path, std::string text);
+
 	const std::string& getPath() const;
 	const std::string& getText() const;
 
+	// False when the file could not be read, which leaves it empty.
+	bool isOpen() const;
+
 private:
 	std::string path;
 	std::string text;
-};
\ No newline at end of file
+	bool open;
+};
+
+// Replaces CRLF and lone CR with LF in place.
+void normalizeNewlines(std::string& text);
+
+// Converts UTF-16 without its byte order mark to UTF-8, replacing CRLF and
+// lone CR with LF.
+std::string decodeUtf16(const char* first, const char* last, bool bigEndian);
\ No newline at end of file
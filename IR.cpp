@@ -0,0 +1,496 @@
+#include "stdafx.h"
+#include "IR.h"
+#include "IRAnalysis.h"
+#include "Type.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+IRType getIRType(const Type* t)
+{
+	switch (t->getKind()) {
+	case Type::bool_kind: return irt_bool;
+	case Type::char_kind: return irt_char;
+	case Type::int_kind: return irt_int;
+	case Type::float_kind: return irt_float;
+	default: return irt_ptr;
+	}
+}
+
+const char* getIRTypeName(IRType t)
+{
+	switch (t) {
+	case irt_void: return "void";
+	case irt_bool: return "bool";
+	case irt_char: return "char";
+	case irt_int: return "int";
+	case irt_float: return "float";
+	case irt_ptr: return "ptr";
+	}
+	return "?";
+}
+
+const char* getIROpcodeName(IROpcode op)
+{
+	static const char* names[] = {
+		"const", "param", "global", "function",
+		"add", "sub", "mul", "div", "rem", "and", "or", "xor", "shl", "shr", "mulh", "neg", "not",
+		"fadd", "fsub", "fmul", "fdiv", "frem", "fneg",
+		"eq", "ne", "lt", "gt", "le", "ge", "ult", "ugt", "ule", "uge",
+		"feq", "fne", "flt", "fgt", "fle", "fge",
+		"trunc", "zext", "itof", "ftoi",
+		"load", "store", "call", "phi",
+		"br", "condbr", "ret", "unreachable"
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == ir_unreachable + 1, "Missing opcode name");
+	return names[op];
+}
+
+IRInstruction* IRBlock::getTerminator() const
+{
+	if (instructions.empty() || !instructions.back()->isTerminator())
+		return nullptr;
+	return instructions.back();
+}
+
+IRBlockList IRBlock::getSuccessors() const
+{
+	IRBlockList succs;
+	if (IRInstruction* t = getTerminator()) {
+		if (t->op == ir_br) {
+			succs.push_back(t->targets[0]);
+		}
+		else if (t->op == ir_condbr) {
+			succs.push_back(t->targets[0]);
+			succs.push_back(t->targets[1]);
+		}
+	}
+	return succs;
+}
+
+std::size_t IRBlock::getFirstInsertionPoint() const
+{
+	std::size_t n = 0;
+	while (n < instructions.size() && instructions[n]->isPhi())
+		++n;
+	return n;
+}
+
+IRInstruction* IRFunction::make(IROpcode op, IRType t)
+{
+	values.emplace_back(nextValue++, op, t);
+	return &values.back();
+}
+
+IRBlock* IRFunction::makeBlock()
+{
+	pool.emplace_back(this, nextBlock++);
+	return &pool.back();
+}
+
+void IRFunction::renumber()
+{
+	nextValue = 0;
+	nextBlock = 0;
+	for (IRBlock* b : blocks) {
+		b->id = nextBlock++;
+		for (IRInstruction* i : b->instructions)
+			i->id = nextValue++;
+	}
+}
+
+std::uint64_t IRGlobal::getBits() const
+{
+	switch (type) {
+	case irt_bool:
+	case irt_char:
+		return static_cast<std::uint8_t>(integer);
+	case irt_int:
+		return static_cast<std::uint32_t>(integer);
+	case irt_float: {
+		float f = static_cast<float>(real);
+		std::uint32_t b;
+		std::memcpy(&b, &f, 4);
+		return b;
+	}
+	default:
+		return static_cast<std::uint64_t>(integer);
+	}
+}
+
+IRFunction* IRModule::makeFunction(const std::string& n, IRType r)
+{
+	functions.emplace_back(new IRFunction(this, n, r));
+	return functions.back().get();
+}
+
+static bool isInteger(IRType t)
+{
+	return t == irt_bool || t == irt_char || t == irt_int;
+}
+
+// Checks the operand and result types of a single instruction.
+static const char* checkTypes(const IRFunction& f, const IRInstruction* i)
+{
+	const auto& ops = i->operands;
+	switch (i->op) {
+	case ir_const:
+		if (!ops.empty() || i->type == irt_void || i->type == irt_ptr)
+			return "bad constant";
+		return nullptr;
+	case ir_param:
+		if (i->integer < 0 || i->integer >= static_cast<std::int64_t>(f.params.size()) || f.params[i->integer] != i->type)
+			return "bad parameter";
+		return nullptr;
+	case ir_global:
+		if (i->type != irt_ptr || i->integer < 0 || (f.parent && i->integer >= static_cast<std::int64_t>(f.parent->globals.size())))
+			return "bad global";
+		return nullptr;
+	case ir_function:
+		if (i->type != irt_ptr || i->integer < 0 || (f.parent && i->integer >= static_cast<std::int64_t>(f.parent->functions.size())))
+			return "bad function";
+		return nullptr;
+	case ir_add: case ir_sub: case ir_mul: case ir_div: case ir_rem:
+	case ir_and: case ir_or: case ir_xor: case ir_shl: case ir_shr:
+		if (ops.size() != 2 || !isInteger(i->type) || ops[0]->type != i->type || ops[1]->type != i->type)
+			return "bad integer operands";
+		return nullptr;
+	case ir_mulh:
+		if (ops.size() != 2 || i->type != irt_int || ops[0]->type != irt_int || ops[1]->type != irt_int)
+			return "bad int operands";
+		return nullptr;
+	case ir_neg: case ir_not:
+		if (ops.size() != 1 || !isInteger(i->type) || ops[0]->type != i->type)
+			return "bad integer operand";
+		return nullptr;
+	case ir_fadd: case ir_fsub: case ir_fmul: case ir_fdiv: case ir_frem:
+		if (ops.size() != 2 || i->type != irt_float || ops[0]->type != irt_float || ops[1]->type != irt_float)
+			return "bad float operands";
+		return nullptr;
+	case ir_fneg:
+		if (ops.size() != 1 || i->type != irt_float || ops[0]->type != irt_float)
+			return "bad float operand";
+		return nullptr;
+	case ir_eq: case ir_ne: case ir_lt: case ir_gt: case ir_le: case ir_ge:
+	case ir_ult: case ir_ugt: case ir_ule: case ir_uge:
+		if (ops.size() != 2 || i->type != irt_bool || !isInteger(ops[0]->type) || ops[1]->type != ops[0]->type)
+			return "bad comparison";
+		return nullptr;
+	case ir_feq: case ir_fne: case ir_flt: case ir_fgt: case ir_fle: case ir_fge:
+		if (ops.size() != 2 || i->type != irt_bool || ops[0]->type != irt_float || ops[1]->type != irt_float)
+			return "bad comparison";
+		return nullptr;
+	case ir_trunc:
+		if (ops.size() != 1 || ops[0]->type != irt_int || (i->type != irt_char && i->type != irt_bool))
+			return "bad truncation";
+		return nullptr;
+	case ir_zext:
+		if (ops.size() != 1 || i->type != irt_int || (ops[0]->type != irt_char && ops[0]->type != irt_bool))
+			return "bad extension";
+		return nullptr;
+	case ir_itof:
+		if (ops.size() != 1 || i->type != irt_float || ops[0]->type != irt_int)
+			return "bad conversion";
+		return nullptr;
+	case ir_ftoi:
+		if (ops.size() != 1 || i->type != irt_int || ops[0]->type != irt_float)
+			return "bad conversion";
+		return nullptr;
+	case ir_load:
+		if (ops.size() != 1 || ops[0]->type != irt_ptr || i->type == irt_void)
+			return "bad load";
+		return nullptr;
+	case ir_store:
+		if (ops.size() != 2 || ops[0]->type != irt_ptr || ops[1]->type == irt_void || i->type != irt_void)
+			return "bad store";
+		return nullptr;
+	case ir_call:
+		if (ops.empty() || ops[0]->type != irt_ptr)
+			return "bad call";
+		return nullptr;
+	case ir_phi:
+		if (ops.size() != i->block->preds.size())
+			return "phi does not match the predecessors";
+		for (const IRInstruction* v : ops) {
+			if (v->type != i->type)
+				return "bad phi operand";
+		}
+		return nullptr;
+	case ir_br:
+		if (!ops.empty() || !i->targets[0])
+			return "bad branch";
+		return nullptr;
+	case ir_condbr:
+		if (ops.size() != 1 || ops[0]->type != irt_bool || !i->targets[0] || !i->targets[1])
+			return "bad branch";
+		return nullptr;
+	case ir_ret:
+		if (ops.size() != 1 || ops[0]->type != f.result)
+			return "bad return";
+		return nullptr;
+	case ir_unreachable:
+		return nullptr;
+	}
+	return "unknown opcode";
+}
+
+bool verify(const IRFunction& f, std::ostream& os)
+{
+	bool ok = true;
+	auto fail = [&](const IRBlock* b, const IRInstruction* i, const char* msg) {
+		os << "@" << f.name << ": b" << b->id;
+		if (i)
+			os << ": %" << i->id;
+		os << ": " << msg << '\n';
+		ok = false;
+	};
+
+	if (!f.isDefined())
+		return true;
+
+	// Where each instruction is placed, to find uses of removed ones.
+	std::vector<char> placed(f.getBlockCount());
+	std::vector<std::size_t> position(f.getValueCount());
+	for (const IRBlock* b : f.blocks) {
+		if (b->id >= f.getBlockCount() || placed[b->id]) {
+			os << "@" << f.name << ": bad block numbering\n";
+			return false;
+		}
+		placed[b->id] = 1;
+		for (std::size_t n = 0; n < b->instructions.size(); ++n) {
+			if (b->instructions[n]->id >= f.getValueCount()) {
+				os << "@" << f.name << ": bad value numbering\n";
+				return false;
+			}
+			position[b->instructions[n]->id] = n;
+		}
+	}
+	auto isPlaced = [&](const IRInstruction* v) {
+		return v->block && v->block->id < placed.size() && placed[v->block->id] &&
+			position[v->id] < v->block->instructions.size() && v->block->instructions[position[v->id]] == v;
+	};
+
+	// The predecessor lists must match the branches.
+	std::vector<std::vector<unsigned>> edges(f.getBlockCount());
+	for (const IRBlock* b : f.blocks) {
+		for (IRBlock* s : b->getSuccessors()) {
+			if (s->id >= placed.size() || !placed[s->id])
+				fail(b, b->getTerminator(), "branch to a block outside the function");
+			else
+				edges[s->id].push_back(b->id);
+		}
+	}
+	for (const IRBlock* b : f.blocks) {
+		std::vector<unsigned> preds;
+		for (const IRBlock* p : b->preds)
+			preds.push_back(p->id);
+		std::sort(preds.begin(), preds.end());
+		std::sort(edges[b->id].begin(), edges[b->id].end());
+		if (preds != edges[b->id])
+			fail(b, nullptr, "predecessors do not match the branches");
+	}
+	if (!f.getEntryBlock()->preds.empty())
+		fail(f.getEntryBlock(), nullptr, "entry block has predecessors");
+	if (!ok)
+		return false;
+
+	IRDominators dom(f);
+	for (const IRBlock* b : f.blocks) {
+		if (b->instructions.empty() || !b->getTerminator()) {
+			fail(b, nullptr, "block has no terminator");
+			continue;
+		}
+		bool phis = true;
+		for (std::size_t n = 0; n < b->instructions.size(); ++n) {
+			const IRInstruction* i = b->instructions[n];
+			if (i->block != b) {
+				fail(b, i, "instruction is in the wrong block");
+				continue;
+			}
+			if (i->isTerminator() && n + 1 != b->instructions.size())
+				fail(b, i, "terminator in the middle of a block");
+			if (i->isPhi() && !phis)
+				fail(b, i, "phi after other instructions");
+			phis = phis && i->isPhi();
+			bool defined = true;
+			for (std::size_t k = 0; k < i->operands.size(); ++k) {
+				const IRInstruction* v = i->operands[k];
+				if (!v || !isPlaced(v)) {
+					fail(b, i, "operand is not in the function");
+					defined = false;
+					continue;
+				}
+				if (!dom.isReachable(b))
+					continue;
+				// The operand of a phi must be available at the end of the
+				// corresponding predecessor.
+				if (i->isPhi()) {
+					if (k < b->preds.size() && !dom.dominates(v->block, b->preds[k]) && dom.isReachable(b->preds[k]))
+						fail(b, i, "phi operand does not dominate its predecessor");
+				}
+				else if (v->block == b ? position[v->id] >= n : !dom.dominates(v->block, b)) {
+					fail(b, i, "operand does not dominate its use");
+				}
+			}
+			if (defined) {
+				if (const char* msg = checkTypes(f, i))
+					fail(b, i, msg);
+			}
+		}
+	}
+	return ok;
+}
+
+bool verify(const IRModule& m, std::ostream& os)
+{
+	bool ok = true;
+	for (const IRGlobal& g : m.globals) {
+		bool fits;
+		switch (g.type) {
+		case irt_bool: fits = g.integer == 0 || g.integer == 1; break;
+		case irt_char: fits = g.integer >= 0 && g.integer <= 255; break;
+		case irt_int: fits = g.integer >= INT32_MIN && g.integer <= INT32_MAX; break;
+		case irt_float: fits = g.integer == 0; break;
+		case irt_ptr: fits = g.integer == 0 && g.real == 0; break;
+		default: fits = false; break;
+		}
+		if (!fits || (g.type != irt_float && g.real != 0)) {
+			os << "@" << g.name << ": bad initial value\n";
+			ok = false;
+		}
+	}
+	for (const auto& f : m.functions) {
+		if (!verify(*f, os))
+			ok = false;
+	}
+	return ok;
+}
+
+static void printValue(std::ostream& os, const IRInstruction* v)
+{
+	if (v)
+		os << '%' << v->id;
+	else
+		os << "<null>";
+}
+
+std::ostream& operator<<(std::ostream& os, const IRInstruction& i)
+{
+	if (i.type != irt_void) {
+		printValue(os, &i);
+		os << " = ";
+	}
+	os << getIROpcodeName(i.op);
+	switch (i.op) {
+	case ir_const:
+		os << ' ' << getIRTypeName(i.type) << ' ';
+		if (i.type == irt_float)
+			os << i.real;
+		else if (i.type == irt_bool)
+			os << (i.integer ? "true" : "false");
+		else
+			os << i.integer;
+		return os;
+	case ir_param:
+		return os << ' ' << getIRTypeName(i.type) << ' ' << i.integer;
+	case ir_global:
+	case ir_function: {
+		// Name the symbol when the instruction is placed in a module.
+		const IRModule* m = i.block ? i.block->parent->parent : nullptr;
+		if (!m)
+			return os << " #" << i.integer;
+		if (i.op == ir_global)
+			return os << " @" << m->globals[i.integer].name;
+		return os << " @" << m->functions[i.integer]->name;
+	}
+	case ir_br:
+		return os << " b" << i.targets[0]->id;
+	case ir_condbr:
+		os << ' ';
+		printValue(os, i.operands[0]);
+		return os << ", b" << i.targets[0]->id << ", b" << i.targets[1]->id;
+	case ir_phi:
+		os << ' ' << getIRTypeName(i.type);
+		for (std::size_t k = 0; k < i.operands.size(); ++k) {
+			os << (k ? ", [" : " [");
+			printValue(os, i.operands[k]);
+			if (i.block && k < i.block->preds.size())
+				os << ", b" << i.block->preds[k]->id;
+			os << ']';
+		}
+		return os;
+	case ir_call:
+		os << ' ' << getIRTypeName(i.type) << ' ';
+		printValue(os, i.operands[0]);
+		os << '(';
+		for (std::size_t k = 1; k < i.operands.size(); ++k) {
+			if (k > 1)
+				os << ", ";
+			printValue(os, i.operands[k]);
+		}
+		return os << ')';
+	default:
+		break;
+	}
+	if (i.type != irt_void)
+		os << ' ' << getIRTypeName(i.type);
+	for (std::size_t k = 0; k < i.operands.size(); ++k) {
+		os << (k ? ", " : " ");
+		printValue(os, i.operands[k]);
+	}
+	return os;
+}
+
+static void printSignature(std::ostream& os, const IRFunction& f)
+{
+	os << '@' << f.name << '(';
+	for (std::size_t k = 0; k < f.params.size(); ++k) {
+		if (k)
+			os << ", ";
+		os << getIRTypeName(f.params[k]);
+	}
+	os << ") -> " << getIRTypeName(f.result);
+}
+
+std::ostream& operator<<(std::ostream& os, const IRFunction& f)
+{
+	if (!f.isDefined()) {
+		os << "declare ";
+		printSignature(os, f);
+		return os << '\n';
+	}
+	os << "function ";
+	printSignature(os, f);
+	os << " {\n";
+	for (const IRBlock* b : f.blocks) {
+		os << 'b' << b->id << ':';
+		if (!b->preds.empty()) {
+			os << " ; preds";
+			for (std::size_t k = 0; k < b->preds.size(); ++k)
+				os << (k ? ", b" : " b") << b->preds[k]->id;
+		}
+		os << '\n';
+		for (const IRInstruction* i : b->instructions)
+			os << '\t' << *i << '\n';
+	}
+	return os << "}\n";
+}
+
+std::ostream& operator<<(std::ostream& os, const IRModule& m)
+{
+	for (const IRGlobal& g : m.globals) {
+		os << "global @" << g.name << " : " << getIRTypeName(g.type) << " = ";
+		if (g.type == irt_float)
+			os << g.real;
+		else if (g.type == irt_bool)
+			os << (g.integer ? "true" : "false");
+		else
+			os << g.integer;
+		os << '\n';
+	}
+	for (const auto& f : m.functions)
+		os << *f;
+	return os;
+}
\ No newline at end of file
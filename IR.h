@@ -0,0 +1,225 @@
+#pragma once
+#include "SmallVector.h"
+
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Type;
+struct ObjectDeclaration;
+struct FunctionDeclaration;
+
+// A small SSA form that sits between the checked tree and the backends.
+// Every value is the instruction that computes it. A block starts with its
+// phis and ends with exactly one terminator; the operands of a phi follow
+// the order of the block's predecessors.
+
+enum IRType {
+	irt_void,
+	irt_bool,
+	irt_char,
+	irt_int,
+	irt_float,
+	irt_ptr
+};
+
+IRType getIRType(const Type* t);
+
+const char* getIRTypeName(IRType t);
+
+enum IROpcode {
+	// Leaves
+	ir_const,
+	ir_param,
+	ir_global,
+	ir_function,
+
+	// Integer arithmetic; div, rem and shr are signed, and mulh gives the
+	// high half of the signed product of two ints
+	ir_add,
+	ir_sub,
+	ir_mul,
+	ir_div,
+	ir_rem,
+	ir_and,
+	ir_or,
+	ir_xor,
+	ir_shl,
+	ir_shr,
+	ir_mulh,
+	ir_neg,
+	ir_not,
+
+	// Floating point arithmetic
+	ir_fadd,
+	ir_fsub,
+	ir_fmul,
+	ir_fdiv,
+	ir_frem,
+	ir_fneg,
+
+	// Comparisons, giving bool. The plain ones are signed.
+	ir_eq,
+	ir_ne,
+	ir_lt,
+	ir_gt,
+	ir_le,
+	ir_ge,
+	ir_ult,
+	ir_ugt,
+	ir_ule,
+	ir_uge,
+	ir_feq,
+	ir_fne, // unordered
+	ir_flt,
+	ir_fgt,
+	ir_fle,
+	ir_fge,
+
+	// Conversions
+	ir_trunc,
+	ir_zext,
+	ir_itof,
+	ir_ftoi,
+
+	ir_load,
+	ir_store,
+	ir_call,
+	ir_phi,
+
+	// Terminators
+	ir_br,
+	ir_condbr,
+	ir_ret,
+	ir_unreachable
+};
+
+const char* getIROpcodeName(IROpcode op);
+
+struct IRBlock;
+struct IRFunction;
+struct IRModule;
+
+struct IRInstruction {
+	IRInstruction(unsigned n, IROpcode op, IRType t)
+		: id(n), op(op), type(t), block(nullptr), integer(0), real(0), targets{ nullptr, nullptr } {}
+
+	bool isTerminator() const { return op >= ir_br; }
+	bool isPhi() const { return op == ir_phi; }
+	bool isConstant() const { return op == ir_const; }
+	bool isCompare() const { return op >= ir_eq && op <= ir_fge; }
+	bool isBinary() const { return (op >= ir_add && op <= ir_mulh) || (op >= ir_fadd && op <= ir_frem) || isCompare(); }
+
+	// True when removing an unused instance would change the program.
+	bool hasSideEffects() const { return op == ir_store || op == ir_call || isTerminator(); }
+
+	// Dense number within the function, used to index side tables.
+	unsigned id;
+
+	IROpcode op;
+	IRType type;
+	IRBlock* block;
+
+	// The value of a bool, char or int constant, or the number of a
+	// parameter, global or function.
+	std::int64_t integer;
+
+	// The value of a float constant.
+	double real;
+
+	SmallVector<IRInstruction*, 2> operands;
+
+	// Branch targets.
+	IRBlock* targets[2];
+};
+
+using IRBlockList = SmallVector<IRBlock*, 2>;
+
+struct IRBlock {
+	IRBlock(IRFunction* f, unsigned n)
+		: parent(f), id(n) {}
+
+	IRInstruction* getTerminator() const;
+	IRBlockList getSuccessors() const;
+
+	// Where a new instruction that must precede everything but the phis
+	// goes.
+	std::size_t getFirstInsertionPoint() const;
+
+	IRFunction* parent;
+	unsigned id;
+	std::vector<IRInstruction*> instructions;
+	IRBlockList preds;
+};
+
+struct IRFunction {
+	IRFunction(IRModule* m, const std::string& n, IRType r)
+		: parent(m), name(n), result(r), source(nullptr), nextValue(0), nextBlock(0) {}
+
+	IRFunction(const IRFunction&) = delete;
+	IRFunction& operator=(const IRFunction&) = delete;
+
+	// A function whose body was never parsed has no blocks.
+	bool isDefined() const { return !blocks.empty(); }
+	IRBlock* getEntryBlock() const { return blocks.front(); }
+
+	// New instructions and blocks belong to the function but are not placed
+	// anywhere until they are added to a block or to the layout.
+	IRInstruction* make(IROpcode op, IRType t);
+	IRBlock* makeBlock();
+
+	// Upper bounds of the instruction and block numbers.
+	unsigned getValueCount() const { return nextValue; }
+	unsigned getBlockCount() const { return nextBlock; }
+
+	// Numbers the placed blocks and instructions in layout order.
+	void renumber();
+
+	IRModule* parent;
+	std::string name;
+	std::vector<IRType> params;
+	IRType result;
+	const FunctionDeclaration* source;
+
+	// The layout; the first block is the entry.
+	std::vector<IRBlock*> blocks;
+
+private:
+	std::deque<IRInstruction> values;
+	std::deque<IRBlock> pool;
+	unsigned nextValue;
+	unsigned nextBlock;
+};
+
+// Globals start out with a constant, zero unless initialized.
+struct IRGlobal {
+	// The bytes of the first value, as a load of the global reads them.
+	std::uint64_t getBits() const;
+
+	std::string name;
+	IRType type;
+	const ObjectDeclaration* source;
+
+	// The first value of a bool, char or int global, or of a float one.
+	std::int64_t integer;
+	double real;
+};
+
+struct IRModule {
+	IRFunction* makeFunction(const std::string& n, IRType r);
+
+	std::vector<IRGlobal> globals;
+	std::vector<std::unique_ptr<IRFunction>> functions;
+};
+
+// Checks the structure, types and dominance of the definitions, writing a
+// line for each problem. Returns true when there is none.
+bool verify(const IRFunction& f, std::ostream& os);
+bool verify(const IRModule& m, std::ostream& os);
+
+std::ostream& operator<<(std::ostream& os, const IRInstruction& i);
+std::ostream& operator<<(std::ostream& os, const IRFunction& f);
+std::ostream& operator<<(std::ostream& os, const IRModule& m);
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "stdafx.h"
+#include "IRAnalysis.h"
+
+#include <algorithm>
+#include <utility>
+
+IRDominators::IRDominators(const IRFunction& f)
+	: position(f.getBlockCount(), -1), idom(f.getBlockCount(), nullptr),
+	children(f.getBlockCount()), enter(f.getBlockCount()), leave(f.getBlockCount())
+{
+	if (!f.isDefined())
+		return;
+
+	// Postorder by a depth-first walk with its own stack.
+	std::vector<char> visited(f.getBlockCount());
+	std::vector<std::pair<IRBlock*, std::size_t>> stack;
+	IRBlock* entry = f.getEntryBlock();
+	visited[entry->id] = 1;
+	stack.push_back({ entry, 0 });
+	while (!stack.empty()) {
+		IRBlock* b = stack.back().first;
+		IRBlockList succs = b->getSuccessors();
+		std::size_t& next = stack.back().second;
+		if (next < succs.size()) {
+			IRBlock* s = succs[next++];
+			if (!visited[s->id]) {
+				visited[s->id] = 1;
+				stack.push_back({ s, 0 });
+			}
+			continue;
+		}
+		order.push_back(b);
+		stack.pop_back();
+	}
+	std::reverse(order.begin(), order.end());
+	for (std::size_t i = 0; i < order.size(); ++i)
+		position[order[i]->id] = static_cast<int>(i);
+
+	// Cooper, Harvey and Kennedy's iteration over the reverse postorder.
+	idom[entry->id] = entry;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (std::size_t i = 1; i < order.size(); ++i) {
+			IRBlock* b = order[i];
+			IRBlock* d = nullptr;
+			for (IRBlock* p : b->preds) {
+				if (!isReachable(p) || !idom[p->id])
+					continue;
+				d = d ? intersect(p, d) : p;
+			}
+			if (d != idom[b->id]) {
+				idom[b->id] = d;
+				changed = true;
+			}
+		}
+	}
+	idom[entry->id] = nullptr;
+
+	for (std::size_t i = 1; i < order.size(); ++i)
+		children[idom[order[i]->id]->id].push_back(order[i]);
+
+	// Number the tree so that dominance is a test of nested intervals.
+	unsigned n = 0;
+	stack.push_back({ entry, 0 });
+	enter[entry->id] = n++;
+	while (!stack.empty()) {
+		IRBlock* b = stack.back().first;
+		std::size_t& next = stack.back().second;
+		if (next < children[b->id].size()) {
+			IRBlock* c = children[b->id][next++];
+			enter[c->id] = n++;
+			stack.push_back({ c, 0 });
+			continue;
+		}
+		leave[b->id] = n++;
+		stack.pop_back();
+	}
+}
+
+IRBlock* IRDominators::intersect(IRBlock* a, IRBlock* b) const
+{
+	while (a != b) {
+		while (position[a->id] > position[b->id])
+			a = idom[a->id];
+		while (position[b->id] > position[a->id])
+			b = idom[b->id];
+	}
+	return a;
+}
+
+bool IRDominators::dominates(const IRBlock* a, const IRBlock* b) const
+{
+	if (!isReachable(a) || !isReachable(b))
+		return false;
+	return enter[a->id] <= enter[b->id] && leave[b->id] <= leave[a->id];
+}
+
+IRLoops::IRLoops(const IRFunction& f, const IRDominators& dom)
+	: innermost(f.getBlockCount(), nullptr)
+{
+	// Collect each body by walking back from the sources of the back edges.
+	std::vector<IRLoop> found;
+	std::vector<int> marks(f.getBlockCount(), -1);
+	for (IRBlock* h : dom.getOrder()) {
+		std::vector<IRBlock*> work;
+		for (IRBlock* p : h->preds) {
+			if (dom.dominates(h, p))
+				work.push_back(p);
+		}
+		if (work.empty())
+			continue;
+		int mark = static_cast<int>(found.size());
+		found.push_back({ h, { h }, nullptr, 0 });
+		marks[h->id] = mark;
+		while (!work.empty()) {
+			IRBlock* b = work.back();
+			work.pop_back();
+			if (marks[b->id] == mark || !dom.isReachable(b))
+				continue;
+			marks[b->id] = mark;
+			found.back().blocks.push_back(b);
+			for (IRBlock* p : b->preds)
+				work.push_back(p);
+		}
+	}
+
+	// Natural loops either nest or are disjoint, so a loop is contained in
+	// every larger loop that contains its header.
+	std::stable_sort(found.begin(), found.end(), [](const IRLoop& a, const IRLoop& b) {
+		return a.blocks.size() > b.blocks.size();
+	});
+	for (IRLoop& l : found) {
+		loops.push_back(std::move(l));
+		IRLoop* loop = &loops.back();
+		loop->parent = innermost[loop->header->id];
+		loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+		for (IRBlock* b : loop->blocks)
+			innermost[b->id] = loop;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+#include "IR.h"
+
+#include <deque>
+#include <vector>
+
+// The reverse postorder and dominator tree of the blocks reachable from
+// the entry of a function. Blocks are looked up by number, so the function
+// must not gain blocks while the analysis is in use.
+class IRDominators {
+public:
+	IRDominators(const IRFunction& f);
+
+	// Reachable blocks, each after all of its dominators.
+	const std::vector<IRBlock*>& getOrder() const { return order; }
+
+	bool isReachable(const IRBlock* b) const { return position[b->id] >= 0; }
+
+	// The entry has no immediate dominator.
+	IRBlock* getIdom(const IRBlock* b) const { return idom[b->id]; }
+
+	const std::vector<IRBlock*>& getChildren(const IRBlock* b) const { return children[b->id]; }
+
+	bool dominates(const IRBlock* a, const IRBlock* b) const;
+
+private:
+	IRBlock* intersect(IRBlock* a, IRBlock* b) const;
+
+	std::vector<IRBlock*> order;
+	std::vector<int> position;
+	std::vector<IRBlock*> idom;
+	std::vector<std::vector<IRBlock*>> children;
+
+	// Preorder and postorder numbers in the dominator tree.
+	std::vector<unsigned> enter;
+	std::vector<unsigned> leave;
+};
+
+// A natural loop: the header and the blocks that reach one of its back
+// edges without passing through the header, the header included.
+struct IRLoop {
+	IRBlock* header;
+	std::vector<IRBlock*> blocks;
+
+	// The innermost loop that contains this one.
+	IRLoop* parent;
+
+	// One for an outermost loop.
+	unsigned depth;
+};
+
+// The natural loops of a function. Back edges to the same header make up
+// a single loop.
+class IRLoops {
+public:
+	IRLoops(const IRFunction& f, const IRDominators& dom);
+
+	// Outer loops come before the loops they contain.
+	const std::deque<IRLoop>& getLoops() const { return loops; }
+
+	// The innermost loop that contains b, if any.
+	IRLoop* getLoop(const IRBlock* b) const { return innermost[b->id]; }
+
+	unsigned getDepth(const IRBlock* b) const { return innermost[b->id] ? innermost[b->id]->depth : 0; }
+
+private:
+	std::deque<IRLoop> loops;
+	std::vector<IRLoop*> innermost;
+};
\ No newline at end of file
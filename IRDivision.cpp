@@ -0,0 +1,162 @@
+#include "stdafx.h"
+#include "IRDivision.h"
+#include "Trace.h"
+
+#include <cstdint>
+#include <vector>
+
+// The multiplier and shift that divide by d, for 2 <= d < 2^31, from
+// Warren's Hacker's Delight, chapter 10. The multiplier may not fit in
+// an int, in which case it is stored less 2^32 and the dividend is added
+// back after the multiplication.
+struct IRMagic {
+	std::int32_t multiplier;
+	int shift;
+};
+
+static IRMagic getMagic(std::uint32_t d)
+{
+	const std::uint32_t two31 = 0x80000000u;
+	std::uint32_t anc = two31 - 1 - two31 % d;
+	int p = 31;
+	std::uint32_t q1 = two31 / anc;
+	std::uint32_t r1 = two31 - q1 * anc;
+	std::uint32_t q2 = two31 / d;
+	std::uint32_t r2 = two31 - q2 * d;
+	std::uint32_t delta;
+	do {
+		++p;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			++q1;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= d) {
+			++q2;
+			r2 -= d;
+		}
+		delta = d - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	return { static_cast<std::int32_t>(q2 + 1), p - 32 };
+}
+
+// Emits the replacement sequence for one division or remainder into a
+// list of instructions.
+class IRDivisionExpander {
+public:
+	IRDivisionExpander(IRFunction& f, IRBlock* b, std::vector<IRInstruction*>& out)
+		: fn(f), block(b), out(out) {}
+
+	IRInstruction* expand(const IRInstruction* i, std::int32_t d);
+
+private:
+	IRInstruction* emit(IROpcode op, IRInstruction* a, IRInstruction* b = nullptr);
+	IRInstruction* constant(std::int32_t v);
+
+	IRFunction& fn;
+	IRBlock* block;
+	std::vector<IRInstruction*>& out;
+};
+
+IRInstruction* IRDivisionExpander::emit(IROpcode op, IRInstruction* a, IRInstruction* b)
+{
+	IRInstruction* i = fn.make(op, irt_int);
+	i->block = block;
+	i->operands.push_back(a);
+	if (b)
+		i->operands.push_back(b);
+	out.push_back(i);
+	return i;
+}
+
+IRInstruction* IRDivisionExpander::constant(std::int32_t v)
+{
+	IRInstruction* i = fn.make(ir_const, irt_int);
+	i->block = block;
+	i->integer = v;
+	out.push_back(i);
+	return i;
+}
+
+// Division rounds toward zero, so a negative dividend is biased before an
+// arithmetic shift, or its quotient raised by one after the
+// multiplication, which rounds down.
+IRInstruction* IRDivisionExpander::expand(const IRInstruction* i, std::int32_t d)
+{
+	IRInstruction* n = i->operands[0];
+	std::uint32_t ad = d < 0 ? 0u - static_cast<std::uint32_t>(d) : static_cast<std::uint32_t>(d);
+	IRInstruction* sign = emit(ir_shr, n, constant(31));
+	IRInstruction* q;
+	if ((ad & (ad - 1)) == 0) {
+		int k = 0;
+		while ((1u << k) != ad)
+			++k;
+		IRInstruction* bias = emit(ir_and, sign, constant(static_cast<std::int32_t>(ad - 1)));
+		q = emit(ir_shr, emit(ir_add, n, bias), constant(k));
+	}
+	else {
+		IRMagic magic = getMagic(ad);
+		q = emit(ir_mulh, n, constant(magic.multiplier));
+		if (magic.multiplier < 0)
+			q = emit(ir_add, q, n);
+		if (magic.shift > 0)
+			q = emit(ir_shr, q, constant(magic.shift));
+		q = emit(ir_sub, q, sign);
+	}
+	if (d < 0)
+		q = emit(ir_neg, q);
+	if (i->op == ir_rem)
+		return emit(ir_sub, n, emit(ir_mul, q, constant(d)));
+	return q;
+}
+
+// Division by 0 and -1 can trap, and by INT_MIN has no magic number, so
+// those are left for the hardware.
+static bool isReducible(const IRInstruction* i)
+{
+	if ((i->op != ir_div && i->op != ir_rem) || i->type != irt_int || !i->operands[1]->isConstant())
+		return false;
+	std::int64_t d = i->operands[1]->integer;
+	return d >= 2 || (d <= -2 && d > INT32_MIN);
+}
+
+static void reduceDivisions(IRFunction& f)
+{
+	std::vector<IRInstruction*> replacement(f.getValueCount());
+	bool any = false;
+	for (IRBlock* b : f.blocks) {
+		std::vector<IRInstruction*> kept;
+		for (IRInstruction* i : b->instructions) {
+			if (!isReducible(i)) {
+				kept.push_back(i);
+				continue;
+			}
+			IRDivisionExpander x(f, b, kept);
+			replacement[i->id] = x.expand(i, static_cast<std::int32_t>(i->operands[1]->integer));
+			any = true;
+		}
+		b->instructions = kept;
+	}
+	if (!any)
+		return;
+
+	for (IRBlock* b : f.blocks) {
+		for (IRInstruction* i : b->instructions) {
+			for (IRInstruction*& op : i->operands) {
+				if (op->id < replacement.size() && replacement[op->id])
+					op = replacement[op->id];
+			}
+		}
+	}
+	f.renumber();
+}
+
+void reduceDivisions(IRModule& m)
+{
+	TraceSpan span("reduceDivisions");
+	for (const auto& f : m.functions)
+		reduceDivisions(*f);
+}
\ No newline at end of file
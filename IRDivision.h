@@ -0,0 +1,6 @@
+#pragma once
+#include "IR.h"
+
+// Replaces int division and remainder by constants with multiplications,
+// shifts and adds, which take a few cycles where idiv takes dozens.
+void reduceDivisions(IRModule& m);
\ No newline at end of file
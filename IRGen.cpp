@@ -0,0 +1,987 @@
+#include "stdafx.h"
+#include "IRGen.h"
+#include "Type.h"
+#include "Expression.h"
+#include "Statement.h"
+#include "Declaration.h"
+#include "Visitor.h"
+#include "Trace.h"
+#include "ConstantEvaluator.h"
+
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Where a global declaration went in the module.
+struct IRSymbol {
+	IROpcode op;
+	unsigned index;
+};
+
+// The result of lowering an expression. A reference to a local names the
+// variable instead of producing a value; a reference to a global is its
+// address.
+struct IRResult {
+	IRInstruction* value;
+	const Declaration* local;
+};
+
+// Builds the body of one function. Variables are put in SSA form while the
+// blocks are generated, following Braun et al., "Simple and Efficient
+// Construction of Static Single Assignment Form": a read looks for the
+// definition in the current block and then in its predecessors, placing
+// phis where paths join. A block is sealed once all of its predecessors are
+// known; phis placed in it before then get their operands when it is.
+class IRFunctionBuilder {
+public:
+	IRFunctionBuilder(IRFunction& f, const std::vector<IRSymbol>& s);
+
+	void define();
+
+	IRBlock* getCurrentBlock() const { return current; }
+	IRBlock* makeBlock();
+	void emitBlock(IRBlock* b);
+	bool isTerminated() const { return current->getTerminator(); }
+
+	IRInstruction* emit(IROpcode op, IRType t);
+	IRInstruction* emit(IROpcode op, IRType t, IRInstruction* a);
+	IRInstruction* emit(IROpcode op, IRType t, IRInstruction* a, IRInstruction* b);
+	IRInstruction* constant(IRType t, std::int64_t v);
+	IRInstruction* constant(double v);
+	IRInstruction* zero(IRType t);
+	IRInstruction* phi(IRBlock* b, IRType t);
+
+	void branch(IRBlock* b);
+	void branchTo(IRBlock* b);
+	void condBranch(IRInstruction* c, IRBlock* pass, IRBlock* fail);
+
+	// Starts a block for the code that follows a jump. Nothing reaches it,
+	// so it is removed once the body is done.
+	void emitDeadBlock();
+
+	// Variables
+	void declare(const ObjectDeclaration* d);
+	void write(unsigned var, IRBlock* b, IRInstruction* v);
+	IRInstruction* read(unsigned var, IRBlock* b);
+	void seal(IRBlock* b);
+
+	IRInstruction* readPlace(IRResult r, IRType t);
+	void writePlace(IRResult r, IRInstruction* v);
+
+	// Expressions are lowered by a walker with its own stack; the functions
+	// below handle a single node whose operands are done.
+	IRResult lowerExpression(const Expression* e);
+	IRInstruction* lowerValue(const Expression* e);
+	IRResult lowerId(const IdExpression* e);
+	IRInstruction* lowerUnop(const UnopExpression* e, IRInstruction* v);
+	IRInstruction* lowerBinop(const BinopExpression* e, IRInstruction* v1, IRInstruction* v2);
+	IRResult lowerConversion(const ConversionExpression* e, IRResult r);
+
+	void lowerStatement(const Statement* s);
+	void lowerDeclaration(const Declaration* d);
+
+	// Branch targets of the enclosing while statements.
+	struct Loop {
+		IRBlock* head;
+		IRBlock* exit;
+	};
+
+	std::vector<Loop> loops;
+
+private:
+	void addPhiOperands(unsigned var, IRInstruction* phi);
+	void removeUnreachableBlocks();
+	void removeTrivialPhis();
+
+	static std::uint64_t key(unsigned var, const IRBlock* b) {
+		return static_cast<std::uint64_t>(b->id) << 32 | var;
+	}
+
+	IRFunction& fn;
+	const std::vector<IRSymbol>& symbols;
+	IRBlock* current;
+
+	// Indexed by the numbers given to parameters and locals during
+	// semantic analysis.
+	std::vector<IRType> types;
+
+	// The value of each variable at the end of each block that defines or
+	// has looked it up.
+	std::unordered_map<std::uint64_t, IRInstruction*> definitions;
+
+	// By type.
+	IRInstruction* zeros[irt_ptr + 1];
+
+	// Phis waiting for a block to be sealed, by block.
+	std::vector<char> sealed;
+	std::unordered_map<unsigned, std::vector<std::pair<unsigned, IRInstruction*>>> incomplete;
+};
+
+IRFunctionBuilder::IRFunctionBuilder(IRFunction& f, const std::vector<IRSymbol>& s)
+	: fn(f), symbols(s), current(nullptr), types(f.source->getLocalCount(), irt_void), zeros() {}
+
+IRBlock* IRFunctionBuilder::makeBlock()
+{
+	IRBlock* b = fn.makeBlock();
+	sealed.resize(fn.getBlockCount());
+	return b;
+}
+
+void IRFunctionBuilder::emitBlock(IRBlock* b)
+{
+	fn.blocks.push_back(b);
+	current = b;
+}
+
+IRInstruction* IRFunctionBuilder::emit(IROpcode op, IRType t)
+{
+	IRInstruction* i = fn.make(op, t);
+	i->block = current;
+	current->instructions.push_back(i);
+	return i;
+}
+
+IRInstruction* IRFunctionBuilder::emit(IROpcode op, IRType t, IRInstruction* a)
+{
+	IRInstruction* i = emit(op, t);
+	i->operands.push_back(a);
+	return i;
+}
+
+IRInstruction* IRFunctionBuilder::emit(IROpcode op, IRType t, IRInstruction* a, IRInstruction* b)
+{
+	IRInstruction* i = emit(op, t);
+	i->operands.push_back(a);
+	i->operands.push_back(b);
+	return i;
+}
+
+IRInstruction* IRFunctionBuilder::constant(IRType t, std::int64_t v)
+{
+	IRInstruction* i = emit(ir_const, t);
+	i->integer = t == irt_bool ? v != 0 : v;
+	return i;
+}
+
+IRInstruction* IRFunctionBuilder::constant(double v)
+{
+	// Floats are single precision, as in the LLVM lowering.
+	IRInstruction* i = emit(ir_const, irt_float);
+	i->real = static_cast<float>(v);
+	return i;
+}
+
+// The value of a variable read where no assignment reaches, which happens
+// only in code that cannot run. It goes first in the entry block so that it
+// is available everywhere, and is shared by all such reads.
+IRInstruction* IRFunctionBuilder::zero(IRType t)
+{
+	if (zeros[t])
+		return zeros[t];
+	IRInstruction* i = fn.make(ir_const, t);
+	zeros[t] = i;
+	IRBlock* entry = fn.getEntryBlock();
+	i->block = entry;
+	entry->instructions.insert(entry->instructions.begin(), i);
+	return i;
+}
+
+IRInstruction* IRFunctionBuilder::phi(IRBlock* b, IRType t)
+{
+	IRInstruction* i = fn.make(ir_phi, t);
+	i->block = b;
+	b->instructions.insert(b->instructions.begin() + b->getFirstInsertionPoint(), i);
+	return i;
+}
+
+void IRFunctionBuilder::branch(IRBlock* b)
+{
+	IRInstruction* i = emit(ir_br, irt_void);
+	i->targets[0] = b;
+	b->preds.push_back(current);
+}
+
+// Falls through to b unless the current block already ends in a jump.
+void IRFunctionBuilder::branchTo(IRBlock* b)
+{
+	if (!isTerminated())
+		branch(b);
+}
+
+void IRFunctionBuilder::condBranch(IRInstruction* c, IRBlock* pass, IRBlock* fail)
+{
+	IRInstruction* i = emit(ir_condbr, irt_void, c);
+	i->targets[0] = pass;
+	i->targets[1] = fail;
+	pass->preds.push_back(current);
+	fail->preds.push_back(current);
+}
+
+void IRFunctionBuilder::emitDeadBlock()
+{
+	IRBlock* b = makeBlock();
+	seal(b);
+	emitBlock(b);
+}
+
+void IRFunctionBuilder::declare(const ObjectDeclaration* d)
+{
+	assert(d->isLocal());
+	types[d->getIndex()] = getIRType(d->getType()->getObjectType());
+}
+
+void IRFunctionBuilder::write(unsigned var, IRBlock* b, IRInstruction* v)
+{
+	definitions[key(var, b)] = v;
+}
+
+// A lookup that passes through a block on its way to the definition.
+// Blocks with one predecessor forward the result; blocks that join paths
+// get a phi and look in each predecessor in turn. The frames are kept on a
+// stack of their own, since a lookup can pass through every block of a long
+// function.
+struct IRLookup {
+	IRBlock* block;
+	IRInstruction* phi;
+	std::size_t next;
+};
+
+IRInstruction* IRFunctionBuilder::read(unsigned var, IRBlock* b)
+{
+	auto found = definitions.find(key(var, b));
+	if (found != definitions.end())
+		return found->second;
+
+	std::vector<IRLookup> stack;
+	stack.push_back({ b, nullptr, 0 });
+	IRInstruction* result = nullptr;
+	while (true) {
+		IRLookup& l = stack.back();
+		if (!result) {
+			// Starting a lookup in l.block, or asking the next predecessor
+			// of a join.
+			if (l.phi) {
+				IRBlock* p = l.block->preds[l.next];
+				auto d = definitions.find(key(var, p));
+				if (d != definitions.end()) {
+					result = d->second;
+				}
+				else {
+					stack.push_back({ p, nullptr, 0 });
+				}
+				continue;
+			}
+			IRBlock* lb = l.block;
+			if (!sealed[lb->id]) {
+				result = phi(lb, types[var]);
+				incomplete[lb->id].push_back({ var, result });
+			}
+			else if (lb->preds.empty()) {
+				result = zero(types[var]);
+			}
+			else if (lb->preds.size() == 1) {
+				IRBlock* p = lb->preds[0];
+				auto d = definitions.find(key(var, p));
+				if (d != definitions.end()) {
+					result = d->second;
+				}
+				else {
+					// Forward: the result is recorded for lb on the way back.
+					l.next = 1;
+					stack.push_back({ p, nullptr, 0 });
+					continue;
+				}
+			}
+			else {
+				// Define the phi before visiting the predecessors to end the
+				// search around loops.
+				l.phi = phi(lb, types[var]);
+				write(var, lb, l.phi);
+				continue;
+			}
+			write(var, lb, result);
+			stack.pop_back();
+			if (stack.empty())
+				return result;
+			continue;
+		}
+
+		// Deliver result to the lookup on top of the stack.
+		if (l.phi) {
+			l.phi->operands.push_back(result);
+			if (++l.next < l.block->preds.size()) {
+				result = nullptr;
+				continue;
+			}
+			result = l.phi;
+		}
+		write(var, l.block, result);
+		stack.pop_back();
+		if (stack.empty())
+			return result;
+	}
+}
+
+void IRFunctionBuilder::addPhiOperands(unsigned var, IRInstruction* phi)
+{
+	for (IRBlock* p : phi->block->preds)
+		phi->operands.push_back(read(var, p));
+}
+
+void IRFunctionBuilder::seal(IRBlock* b)
+{
+	sealed[b->id] = 1;
+	auto found = incomplete.find(b->id);
+	if (found == incomplete.end())
+		return;
+	std::vector<std::pair<unsigned, IRInstruction*>> phis = std::move(found->second);
+	incomplete.erase(found);
+	for (const auto& p : phis)
+		addPhiOperands(p.first, p.second);
+}
+
+IRInstruction* IRFunctionBuilder::readPlace(IRResult r, IRType t)
+{
+	if (r.local)
+		return read(r.local->getIndex(), current);
+	return emit(ir_load, t, r.value);
+}
+
+void IRFunctionBuilder::writePlace(IRResult r, IRInstruction* v)
+{
+	if (r.local)
+		write(r.local->getIndex(), current, v);
+	else
+		emit(ir_store, irt_void, r.value, v);
+}
+
+void IRFunctionBuilder::define()
+{
+	TraceSpan span("IRFunctionBuilder::define", fn.name);
+	const FunctionDeclaration* f = fn.source;
+	IRBlock* entry = makeBlock();
+	seal(entry);
+	emitBlock(entry);
+
+	const DeclarationList& params = f->getParameters();
+	for (std::size_t k = 0; k < params.size(); ++k) {
+		const ParameterDeclaration* param = cast<ParameterDeclaration>(params[k]);
+		declare(param);
+		IRInstruction* v = emit(ir_param, fn.params[k]);
+		v->integer = k;
+		write(param->getIndex(), entry, v);
+	}
+
+	lowerStatement(f->getBody());
+
+	// Control can reach the end of a function only when a return was
+	// missed; the checker does not diagnose that yet.
+	if (!isTerminated())
+		emit(ir_unreachable, irt_void);
+
+	removeUnreachableBlocks();
+	removeTrivialPhis();
+	fn.renumber();
+}
+
+// Drops the blocks that follow jumps, along with the edges and phi operands
+// that come from them.
+void IRFunctionBuilder::removeUnreachableBlocks()
+{
+	std::vector<char> live(fn.getBlockCount());
+	std::vector<IRBlock*> work{ fn.getEntryBlock() };
+	live[fn.getEntryBlock()->id] = 1;
+	while (!work.empty()) {
+		IRBlock* b = work.back();
+		work.pop_back();
+		for (IRBlock* s : b->getSuccessors()) {
+			if (!live[s->id]) {
+				live[s->id] = 1;
+				work.push_back(s);
+			}
+		}
+	}
+
+	std::vector<IRBlock*> layout;
+	for (IRBlock* b : fn.blocks) {
+		if (!live[b->id])
+			continue;
+		layout.push_back(b);
+		IRBlockList preds;
+		std::vector<std::size_t> kept;
+		for (std::size_t k = 0; k < b->preds.size(); ++k) {
+			if (live[b->preds[k]->id]) {
+				preds.push_back(b->preds[k]);
+				kept.push_back(k);
+			}
+		}
+		if (preds.size() == b->preds.size())
+			continue;
+		for (IRInstruction* i : b->instructions) {
+			if (!i->isPhi())
+				break;
+			SmallVector<IRInstruction*, 2> ops;
+			for (std::size_t k : kept)
+				ops.push_back(i->operands[k]);
+			i->operands = ops;
+		}
+		b->preds = preds;
+	}
+	fn.blocks = layout;
+}
+
+// Replaces the phis whose operands are all the same value, or the phi
+// itself, with that value. Removing one can make others trivial, so this
+// repeats until nothing changes.
+void IRFunctionBuilder::removeTrivialPhis()
+{
+	std::vector<IRInstruction*> replacement(fn.getValueCount());
+	auto resolve = [&](IRInstruction* v) {
+		while (v->id < replacement.size() && replacement[v->id])
+			v = replacement[v->id];
+		return v;
+	};
+
+	bool changed = true;
+	bool any = false;
+	while (changed) {
+		changed = false;
+		for (IRBlock* b : fn.blocks) {
+			for (IRInstruction* i : b->instructions) {
+				if (!i->isPhi())
+					break;
+				if (replacement[i->id])
+					continue;
+				IRInstruction* same = nullptr;
+				bool trivial = true;
+				for (IRInstruction* op : i->operands) {
+					IRInstruction* v = resolve(op);
+					if (v == i || v == same)
+						continue;
+					if (same) {
+						trivial = false;
+						break;
+					}
+					same = v;
+				}
+				if (!trivial)
+					continue;
+				replacement[i->id] = same ? same : zero(i->type);
+				changed = any = true;
+			}
+		}
+	}
+	if (!any)
+		return;
+
+	for (IRBlock* b : fn.blocks) {
+		std::vector<IRInstruction*> kept;
+		for (IRInstruction* i : b->instructions) {
+			if (i->id < replacement.size() && replacement[i->id])
+				continue;
+			for (IRInstruction*& op : i->operands)
+				op = resolve(op);
+			kept.push_back(i);
+		}
+		b->instructions = kept;
+	}
+}
+
+// An expression whose operands are being lowered by the expression walker.
+// Stage counts the operands lowered so far; the blocks are used by
+// operators that introduce control flow.
+struct IRExpressionTask {
+	const Expression* expr;
+	int stage;
+	IRInstruction* value;
+	IRBlock* block;
+	IRBlock* join;
+};
+
+// Lowers an expression with its own stack of tasks, in the same way as the
+// walkers of the LLVM lowering.
+class IRExpressionWalker : public ExpressionVisitor<IRExpressionWalker> {
+public:
+	IRExpressionWalker(IRFunctionBuilder& f)
+		: fn(f), i(0), stage(0) {}
+
+	IRResult run(const Expression* e) {
+		tasks.push_back({ e, 0, nullptr, nullptr, nullptr });
+		while (!tasks.empty()) {
+			i = tasks.size() - 1;
+			stage = tasks[i].stage++;
+			visit(tasks[i].expr);
+		}
+		assert(values.size() == 1);
+		return values.back();
+	}
+
+	void visitBoolExpression(const BoolExpression* e) {
+		finish(fn.constant(irt_bool, e->getValue()));
+	}
+
+	void visitIntExpression(const IntExpression* e) {
+		finish(fn.constant(irt_int, e->getValue()));
+	}
+
+	void visitFloatExpression(const FloatExpression* e) {
+		finish(fn.constant(e->getValue()));
+	}
+
+	void visitIdExpression(const IdExpression* e) {
+		values.push_back(fn.lowerId(e));
+		tasks.pop_back();
+	}
+
+	void visitUnopExpression(const UnopExpression* u) {
+		if (stage == 0) {
+			return operand(u->getOperand());
+		}
+		IRInstruction* v = pop();
+		finish(fn.lowerUnop(u, v));
+	}
+
+	void visitBinopExpression(const BinopExpression* b) {
+		binop op = b->getOperator();
+		if (op == bo_land || op == bo_lor) {
+			return logical(b, op);
+		}
+		if (stage == 0) {
+			return operand(b->getLHS());
+		}
+		if (stage == 1) {
+			return operand(b->getRHS());
+		}
+		IRInstruction* v2 = pop();
+		IRInstruction* v1 = pop();
+		finish(fn.lowerBinop(b, v1, v2));
+	}
+
+	// Evaluates the right operand only when the left one does not decide
+	// the result, then merges both paths.
+	void logical(const BinopExpression* b, binop op) {
+		if (stage == 0) {
+			return operand(b->getLHS());
+		}
+		if (stage == 1) {
+			IRInstruction* v1 = pop();
+			IRBlock* rhs = fn.makeBlock();
+			IRBlock* join = fn.makeBlock();
+			tasks[i].value = fn.constant(irt_bool, op == bo_lor);
+			if (op == bo_land) {
+				fn.condBranch(v1, rhs, join);
+			}
+			else {
+				fn.condBranch(v1, join, rhs);
+			}
+			tasks[i].join = join;
+			fn.seal(rhs);
+			fn.emitBlock(rhs);
+			return operand(b->getRHS());
+		}
+		IRInstruction* v2 = pop();
+		fn.branch(tasks[i].join);
+		fn.emitBlock(tasks[i].join);
+		fn.seal(tasks[i].join);
+		IRInstruction* phi = fn.phi(tasks[i].join, irt_bool);
+		phi->operands.push_back(tasks[i].value);
+		phi->operands.push_back(v2);
+		finish(phi);
+	}
+
+	void visitCallExpression(const CallExpression* c) {
+		const ExpressionList& args = c->getArguments();
+		if (stage == 0) {
+			return operand(c->getCallee());
+		}
+		if (stage <= static_cast<int>(args.size())) {
+			return operand(args[stage - 1]);
+		}
+		IRInstruction* call = fn.emit(ir_call, getIRType(c->getType()));
+		call->operands.resize(args.size() + 1);
+		for (std::size_t k = args.size() + 1; k-- > 0;)
+			call->operands[k] = pop();
+		finish(call);
+	}
+
+	// The checker has already converted the operand.
+	void visitCastExpression(const CastExpression* c) {
+		if (stage == 0) {
+			return operand(c->source);
+		}
+		tasks.pop_back();
+	}
+
+	void visitAssignmentExpression(const AssignmentExpression* a) {
+		if (stage == 0) {
+			return operand(a->getLHS());
+		}
+		if (stage == 1) {
+			return operand(a->getRHS());
+		}
+		IRInstruction* v = pop();
+		IRResult ref = values.back();
+		fn.writePlace(ref, v);
+		tasks.pop_back();
+	}
+
+	void visitConditionalExpression(const ConditionalExpression* c) {
+		if (stage == 0) {
+			if (c->getType()->isReference()) {
+				throw std::logic_error("Unsupported expression");
+			}
+			return operand(c->getCondition());
+		}
+		if (stage == 1) {
+			IRInstruction* v = pop();
+			IRBlock* pass = fn.makeBlock();
+			IRBlock* fail = fn.makeBlock();
+			tasks[i].block = fail;
+			tasks[i].join = fn.makeBlock();
+			fn.condBranch(v, pass, fail);
+			fn.seal(pass);
+			fn.seal(fail);
+			fn.emitBlock(pass);
+			return operand(c->getPassValue());
+		}
+		if (stage == 2) {
+			tasks[i].value = pop();
+			fn.branch(tasks[i].join);
+			fn.emitBlock(tasks[i].block);
+			return operand(c->getFailValue());
+		}
+		IRInstruction* v2 = pop();
+		fn.branch(tasks[i].join);
+		fn.emitBlock(tasks[i].join);
+		fn.seal(tasks[i].join);
+		IRInstruction* phi = fn.phi(tasks[i].join, v2->type);
+		phi->operands.push_back(tasks[i].value);
+		phi->operands.push_back(v2);
+		finish(phi);
+	}
+
+	void visitConversionExpression(const ConversionExpression* c) {
+		if (stage == 0) {
+			return operand(c->getSource());
+		}
+		IRResult r = values.back();
+		values.pop_back();
+		values.push_back(fn.lowerConversion(c, r));
+		tasks.pop_back();
+	}
+
+	void visitExpression(const Expression*) {
+		throw std::logic_error("Unsupported expression");
+	}
+
+private:
+	void operand(const Expression* e) {
+		tasks.push_back({ e, 0, nullptr, nullptr, nullptr });
+	}
+
+	void finish(IRInstruction* v) {
+		values.push_back({ v, nullptr });
+		tasks.pop_back();
+	}
+
+	IRInstruction* pop() {
+		IRInstruction* v = values.back().value;
+		values.pop_back();
+		return v;
+	}
+
+	IRFunctionBuilder& fn;
+	std::vector<IRExpressionTask> tasks;
+	std::vector<IRResult> values;
+	std::size_t i;
+	int stage;
+};
+
+IRResult IRFunctionBuilder::lowerExpression(const Expression* e)
+{
+	return IRExpressionWalker(*this).run(e);
+}
+
+// The checker leaves some operands that need a value as references, such
+// as returned names and initializers, so those are read here.
+IRInstruction* IRFunctionBuilder::lowerValue(const Expression* e)
+{
+	IRResult r = lowerExpression(e);
+	if (e->getType()->isReference())
+		return readPlace(r, getIRType(e->getType()->getObjectType()));
+	return r.value;
+}
+
+IRResult IRFunctionBuilder::lowerId(const IdExpression* e)
+{
+	const Declaration* d = e->getDeclaration();
+	if (d->isLocal()) {
+		if (e->getType()->isReference())
+			return { nullptr, d };
+		return { read(d->getIndex(), current), nullptr };
+	}
+	const IRSymbol& s = symbols[d->getIndex()];
+	IRInstruction* v = emit(s.op, irt_ptr);
+	v->integer = s.index;
+	if (s.op == ir_function || e->getType()->isReference())
+		return { v, nullptr };
+	return { emit(ir_load, getIRType(e->getType()), v), nullptr };
+}
+
+IRInstruction* IRFunctionBuilder::lowerUnop(const UnopExpression* e, IRInstruction* v)
+{
+	switch (e->getOperator()) {
+	case uo_pos:
+		return v;
+	case uo_neg:
+		if (e->isFloat()) {
+			return emit(ir_fneg, irt_float, v);
+		}
+		return emit(ir_neg, v->type, v);
+	case uo_cmp:
+	case uo_not:
+		return emit(ir_not, v->type, v);
+	default:
+		throw std::logic_error("Unsupported operator");
+	}
+}
+
+IRInstruction* IRFunctionBuilder::lowerBinop(const BinopExpression* e, IRInstruction* v1, IRInstruction* v2)
+{
+	static const IROpcode integers[] = { ir_add, ir_sub, ir_mul, ir_div, ir_rem, ir_and, ir_or, ir_xor, ir_shl, ir_shr };
+	static const IROpcode floats[] = { ir_fadd, ir_fsub, ir_fmul, ir_fdiv, ir_frem };
+	static const IROpcode signedCompares[] = { ir_eq, ir_ne, ir_lt, ir_gt, ir_le, ir_ge };
+	static const IROpcode unsignedCompares[] = { ir_eq, ir_ne, ir_ult, ir_ugt, ir_ule, ir_uge };
+	static const IROpcode floatCompares[] = { ir_feq, ir_fne, ir_flt, ir_fgt, ir_fle, ir_fge };
+
+	binop op = e->getOperator();
+	const Expression* lhs = e->getLHS();
+	if (op >= bo_eq && op <= bo_ge) {
+		if (lhs->isFloat())
+			return emit(floatCompares[op - bo_eq], irt_bool, v1, v2);
+		if (lhs->isInt())
+			return emit(signedCompares[op - bo_eq], irt_bool, v1, v2);
+		return emit(unsignedCompares[op - bo_eq], irt_bool, v1, v2);
+	}
+	if (lhs->isFloat()) {
+		if (op > bo_rem)
+			throw std::logic_error("Invalid operator");
+		return emit(floats[op], irt_float, v1, v2);
+	}
+	if (op > bo_shr)
+		throw std::logic_error("Invalid operator");
+	return emit(integers[op], v1->type, v1, v2);
+}
+
+IRResult IRFunctionBuilder::lowerConversion(const ConversionExpression* e, IRResult r)
+{
+	IRType t = getIRType(e->getType());
+	IRInstruction* v = r.value;
+	switch (e->getConversion()) {
+	case conv_identity:
+		return r;
+	case conv_value:
+		return { readPlace(r, t), nullptr };
+	case conv_bool:
+		if (v->type == irt_float) {
+			return { emit(ir_fne, irt_bool, v, constant(0.0)), nullptr };
+		}
+		return { emit(ir_ne, irt_bool, v, constant(v->type, 0)), nullptr };
+	case conv_char:
+		return { emit(ir_trunc, t, v), nullptr };
+	case conv_int:
+		return { emit(ir_zext, t, v), nullptr };
+	case conv_ext:
+		return { emit(ir_itof, t, v), nullptr };
+	case conv_trunc:
+		return { emit(ir_ftoi, t, v), nullptr };
+	}
+	throw std::logic_error("Invalid conversion");
+}
+
+// A statement whose sub-statements are being lowered by the statement
+// walker. Stage counts the sub-statements started so far.
+struct IRStatementTask {
+	const Statement* stmt;
+	std::size_t stage;
+	IRBlock* next;
+	IRBlock* join;
+};
+
+class IRStatementWalker : public StatementVisitor<IRStatementWalker> {
+public:
+	IRStatementWalker(IRFunctionBuilder& f)
+		: fn(f), i(0), stage(0) {}
+
+	void run(const Statement* s) {
+		tasks.push_back({ s, 0, nullptr, nullptr });
+		while (!tasks.empty()) {
+			i = tasks.size() - 1;
+			stage = tasks[i].stage++;
+			visit(tasks[i].stmt);
+		}
+	}
+
+	void visitBlockStatement(const BlockStatement* b) {
+		const StatementList& stmts = b->getStatements();
+		if (stage < stmts.size()) {
+			return tasks.push_back({ stmts[stage], 0, nullptr, nullptr });
+		}
+		tasks.pop_back();
+	}
+
+	void visitWhenStatement(const WhenStatement* w) {
+		if (stage == 0) {
+			IRInstruction* c = fn.lowerValue(w->getCondition());
+			IRBlock* pass = fn.makeBlock();
+			tasks[i].join = fn.makeBlock();
+			fn.condBranch(c, pass, tasks[i].join);
+			fn.seal(pass);
+			fn.emitBlock(pass);
+			return tasks.push_back({ w->getBody(), 0, nullptr, nullptr });
+		}
+		fn.branchTo(tasks[i].join);
+		fn.seal(tasks[i].join);
+		fn.emitBlock(tasks[i].join);
+		tasks.pop_back();
+	}
+
+	void visitIfStatement(const IfStatement* f) {
+		if (stage == 0) {
+			IRInstruction* c = fn.lowerValue(f->getCondition());
+			IRBlock* pass = fn.makeBlock();
+			tasks[i].next = fn.makeBlock();
+			tasks[i].join = fn.makeBlock();
+			fn.condBranch(c, pass, tasks[i].next);
+			fn.seal(pass);
+			fn.seal(tasks[i].next);
+			fn.emitBlock(pass);
+			return tasks.push_back({ f->getPassValue(), 0, nullptr, nullptr });
+		}
+		fn.branchTo(tasks[i].join);
+		if (stage == 1) {
+			fn.emitBlock(tasks[i].next);
+			return tasks.push_back({ f->getFailValue(), 0, nullptr, nullptr });
+		}
+		fn.seal(tasks[i].join);
+		fn.emitBlock(tasks[i].join);
+		tasks.pop_back();
+	}
+
+	// The head is sealed only after the body, when the back edges are known.
+	void visitWhileStatement(const WhileStatement* w) {
+		if (stage == 0) {
+			IRBlock* head = fn.makeBlock();
+			IRBlock* body = fn.makeBlock();
+			IRBlock* exit = fn.makeBlock();
+			fn.branch(head);
+			fn.emitBlock(head);
+			IRInstruction* c = fn.lowerValue(w->getCondition());
+			fn.condBranch(c, body, exit);
+			fn.seal(body);
+			fn.emitBlock(body);
+			fn.loops.push_back({ head, exit });
+			return tasks.push_back({ w->getBody(), 0, nullptr, nullptr });
+		}
+		IRFunctionBuilder::Loop loop = fn.loops.back();
+		fn.loops.pop_back();
+		fn.branchTo(loop.head);
+		fn.seal(loop.head);
+		fn.seal(loop.exit);
+		fn.emitBlock(loop.exit);
+		tasks.pop_back();
+	}
+
+	void visitBreakStatement(const BreakStatement*) {
+		fn.branch(fn.loops.back().exit);
+		fn.emitDeadBlock();
+		tasks.pop_back();
+	}
+
+	void visitContinueStatement(const ContinueStatement*) {
+		fn.branch(fn.loops.back().head);
+		fn.emitDeadBlock();
+		tasks.pop_back();
+	}
+
+	void visitReturnStatement(const ReturnStatement* s) {
+		IRInstruction* v = fn.lowerValue(s->getValue());
+		fn.emit(ir_ret, irt_void, v);
+		fn.emitDeadBlock();
+		tasks.pop_back();
+	}
+
+	void visitDeclareStatement(const DeclareStatement* s) {
+		fn.lowerDeclaration(s->getDeclaration());
+		tasks.pop_back();
+	}
+
+	void visitExpressionStatement(const ExpressionStatement* s) {
+		fn.lowerExpression(s->getExpression());
+		tasks.pop_back();
+	}
+
+	void visitStatement(const Statement*) {
+		throw std::logic_error("Unsupported statement");
+	}
+
+private:
+	IRFunctionBuilder& fn;
+	std::vector<IRStatementTask> tasks;
+	std::size_t i;
+	std::size_t stage;
+};
+
+void IRFunctionBuilder::lowerStatement(const Statement* s)
+{
+	IRStatementWalker(*this).run(s);
+}
+
+void IRFunctionBuilder::lowerDeclaration(const Declaration* d)
+{
+	const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d);
+	if (!o) {
+		throw std::logic_error("Invalid local declaration");
+	}
+	declare(o);
+	IRType t = types[o->getIndex()];
+	IRInstruction* v = o->getInit() ? lowerValue(o->getInit()) : zero(t);
+	write(o->getIndex(), current, v);
+}
+
+std::unique_ptr<IRModule> lowerProgram(const ProgramDeclaration* p)
+{
+	TraceSpan span("lowerProgram");
+	std::unique_ptr<IRModule> m(new IRModule());
+
+	// Indexed by the numbers given to globals during semantic analysis.
+	std::vector<IRSymbol> symbols(p->getGlobalCount(), { ir_global, 0 });
+	for (const Declaration* d : p->getDeclarations()) {
+		if (const FunctionDeclaration* f = dyn_cast<FunctionDeclaration>(d)) {
+			IRFunction* fn = m->makeFunction(*f->getName(), getIRType(f->getReturnType()));
+			fn->source = f;
+			for (const Declaration* param : f->getParameters())
+				fn->params.push_back(getIRType(cast<ParameterDeclaration>(param)->getType()));
+			symbols[f->getIndex()] = { ir_function, static_cast<unsigned>(m->functions.size() - 1) };
+		}
+		else if (const ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(d)) {
+			// The checker requires the initializers of globals to be
+			// constants.
+			ConstantValue v = { Type::int_kind, 0, 0 };
+			if (o->getInit() && !evaluateConstant(o->getInit(), v))
+				throw std::logic_error("Invalid global initializer");
+			m->globals.push_back({ *o->getName(), getIRType(o->getType()->getObjectType()), o, v.integer, v.real });
+			symbols[o->getIndex()] = { ir_global, static_cast<unsigned>(m->globals.size() - 1) };
+		}
+	}
+
+	// A body that was skimmed and never parsed leaves only a declaration.
+	for (const auto& fn : m->functions) {
+		if (fn->source->getBody())
+			IRFunctionBuilder(*fn, symbols).define();
+	}
+	return m;
+}
\ No newline at end of file
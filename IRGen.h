@@ -0,0 +1,11 @@
+#pragma once
+#include "IR.h"
+
+#include <memory>
+
+struct ProgramDeclaration;
+
+// Lowers a checked program to the SSA form. Parameters and locals become
+// SSA values; globals are loaded and stored through their addresses, and
+// start out zeroed as they do in the LLVM lowering.
+std::unique_ptr<IRModule> lowerProgram(const ProgramDeclaration* p);
\ No newline at end of file
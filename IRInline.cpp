@@ -0,0 +1,282 @@
+#include "stdafx.h"
+#include "IRInline.h"
+#include "IRAnalysis.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// A body no larger than this costs about as much as the call that it
+// replaces, so it is inlined wherever it is called.
+static const unsigned inlineSizeLimit = 12;
+
+// Calls inside loops run more often, so each level of nesting allows a
+// body this much larger.
+static const unsigned inlineLoopBonus = 24;
+
+// Inlining stops once a caller grows past this size.
+static const unsigned inlineCallerLimit = 2000;
+
+// The number of instructions that do work. Leaves are cheap to copy and
+// often shared with the caller.
+static unsigned getSize(const IRFunction& f)
+{
+	unsigned n = 0;
+	for (const IRBlock* b : f.blocks) {
+		for (const IRInstruction* i : b->instructions) {
+			if (i->op > ir_function)
+				++n;
+		}
+	}
+	return n;
+}
+
+// The function called directly by i, if any.
+static IRFunction* getCallee(const IRModule& m, const IRInstruction* i)
+{
+	if (i->op != ir_call || i->operands[0]->op != ir_function)
+		return nullptr;
+	return m.functions[i->operands[0]->integer].get();
+}
+
+static bool returns(const IRFunction& f)
+{
+	for (const IRBlock* b : f.blocks) {
+		if (b->getTerminator()->op == ir_ret)
+			return true;
+	}
+	return false;
+}
+
+// Orders the strongly connected components of the call graph so that
+// callees come before their callers, by Tarjan's walk with its own stack.
+// Marks the functions that can call themselves.
+static std::vector<std::size_t> getBottomUpOrder(const IRModule& m, std::vector<char>& recursive)
+{
+	std::size_t n = m.functions.size();
+	std::vector<std::vector<std::size_t>> callees(n);
+	for (std::size_t k = 0; k < n; ++k) {
+		for (const IRBlock* b : m.functions[k]->blocks) {
+			for (const IRInstruction* i : b->instructions) {
+				if (i->op == ir_call && i->operands[0]->op == ir_function)
+					callees[k].push_back(static_cast<std::size_t>(i->operands[0]->integer));
+			}
+		}
+	}
+
+	std::vector<std::size_t> order;
+	std::vector<int> number(n, -1);
+	std::vector<int> low(n);
+	std::vector<char> onStack(n);
+	std::vector<std::size_t> component;
+	std::vector<std::pair<std::size_t, std::size_t>> stack;
+	int next = 0;
+	recursive.assign(n, 0);
+	for (std::size_t root = 0; root < n; ++root) {
+		if (number[root] >= 0)
+			continue;
+		stack.push_back({ root, 0 });
+		while (!stack.empty()) {
+			std::size_t v = stack.back().first;
+			std::size_t& edge = stack.back().second;
+			if (edge == 0 && number[v] < 0) {
+				number[v] = low[v] = next++;
+				component.push_back(v);
+				onStack[v] = 1;
+			}
+			if (edge < callees[v].size()) {
+				std::size_t w = callees[v][edge++];
+				if (w == v)
+					recursive[v] = 1;
+				if (number[w] < 0)
+					stack.push_back({ w, 0 });
+				else if (onStack[w])
+					low[v] = std::min(low[v], number[w]);
+				continue;
+			}
+			stack.pop_back();
+			if (!stack.empty())
+				low[stack.back().first] = std::min(low[stack.back().first], low[v]);
+			if (low[v] != number[v])
+				continue;
+			std::size_t first = order.size();
+			std::size_t w;
+			do {
+				w = component.back();
+				component.pop_back();
+				onStack[w] = 0;
+				order.push_back(w);
+			} while (w != v);
+			if (order.size() - first > 1) {
+				for (std::size_t k = first; k < order.size(); ++k)
+					recursive[order[k]] = 1;
+			}
+		}
+	}
+	return order;
+}
+
+// Replaces the call c in f with a copy of the body of g. The block of the
+// call is split after it; each return of the copy becomes a branch to the
+// second half, where a phi merges the results when there are several.
+static void inlineCall(IRFunction& f, IRInstruction* c, const IRFunction& g)
+{
+	IRBlock* b = c->block;
+	IRBlock* rest = f.makeBlock();
+	auto at = std::find(b->instructions.begin(), b->instructions.end(), c);
+	rest->instructions.assign(at + 1, b->instructions.end());
+	b->instructions.erase(at, b->instructions.end());
+	for (IRInstruction* i : rest->instructions)
+		i->block = rest;
+	for (IRBlock* s : rest->getSuccessors())
+		std::replace(s->preds.begin(), s->preds.end(), b, rest);
+
+	// Copy the blocks first, then the instructions, so that phis and
+	// branches can refer forward.
+	std::vector<IRBlock*> blocks(g.getBlockCount());
+	for (const IRBlock* gb : g.blocks)
+		blocks[gb->id] = f.makeBlock();
+	std::vector<IRInstruction*> values(g.getValueCount());
+	std::vector<std::pair<IRInstruction*, const IRInstruction*>> copies;
+	for (const IRBlock* gb : g.blocks) {
+		IRBlock* nb = blocks[gb->id];
+		for (const IRBlock* p : gb->preds)
+			nb->preds.push_back(blocks[p->id]);
+		for (const IRInstruction* i : gb->instructions) {
+			if (i->op == ir_param) {
+				values[i->id] = c->operands[i->integer + 1];
+				continue;
+			}
+			IRInstruction* n = f.make(i->op == ir_ret ? ir_br : i->op, i->op == ir_ret ? irt_void : i->type);
+			n->block = nb;
+			n->integer = i->integer;
+			n->real = i->real;
+			nb->instructions.push_back(n);
+			values[i->id] = n;
+			copies.push_back({ n, i });
+		}
+	}
+
+	IRBlockList exits;
+	SmallVector<IRInstruction*, 2> results;
+	for (const auto& copy : copies) {
+		IRInstruction* n = copy.first;
+		const IRInstruction* i = copy.second;
+		if (i->op == ir_ret) {
+			n->targets[0] = rest;
+			exits.push_back(n->block);
+			results.push_back(values[i->operands[0]->id]);
+			continue;
+		}
+		for (const IRInstruction* op : i->operands)
+			n->operands.push_back(values[op->id]);
+		for (int k = 0; k < 2; ++k)
+			n->targets[k] = i->targets[k] ? blocks[i->targets[k]->id] : nullptr;
+	}
+
+	IRInstruction* jump = f.make(ir_br, irt_void);
+	jump->block = b;
+	jump->targets[0] = blocks[g.getEntryBlock()->id];
+	b->instructions.push_back(jump);
+	jump->targets[0]->preds.push_back(b);
+	rest->preds = exits;
+
+	IRInstruction* result = results[0];
+	if (results.size() > 1) {
+		result = f.make(ir_phi, c->type);
+		result->block = rest;
+		result->operands = results;
+		rest->instructions.insert(rest->instructions.begin(), result);
+	}
+	for (IRBlock* fb : f.blocks) {
+		for (IRInstruction* i : fb->instructions)
+			std::replace(i->operands.begin(), i->operands.end(), c, result);
+	}
+	for (IRInstruction* i : rest->instructions)
+		std::replace(i->operands.begin(), i->operands.end(), c, result);
+
+	std::vector<IRBlock*> layout;
+	for (const IRBlock* gb : g.blocks)
+		layout.push_back(blocks[gb->id]);
+	layout.push_back(rest);
+	auto after = std::find(f.blocks.begin(), f.blocks.end(), b) + 1;
+	f.blocks.insert(after, layout.begin(), layout.end());
+}
+
+// Joins each block that ends in a jump to a block with no other
+// predecessor to that block, removing the jumps that inlining leaves
+// behind.
+static void mergeBlocks(IRFunction& f)
+{
+	std::vector<char> merged(f.getBlockCount());
+	for (IRBlock* b : f.blocks) {
+		if (merged[b->id])
+			continue;
+		for (;;) {
+			IRInstruction* t = b->getTerminator();
+			IRBlock* s = t->targets[0];
+			if (t->op != ir_br || s == b || s->preds.size() != 1 || s->instructions.front()->isPhi())
+				break;
+			b->instructions.pop_back();
+			for (IRInstruction* i : s->instructions) {
+				i->block = b;
+				b->instructions.push_back(i);
+			}
+			for (IRBlock* n : s->getSuccessors())
+				std::replace(n->preds.begin(), n->preds.end(), s, b);
+			merged[s->id] = 1;
+		}
+	}
+	std::vector<IRBlock*> layout;
+	for (IRBlock* b : f.blocks) {
+		if (!merged[b->id])
+			layout.push_back(b);
+	}
+	f.blocks = layout;
+}
+
+void inlineCalls(IRModule& m)
+{
+	TraceSpan span("inlineCalls");
+	std::vector<char> recursive;
+	std::vector<std::size_t> order = getBottomUpOrder(m, recursive);
+	std::vector<unsigned> sizes(m.functions.size());
+	for (std::size_t k = 0; k < m.functions.size(); ++k)
+		sizes[k] = getSize(*m.functions[k]);
+
+	for (std::size_t k : order) {
+		IRFunction& f = *m.functions[k];
+		if (!f.isDefined())
+			continue;
+
+		// Choose the calls up front; calls copied in with a callee were
+		// already considered in the callee.
+		IRDominators dom(f);
+		IRLoops loops(f, dom);
+		std::vector<IRInstruction*> calls;
+		for (IRBlock* b : f.blocks) {
+			for (IRInstruction* i : b->instructions) {
+				IRFunction* g = getCallee(m, i);
+				if (!g || !g->isDefined() || recursive[i->operands[0]->integer] || !returns(*g))
+					continue;
+				if (sizes[i->operands[0]->integer] <= inlineSizeLimit + inlineLoopBonus * loops.getDepth(b))
+					calls.push_back(i);
+			}
+		}
+		if (calls.empty())
+			continue;
+
+		TraceSpan function("inlineCalls", f.name);
+		for (IRInstruction* c : calls) {
+			std::size_t g = static_cast<std::size_t>(c->operands[0]->integer);
+			if (sizes[k] + sizes[g] > inlineCallerLimit)
+				break;
+			inlineCall(f, c, *m.functions[g]);
+			sizes[k] += sizes[g];
+		}
+		f.renumber();
+		mergeBlocks(f);
+		f.renumber();
+	}
+}
\ No newline at end of file
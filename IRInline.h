@@ -0,0 +1,8 @@
+#pragma once
+#include "IR.h"
+
+// Replaces direct calls with copies of the callee's body where the cost
+// model finds it worthwhile. Callees are handled before their callers, so
+// the copies already include whatever was inlined into them; functions
+// that can reach themselves are never inlined.
+void inlineCalls(IRModule& m);
\ No newline at end of file
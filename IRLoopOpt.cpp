@@ -0,0 +1,269 @@
+#include "stdafx.h"
+#include "IRLoopOpt.h"
+#include "IRAnalysis.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <vector>
+
+// Gives every loop a preheader: a block outside the loop whose only
+// successor is the header, and through which every entry to the loop
+// passes. It becomes the header's first predecessor. Adds blocks, so the
+// analyses must be rebuilt afterwards.
+static void addPreheaders(IRFunction& f, const IRLoops& loops)
+{
+	for (const IRLoop& l : loops.getLoops()) {
+		IRBlock* h = l.header;
+		std::vector<char> inside(f.getBlockCount());
+		for (const IRBlock* b : l.blocks)
+			inside[b->id] = 1;
+
+		std::vector<std::size_t> entries;
+		for (std::size_t k = 0; k < h->preds.size(); ++k) {
+			if (!inside[h->preds[k]->id])
+				entries.push_back(k);
+		}
+		if (entries.size() == 1 && entries[0] == 0 && h->preds[0]->getTerminator()->op == ir_br)
+			continue;
+
+		IRBlock* ph = f.makeBlock();
+		for (std::size_t k : entries) {
+			IRBlock* p = h->preds[k];
+			ph->preds.push_back(p);
+			for (IRBlock*& target : p->getTerminator()->targets) {
+				if (target == h)
+					target = ph;
+			}
+		}
+
+		// The phis of the header take one value from the preheader, which
+		// merges the values from the entries when they differ.
+		for (IRInstruction* i : h->instructions) {
+			if (!i->isPhi())
+				break;
+			SmallVector<IRInstruction*, 2> merged;
+			for (std::size_t k : entries)
+				merged.push_back(i->operands[k]);
+			IRInstruction* v = merged[0];
+			if (std::any_of(merged.begin(), merged.end(), [&](IRInstruction* op) { return op != v; })) {
+				v = f.make(ir_phi, i->type);
+				v->block = ph;
+				v->operands = merged;
+				ph->instructions.push_back(v);
+			}
+			SmallVector<IRInstruction*, 2> ops;
+			ops.push_back(v);
+			for (std::size_t k = 0; k < h->preds.size(); ++k) {
+				if (inside[h->preds[k]->id])
+					ops.push_back(i->operands[k]);
+			}
+			i->operands = ops;
+		}
+		IRBlockList preds;
+		preds.push_back(ph);
+		for (IRBlock* p : h->preds) {
+			if (inside[p->id])
+				preds.push_back(p);
+		}
+		h->preds = preds;
+
+		IRInstruction* jump = f.make(ir_br, irt_void);
+		jump->block = ph;
+		jump->targets[0] = h;
+		ph->instructions.push_back(jump);
+		f.blocks.insert(std::find(f.blocks.begin(), f.blocks.end(), h), ph);
+	}
+}
+
+// Division by a variable, 0 or -1 can trap.
+static bool canTrap(const IRInstruction* i)
+{
+	if (i->op != ir_div && i->op != ir_rem)
+		return false;
+	const IRInstruction* d = i->operands[1];
+	return !d->isConstant() || d->integer == 0 || d->integer == -1;
+}
+
+// Rewrites the loops of one function from the innermost out, so that what
+// leaves an inner loop is considered again for the loop around it.
+class IRLoopOptimizer {
+public:
+	IRLoopOptimizer(IRFunction& f, const IRDominators& dom)
+		: fn(f), dom(dom), inside(f.getBlockCount()) {}
+
+	void run(const IRLoops& loops);
+
+private:
+	bool isInvariant(const IRInstruction* v) const;
+	void hoist(const IRLoop& l, const std::vector<IRBlock*>& order);
+	void reduce(const IRLoop& l, const std::vector<IRBlock*>& order);
+	IRInstruction* make(IROpcode op, IRBlock* b, IRInstruction* x, IRInstruction* y);
+	void replace(const std::vector<IRInstruction*>& replacement);
+
+	IRFunction& fn;
+	const IRDominators& dom;
+
+	// The blocks of the loop being rewritten.
+	std::vector<char> inside;
+
+	// Instructions moved out of the loop being rewritten.
+	std::vector<char> hoisted;
+};
+
+bool IRLoopOptimizer::isInvariant(const IRInstruction* v) const
+{
+	return !inside[v->block->id] || (v->id < hoisted.size() && hoisted[v->id]);
+}
+
+IRInstruction* IRLoopOptimizer::make(IROpcode op, IRBlock* b, IRInstruction* x, IRInstruction* y)
+{
+	IRInstruction* i = fn.make(op, irt_int);
+	i->block = b;
+	i->operands.push_back(x);
+	if (y)
+		i->operands.push_back(y);
+	return i;
+}
+
+void IRLoopOptimizer::replace(const std::vector<IRInstruction*>& replacement)
+{
+	for (IRBlock* b : fn.blocks) {
+		for (IRInstruction* i : b->instructions) {
+			for (IRInstruction*& op : i->operands) {
+				if (op->id < replacement.size() && replacement[op->id])
+					op = replacement[op->id];
+			}
+		}
+	}
+}
+
+// Moves the pure instructions whose operands are invariant to the
+// preheader, in an order that keeps definitions ahead of their uses. Only
+// the header is sure to run whenever the preheader does, so anything that
+// can trap stays put elsewhere. Loads move only out of loops that do not
+// write memory.
+void IRLoopOptimizer::hoist(const IRLoop& l, const std::vector<IRBlock*>& order)
+{
+	bool writes = false;
+	for (const IRBlock* b : order) {
+		for (const IRInstruction* i : b->instructions)
+			writes = writes || i->op == ir_store || i->op == ir_call;
+	}
+
+	hoisted.assign(fn.getValueCount(), 0);
+	std::vector<IRInstruction*> moved;
+	for (IRBlock* b : order) {
+		std::vector<IRInstruction*> kept;
+		for (IRInstruction* i : b->instructions) {
+			bool movable = !i->isPhi() && !i->hasSideEffects() && i->op != ir_param &&
+				!(i->op == ir_load && writes) && !(canTrap(i) && b != l.header) &&
+				std::all_of(i->operands.begin(), i->operands.end(), [&](const IRInstruction* op) { return isInvariant(op); });
+			if (movable) {
+				hoisted[i->id] = 1;
+				moved.push_back(i);
+			}
+			else {
+				kept.push_back(i);
+			}
+		}
+		b->instructions = kept;
+	}
+
+	IRBlock* ph = l.header->preds[0];
+	for (IRInstruction* i : moved)
+		i->block = ph;
+	ph->instructions.insert(ph->instructions.end() - 1, moved.begin(), moved.end());
+}
+
+// Finds the int phis of the header that step by an invariant amount on
+// each trip, and replaces each product of one with an invariant by a phi
+// of its own that steps by the product of the step. Wrapping arithmetic
+// keeps the two equal however far they run.
+void IRLoopOptimizer::reduce(const IRLoop& l, const std::vector<IRBlock*>& order)
+{
+	IRBlock* h = l.header;
+	IRBlock* ph = h->preds[0];
+	if (h->preds.size() != 2)
+		return;
+
+	std::vector<IRInstruction*> replacement(fn.getValueCount());
+	std::vector<IRInstruction*> phis;
+	for (IRInstruction* iv : h->instructions) {
+		if (!iv->isPhi())
+			break;
+		IRInstruction* next = iv->operands[1];
+		if (iv->type != irt_int || !inside[next->block->id] || (next->op != ir_add && next->op != ir_sub))
+			continue;
+		IRInstruction* step = next->operands[0] == iv ? next->operands[1] : next->op == ir_add ? next->operands[0] : nullptr;
+		if (!step || step == iv || !isInvariant(step))
+			continue;
+
+		std::vector<IRInstruction*> products;
+		for (IRBlock* b : order) {
+			for (IRInstruction* i : b->instructions) {
+				if (i->op == ir_mul && std::count(i->operands.begin(), i->operands.end(), iv) == 1 &&
+					isInvariant(i->operands[i->operands[0] == iv ? 1 : 0]))
+					products.push_back(i);
+			}
+		}
+		for (IRInstruction* i : products) {
+			IRInstruction* k = i->operands[i->operands[0] == iv ? 1 : 0];
+			IRInstruction* start = make(ir_mul, ph, iv->operands[0], k);
+			IRInstruction* stride = make(ir_mul, ph, step, k);
+			ph->instructions.insert(ph->instructions.end() - 1, { start, stride });
+			IRInstruction* p = fn.make(ir_phi, irt_int);
+			p->block = h;
+			IRInstruction* stepped = make(next->op, next->block, p, stride);
+			p->operands.push_back(start);
+			p->operands.push_back(stepped);
+			phis.push_back(p);
+			std::vector<IRInstruction*>& in = next->block->instructions;
+			in.insert(std::find(in.begin(), in.end(), next) + 1, stepped);
+			std::vector<IRInstruction*>& from = i->block->instructions;
+			from.erase(std::find(from.begin(), from.end(), i));
+			replacement[i->id] = p;
+		}
+	}
+	h->instructions.insert(h->instructions.begin(), phis.begin(), phis.end());
+	if (!phis.empty())
+		replace(replacement);
+}
+
+void IRLoopOptimizer::run(const IRLoops& loops)
+{
+	const std::deque<IRLoop>& all = loops.getLoops();
+	for (auto l = all.rbegin(); l != all.rend(); ++l) {
+		std::fill(inside.begin(), inside.end(), 0);
+		for (const IRBlock* b : l->blocks)
+			inside[b->id] = 1;
+		std::vector<IRBlock*> order;
+		for (IRBlock* b : dom.getOrder()) {
+			if (inside[b->id])
+				order.push_back(b);
+		}
+		hoist(*l, order);
+		reduce(*l, order);
+	}
+}
+
+void optimizeLoops(IRModule& m)
+{
+	TraceSpan span("optimizeLoops");
+	for (const auto& f : m.functions) {
+		if (!f->isDefined())
+			continue;
+		{
+			IRDominators dom(*f);
+			IRLoops loops(*f, dom);
+			if (loops.getLoops().empty())
+				continue;
+			addPreheaders(*f, loops);
+			f->renumber();
+		}
+		TraceSpan function("optimizeLoops", f->name);
+		IRDominators dom(*f);
+		IRLoops loops(*f, dom);
+		IRLoopOptimizer(*f, dom).run(loops);
+		f->renumber();
+	}
+}
\ No newline at end of file
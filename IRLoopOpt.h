@@ -0,0 +1,7 @@
+#pragma once
+#include "IR.h"
+
+// Moves the computations that do not change within a loop to a block that
+// runs once before it, and turns multiplications of an induction variable
+// into additions carried around the loop.
+void optimizeLoops(IRModule& m);
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "stdafx.h"
+#include "IRValueNumbering.h"
+#include "IRAnalysis.h"
+#include "Trace.h"
+
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// What a pure instruction computes. Operands of commutative operations
+// are sorted, so that a + b and b + a have the same key. Loads also carry
+// the state of memory they read.
+struct IRValueKey {
+	IROpcode op;
+	IRType type;
+	std::int64_t integer;
+	std::uint64_t real;
+	const IRInstruction* operands[2];
+	unsigned memory;
+
+	bool operator==(const IRValueKey& k) const {
+		return op == k.op && type == k.type && integer == k.integer && real == k.real &&
+			operands[0] == k.operands[0] && operands[1] == k.operands[1] && memory == k.memory;
+	}
+};
+
+struct IRValueKeyHash {
+	std::size_t operator()(const IRValueKey& k) const {
+		std::size_t h = std::hash<int>()(k.op * 8 + k.type);
+		auto mix = [&](std::size_t v) { h ^= v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2); };
+		mix(std::hash<std::int64_t>()(k.integer));
+		mix(std::hash<std::uint64_t>()(k.real));
+		mix(std::hash<const void*>()(k.operands[0]));
+		mix(std::hash<const void*>()(k.operands[1]));
+		mix(k.memory);
+		return h;
+	}
+};
+
+static bool isCommutative(IROpcode op)
+{
+	switch (op) {
+	case ir_add: case ir_mul: case ir_and: case ir_or: case ir_xor: case ir_mulh:
+	case ir_fadd: case ir_fmul:
+	case ir_eq: case ir_ne: case ir_feq: case ir_fne:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static IRValueKey getKey(const IRInstruction* i, unsigned memory)
+{
+	IRValueKey k = { i->op, i->type, i->integer, 0, { nullptr, nullptr }, i->op == ir_load ? memory : 0 };
+	std::memcpy(&k.real, &i->real, sizeof k.real);
+	for (std::size_t n = 0; n < i->operands.size(); ++n)
+		k.operands[n] = i->operands[n];
+	if (isCommutative(i->op) && k.operands[0]->id > k.operands[1]->id)
+		std::swap(k.operands[0], k.operands[1]);
+	return k;
+}
+
+static void numberValues(IRFunction& f)
+{
+	IRDominators dom(f);
+	std::vector<IRInstruction*> replacement(f.getValueCount());
+	std::unordered_map<IRValueKey, IRInstruction*, IRValueKeyHash> available;
+
+	// The keys added by each block on the path from the entry, removed
+	// again once its subtree of the dominator tree is done.
+	std::vector<IRValueKey> added;
+	std::vector<std::pair<IRBlock*, std::size_t>> stack;
+	std::vector<std::size_t> marks;
+	unsigned memory = 0;
+	bool any = false;
+
+	stack.push_back({ f.getEntryBlock(), 0 });
+	while (!stack.empty()) {
+		IRBlock* b = stack.back().first;
+		std::size_t& next = stack.back().second;
+		if (next == 0) {
+			marks.push_back(added.size());
+			++memory;
+			std::vector<IRInstruction*> kept;
+			for (IRInstruction* i : b->instructions) {
+				for (IRInstruction*& op : i->operands) {
+					if (replacement[op->id])
+						op = replacement[op->id];
+				}
+				if (i->op == ir_store || i->op == ir_call)
+					++memory;
+				if (i->isPhi() || i->hasSideEffects() || i->op == ir_param) {
+					kept.push_back(i);
+					continue;
+				}
+				IRValueKey k = getKey(i, memory);
+				auto found = available.find(k);
+				if (found != available.end()) {
+					replacement[i->id] = found->second;
+					any = true;
+					continue;
+				}
+				available.emplace(k, i);
+				added.push_back(k);
+				kept.push_back(i);
+			}
+			b->instructions = kept;
+		}
+		const std::vector<IRBlock*>& children = dom.getChildren(b);
+		if (next < children.size()) {
+			IRBlock* c = children[next++];
+			stack.push_back({ c, 0 });
+			continue;
+		}
+		for (std::size_t n = marks.back(); n < added.size(); ++n)
+			available.erase(added[n]);
+		added.resize(marks.back());
+		marks.pop_back();
+		stack.pop_back();
+	}
+	if (!any)
+		return;
+
+	// Phis read values from blocks that may be visited after them.
+	for (IRBlock* b : f.blocks) {
+		for (IRInstruction* i : b->instructions) {
+			for (IRInstruction*& op : i->operands) {
+				if (replacement[op->id])
+					op = replacement[op->id];
+			}
+		}
+	}
+	f.renumber();
+}
+
+void numberValues(IRModule& m)
+{
+	TraceSpan span("numberValues");
+	for (const auto& f : m.functions) {
+		if (f->isDefined())
+			numberValues(*f);
+	}
+}
\ No newline at end of file
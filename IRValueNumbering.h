@@ -0,0 +1,8 @@
+#pragma once
+#include "IR.h"
+
+// Global value numbering. Replaces each pure instruction that computes a
+// value already computed in a dominating block with that earlier value.
+// Loads are reused only within a block and only while nothing is stored
+// or called in between.
+void numberValues(IRModule& m);
\ No newline at end of file
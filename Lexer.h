@@ -1,22 +1,66 @@
 #pragma once
 #include "Token.h"
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 class File;
+class Stream;
+class TokenCache;
+class Diagnostics;
 
 class Lexer {
 public:
-	Lexer(SymbolTable& s, const File& f);
+	Lexer(SymbolTable& s, const File& f, Diagnostics& d);
+	Lexer(SymbolTable& s, Stream& in, Diagnostics& d);
+
+	// Reads the tokens of f from a cache instead of lexing it.
+	Lexer(SymbolTable& s, const File& f, const TokenCache& c, Diagnostics& d);
+	~Lexer();
+	Lexer(const Lexer& l, Diagnostics& d);
 	Token operator()() { return scan(); }
 	Token scan();
 	bool eof() const;
 	char peek() const;
 	char peek(int n) const;
 
+	// A point in the input that scanning can be resumed from.
+	struct Position {
+		const char* first;
+		Location location;
+		std::size_t next;
+	};
+
+	Position getPosition() const { return { first, currentLocation, next }; }
+	void setPosition(const Position& p) { first = p.first; currentLocation = p.location; next = p.next; }
+
+	bool skipBlock();
+
+	// Streamed input is discarded once lexed, and input lexed on another
+	// thread is only seen as tokens, so positions in them cannot be
+	// returned to.
+	bool canRewind() const { return !stream && !pipeline; }
+
+	// Lexes the rest of the input at once, splitting it at newlines into
+	// chunks that are lexed on the given number of threads (by default one
+	// per hardware thread). Later scans return the buffered tokens. Not
+	// available for streamed input.
+	void prescan(unsigned threads = 0);
+
+	// Moves lexing of the rest of the input to another thread, which sends
+	// tokens over in batches as it finds them. Later scans take them from
+	// there, so lexing overlaps with parsing.
+	void startThread();
+
 private:
+	void addReservedWords();
+	bool refill();
+	std::size_t countBuffered() const;
+	Token getBuffered(std::size_t i) const;
 	char accept();
 	void accept(int n);
 	char ignore();
+	void error(const std::string& msg);
 	
 	void skipSpace();
 	void skipNewline();
@@ -32,7 +76,9 @@ private:
 	Token lexAssignmentOperator();
 	Token lexCompoundAssignmentOperator(int length, CompoundAssignmentOperator c);
 	Token lexWord();
+	void acceptDigits(bool (*isDigitOf)(char));
 	Token lexNumber();
+	Token lexRadixNumber(Radix r, int base, bool (*isDigitOf)(char));
 	Token lexBinNumber();
 	Token lexHexNumber();
 	Token lexChar();
@@ -40,10 +86,20 @@ private:
 
 	char scanEscapeSequence();
 
-	SymbolTable symbolTable;
+	SymbolTable& symbolTable;
 	const char* first;
 	const char* last;
 	Location currentLocation;
 	Location tokenLocation;
 	std::unordered_map<Symbol,Token> reserved;
+	Diagnostics& diagnostics;
+	Stream* stream;
+
+	// Tokens lexed by prescan, shared with copies of this lexer.
+	std::shared_ptr<const std::vector<Token>> buffer;
+	const TokenCache* cache;
+	std::size_t next;
+
+	struct Pipeline;
+	std::unique_ptr<Pipeline> pipeline;
 };
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "MemoryProfile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> MemoryProfile::enabled(false);
+thread_local std::size_t MemoryProfile::pending;
+
+struct MemoryCount {
+	std::atomic<std::size_t> allocations;
+	std::atomic<std::size_t> bytes;
+};
+
+static MemoryCount memoryCounts[MemoryProfile::category_count][MemoryProfile::kind_count];
+
+static const char* const categoryNames[MemoryProfile::category_count] = {
+	"type", "expression", "statement", "declaration", "node list", "tokens", "scope"
+};
+
+// Names of the kinds of each category, in the order of their enums.
+static const char* const typeKindNames[] = {
+	"bool", "char", "int", "float", "pointer", "reference", "function"
+};
+static const char* const expressionKindNames[] = {
+	"bool", "int", "float", "id", "unop", "binop", "ptr", "call", "index", "cast", "assign", "cond", "conv"
+};
+static const char* const statementKindNames[] = {
+	"block", "when", "if", "while", "break", "continue", "return", "declare", "expression"
+};
+static const char* const declarationKindNames[] = {
+	"program", "variable", "constant", "value", "parameter", "function"
+};
+static const char* const scopeKindNames[] = {
+	"global", "parameter", "block"
+};
+
+static const char* getKindName(int c, int k) {
+	auto pick = [k](const auto& names) -> const char* {
+		return k < static_cast<int>(sizeof names / sizeof names[0]) ? names[k] : "?";
+	};
+	switch (c) {
+	case MemoryProfile::type_nodes:
+		return pick(typeKindNames);
+	case MemoryProfile::expression_nodes:
+		return pick(expressionKindNames);
+	case MemoryProfile::statement_nodes:
+		return pick(statementKindNames);
+	case MemoryProfile::declaration_nodes:
+		return pick(declarationKindNames);
+	case MemoryProfile::scopes:
+		return pick(scopeKindNames);
+	default:
+		return "";
+	}
+}
+
+struct PhasePeak {
+	const char* name;
+	std::size_t before;
+	std::size_t peak;
+};
+
+static std::mutex phaseMutex;
+static std::vector<PhasePeak> phasePeaks;
+static std::atomic<int> phaseDepth(0);
+
+// The resident set size and its peak in bytes, from /proc on Linux. The
+// peak can be reset there, which lets each phase measure its own.
+static std::size_t readStatus(const char* field) {
+	std::size_t kb = 0;
+#ifdef __linux__
+	if (std::FILE* f = std::fopen("/proc/self/status", "r")) {
+		char line[256];
+		std::size_t n = std::strlen(field);
+		while (std::fgets(line, sizeof line, f)) {
+			if (std::strncmp(line, field, n) == 0 && line[n] == ':') {
+				kb = std::strtoull(line + n + 1, nullptr, 10);
+				break;
+			}
+		}
+		std::fclose(f);
+	}
+#endif
+	return kb * 1024;
+}
+
+static void resetPeak() {
+#ifdef __linux__
+	if (std::FILE* f = std::fopen("/proc/self/clear_refs", "w")) {
+		std::fputs("5", f);
+		std::fclose(f);
+	}
+#endif
+}
+
+static void reportAtExit() {
+	MemoryProfile::report(std::cerr);
+}
+
+void MemoryProfile::start() {
+	if (!enabled.exchange(true)) {
+		std::atexit(reportAtExit);
+	}
+}
+
+void MemoryProfile::count(Category c, int kind, std::size_t bytes) {
+	MemoryCount& m = memoryCounts[c][kind < kind_count ? kind : 0];
+	m.allocations.fetch_add(1, std::memory_order_relaxed);
+	m.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void MemoryProfile::report(std::ostream& os) {
+	os << std::left << std::setw(14) << "category" << std::setw(12) << "kind" << std::right
+		<< std::setw(14) << "allocations" << std::setw(16) << "bytes" << '\n';
+	for (int c = 0; c < category_count; ++c) {
+		std::size_t allocations = 0;
+		std::size_t bytes = 0;
+		int kinds = 0;
+		for (int k = 0; k < kind_count; ++k) {
+			std::size_t n = memoryCounts[c][k].allocations.load(std::memory_order_relaxed);
+			std::size_t b = memoryCounts[c][k].bytes.load(std::memory_order_relaxed);
+			if (!n) {
+				continue;
+			}
+			allocations += n;
+			bytes += b;
+			++kinds;
+			os << std::left << std::setw(14) << categoryNames[c] << std::setw(12) << getKindName(c, k) << std::right
+				<< std::setw(14) << n << std::setw(16) << b << '\n';
+		}
+		if (kinds > 1) {
+			os << std::left << std::setw(14) << categoryNames[c] << std::setw(12) << "(total)" << std::right
+				<< std::setw(14) << allocations << std::setw(16) << bytes << '\n';
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(phaseMutex);
+	if (phasePeaks.empty()) {
+		return;
+	}
+	os << '\n' << std::left << std::setw(26) << "phase" << std::right
+		<< std::setw(14) << "rss before" << std::setw(16) << "peak rss" << '\n';
+	for (const PhasePeak& p : phasePeaks) {
+		os << std::left << std::setw(26) << p.name << std::right
+			<< std::setw(14) << p.before << std::setw(16) << p.peak << '\n';
+	}
+}
+
+MemoryPhase::MemoryPhase(const char* name)
+	: name(name), before(0), entered(MemoryProfile::isEnabled()), active(false) {
+	if (!entered || phaseDepth++ != 0) {
+		return;
+	}
+	active = true;
+	resetPeak();
+	before = readStatus("VmRSS");
+}
+
+MemoryPhase::~MemoryPhase() {
+	if (entered) {
+		--phaseDepth;
+	}
+	if (!active) {
+		return;
+	}
+	std::size_t peak = readStatus("VmHWM");
+	std::lock_guard<std::mutex> lock(phaseMutex);
+	phasePeaks.push_back({ name, before, peak });
+}
\ No newline at end of file
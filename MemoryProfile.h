@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
+#include <new>
+
+// Counts the memory allocated for the tree, its child lists, token buffers
+// and scopes, and records the peak resident set size of each phase.
+// Nothing is counted until start is called; the counts are printed to the
+// standard error stream when the program exits.
+class MemoryProfile {
+public:
+	enum Category {
+		type_nodes,
+		expression_nodes,
+		statement_nodes,
+		declaration_nodes,
+		node_lists,
+		token_buffers,
+		scopes,
+		category_count
+	};
+
+	// Enough for the node kind with the most members.
+	static constexpr int kind_count = 16;
+
+	static void start();
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Adds one allocation of the given kind.
+	static void count(Category c, int kind, std::size_t bytes);
+
+	// Node classes allocate through here so that their base constructor,
+	// which knows the kind but not the size of the node, can count it.
+	static void* allocate(std::size_t n) {
+		if (isEnabled()) {
+			pending = n;
+		}
+		return ::operator new(n);
+	}
+
+	static void countNode(Category c, int kind) {
+		if (isEnabled()) {
+			count(c, kind, pending);
+			pending = 0;
+		}
+	}
+
+	static void report(std::ostream& os);
+
+private:
+	static std::atomic<bool> enabled;
+	static thread_local std::size_t pending;
+};
+
+// Records the peak resident set size between its construction and
+// destruction. The peak is tracked for the whole process, so a phase
+// begun inside another is not recorded separately.
+class MemoryPhase {
+public:
+	explicit MemoryPhase(const char* name);
+	~MemoryPhase();
+
+	MemoryPhase(const MemoryPhase&) = delete;
+	MemoryPhase& operator=(const MemoryPhase&) = delete;
+
+private:
+	const char* name;
+	std::size_t before;
+	bool entered;
+	bool active;
+};
\ No newline at end of file
@@ -1,7 +1,14 @@
 #include "stdafx.h"
 #include "Parser.h"
-#include <sstream>
+#include "Declaration.h"
+#include "Casting.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include "MemoryProfile.h"
+#include <algorithm>
+#include <atomic>
 #include <stdexcept>
+#include <thread>
 
 TokenName Parser::lookahead() {
 	assert(!tok.empty());
@@ -9,7 +16,7 @@ TokenName Parser::lookahead() {
 }
 
 TokenName Parser::lookahead(int n) {
-	if (n < tok.size()) {
+	if (static_cast<std::size_t>(n) < tok.size()) {
 		return tok[n].getName();
 	}
 	n = n - tok.size() + 1;
@@ -24,9 +31,8 @@ Token Parser::match(TokenName name) {
 	if (lookahead() == name) {
 		return accept();
 	}
-	std::stringstream ss;
-	ss << peek().getLocation() << ": syntax error";
-	throw std::runtime_error(ss.str());
+	error(std::string("expected ") + to_string(name));
+	return {};
 }
 
 Token Parser::matchIf(TokenName name) {
@@ -151,12 +157,44 @@ Token Parser::matchMultiplicative() {
 	return {};
 }
 
+Token Parser::matchUnary() {
+	switch (lookahead()) {
+	case tok_arithmetic_operator:
+		switch (peek().getArithmeticOperator()) {
+		default:
+			return {};
+		case op_add:
+		case op_sub:
+		case op_mul:
+			return accept();
+		}
+	case tok_bitwise_operator:
+		switch (peek().getBitwiseOperator()) {
+		default:
+			return {};
+		case op_bitNot:
+		case op_bitAnd:
+			return accept();
+		}
+	case tok_logical_operator:
+		if (peek().getLogicalOperator() == op_logicNot) {
+			return accept();
+		}
+		return {};
+	default:
+		return {};
+	}
+}
+
 Token Parser::accept() {
 	Token token = peek();
 	tok.pop_front();
 	if (tok.empty()) {
 		fetch();
 	}
+	++accepted;
+	previous = token.getName();
+	action.setLocation(token.getLocation());
 	return token;
 }
 
@@ -167,30 +205,112 @@ Token Parser::peek() {
 
 void Parser::fetch() {
 	tok.push_back(lex());
+	if (MemoryProfile::isEnabled() && tok.size() > tokPeak) {
+		MemoryProfile::count(MemoryProfile::token_buffers, 0, (tok.size() - tokPeak) * sizeof(Token));
+		tokPeak = tok.size();
+	}
+}
+
+// Reports a syntax error at the next token and enters panic mode.
+void Parser::error(const std::string& msg) {
+	if (!panic) {
+		diagnostics.error(peek().getLocation(), "syntax error, " + msg);
+		panic = true;
+		errorPoint = accepted;
+	}
+}
+
+// Leaves panic mode at the end of the statement or declaration in which
+// the error was found: just after a semicolon, or before a closing brace
+// so that the enclosing block can still be closed.
+void Parser::recover() {
+	if (accepted == errorPoint || (previous != tok_semicolon && previous != tok_right_brace)) {
+		while (lookahead() != tok_eof && lookahead() != tok_semicolon && lookahead() != tok_right_brace) {
+			accept();
+		}
+		matchIf(tok_semicolon);
+	}
+	panic = false;
 }
 
+// Leaves panic mode at the end of a top-level declaration, or else at the
+// next token that can start one.
+void Parser::recoverDeclaration() {
+	if (accepted == errorPoint || (previous != tok_semicolon && previous != tok_right_brace)) {
+		// Step over the offending token so that it is not met again.
+		if (accepted == errorPoint && lookahead() != tok_eof) {
+			accept();
+		}
+		while (lookahead() != tok_eof && lookahead() != kw_def && lookahead() != kw_let && lookahead() != kw_var) {
+			accept();
+		}
+	}
+	panic = false;
+}
+
+// Tracks how many nested constructs are currently being parsed on the
+// native stack.
+struct NestingGuard {
+	NestingGuard(int& d)
+		: depth(d) { ++depth; }
+
+	~NestingGuard() { --depth; }
+
+	int& depth;
+};
+
 Parser::Parser(SymbolTable& symbols, const File& file)
-	: lex(symbols, file), tok() {
+	: diagnostics(), lex(symbols, file, diagnostics), tok(), tokPeak(0),
+	panic(false), accepted(0), errorPoint(0), previous(tok_eof),
+	action(diagnostics), depth(0), nestingLimit(128), lazy(false) {
+	fetch();
+}
+
+Parser::Parser(SymbolTable& symbols, const File& file, const TokenCache& cache)
+	: diagnostics(), lex(symbols, file, cache, diagnostics), tok(), tokPeak(0),
+	panic(false), accepted(0), errorPoint(0), previous(tok_eof),
+	action(diagnostics), depth(0), nestingLimit(128), lazy(false) {
+	fetch();
+}
+
+Parser::Parser(SymbolTable& symbols, Stream& in)
+	: diagnostics(), lex(symbols, in, diagnostics), tok(), tokPeak(0),
+	panic(false), accepted(0), errorPoint(0), previous(tok_eof),
+	action(diagnostics), depth(0), nestingLimit(128), lazy(false) {
 	fetch();
 }
 
+Parser::Parser(const Parser& p, Scope* globals)
+	: diagnostics(), lex(p.lex, diagnostics), tok(), tokPeak(0),
+	panic(false), accepted(0), errorPoint(0), previous(tok_eof),
+	action(diagnostics, globals), depth(0), nestingLimit(p.nestingLimit), lazy(false) {}
+
+Parser::~Parser() {
+	// The global scope is kept alive for bodies parsed on demand.
+	if (lazy && action.getCurrentScope()) {
+		action.leaveScope();
+	}
+}
+
 Type* Parser::parseType() {
 	return parseBasicType();
 }
 
 Type* Parser::parseBasicType() {
-	switch (lookahead()) {
-	case tok_type_specifier:
-		return action.onBasicType(accept());
-	case tok_left_paren: {
-		match(tok_left_paren);
-		Type* t = parseType();
-		match(tok_right_paren);
-		return t;
+	int parens = 0;
+	while (matchIf(tok_left_paren)) {
+		++parens;
 	}
-	default:
-		throw std::runtime_error("Expected basic type");
+	if (lookahead() != tok_type_specifier) {
+		error("expected basic type");
+		return nullptr;
 	}
+	Type* t = action.onBasicType(accept());
+	while (parens != 0) {
+		match(tok_right_paren);
+		--parens;
+	}
+	return t;
 }
 
 Expression* Parser::parseExpr() {
@@ -199,14 +319,28 @@ Expression* Parser::parseExpr() {
 
 Expression* Parser::parseAssignmentExpr() {
 	Expression* e1 = parseConditionalExpr();
-	if (matchIf(tok_assignment_operator)) {
-		Expression* e2 = parseAssignmentExpr();
-		return action.onAssignmentExpression(e1, e2);
+	if (!matchIf(tok_assignment_operator)) {
+		return e1;
 	}
-	return e1;
+	// Assignment is right associative; collect the chain and fold it
+	// from the right rather than recursing once per '='.
+	ExpressionList targets{ e1 };
+	Expression* e2 = parseConditionalExpr();
+	while (matchIf(tok_assignment_operator)) {
+		targets.push_back(e2);
+		e2 = parseConditionalExpr();
+	}
+	for (auto i = targets.rbegin(); i != targets.rend(); ++i) {
+		e2 = action.onAssignmentExpression(*i, e2);
+	}
+	return e2;
 }
 
 Expression* Parser::parseConditionalExpr() {
+	if (depth >= nestingLimit) {
+		return parseConditionalExprIterative();
+	}
+	NestingGuard guard(depth);
 	Expression* e1 = parseLogicalOrExpr();
 	if (matchIf(tok_conditional_operator)) {
 		Expression* e2 = parseConditionalExpr();
@@ -317,45 +451,21 @@ Expression* Parser::parseCastExpr() {
 }
 
 Expression* Parser::parseUnaryExpr() {
-	Token t;
-	switch (lookahead()) {
-	case tok_arithmetic_operator:
-		switch (peek().getArithmeticOperator()) {
-		case op_add:
-		case op_sub:
-		case op_mul:
-			t = accept();
-			break;
-		default:
-			break;
-		}
-
-	case tok_bitwise_operator:
-		switch (peek().getBitwiseOperator()) {
-		case op_bitNot:
-		case op_bitAnd:
-			t = accept();
-			break;
-		default:
-			break;
-		}
-
-	case tok_logical_operator:
-		if (peek().getLogicalOperator() == op_logicNot) {
-			t = accept();
-		}
-		break;
-
-	default:
-		break;
+	Token t = matchUnary();
+	if (!t) {
+		return parsePostfixExpr();
 	}
 
-	if (t) {
-		Expression* e = parseUnaryExpr();
-		return action.onUnaryExpression(t, e);
+	// Prefix operators nest to the right; apply them innermost first.
+	std::vector<Token> ops{ t };
+	while (Token u = matchUnary()) {
+		ops.push_back(u);
 	}
-
-	return parsePostfixExpr();
+	Expression* e = parsePostfixExpr();
+	for (auto i = ops.rbegin(); i != ops.rend(); ++i) {
+		e = action.onUnaryExpression(*i, e);
+	}
+	return e;
 }
 
 Expression* Parser::parsePostfixExpr() {
@@ -405,7 +515,256 @@ Expression* Parser::parsePrimaryExpr() {
 		break;
 	}
 
-	throw std::runtime_error("Expected primary expression");
+	error("expected primary expression");
+	return nullptr;
+}
+
+enum Precedence {
+	prec_none,
+	prec_logical_or,
+	prec_logical_and,
+	prec_bitwise_or,
+	prec_bitwise_xor,
+	prec_bitwise_and,
+	prec_equality,
+	prec_relational,
+	prec_shift,
+	prec_additive,
+	prec_multiplicative
+};
+
+static Precedence getPrecedence(const Token& t) {
+	switch (t.getName()) {
+	case tok_logical_operator:
+		switch (t.getLogicalOperator()) {
+		case op_logicOr: return prec_logical_or;
+		case op_logicAnd: return prec_logical_and;
+		default: return prec_none;
+		}
+	case tok_bitwise_operator:
+		switch (t.getBitwiseOperator()) {
+		case op_bitOr: return prec_bitwise_or;
+		case op_bitXOR: return prec_bitwise_xor;
+		case op_bitAnd: return prec_bitwise_and;
+		case op_shiftLeft:
+		case op_shiftRight: return prec_shift;
+		default: return prec_none;
+		}
+	case tok_relational_operator:
+		switch (t.getRelationalOperator()) {
+		case op_equal:
+		case op_notEqual: return prec_equality;
+		default: return prec_relational;
+		}
+	case tok_arithmetic_operator:
+		switch (t.getArithmeticOperator()) {
+		case op_add:
+		case op_sub: return prec_additive;
+		case op_mul:
+		case op_div:
+		case op_mod: return prec_multiplicative;
+		default: return prec_none;
+		}
+	default:
+		return prec_none;
+	}
+}
+
+enum ExprFrameKind {
+	frame_unary,
+	frame_binary,
+	frame_paren,
+	frame_call,
+	frame_index,
+	frame_cond_pass,
+	frame_cond_fail,
+	frame_assign
+};
+
+// A pending operator of the explicit-stack expression parser. Call and
+// index frames remember where their arguments start on the operand stack.
+struct ExprFrame {
+	ExprFrameKind kind;
+	Token op;
+	Precedence precedence;
+	std::size_t base;
+};
+
+static Expression* pop(std::vector<Expression*>& operands) {
+	assert(!operands.empty());
+	Expression* e = operands.back();
+	operands.pop_back();
+	return e;
+}
+
+static Expression* onBinary(Semantics& action, const ExprFrame& f, Expression* e1, Expression* e2) {
+	switch (f.precedence) {
+	case prec_logical_or: return action.onLogicalOrExpression(e1, e2);
+	case prec_logical_and: return action.onLogicalAndExpression(e1, e2);
+	case prec_bitwise_or: return action.onBitwiseOrExpression(e1, e2);
+	case prec_bitwise_xor: return action.onBitwiseXOrExpression(e1, e2);
+	case prec_bitwise_and: return action.onBitwiseAndExpression(e1, e2);
+	case prec_equality: return action.onEqualityExpression(f.op, e1, e2);
+	case prec_relational: return action.onRelationalExpression(f.op, e1, e2);
+	case prec_shift: return action.onShiftExpression(f.op, e1, e2);
+	case prec_additive: return action.onAdditiveExpression(f.op, e1, e2);
+	case prec_multiplicative: return action.onMultiplicativeExpression(f.op, e1, e2);
+	default: throw std::logic_error("Invalid precedence");
+	}
+}
+
+// Pops the top frame and replaces its operands with the resulting node.
+static void reduce(Semantics& action, std::vector<ExprFrame>& frames, std::vector<Expression*>& operands) {
+	ExprFrame f = frames.back();
+	frames.pop_back();
+	switch (f.kind) {
+	case frame_unary: {
+		Expression* e = pop(operands);
+		operands.push_back(action.onUnaryExpression(f.op, e));
+		return;
+	}
+	case frame_binary: {
+		Expression* e2 = pop(operands);
+		Expression* e1 = pop(operands);
+		operands.push_back(onBinary(action, f, e1, e2));
+		return;
+	}
+	case frame_cond_fail: {
+		Expression* e3 = pop(operands);
+		Expression* e2 = pop(operands);
+		Expression* e1 = pop(operands);
+		operands.push_back(action.onConditationalExpression(e1, e2, e3));
+		return;
+	}
+	case frame_assign: {
+		Expression* e2 = pop(operands);
+		Expression* e1 = pop(operands);
+		operands.push_back(action.onAssignmentExpression(e1, e2));
+		return;
+	}
+	default:
+		throw std::logic_error("Frame cannot be reduced");
+	}
+}
+
+static bool isTop(const std::vector<ExprFrame>& frames, ExprFrameKind k) {
+	return !frames.empty() && frames.back().kind == k;
+}
+
+// Parses a conditional-expression without recursing on nested parentheses,
+// prefix operators or operands. The grammar is the same as the recursive
+// cascade above; operators wait on an explicit stack until an operator of
+// lower precedence, or a closing token, completes them.
+Expression* Parser::parseConditionalExprIterative() {
+	std::vector<ExprFrame> frames;
+	std::vector<Expression*> operands;
+	while (true) {
+		// Operand position.
+		while (true) {
+			if (Token t = matchUnary()) {
+				frames.push_back({ frame_unary, t, prec_none, 0 });
+			}
+			else if (matchIf(tok_left_paren)) {
+				frames.push_back({ frame_paren, {}, prec_none, 0 });
+			}
+			else {
+				break;
+			}
+		}
+		operands.push_back(parsePrimaryExpr());
+
+		// Operator position, until another operand is expected.
+		bool operand = false;
+		while (!operand) {
+			if (matchIf(tok_left_paren)) {
+				frames.push_back({ frame_call, {}, prec_none, operands.size() });
+				operand = true;
+				continue;
+			}
+			if (matchIf(tok_left_bracket)) {
+				frames.push_back({ frame_index, {}, prec_none, operands.size() });
+				operand = true;
+				continue;
+			}
+			while (isTop(frames, frame_unary)) {
+				reduce(action, frames, operands);
+			}
+			if (matchIf(kw_as)) {
+				Type* t = parseType();
+				operands.back() = action.onCastExpression(operands.back(), t);
+			}
+
+			if (Precedence p = getPrecedence(peek())) {
+				Token t = accept();
+				while (isTop(frames, frame_binary) && frames.back().precedence >= p) {
+					reduce(action, frames, operands);
+				}
+				frames.push_back({ frame_binary, t, p, 0 });
+				operand = true;
+				continue;
+			}
+			while (isTop(frames, frame_binary)) {
+				reduce(action, frames, operands);
+			}
+			if (matchIf(tok_conditional_operator)) {
+				frames.push_back({ frame_cond_pass, {}, prec_none, 0 });
+				operand = true;
+				continue;
+			}
+			while (isTop(frames, frame_cond_fail)) {
+				reduce(action, frames, operands);
+			}
+			if (isTop(frames, frame_cond_pass)) {
+				match(tok_colon);
+				frames.back().kind = frame_cond_fail;
+				operand = true;
+				continue;
+			}
+			if (lookahead() == tok_assignment_operator && !frames.empty()) {
+				accept();
+				frames.push_back({ frame_assign, {}, prec_none, 0 });
+				operand = true;
+				continue;
+			}
+			while (isTop(frames, frame_assign) || isTop(frames, frame_cond_fail)) {
+				reduce(action, frames, operands);
+			}
+
+			if (frames.empty()) {
+				assert(operands.size() == 1);
+				return operands.back();
+			}
+			ExprFrame& f = frames.back();
+			switch (f.kind) {
+			case frame_paren:
+				match(tok_right_paren);
+				frames.pop_back();
+				break;
+			case frame_call:
+			case frame_index: {
+				TokenName close = f.kind == frame_call ? tok_right_paren : tok_right_bracket;
+				if (matchIf(tok_comma)) {
+					operand = true;
+					break;
+				}
+				match(close);
+				ExpressionList args(operands.begin() + f.base, operands.end());
+				operands.resize(f.base);
+				Expression* e = pop(operands);
+				if (f.kind == frame_call) {
+					operands.push_back(action.onCallExpression(e, args));
+				}
+				else {
+					operands.push_back(action.onIndexExpression(e, args));
+				}
+				frames.pop_back();
+				break;
+			}
+			default:
+				throw std::logic_error("Unexpected frame");
+			}
+		}
+	}
 }
 
 ExpressionList Parser::parseArgumentList() {
@@ -413,13 +772,7 @@ ExpressionList Parser::parseArgumentList() {
 	while (true) {
 		Expression* arg = parseExpr();
 		args.push_back(arg);
-		if (matchIf(tok_comma)) {
-			continue;
-		}
-		if (lookahead() == tok_right_paren) {
-			break;
-		}
-		if (lookahead() == tok_right_brace) {
+		if (!matchIf(tok_comma)) {
 			break;
 		}
 	}
@@ -427,6 +780,10 @@ ExpressionList Parser::parseArgumentList() {
 }
 
 Statement* Parser::parseStatement() {
+	if (depth >= nestingLimit) {
+		return parseStatementIterative();
+	}
+	NestingGuard guard(depth);
 	switch (lookahead()) {
 	case kw_if:
 		return parseIfStatement();
@@ -520,12 +877,138 @@ Statement* Parser::parseExpressionStatement() {
 	return action.onExpressionStatement(e);
 }
 
+enum StmtFrameKind {
+	frame_block,
+	frame_if_pass,
+	frame_if_fail,
+	frame_while
+};
+
+// A statement whose sub-statements are still being parsed by the
+// explicit-stack statement parser.
+struct StmtFrame {
+	StmtFrameKind kind;
+	Expression* condition;
+	Statement* pass;
+	StatementList statements;
+};
+
+// Parses a statement without recursing on nested blocks, if and while
+// statements. Semantic actions run in the same order as for the recursive
+// parser.
+Statement* Parser::parseStatementIterative() {
+	std::vector<StmtFrame> frames;
+	auto finishBlock = [&]() {
+		action.finishBlock();
+		action.leaveScope();
+		match(tok_right_brace);
+		Statement* s = action.onBlockStatement(frames.back().statements);
+		frames.pop_back();
+		return s;
+	};
+
+	while (true) {
+		Statement* s;
+		switch (lookahead()) {
+		case kw_if: {
+			accept();
+			match(tok_left_paren);
+			Expression* e = parseExpr();
+			match(tok_right_paren);
+			frames.push_back({ frame_if_pass, e, nullptr, {} });
+			continue;
+		}
+		case kw_while: {
+			accept();
+			match(tok_left_paren);
+			Expression* e = parseExpr();
+			match(tok_right_paren);
+			frames.push_back({ frame_while, e, nullptr, {} });
+			continue;
+		}
+		case tok_left_brace:
+			match(tok_left_brace);
+			action.enterBlockScope();
+			action.startBlock();
+			frames.push_back({ frame_block, nullptr, nullptr, {} });
+			if (lookahead() != tok_right_brace && lookahead() != tok_eof) {
+				continue;
+			}
+			s = finishBlock();
+			break;
+		case kw_break:
+			s = parseBreakStatement();
+			break;
+		case kw_continue:
+			s = parseContinueStatement();
+			break;
+		case kw_return:
+			s = parseReturnStatement();
+			break;
+		case kw_var:
+		case kw_let:
+		case kw_def:
+			s = parseDeclarationStatement();
+			break;
+		default:
+			s = parseExpressionStatement();
+			break;
+		}
+
+		// Hand the finished statement to the enclosing frames, completing
+		// each one that no longer expects a sub-statement. A statement with
+		// errors is null and is left out of its block.
+		bool complete = true;
+		while (complete) {
+			if (frames.empty()) {
+				return s;
+			}
+			StmtFrame& f = frames.back();
+			switch (f.kind) {
+			case frame_block:
+				if (s) {
+					f.statements.push_back(s);
+				}
+				if (panic) {
+					recover();
+				}
+				if (lookahead() == tok_right_brace || lookahead() == tok_eof) {
+					s = finishBlock();
+				}
+				else {
+					complete = false;
+				}
+				break;
+			case frame_if_pass:
+				f.pass = s;
+				match(kw_else);
+				f.kind = frame_if_fail;
+				complete = false;
+				break;
+			case frame_if_fail:
+				s = action.onIfStatement(f.condition, f.pass, s);
+				frames.pop_back();
+				break;
+			case frame_while:
+				s = action.onWhileStatement(f.condition, s);
+				frames.pop_back();
+				break;
+			}
+		}
+	}
+}
+
 StatementList Parser::parseStatementSequence() {
 	StatementList s;
 	while (true) {
 		Statement* t = parseStatement();
-		s.push_back(t);
-		if (lookahead() == tok_right_brace) {
+		if (t) {
+			s.push_back(t);
+		}
+		if (panic) {
+			recover();
+		}
+		if (lookahead() == tok_right_brace || lookahead() == tok_eof) {
 			break;
 		}
 	}
@@ -535,7 +1018,8 @@ StatementList Parser::parseStatementSequence() {
 Declaration* Parser::parseDeclaration() {
 	switch (lookahead()) {
 	default:
-		throw std::runtime_error("Expected declaration");
+		error("expected declaration");
+		return nullptr;
 	case kw_def: {
 		TokenName name = lookahead(2);
 		if (name == tok_colon) {
@@ -544,7 +1028,8 @@ Declaration* Parser::parseDeclaration() {
 		if (name == tok_left_paren) {
 			return parseFunctionDefinition();
 		}
-		throw std::runtime_error("Improper declaration");
+		error("improper declaration");
+		return nullptr;
 	}
 	case kw_let:
 	case kw_var:
@@ -560,7 +1045,8 @@ Declaration* Parser::parseLocalDeclaration() {
 Declaration* Parser::parseObjectDefinition() {
 	switch (lookahead()) {
 	default:
-		throw std::runtime_error("Expected object definition");
+		error("expected object definition");
+		return nullptr;
 	case kw_def:
 		return parseValueDefinition();
 	case kw_let:
@@ -571,9 +1057,13 @@ Declaration* Parser::parseObjectDefinition() {
 }
 
 Declaration* Parser::parseVariableDefinition() {
+	TraceSpan span("Parser::parseVariableDefinition");
 	assert(lookahead() == kw_var);
 	accept();
 	Token id = match(tok_identifier);
+	if (id) {
+		span.setDetail(*id.getIdentifier());
+	}
 	match(tok_colon);
 	Type* t = parseType();
 	Declaration* d = action.onVariableDeclaration(id, t);
@@ -584,9 +1074,13 @@ Declaration* Parser::parseVariableDefinition() {
 }
 
 Declaration* Parser::parseConstantDefinition() {
+	TraceSpan span("Parser::parseConstantDefinition");
 	assert(lookahead() == kw_let);
 	accept();
 	Token id = match(tok_identifier);
+	if (id) {
+		span.setDetail(*id.getIdentifier());
+	}
 	match(tok_colon);
 	Type* t = parseType();
 	Declaration* d = action.onConstantDeclaration(id, t);
@@ -597,9 +1091,13 @@ Declaration* Parser::parseConstantDefinition() {
 }
 
 Declaration* Parser::parseValueDefinition() {
+	TraceSpan span("Parser::parseValueDefinition");
 	assert(lookahead() == kw_def);
 	accept();
 	Token id = match(tok_identifier);
+	if (id) {
+		span.setDetail(*id.getIdentifier());
+	}
 	match(tok_colon);
 	Type* t = parseType();
 	Declaration* d = action.onValueDeclaration(id, t);
@@ -610,9 +1108,13 @@ Declaration* Parser::parseValueDefinition() {
 }
 
 Declaration* Parser::parseFunctionDefinition() {
+	TraceSpan span("Parser::parseFunctionDefinition");
 	assert(lookahead() == kw_def);
 	accept();
 	Token id = match(tok_identifier);
+	if (id) {
+		span.setDetail(*id.getIdentifier());
+	}
 	match(tok_left_paren);
 	action.enterParameterScope();
 	DeclarationList parms;
@@ -624,6 +1126,17 @@ Declaration* Parser::parseFunctionDefinition() {
 	match(tok_arrow_operator);
 	Type* t = parseType();
 	Declaration* d = action.onFunctionDeclaration(id, parms, t);
+	if (lazy && lex.canRewind() && d && tok.size() == 1 && lookahead() == tok_left_brace) {
+		SkimmedBody body{ peek(), lex.getPosition() };
+		if (lex.skipBlock()) {
+			bodies.emplace(d, body);
+		}
+		tok.clear();
+		fetch();
+		++accepted;
+		previous = tok_right_brace;
+		return action.onFunctionDefinition(d, nullptr);
+	}
 	Statement* s = parseBlockStatement();
 	return action.onFunctionDefinition(d, s);
 }
@@ -657,14 +1170,109 @@ DeclarationList Parser::parseDeclarationSequence() {
 	DeclarationList dl;
 	while (peek()) {
 		Declaration* d = parseDeclaration();
-		dl.push_back(d);
+		if (d) {
+			dl.push_back(d);
+		}
+		if (panic) {
+			recoverDeclaration();
+		}
 	}
 	return dl;
 }
 
 Declaration* Parser::parseProgram() {
+	TraceSpan span("Parser::parseProgram");
+	PerfPhase phase(PerfCounters::parse_phase);
+	MemoryPhase memory("parse");
 	action.enterGlobalScope();
 	DeclarationList declarations = parseDeclarationSequence();
-	action.leaveScope();
-	return action.onProgram(declarations);
+	if (!lazy) {
+		action.leaveScope();
+	}
+	Declaration* program = action.onProgram(declarations);
+	// A prescan reports all lexical errors before any found by the parser.
+	diagnostics.sort();
+	return program;
+}
+
+// Parses and checks a body that was skimmed in lazy mode. The lexer is
+// rewound to the body and then returned to where it was.
+Statement* Parser::parseFunctionBody(Declaration* d) {
+	FunctionDeclaration* f = cast<FunctionDeclaration>(d);
+	auto iter = bodies.find(f);
+	if (iter == bodies.end()) {
+		return f->getBody();
+	}
+	SkimmedBody body = iter->second;
+	bodies.erase(iter);
+
+	Lexer::Position resume = lex.getPosition();
+	std::deque<Token> pending;
+	pending.swap(tok);
+	Statement* s = parseSkimmedBody(f, body);
+	lex.setPosition(resume);
+	tok.swap(pending);
+	return s;
+}
+
+// Bodies only read the global scope and the declarations in it, so each
+// worker parses and checks them with its own lexer and block scopes.
+// Diagnostics are collected per body and appended in source order once
+// all workers are done.
+void Parser::parseFunctionBodies(unsigned threads) {
+	TraceSpan span("Parser::parseFunctionBodies");
+	MemoryPhase memory("parse bodies");
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	std::vector<std::pair<const Declaration*, SkimmedBody>> work(bodies.begin(), bodies.end());
+	bodies.clear();
+	std::sort(work.begin(), work.end(), [](const auto& a, const auto& b) {
+		Location l = a.second.brace.getLocation();
+		Location r = b.second.brace.getLocation();
+		return l.line < r.line || (l.line == r.line && l.column < r.column);
+	});
+
+	Scope* globals = action.getCurrentScope();
+	std::vector<Diagnostics> reports(work.size());
+	std::atomic<std::size_t> next(0);
+	auto run = [&]() {
+		PerfPhase phase(PerfCounters::parse_phase);
+		Parser worker(*this, globals);
+		for (std::size_t i = next++; i < work.size(); i = next++) {
+			Declaration* d = const_cast<Declaration*>(work[i].first);
+			worker.parseSkimmedBody(d, work[i].second);
+			reports[i].append(worker.diagnostics);
+			worker.diagnostics.clear();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	threads = std::min<std::size_t>(threads, work.size());
+	for (unsigned i = 1; i < threads; ++i) {
+		pool.emplace_back(run);
+	}
+	run();
+	for (std::thread& t : pool) {
+		t.join();
+	}
+
+	for (const Diagnostics& r : reports) {
+		diagnostics.append(r);
+	}
+	diagnostics.sort();
+}
+
+Statement* Parser::parseSkimmedBody(Declaration* d, const SkimmedBody& body) {
+	TraceSpan span("Parser::parseSkimmedBody", *d->getName());
+	lex.setPosition(body.position);
+	tok.clear();
+	tok.push_back(body.brace);
+
+	action.resumeFunction(d);
+	Statement* s = parseBlockStatement();
+	action.onFunctionDefinition(d, s);
+	panic = false;
+	return s;
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #pragma once
+#include "Diagnostics.h"
 #include "Lexer.h"
 #include "Semantics.h"
+#include "SmallVector.h"
 
 #include <deque>
+#include <unordered_map>
 #include <vector>
 
 class Type;
@@ -11,15 +14,41 @@ class Statement;
 class Declaration;
 class Program;
 
-using TypeList = std::vector<Type*>;
-using ExpressionList = std::vector<Expression*>;
-using StatementList = std::vector<Statement*>;
-using DeclarationList = std::vector<Declaration*>;
+using TypeList = SmallVector<Type*, 4>;
+using ExpressionList = SmallVector<Expression*, 4>;
+using StatementList = SmallVector<Statement*, 8>;
+using DeclarationList = SmallVector<Declaration*, 4>;
 
 class Parser {
 public:
 	Parser(SymbolTable& symbols, const File& file);
 
+	// Parses input as it is read. Function bodies are never skimmed.
+	Parser(SymbolTable& symbols, Stream& in);
+
+	// Parses file from the tokens saved in cache.
+	Parser(SymbolTable& symbols, const File& file, const TokenCache& cache);
+	~Parser();
+
+	// Nesting deeper than this is parsed with an explicit stack instead
+	// of native recursion.
+	void setNestingLimit(int n) { nestingLimit = n; }
+
+	// When set, function bodies are skimmed over and only parsed and
+	// checked when requested with parseFunctionBody.
+	void setLazyBodies(bool b) { lazy = b; }
+
+	// Lexes the whole input up front on the given number of threads. Must
+	// be called before parsing starts.
+	void prescan(unsigned threads = 0) { lex.prescan(threads); }
+
+	// Lexes the rest of the input on another thread while parsing. Function
+	// bodies are never skimmed.
+	void startLexerThread() { lex.startThread(); }
+
+	// Syntax and semantic errors found so far.
+	const Diagnostics& getDiagnostics() const { return diagnostics; }
+
 	Type* parseType();
 	Type* parseBasicType();
 
@@ -40,6 +69,7 @@ public:
 	Expression* parseUnaryExpr();
 	Expression* parsePostfixExpr();
 	Expression* parsePrimaryExpr();
+	Expression* parseConditionalExprIterative();
 
 	ExpressionList parseArgumentList();
 
@@ -52,6 +82,7 @@ public:
 	Statement* parseReturnStatement();
 	Statement* parseDeclarationStatement();
 	Statement* parseExpressionStatement();
+	Statement* parseStatementIterative();
 	
 	StatementList parseStatementSequence();
 
@@ -70,7 +101,17 @@ public:
 
 	Declaration* parseProgram();
 
+	Statement* parseFunctionBody(Declaration* d);
+
+	// Parses every skimmed body, spreading the work over the given number
+	// of threads (by default one per hardware thread). Diagnostics are
+	// kept in source order.
+	void parseFunctionBodies(unsigned threads = 0);
+
 private:
+	// Creates a parser for bodies of p on another thread.
+	Parser(const Parser& p, Scope* globals);
+
 	TokenName lookahead();
 	TokenName lookahead(int n);
 	Token match(TokenName name);
@@ -85,14 +126,46 @@ private:
 	Token matchShift();
 	Token matchAdditive();
 	Token matchMultiplicative();
+	Token matchUnary();
+
+	void error(const std::string& msg);
+	void recover();
+	void recoverDeclaration();
 
 	Token accept();
 	Token peek();
 	void fetch();
 
+	Diagnostics diagnostics;
+
 	Lexer lex;
 
 	std::deque<Token> tok;
 
+	// The most tokens tok has held, for the memory profile.
+	std::size_t tokPeak;
+
+	// Set by a syntax error until the parser has skipped to the end of the
+	// statement or declaration containing it; further errors are not
+	// reported meanwhile.
+	bool panic;
+	std::size_t accepted;
+	std::size_t errorPoint;
+	TokenName previous;
+
 	Semantics action;
+
+	int depth;
+	int nestingLimit;
+
+	// A function body that has not been parsed yet.
+	struct SkimmedBody {
+		Token brace;
+		Lexer::Position position;
+	};
+
+	Statement* parseSkimmedBody(Declaration* d, const SkimmedBody& body);
+
+	bool lazy;
+	std::unordered_map<const Declaration*, SkimmedBody> bodies;
 };
\ No newline at end of file
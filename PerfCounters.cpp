@@ -0,0 +1,195 @@
+#include "stdafx.h"
+#include "PerfCounters.h"
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PERF_USE_RDPMC 1
+#endif
+#endif
+
+std::atomic<bool> PerfCounters::enabled(false);
+
+static std::atomic<std::uint64_t> perfTotals[PerfCounters::phase_count][PerfCounters::event_count];
+
+// Whether any thread could open each event.
+static std::atomic<bool> perfCounted[PerfCounters::event_count];
+
+static const char* const perfPhaseNames[PerfCounters::phase_count] = {
+	"lex", "parse", "semantics", "codegen"
+};
+
+static const char* const perfEventNames[PerfCounters::event_count] = {
+	"cycles", "instructions", "branch-misses", "llc-misses"
+};
+
+#ifdef __linux__
+static const std::uint64_t perfConfigs[PerfCounters::event_count] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES
+};
+
+// One event counted for the calling thread in user mode. Where the kernel
+// allows it, the counter is read with rdpmc through its mapped page rather
+// than with a system call, so that switching phases stays cheap.
+struct PerfCounter {
+	PerfCounter()
+		: fd(-1), page(nullptr) {}
+
+	~PerfCounter() {
+		if (page) {
+			munmap(page, sysconf(_SC_PAGESIZE));
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	bool open(std::uint64_t config) {
+		perf_event_attr a;
+		std::memset(&a, 0, sizeof a);
+		a.size = sizeof a;
+		a.type = PERF_TYPE_HARDWARE;
+		a.config = config;
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		fd = static_cast<int>(syscall(SYS_perf_event_open, &a, 0, -1, -1, 0));
+		if (fd < 0) {
+			return false;
+		}
+		void* p = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) {
+			page = static_cast<perf_event_mmap_page*>(p);
+		}
+		return true;
+	}
+
+	std::uint64_t read() const {
+#ifdef PERF_USE_RDPMC
+		if (page) {
+			// The kernel updates the page under a sequence count; retry
+			// until the fields are read without an update in between.
+			std::uint32_t seq;
+			std::uint32_t index;
+			std::uint64_t count;
+			do {
+				seq = page->lock;
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+				index = page->cap_user_rdpmc ? page->index : 0;
+				count = page->offset;
+				if (index) {
+					unsigned shift = 64 - page->pmc_width;
+					std::uint64_t pmc = static_cast<std::uint64_t>(__rdpmc(index - 1)) << shift;
+					count += static_cast<std::int64_t>(pmc) >> shift;
+				}
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+			} while (page->lock != seq);
+			if (index) {
+				return count;
+			}
+		}
+#endif
+		std::uint64_t v = 0;
+		if (::read(fd, &v, sizeof v) != sizeof v) {
+			return 0;
+		}
+		return v;
+	}
+
+	int fd;
+	perf_event_mmap_page* page;
+};
+#else
+struct PerfCounter {
+	bool open(std::uint64_t) { return false; }
+	std::uint64_t read() const { return 0; }
+
+	int fd = -1;
+};
+#endif
+
+// The counters of one thread, opened the first time it enters a phase.
+struct PerfThread {
+	PerfThread()
+		: phase(PerfCounters::no_phase) {
+		for (int e = 0; e < PerfCounters::event_count; ++e) {
+#ifdef __linux__
+			if (counters[e].open(perfConfigs[e])) {
+				perfCounted[e].store(true, std::memory_order_relaxed);
+			}
+#endif
+			last[e] = 0;
+		}
+	}
+
+	PerfCounter counters[PerfCounters::event_count];
+	std::uint64_t last[PerfCounters::event_count];
+	PerfCounters::Phase phase;
+};
+
+static thread_local PerfThread perfThread;
+
+void PerfCounters::start() {
+	for (auto& phase : perfTotals) {
+		for (auto& total : phase) {
+			total.store(0, std::memory_order_relaxed);
+		}
+	}
+	enabled.store(true, std::memory_order_relaxed);
+}
+
+PerfCounters::Phase PerfCounters::enter(Phase p) {
+	PerfThread& t = perfThread;
+	Phase previous = t.phase;
+	for (int e = 0; e < event_count; ++e) {
+		if (t.counters[e].fd < 0) {
+			continue;
+		}
+		std::uint64_t v = t.counters[e].read();
+		if (previous != no_phase) {
+			perfTotals[previous][e].fetch_add(v - t.last[e], std::memory_order_relaxed);
+		}
+		t.last[e] = v;
+	}
+	t.phase = p;
+	return previous;
+}
+
+void PerfCounters::report(std::ostream& os) {
+	std::ios::fmtflags flags = os.flags();
+	os << std::left << std::setw(12) << "phase" << std::right;
+	for (const char* name : perfEventNames) {
+		os << std::setw(16) << name;
+	}
+	os << std::setw(8) << "IPC" << '\n';
+
+	bool ipc = perfCounted[cycles] && perfCounted[instructions];
+	for (int p = 0; p < phase_count; ++p) {
+		os << std::left << std::setw(12) << perfPhaseNames[p] << std::right;
+		for (int e = 0; e < event_count; ++e) {
+			if (perfCounted[e]) {
+				os << std::setw(16) << perfTotals[p][e].load(std::memory_order_relaxed);
+			}
+			else {
+				os << std::setw(16) << "";
+			}
+		}
+		std::uint64_t c = perfTotals[p][cycles].load(std::memory_order_relaxed);
+		if (ipc && c) {
+			double i = static_cast<double>(perfTotals[p][instructions].load(std::memory_order_relaxed));
+			os << std::setw(8) << std::fixed << std::setprecision(2) << i / c;
+		}
+		os << '\n';
+	}
+	os.flags(flags);
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <iosfwd>
+
+// Counts hardware events for each phase of the compiler with Linux
+// perf_event_open. Nothing is counted until start is called, and other
+// systems never count. Phases nest, and each is charged only for the
+// events outside the phases entered within it, so semantic actions run by
+// the parser are not also charged to parsing. Lexing on demand is part of
+// parsing; prescan or a lexer thread keep it separate.
+class PerfCounters {
+public:
+	enum Phase {
+		lex_phase,
+		parse_phase,
+		semantics_phase,
+		codegen_phase,
+		phase_count,
+		no_phase = phase_count
+	};
+
+	enum Event {
+		cycles,
+		instructions,
+		branch_misses,
+		cache_misses,
+		event_count
+	};
+
+	// Begins counting on threads that enter a phase from now on.
+	static void start();
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Charges the events since the calling thread last changed phase to the
+	// phase it was in, and moves it to p. Returns the phase it was in.
+	static Phase enter(Phase p);
+
+	// Prints the events and instructions per cycle of each phase. Events
+	// the machine cannot count are left blank.
+	static void report(std::ostream& os);
+
+private:
+	static std::atomic<bool> enabled;
+};
+
+// Counts the events between its construction and destruction for a phase.
+class PerfPhase {
+public:
+	explicit PerfPhase(PerfCounters::Phase p)
+		: active(PerfCounters::isEnabled()),
+		previous(active ? PerfCounters::enter(p) : PerfCounters::no_phase) {}
+
+	PerfPhase(const PerfPhase&) = delete;
+	PerfPhase& operator=(const PerfPhase&) = delete;
+
+	~PerfPhase() {
+		if (active) {
+			PerfCounters::enter(previous);
+		}
+	}
+
+private:
+	bool active;
+	PerfCounters::Phase previous;
+};
\ No newline at end of file
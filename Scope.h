@@ -1,13 +1,23 @@
 #pragma once
 #include "Symbol.h"
+#include "MemoryProfile.h"
 #include <cassert>
 #include <unordered_map>
 
 class Declaration;
 
 struct Scope : std::unordered_map<Symbol, Declaration*> {
-	Scope(Scope* s = nullptr)
-		: parent(s) {}
+	enum Kind {
+		global_kind,
+		parameter_kind,
+		block_kind
+	};
+
+	Scope(Kind k, Scope* s = nullptr)
+		: kind(k), parent(s) { MemoryProfile::countNode(MemoryProfile::scopes, k); }
+
+	static void* operator new(std::size_t n) { return MemoryProfile::allocate(n); }
+	static void operator delete(void* p) { ::operator delete(p); }
 
 	virtual ~Scope() = default;
 
@@ -21,17 +31,29 @@ struct Scope : std::unordered_map<Symbol, Declaration*> {
 		emplace(s, d);
 	}
 
+	Kind getKind() const { return kind; }
+
+	Kind kind;
 	Scope* parent;
 };
 
 struct GlobalScope : Scope {
-	using Scope::Scope;
+	GlobalScope()
+		: Scope(global_kind) {}
+
+	static bool classof(const Scope* n) { return n->getKind() == global_kind; }
 };
 
 struct ParamenterScope : Scope {
-	using Scope::Scope;
+	ParamenterScope(Scope* s)
+		: Scope(parameter_kind, s) {}
+
+	static bool classof(const Scope* n) { return n->getKind() == parameter_kind; }
 };
 
 struct BlockScope : Scope {
-	using Scope::Scope;
+	BlockScope(Scope* s)
+		: Scope(block_kind, s) {}
+
+	static bool classof(const Scope* n) { return n->getKind() == block_kind; }
 };
\ No newline at end of file
@@ -5,23 +5,51 @@
 #include "Statement.h"
 #include "Declaration.h"
 #include "Scope.h"
-
+#include "Diagnostics.h"
+#include "ConstantEvaluator.h"
+#include "Casting.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <sstream>
 
-Semantics::Semantics()
-	: scope(nullptr),
+Semantics::Semantics(Diagnostics& d)
+	: diagnostics(d),
+	scope(nullptr),
+	shared(nullptr),
 	function(nullptr),
+	started(-1),
+	globals(0),
 	_bool(new BoolType()),
 	_char(new CharType()),
 	_int(new IntType()),
 	_float(new FloatType()) {}
 
+Semantics::Semantics(Diagnostics& d, Scope* globals)
+	: Semantics(d) {
+	scope = globals;
+	shared = globals;
+}
+
 Semantics::~Semantics() {
-	assert(!scope);
+	assert(scope == shared);
 	assert(!function);
 }
 
+// Reports an error and yields a null node. Actions given a null operand
+// return null without a further report, so that one mistake produces
+// one error.
+std::nullptr_t Semantics::error(const std::string& msg) {
+	diagnostics.error(location, msg);
+	return nullptr;
+}
+
 Type* Semantics::onBasicType(Token t) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	switch (t.getTypeSpecifier()) {
 	case type_bool:
 		return _bool;
@@ -35,53 +63,86 @@ Type* Semantics::onBasicType(Token t) {
 }
 
 Expression* Semantics::onAssignmentExpression(Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireReference(e1);
 	e2 = requireValue(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 
 	Type* t1 = e1->getObjectType();
 	Type* t2 = e2->getType();
-	requireSame(t1, t2);
+	if (!requireSame(t1, t2)) {
+		return nullptr;
+	}
 
 	return new AssignmentExpression(e1->getType(), e1, e2);
 }
 
 Expression* Semantics::onConditationalExpression(Expression* e1, Expression* e2, Expression* e3) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireBoolean(e1);
+	if (!e1 || !e2 || !e3) {
+		return nullptr;
+	}
 
 	Type* t = commonType(e1->getType(), e2->getType());
 	e2 = convertToType(e2, t);
 	e3 = convertToType(e3, t);
+	if (!e2 || !e3) {
+		return nullptr;
+	}
 
 	return new ConditionalExpression(t, e1, e2, e3);
 }
 
 Expression* Semantics::onLogicalOrExpression(Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireBoolean(e1);
 	e2 = requireBoolean(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	return new BinopExpression(_bool, bo_lor, e1, e2);
 }
 
 Expression* Semantics::onLogicalAndExpression(Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireBoolean(e1);
 	e2 = requireBoolean(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	return new BinopExpression(_bool, bo_land, e1, e2);
 }
 
 Expression* Semantics::onBitwiseOrExpression(Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireInteger(e1);
 	e2 = requireInteger(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	return new BinopExpression(_int, bo_ior, e1, e2);
 }
 
 Expression* Semantics::onBitwiseXOrExpression(Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireInteger(e1);
 	e2 = requireInteger(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	return new BinopExpression(_int, bo_xor, e1, e2);
 }
 
 Expression* Semantics::onBitwiseAndExpression(Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireInteger(e1);
 	e2 = requireInteger(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	return new BinopExpression(_int, bo_and, e1, e2);
 }
 
@@ -97,15 +158,23 @@ static binop getRelationalOperator(RelationalOperator r) {
 }
 
 Expression* Semantics::onEqualityExpression(Token t, Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireScalar(e1);
 	e2 = requireScalar(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	RelationalOperator r = t.getRelationalOperator();
 	return new BinopExpression(_bool, getRelationalOperator(r), e1, e2);
 }
 
 Expression* Semantics::onRelationalExpression(Token t, Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireNumeric(e1);
 	e2 = requireNumeric(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	RelationalOperator r = t.getRelationalOperator();
 	return new BinopExpression(_bool, getRelationalOperator(r), e1, e2);
 }
@@ -123,8 +192,12 @@ static binop getBitwiseOperator(BitwiseOperator b) {
 }
 
 Expression* Semantics::onShiftExpression(Token t, Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireInteger(e1);
 	e2 = requireInteger(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	BitwiseOperator b = t.getBitwiseOperator();
 	return new BinopExpression(_int, getBitwiseOperator(b), e1, e2);
 }
@@ -141,25 +214,47 @@ static binop getArithmeticOperator(ArithmeticOperator a) {
 }
 
 Expression* Semantics::onAdditiveExpression(Token t, Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireArithmetic(e1);
 	e2 = requireArithmetic(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	Type* y = requireSame(e1->getType(), e2->getType());
+	if (!y) {
+		return nullptr;
+	}
 
 	ArithmeticOperator a = t.getArithmeticOperator();
 	return new BinopExpression(y, getArithmeticOperator(a), e1, e2);
 }
 
 Expression* Semantics::onMultiplicativeExpression(Token t, Expression* e1, Expression* e2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e1 = requireArithmetic(e1);
 	e2 = requireArithmetic(e2);
+	if (!e1 || !e2) {
+		return nullptr;
+	}
 	Type* y = requireSame(e1->getType(), e2->getType());
+	if (!y) {
+		return nullptr;
+	}
 
 	ArithmeticOperator a = t.getArithmeticOperator();
 	return new BinopExpression(y, getArithmeticOperator(a), e1, e2);
 }
 
 Expression* Semantics::onCastExpression(Expression* e, Type* t) {
-	return new CastExpression(convertToType(e, t), t);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!t) {
+		return nullptr;
+	}
+	e = convertToType(e, t);
+	if (!e) {
+		return nullptr;
+	}
+	return new CastExpression(e, t);
 }
 
 static unop getUnaryOperator(Token t) {
@@ -169,11 +264,15 @@ static unop getUnaryOperator(Token t) {
 			return uo_pos;
 		else if (t.getArithmeticOperator() == op_sub)
 			return uo_neg;
+		else if (t.getArithmeticOperator() == op_mul)
+			return uo_deref;
 		else
 			throw std::logic_error("invalid operator");
 	case tok_bitwise_operator:
 		if (t.getBitwiseOperator() == op_bitNot)
 			return uo_cmp;
+		else if (t.getBitwiseOperator() == op_bitAnd)
+			return uo_addr;
 		else
 			throw std::logic_error("invalid operator");
 	case tok_logical_operator:
@@ -188,13 +287,14 @@ static unop getUnaryOperator(Token t) {
 }
 
 Expression* Semantics::onUnaryExpression(Token t, Expression* e) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	unop u = getUnaryOperator(t);
 	Type* y;
 	switch (u) {
 	case uo_pos:
 	case uo_neg:
 		e = requireArithmetic(e);
-		y = e->getType();
+		y = e ? e->getType() : nullptr;
 		break;
 	case uo_cmp:
 		e = requireInteger(e);
@@ -207,28 +307,35 @@ Expression* Semantics::onUnaryExpression(Token t, Expression* e) {
 	case uo_addr:
 	case uo_deref:
 		//todo
-		break;
+		return error("Pointer operators are not supported");
+	}
+	if (!e) {
+		return nullptr;
 	}
-	return new UnopExpression(u, e);
+	return new UnopExpression(y, u, e);
 }
 
 Expression* Semantics::onCallExpression(Expression* e, const ExpressionList& args) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	e = requireFunction(e);
-	FunctionType* t = static_cast<FunctionType*>(e->getType());
+	if (!e || std::count(args.begin(), args.end(), nullptr)) {
+		return nullptr;
+	}
+	FunctionType* t = cast<FunctionType>(e->getType());
 
 	TypeList& parameters = t->getParamTypes();
 	if (parameters.size() < args.size()) {
-		throw std::runtime_error("Too many arguments");
+		return error("Too many arguments");
 	}
 	if (args.size() < parameters.size()) {
-		throw std::runtime_error("Too few arguments");
+		return error("Too few arguments");
 	}
 
 	for (size_t i = 0; i != parameters.size(); i++) {
 		Type* p = parameters[i];
 		Expression* a = args[i];
 		if (!a->hasType(p)) {
-			throw std::runtime_error("Argument does not match type");
+			return error("Argument does not match type");
 		}
 	}
 
@@ -236,22 +343,24 @@ Expression* Semantics::onCallExpression(Expression* e, const ExpressionList& arg
 }
 
 Expression* Semantics::onIndexExpression(Expression* e, const ExpressionList& args) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	//todo
 	return {};
 }
 
 Expression* Semantics::onIdExpression(Token t) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	Symbol s = t.getIdentifier();
 
 	Declaration* d = lookup(s);
 	if (!d) {
 		std::stringstream ss;
 		ss << "No matching declaration for '" << *s << "'";
-		throw std::runtime_error(ss.str());
+		return error(ss.str());
 	}
 
 	Type* y;
-	TypedDeclaration* td = dynamic_cast<TypedDeclaration*>(d);
+	TypedDeclaration* td = cast<TypedDeclaration>(d);
 	if (td->isVariable()) {
 		y = new ReferenceType(td->getType());
 	}
@@ -263,28 +372,47 @@ Expression* Semantics::onIdExpression(Token t) {
 }
 
 Expression* Semantics::onIntegerLiteral(Token t) {
-	int val = t.getInteger();
-	return new IntExpression(_int, val);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	long long val = t.getInteger();
+	// Binary and hexadecimal literals hold unsigned bit patterns, so any
+	// that fits in 32 bits is taken as the int with those bits.
+	if (t.getRadix() != dec) {
+		unsigned long long bits = static_cast<unsigned long long>(val);
+		if (bits > std::numeric_limits<std::uint32_t>::max()) {
+			return error("Integer literal does not fit in int");
+		}
+		return new IntExpression(_int, static_cast<int>(static_cast<std::uint32_t>(bits)));
+	}
+	if (val < std::numeric_limits<int>::min() || val > std::numeric_limits<int>::max()) {
+		return error("Integer literal does not fit in int");
+	}
+	return new IntExpression(_int, static_cast<int>(val));
 }
 
 Expression* Semantics::onBooleanLiteral(Token t) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	int val = t.getBool();
 	return new BoolExpression(_bool, val);
 }
 
 Expression* Semantics::onFloatLiteral(Token t) {
-	int val = t.getFloatingPoint();
+	PerfPhase phase(PerfCounters::semantics_phase);
+	double val = t.getFloatingPoint();
 	return new FloatExpression(_float, val);
 }
 
 Statement* Semantics::onBlockStatement(const StatementList& s) {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	return new BlockStatement(s);
 }
 
 void Semantics::startBlock() {
 	Scope* parent = getCurrentScope()->parent;
-	if (dynamic_cast<GlobalScope*>(parent)) {
+	if (isa<GlobalScope>(parent)) {
 		FunctionDeclaration* function = getCurrentFunction();
+		if (!function) {
+			return;
+		}
 		for (Declaration* param : function->getParameters()) {
 			declare(param);
 		}
@@ -296,30 +424,52 @@ void Semantics::finishBlock() {
 }
 
 Statement* Semantics::onIfStatement(Expression* e, Statement* s1, Statement* s2) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!e || !s1 || !s2) {
+		return nullptr;
+	}
 	return new IfStatement(e, s1, s2);
 }
 
 Statement* Semantics::onWhileStatement(Expression* e, Statement* s) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!e || !s) {
+		return nullptr;
+	}
 	return new WhileStatement(e, s);
 }
 
 Statement* Semantics::onBreakStatement() {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	return new BreakStatement();
 }
 
 Statement* Semantics::onContinueStatement() {
+	PerfPhase phase(PerfCounters::semantics_phase);
 	return new ContinueStatement();
 }
 
 Statement* Semantics::onReturnStatement(Expression* e) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!e) {
+		return nullptr;
+	}
 	return new ReturnStatement(e);
 }
 
 Statement* Semantics::onDeclareStatement(Declaration* d) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!d) {
+		return nullptr;
+	}
 	return new DeclareStatement(d);
 }
 
 Statement* Semantics::onExpressionStatement(Expression* e) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!e) {
+		return nullptr;
+	}
 	return new ExpressionStatement(e);
 }
 
@@ -327,49 +477,99 @@ void Semantics::declare(Declaration* d) {
 	Scope* s = getCurrentScope();
 	if (s->lookup(d->getName())) {
 		std::stringstream ss;
-		ss << "Redeclaration of '" << d->getName() << "' unallowed.";
-		throw std::runtime_error(ss.str());
+		ss << "Redeclaration of '" << *d->getName() << "' unallowed.";
+		error(ss.str());
+		return;
 	}
 	s->declare(d->getName(), d);
+
+	// Parameters are numbered by their function, and declared again in
+	// its outermost block.
+	if (isa<ParameterDeclaration>(d)) {
+		return;
+	}
+	if (isa<GlobalScope>(s)) {
+		d->setIndex(globals++, false);
+	}
+	else if (function) {
+		d->setIndex(function->addLocal(), true);
+	}
 }
 
 Declaration* Semantics::onVariableDeclaration(Token t, Type* y) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!t || !y) {
+		return nullptr;
+	}
 	Declaration* var = new VariableDeclaration(t.getIdentifier(), y);
 	declare(var);
 	return var;
 }
 
 Declaration* Semantics::onVariableDefinition(Declaration* d, Expression* e) {
-	VariableDeclaration* var = static_cast<VariableDeclaration*>(d);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!d) {
+		return nullptr;
+	}
+	VariableDeclaration* var = cast<VariableDeclaration>(d);
+	if (!var->isLocal()) {
+		e = requireConstant(e, var->getType()->getObjectType());
+	}
 	var->setInit(e);
 	return var;
 }
 
 Declaration* Semantics::onConstantDeclaration(Token t, Type* y) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!t || !y) {
+		return nullptr;
+	}
 	Declaration* var = new ConstantDeclaration(t.getIdentifier(), y);
 	declare(var);
 	return var;
 }
 
 Declaration* Semantics::onConstantDefinition(Declaration* d, Expression* e) {
-	ConstantDeclaration* var = static_cast<ConstantDeclaration*>(d);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!d) {
+		return nullptr;
+	}
+	ConstantDeclaration* var = cast<ConstantDeclaration>(d);
+	if (!var->isLocal()) {
+		e = requireConstant(e, var->getType()->getObjectType());
+	}
 	var->setInit(e);
 	return var;
 }
 
 Declaration* Semantics::onValueDeclaration(Token t, Type* y) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!t || !y) {
+		return nullptr;
+	}
 	Declaration* var = new ValueDeclaration(t.getIdentifier(), y);
 	declare(var);
 	return var;
 }
 
 Declaration* Semantics::onValueDefinition(Declaration* d, Expression* e) {
-	ValueDeclaration* var = static_cast<ValueDeclaration*>(d);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!d) {
+		return nullptr;
+	}
+	ValueDeclaration* var = cast<ValueDeclaration>(d);
+	if (!var->isLocal()) {
+		e = requireConstant(e, var->getType()->getObjectType());
+	}
 	var->setInit(e);
 	return var;
 }
 
 Declaration* Semantics::onParameterDeclaration(Token t, Type* y) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!t || !y) {
+		return nullptr;
+	}
 	Declaration* param = new ParameterDeclaration(t.getIdentifier(), y);
 	declare(param);
 	return param;
@@ -378,35 +578,60 @@ Declaration* Semantics::onParameterDeclaration(Token t, Type* y) {
 static TypeList getParameterTypes(const DeclarationList& d) {
 	TypeList types;
 	for (const Declaration* decl : d) {
-		types.push_back(static_cast<const ParameterDeclaration*>(decl)->getType());
+		types.push_back(cast<ParameterDeclaration>(decl)->getType());
 	}
 	return types;
 }
 
 Declaration* Semantics::onFunctionDeclaration(Token t, const DeclarationList& params, Type* y) {
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!t || !y || std::count(params.begin(), params.end(), nullptr)) {
+		return nullptr;
+	}
 	FunctionType* ft = new FunctionType(getParameterTypes(params), y);
 	FunctionDeclaration* fd = new FunctionDeclaration(t.getIdentifier(), ft, params);
 	fd->setType(ft);
 	declare(fd);
+	for (Declaration* param : params) {
+		param->setIndex(fd->addLocal(), true);
+	}
 
 	assert(!function);
 	function = fd;
+	started = Trace::isEnabled() ? Trace::now() : -1;
 
 	return fd;
 }
 
 Declaration* Semantics::onFunctionDefinition(Declaration* d, Statement* s) {
-	FunctionDeclaration* f = static_cast<FunctionDeclaration*>(d);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	if (!d) {
+		return nullptr;
+	}
+	FunctionDeclaration* f = cast<FunctionDeclaration>(d);
 	f->setBody(s);
 
 	assert(function == f);
 	function = nullptr;
+	if (started >= 0) {
+		Trace::record("Semantics function", *f->getName(), started, Trace::now());
+	}
 
 	return f;
 }
 
+// Re-enters a function whose body was skipped so that it can be parsed
+// against the global scope.
+void Semantics::resumeFunction(Declaration* d) {
+	assert(!function);
+	assert(isa<GlobalScope>(scope));
+	function = cast<FunctionDeclaration>(d);
+	started = Trace::isEnabled() ? Trace::now() : -1;
+}
+
 Declaration* Semantics::onProgram(const DeclarationList& d) {
-	return new ProgramDeclaration(d);
+	PerfPhase phase(PerfCounters::semantics_phase);
+	return new ProgramDeclaration(d, globals);
 }
 
 void Semantics::enterGlobalScope() {
@@ -423,6 +648,7 @@ void Semantics::enterBlockScope() {
 }
 
 void Semantics::leaveScope() {
+	assert(scope != shared);
 	Scope* s = scope;
 	scope = s->parent;
 	delete s;
@@ -440,9 +666,12 @@ Declaration* Semantics::lookup(Symbol s) {
 }
 
 Expression* Semantics::requireReference(Expression* e) {
+	if (!e) {
+		return nullptr;
+	}
 	Type* t = e->getType();
 	if (!t->isReference()) {
-		throw std::runtime_error("Expected a reference type");
+		return error("Expected a reference type");
 	}
 	return e;
 }
@@ -453,24 +682,47 @@ Expression* Semantics::requireValue(Expression* e) {
 
 Expression* Semantics::requireArithmetic(Expression* e) {
 	e = requireValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	if (!e->isArithmetic()) {
-		throw std::runtime_error("Expected an arithmetic expression");
+		return error("Expected an arithmetic expression");
 	}
 	return e;
 }
 
 Expression* Semantics::requireNumeric(Expression* e) {
 	e = requireValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	if (!e->isNumeric()) {
-		throw std::runtime_error("Expected a numeric expression");
+		return error("Expected a numeric expression");
 	}
 	return e;
 }
 
 Expression* Semantics::requireScalar(Expression* e) {
 	e = requireValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	if (!e->isScalar()) {
-		throw std::runtime_error("Expected a scalar expression");
+		return error("Expected a scalar expression");
+	}
+	return e;
+}
+
+// Globals are given their values before the program runs, so their
+// initializers must be constants of the declared type.
+Expression* Semantics::requireConstant(Expression* e, Type* t) {
+	e = convertToType(e, t);
+	if (!e) {
+		return nullptr;
+	}
+	ConstantValue v;
+	if (!evaluateConstant(e, v) || (v.kind == Type::float_kind && !std::isfinite(v.real))) {
+		return error("Expected a constant expression");
 	}
 	return e;
 }
@@ -478,31 +730,37 @@ Expression* Semantics::requireScalar(Expression* e) {
 Expression* Semantics::requireInteger(Expression* e)
 {
 	e = requireValue(e);
+	if (!e)
+		return nullptr;
 	if (!e->isInt())
-		throw std::runtime_error("Expected an integer expression");
+		return error("Expected an integer expression");
 	return e;
 }
 
 Expression* Semantics::requireBoolean(Expression* e)
 {
 	e = requireValue(e);
+	if (!e)
+		return nullptr;
 	if (!e->isBool())
-		throw std::runtime_error("Expected a boolean expression");
+		return error("Expected a boolean expression");
 	return e;
 }
 
 Expression* Semantics::requireFunction(Expression* e)
 {
 	e = requireValue(e);
+	if (!e)
+		return nullptr;
 	if (!e->isFunction())
-		throw std::runtime_error("Expected a function");
+		return error("Expected a function");
 	return e;
 }
 
 Type* Semantics::requireSame(Type* t1, Type* t2)
 {
 	if (!areSame(t1, t2))
-		throw std::runtime_error("Type mismatch");
+		return error("Type mismatch");
 	return t1;
 }
 
@@ -515,10 +773,13 @@ Type* Semantics::commonType(Type* t1, Type* t2)
 		return t2;
 	if (t2->isReferenceTo(t1))
 		return t1;
-	throw std::runtime_error("No common type");
+	return error("No common type");
 }
 
 Expression* Semantics::convertToValue(Expression* e) {
+	if (!e) {
+		return nullptr;
+	}
 	Type* t = e->getType();
 	if (t->isReference()) {
 		return new ConversionExpression(e, conv_value, t->getObjectType());
@@ -528,6 +789,9 @@ Expression* Semantics::convertToValue(Expression* e) {
 
 Expression* Semantics::convertToBool(Expression* e) {
 	e = convertToValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	Type* t = e->getType();
 	switch (t->getKind()) {
 	case Type::bool_kind:
@@ -539,12 +803,15 @@ Expression* Semantics::convertToBool(Expression* e) {
 	case Type::function_kind:
 		return new ConversionExpression(e, conv_bool, _bool);
 	default:
-		throw std::runtime_error("Cannot convert to bool");
+		return error("Cannot convert to bool");
 	}
 }
 
 Expression* Semantics::convertToChar(Expression* e) {
 	e = convertToValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	Type* t = e->getType();
 	switch (t->getKind()) {
 	case Type::char_kind:
@@ -552,12 +819,15 @@ Expression* Semantics::convertToChar(Expression* e) {
 	case Type::int_kind:
 		return new ConversionExpression(e, conv_char, _char);
 	default:
-		throw std::runtime_error("Cannot convert to char");
+		return error("Cannot convert to char");
 	}
 }
 
 Expression* Semantics::convertToInt(Expression* e) {
 	e = convertToValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	Type* t = e->getType();
 	switch (t->getKind()) {
 	case Type::int_kind:
@@ -568,12 +838,15 @@ Expression* Semantics::convertToInt(Expression* e) {
 	case Type::float_kind:
 		return new ConversionExpression(e, conv_trunc, _int);
 	default:
-		throw std::runtime_error("Cannot convert to int");
+		return error("Cannot convert to int");
 	}
 }
 
 Expression* Semantics::convertToFloat(Expression* e) {
 	e = convertToValue(e);
+	if (!e) {
+		return nullptr;
+	}
 	Type* t = e->getType();
 	switch (t->getKind()) {
 	case Type::int_kind:
@@ -581,11 +854,14 @@ Expression* Semantics::convertToFloat(Expression* e) {
 	case Type::float_kind:
 		return e;
 	default:
-		throw std::runtime_error("Cannot convert to float");
+		return error("Cannot convert to float");
 	}
 }
 
 Expression* Semantics::convertToType(Expression* e, Type* t) {
+	if (!e || !t) {
+		return nullptr;
+	}
 	if (t->isObject()) {
 		e = convertToValue(e);
 	}
@@ -604,6 +880,6 @@ Expression* Semantics::convertToType(Expression* e, Type* t) {
 	case Type::float_kind:
 		return convertToFloat(e);
 	default:
-		throw std::runtime_error("Cannot convert");
+		return error("Cannot convert");
 	}
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 #include "Token.h"
+#include "SmallVector.h"
+#include <cstddef>
+#include <string>
 
 class Type;
 class Expression;
@@ -7,18 +10,27 @@ class Statement;
 class Declaration;
 class FunctionDeclaration;
 
-using TypeList = std::vector<Type*>;
-using ExpressionList = std::vector<Expression*>;
-using StatementList = std::vector<Statement*>;
-using DeclarationList = std::vector<Declaration*>;
+using TypeList = SmallVector<Type*, 4>;
+using ExpressionList = SmallVector<Expression*, 4>;
+using StatementList = SmallVector<Statement*, 8>;
+using DeclarationList = SmallVector<Declaration*, 4>;
 
 class Scope;
+class Diagnostics;
 
 class Semantics {
 public:
-	Semantics();
+	Semantics(Diagnostics& d);
 	~Semantics();
 
+	// Checks function bodies against a global scope owned by another
+	// instance. The shared scope is only read, so several instances may
+	// use it at once.
+	Semantics(Diagnostics& d, Scope* globals);
+
+	// Errors are reported at the most recently parsed token.
+	void setLocation(Location l) { location = l; }
+
 	Type* onBasicType(Token t);
 
 	// Expression
@@ -65,6 +77,7 @@ public:
 	Declaration* onParameterDeclaration(Token t, Type* y);
 	Declaration* onFunctionDeclaration(Token t, const DeclarationList& d, Type* y);
 	Declaration* onFunctionDefinition(Declaration* d, Statement* s);
+	void resumeFunction(Declaration* d);
 
 	Declaration* onProgram(const DeclarationList& d);
 
@@ -94,6 +107,7 @@ public:
 	Expression* requireArithmetic(Expression* e);
 	Expression* requireNumeric(Expression* e);
 	Expression* requireScalar(Expression* e);
+	Expression* requireConstant(Expression* e, Type* t);
 
 	Type* requireSame(Type* t1, Type* t2);
 	Type* commonType(Type* t1, Type* t2);
@@ -107,10 +121,22 @@ public:
 	Expression* convertToType(Expression* e, Type* t);
 
 private:
+	std::nullptr_t error(const std::string& msg);
+
+	Diagnostics& diagnostics;
+	Location location;
+
 	Scope* scope;
+	Scope* shared;
 
 	FunctionDeclaration* function;
 
+	// When checking of the current function began, for tracing.
+	long long started;
+
+	// The number of globals declared so far.
+	unsigned globals;
+
 	Type* _bool;
 	Type* _char;
 	Type* _int;
@@ -0,0 +1,182 @@
+#pragma once
+#include "MemoryProfile.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <type_traits>
+
+// A vector that keeps up to N elements in place and only moves them to the
+// heap when it grows past that. Elements are copied as raw bytes, so it only
+// holds trivially copyable values such as the node pointers of the tree.
+template<typename T, std::size_t N>
+class SmallVector {
+	static_assert(std::is_trivially_copyable<T>::value, "SmallVector holds trivially copyable values");
+	static_assert(N > 0, "SmallVector needs room for at least one element");
+
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+	using reference = T&;
+	using const_reference = const T&;
+	using iterator = T*;
+	using const_iterator = const T*;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	SmallVector()
+		: first(local()), count(0), cap(N) {}
+
+	SmallVector(std::initializer_list<T> list)
+		: SmallVector() { append(list.begin(), list.size()); }
+
+	template<typename Iter>
+	SmallVector(Iter f, Iter l)
+		: SmallVector() {
+		for (; f != l; ++f) {
+			push_back(*f);
+		}
+	}
+
+	SmallVector(const SmallVector& x)
+		: SmallVector() { append(x.first, x.count); }
+
+	SmallVector(SmallVector&& x) noexcept
+		: SmallVector() { take(x); }
+
+	~SmallVector() { release(); }
+
+	SmallVector& operator=(const SmallVector& x) {
+		if (this != &x) {
+			count = 0;
+			append(x.first, x.count);
+		}
+		return *this;
+	}
+
+	SmallVector& operator=(SmallVector&& x) noexcept {
+		if (this != &x) {
+			release();
+			first = local();
+			count = 0;
+			cap = N;
+			take(x);
+		}
+		return *this;
+	}
+
+	iterator begin() { return first; }
+	iterator end() { return first + count; }
+	const_iterator begin() const { return first; }
+	const_iterator end() const { return first + count; }
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+	size_type size() const { return count; }
+	size_type capacity() const { return cap; }
+	bool empty() const { return count == 0; }
+
+	T* data() { return first; }
+	const T* data() const { return first; }
+
+	T& operator[](size_type i) { assert(i < count); return first[i]; }
+	const T& operator[](size_type i) const { assert(i < count); return first[i]; }
+	T& front() { return (*this)[0]; }
+	const T& front() const { return (*this)[0]; }
+	T& back() { return (*this)[count - 1]; }
+	const T& back() const { return (*this)[count - 1]; }
+
+	void push_back(const T& x) {
+		if (count == cap) {
+			// x may live in this vector, so copy it before growing.
+			T v = x;
+			grow(count + 1);
+			first[count++] = v;
+			return;
+		}
+		first[count++] = x;
+	}
+
+	void pop_back() { assert(count > 0); --count; }
+
+	void reserve(size_type n) {
+		if (n > cap) {
+			grow(n);
+		}
+	}
+
+	void resize(size_type n) {
+		reserve(n);
+		for (size_type i = count; i < n; ++i) {
+			first[i] = T();
+		}
+		count = n;
+	}
+
+	void clear() { count = 0; }
+
+	friend bool operator==(const SmallVector& a, const SmallVector& b) {
+		return std::equal(a.begin(), a.end(), b.begin(), b.end());
+	}
+
+	friend bool operator!=(const SmallVector& a, const SmallVector& b) {
+		return !(a == b);
+	}
+
+private:
+	T* local() { return reinterpret_cast<T*>(&storage); }
+	bool isInline() const { return first == reinterpret_cast<const T*>(&storage); }
+
+	void append(const T* p, size_type n) {
+		reserve(count + n);
+		if (n) {
+			std::memcpy(first + count, p, n * sizeof(T));
+		}
+		count += n;
+	}
+
+	// Steals x's heap block, or copies its elements if they are in place.
+	void take(SmallVector& x) {
+		if (x.isInline()) {
+			append(x.first, x.count);
+		}
+		else {
+			first = x.first;
+			count = x.count;
+			cap = x.cap;
+			x.first = x.local();
+			x.cap = N;
+		}
+		x.count = 0;
+	}
+
+	void grow(size_type n) {
+		size_type c = std::max(n, cap * 2);
+		T* p = static_cast<T*>(::operator new(c * sizeof(T)));
+		if (MemoryProfile::isEnabled()) {
+			MemoryProfile::count(MemoryProfile::node_lists, 0, c * sizeof(T));
+		}
+		if (count) {
+			std::memcpy(p, first, count * sizeof(T));
+		}
+		release();
+		first = p;
+		cap = c;
+	}
+
+	void release() {
+		if (!isInline()) {
+			::operator delete(first);
+		}
+	}
+
+	T* first;
+	size_type count;
+	size_type cap;
+	typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type storage;
+};
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
-#include <vector>
+#include "SmallVector.h"
+#include "MemoryProfile.h"
 
 class Expression;
 class Declaration;
@@ -20,9 +21,12 @@ public:
 
 protected:
 	Statement(Kind k)
-		: kind(k) {}
+		: kind(k) { MemoryProfile::countNode(MemoryProfile::statement_nodes, k); }
 
 public:
+	static void* operator new(std::size_t n) { return MemoryProfile::allocate(n); }
+	static void operator delete(void* p) { ::operator delete(p); }
+
 	virtual ~Statement() = default;
 
 	Kind getKind() const { return kind; }
@@ -31,12 +35,14 @@ private:
 	Kind kind;
 };
 
-using StatementList = std::vector<Statement*>;
+using StatementList = SmallVector<Statement*, 8>;
 
 struct BlockStatement : Statement {
 	BlockStatement(const StatementList& s)
 		: Statement(block_kind), statements(s) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == block_kind; }
+
 	const StatementList& getStatements() const { return statements; }
 	StatementList& getStatements() { return statements; }
 
@@ -47,6 +53,8 @@ struct WhenStatement : Statement {
 	WhenStatement(Expression* e, Statement* s)
 		: Statement(when_kind), condition(e), body(s) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == when_kind; }
+
 	Expression* getCondition() const { return condition; }
 	Statement* getBody() const { return body; }
 
@@ -58,6 +66,8 @@ struct IfStatement : Statement {
 	IfStatement(Expression* e, Statement* s1, Statement* s2)
 		: Statement(if_kind), condition(e), pass(s1), fail(s2) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == if_kind; }
+
 	Expression* getCondition() const { return condition; }
 	Statement* getPassValue() const { return pass; }
 	Statement* getFailValue() const { return fail; }
@@ -71,6 +81,8 @@ struct WhileStatement : Statement {
 	WhileStatement(Expression* e, Statement* s)
 		: Statement(while_kind), condition(e), body(s) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == while_kind; }
+
 	Expression* getCondition() const { return condition; }
 	Statement* getBody() const { return body; }
 
@@ -81,17 +93,23 @@ struct WhileStatement : Statement {
 struct BreakStatement : Statement {
 	BreakStatement()
 		: Statement(break_kind) {}
+
+	static bool classof(const Statement* n) { return n->getKind() == break_kind; }
 };
 
 struct ContinueStatement : Statement {
 	ContinueStatement()
 		: Statement(cont_kind) {}
+
+	static bool classof(const Statement* n) { return n->getKind() == cont_kind; }
 };
 
 struct ReturnStatement : Statement {
 	ReturnStatement(Expression* e)
 		: Statement(ret_kind), val(e) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == ret_kind; }
+
 	Expression* getValue() const { return val; }
 
 	Expression* val;
@@ -101,6 +119,8 @@ struct DeclareStatement : Statement {
 	DeclareStatement(Declaration* d)
 		: Statement(decl_kind), declaration(d) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == decl_kind; }
+
 	Declaration* getDeclaration() const { return declaration; }
 
 	Declaration* declaration;
@@ -110,6 +130,8 @@ struct ExpressionStatement : Statement {
 	ExpressionStatement(Expression* e)
 		: Statement(expr_kind), expression(e) {}
 
+	static bool classof(const Statement* n) { return n->getKind() == expr_kind; }
+
 	Expression* getExpression() const { return expression; }
 
 	Expression* expression;
@@ -0,0 +1,845 @@
+#include "stdafx.h"
+#include "StencilJIT.h"
+#include "X86Assembler.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// The pieces of code that instructions are made of. Operands are passed
+// between stencils in eax or rax, ecx, r11 and xmm0 or xmm1. Stencils with
+// a suffix come in one version for each condition code or register.
+enum StencilKind {
+	// Loads of the first operand
+	stencil_load,
+	stencil_load64,
+	stencil_loadSigned8,
+	stencil_loadFloat,
+	stencil_loadAddress,
+
+	// Loads of the second operand
+	stencil_loadCount,
+	stencil_loadCountSigned8,
+	stencil_loadFloat1,
+
+	stencil_store,
+	stencil_store64,
+	stencil_storeFloat,
+
+	stencil_constant,
+	stencil_function,
+
+	stencil_add,
+	stencil_sub,
+	stencil_and,
+	stencil_or,
+	stencil_xor,
+	stencil_mul,
+	stencil_mulh,
+	stencil_div,
+	stencil_rem,
+	stencil_shl,
+	stencil_sar,
+	stencil_neg,
+	stencil_not,
+	stencil_flip,
+	stencil_zext8,
+	stencil_mask1,
+	stencil_cmp,
+	stencil_test,
+
+	stencil_fadd,
+	stencil_fsub,
+	stencil_fmul,
+	stencil_fdiv,
+	stencil_frem,
+	stencil_fneg,
+	stencil_ucomiss,
+	stencil_setfeq,
+	stencil_setfne,
+	stencil_itof,
+	stencil_ftoi,
+
+	stencil_deref,
+	stencil_deref8,
+	stencil_deref64,
+	stencil_derefFloat,
+	stencil_storeAt,
+	stencil_storeAt8,
+	stencil_storeAt64,
+	stencil_storeAtFloat,
+
+	stencil_argumentStack,
+	stencil_callee,
+	stencil_call,
+	stencil_callIndirect,
+
+	stencil_enter,
+	stencil_leave,
+	stencil_jump,
+	stencil_trap,
+
+	stencil_set, // + X86Condition
+	stencil_jcc = stencil_set + 16, // + X86Condition
+	stencil_argument = stencil_jcc + 16, // + X86Register
+	stencil_argumentFloat = stencil_argument + 16, // + XMM number
+	stencil_parameter = stencil_argumentFloat + 16, // + X86Register
+	stencil_parameterFloat = stencil_parameter + 16, // + XMM number
+	stencil_count = stencil_parameterFloat + 16
+};
+
+// What is patched into a hole.
+enum StencilHoleKind {
+	hole_a, // rbp-relative displacement of the first operand
+	hole_b, // rbp-relative displacement of the second operand
+	hole_result, // displacement of the result
+	hole_frame, // size of the stack frame
+	hole_value, // 64-bit constant
+	hole_target // rel32 to a label
+};
+
+struct StencilHole {
+	std::uint32_t offset;
+	StencilHoleKind kind;
+};
+
+struct Stencil {
+	std::vector<std::uint8_t> code;
+	std::vector<StencilHole> holes;
+};
+
+// Stencils are assembled once with these values in their holes, which are
+// then found by searching for them.
+static const std::int32_t sentinels[] = { 0x5EA00011, 0x5EA00022, 0x5EA00033, 0x5EA00044 };
+static const std::int64_t valueSentinel = 0x5EA000555EA00055LL;
+
+static float floatRemainder(float a, float b)
+{
+	return std::fmod(a, b);
+}
+
+static Stencil makeStencil(int kind)
+{
+	X86Assembler as;
+	X86Memory a = { reg_rbp, sentinels[hole_a] };
+	X86Memory b = { reg_rbp, sentinels[hole_b] };
+	X86Memory r = { reg_rbp, sentinels[hole_result] };
+	X86Memory r11 = { reg_r11, 0 };
+	int label = as.makeLabel();
+
+	// These end with a displacement to the label.
+	bool target = (kind >= stencil_jcc && kind < stencil_argument) || kind == stencil_function || kind == stencil_call || kind == stencil_jump;
+
+	if (kind >= stencil_set && kind < stencil_jcc) {
+		as.setcc(static_cast<X86Condition>(kind - stencil_set), reg_rax);
+		as.movzxByte(reg_rax, reg_rax);
+		kind = stencil_count;
+	}
+	else if (kind >= stencil_jcc && kind < stencil_argument) {
+		as.jcc(static_cast<X86Condition>(kind - stencil_jcc), label);
+		kind = stencil_count;
+	}
+	else if (kind >= stencil_argument && kind < stencil_argumentFloat) {
+		as.load(static_cast<X86Register>(kind - stencil_argument), a, true);
+		kind = stencil_count;
+	}
+	else if (kind >= stencil_argumentFloat && kind < stencil_parameter) {
+		as.movss(kind - stencil_argumentFloat, a);
+		kind = stencil_count;
+	}
+	else if (kind >= stencil_parameter && kind < stencil_parameterFloat) {
+		as.store(r, static_cast<X86Register>(kind - stencil_parameter), true);
+		kind = stencil_count;
+	}
+	else if (kind >= stencil_parameterFloat && kind < stencil_count) {
+		as.movss(r, kind - stencil_parameterFloat);
+		kind = stencil_count;
+	}
+
+	switch (kind) {
+	case stencil_load: as.load(reg_rax, a); break;
+	case stencil_load64: as.load(reg_rax, a, true); break;
+	case stencil_loadSigned8:
+		as.loadByte(reg_rax, a);
+		as.movsxByte(reg_rax, reg_rax);
+		break;
+	case stencil_loadFloat: as.movss(0, a); break;
+	case stencil_loadAddress: as.load(reg_r11, a, true); break;
+	case stencil_loadCount: as.load(reg_rcx, b); break;
+	case stencil_loadCountSigned8:
+		as.loadByte(reg_rcx, b);
+		as.movsxByte(reg_rcx, reg_rcx);
+		break;
+	case stencil_loadFloat1: as.movss(1, b); break;
+	case stencil_store: as.store(r, reg_rax); break;
+	case stencil_store64: as.store(r, reg_rax, true); break;
+	case stencil_storeFloat: as.movss(r, 0); break;
+	case stencil_constant: as.mov(reg_rax, valueSentinel, true); break;
+	case stencil_function: as.leaLabel(reg_rax, label); break;
+	case stencil_add: as.arith(arith_add, reg_rax, b); break;
+	case stencil_sub: as.arith(arith_sub, reg_rax, b); break;
+	case stencil_and: as.arith(arith_and, reg_rax, b); break;
+	case stencil_or: as.arith(arith_or, reg_rax, b); break;
+	case stencil_xor: as.arith(arith_xor, reg_rax, b); break;
+	case stencil_mul: as.imul(reg_rax, b); break;
+	case stencil_mulh:
+		as.imul(b);
+		as.mov(reg_rax, reg_rdx);
+		break;
+	case stencil_div:
+		as.cdq();
+		as.idiv(reg_rcx);
+		break;
+	case stencil_rem:
+		as.cdq();
+		as.idiv(reg_rcx);
+		as.mov(reg_rax, reg_rdx);
+		break;
+	case stencil_shl: as.shl(reg_rax); break;
+	case stencil_sar: as.sar(reg_rax); break;
+	case stencil_neg: as.neg(reg_rax); break;
+	case stencil_not: as.not_(reg_rax); break;
+	case stencil_flip: as.arith(arith_xor, reg_rax, 1); break;
+	case stencil_zext8: as.movzxByte(reg_rax, reg_rax); break;
+	case stencil_mask1: as.arith(arith_and, reg_rax, 1); break;
+	case stencil_cmp: as.arith(arith_cmp, reg_rax, b); break;
+	case stencil_test: as.test(reg_rax, reg_rax); break;
+	case stencil_fadd: as.sse(sse_add, 0, b); break;
+	case stencil_fsub: as.sse(sse_sub, 0, b); break;
+	case stencil_fmul: as.sse(sse_mul, 0, b); break;
+	case stencil_fdiv: as.sse(sse_div, 0, b); break;
+	case stencil_frem:
+		as.mov(reg_rax, valueSentinel, true);
+		as.call(reg_rax);
+		break;
+	case stencil_fneg:
+		as.mov(reg_rax, 0x80000000LL);
+		as.movd(1, reg_rax);
+		as.xorps(0, 1);
+		break;
+	case stencil_ucomiss: as.ucomiss(0, b); break;
+	case stencil_setfeq:
+	case stencil_setfne:
+		as.setcc(kind == stencil_setfeq ? cc_np : cc_p, reg_rcx);
+		as.setcc(kind == stencil_setfeq ? cc_e : cc_ne, reg_rax);
+		as.arith(kind == stencil_setfeq ? arith_and : arith_or, reg_rax, reg_rcx);
+		as.movzxByte(reg_rax, reg_rax);
+		break;
+	case stencil_itof: as.cvtsi2ss(0, reg_rax); break;
+	case stencil_ftoi: as.cvttss2si(reg_rax, 0); break;
+	case stencil_deref: as.load(reg_rax, r11); break;
+	case stencil_deref8: as.loadByte(reg_rax, r11); break;
+	case stencil_deref64: as.load(reg_rax, r11, true); break;
+	case stencil_derefFloat: as.movss(0, r11); break;
+	case stencil_storeAt: as.store(r11, reg_rax); break;
+	case stencil_storeAt8: as.storeByte(r11, reg_rax); break;
+	case stencil_storeAt64: as.store(r11, reg_rax, true); break;
+	case stencil_storeAtFloat: as.movss(r11, 0); break;
+	case stencil_argumentStack:
+		as.load(reg_rax, a, true);
+		as.store({ reg_rsp, sentinels[hole_result] }, reg_rax, true);
+		break;
+	case stencil_callee: as.load(reg_r10, a, true); break;
+	case stencil_call: as.call(label); break;
+	case stencil_callIndirect: as.call(reg_r10); break;
+	case stencil_enter:
+		as.push(reg_rbp);
+		as.mov(reg_rbp, reg_rsp, true);
+		as.arith(arith_sub, reg_rsp, sentinels[hole_frame], true);
+		break;
+	case stencil_leave:
+		as.mov(reg_rsp, reg_rbp, true);
+		as.pop(reg_rbp);
+		as.ret();
+		break;
+	case stencil_jump: as.jmp(label); break;
+	case stencil_trap: as.ud2(); break;
+	default: break;
+	}
+
+	Stencil s;
+	s.code = as.getCode();
+	std::uint32_t size = static_cast<std::uint32_t>(s.code.size());
+
+	if (target)
+		s.holes.push_back({ size - 4, hole_target });
+	for (StencilHoleKind k : { hole_a, hole_b, hole_result, hole_frame }) {
+		for (std::uint32_t i = 0; i + 4 <= size; ++i) {
+			std::int32_t v;
+			std::memcpy(&v, &s.code[i], 4);
+			if (v == sentinels[k])
+				s.holes.push_back({ i, k });
+		}
+	}
+	for (std::uint32_t i = 0; i + 8 <= size; ++i) {
+		std::int64_t v;
+		std::memcpy(&v, &s.code[i], 8);
+		if (v == valueSentinel)
+			s.holes.push_back({ i, hole_value });
+	}
+	return s;
+}
+
+static const std::vector<Stencil>& getStencils()
+{
+	static const std::vector<Stencil> stencils = [] {
+		std::vector<Stencil> s;
+		for (int k = 0; k < stencil_count; ++k)
+			s.push_back(makeStencil(k));
+		return s;
+	}();
+	return stencils;
+}
+
+// A rel32 in the code to be pointed at a block or function.
+struct StencilPatch {
+	std::size_t offset;
+	std::size_t target;
+};
+
+// State shared by the functions of a module.
+struct StencilModuleContext {
+	const std::vector<Stencil>& stencils;
+	std::vector<std::uint8_t> code;
+	std::vector<std::uint64_t>& data;
+
+	// Patches to function entries, by function index; calls to functions
+	// without a body go to the trap after the last function.
+	std::vector<StencilPatch> calls;
+	std::vector<char> defined;
+};
+
+class StencilFunctionCompiler {
+public:
+	StencilFunctionCompiler(StencilModuleContext& m, const IRFunction& f);
+
+	void compile();
+
+private:
+	std::size_t emit(int kind, std::int32_t a = 0, std::int32_t b = 0, std::int32_t r = 0, std::int64_t value = 0);
+	void emitInstruction(const IRInstruction* i);
+	void emitParameters();
+	void emitCall(const IRInstruction* i);
+	void emitCondBranch(const IRInstruction* i);
+	X86Condition emitCompare(const IRInstruction* c);
+	void emitCopies(const IRBlock* from, const IRBlock* to, bool last);
+	bool hasCopies(const IRBlock* to) const;
+	void jumpTo(const IRBlock* b);
+	void callTo(std::size_t function);
+
+	void load(const IRInstruction* v);
+	void store(const IRInstruction* i);
+	void normalize(IRType t);
+
+	std::int32_t slot(const IRInstruction* v) const { return -8 * static_cast<std::int32_t>(v->id + 1); }
+
+	StencilModuleContext& mod;
+	std::vector<std::uint8_t>& code;
+	const IRFunction& fn;
+
+	std::vector<unsigned> uses;
+	std::vector<char> fused;
+
+	// Second slots for phis, for copies whose sources are other phis of
+	// the same block.
+	std::vector<std::int32_t> shadows;
+
+	std::vector<std::size_t> blockOffsets;
+	std::vector<StencilPatch> jumps;
+	const IRBlock* next;
+};
+
+StencilFunctionCompiler::StencilFunctionCompiler(StencilModuleContext& m, const IRFunction& f)
+	: mod(m), code(m.code), fn(f), next(nullptr) {}
+
+std::size_t StencilFunctionCompiler::emit(int kind, std::int32_t a, std::int32_t b, std::int32_t r, std::int64_t value)
+{
+	const Stencil& s = mod.stencils[kind];
+	std::size_t at = code.size();
+	code.insert(code.end(), s.code.begin(), s.code.end());
+	std::size_t target = 0;
+	for (const StencilHole& h : s.holes) {
+		std::uint8_t* p = &code[at + h.offset];
+		std::int32_t v = 0;
+		switch (h.kind) {
+		case hole_a: v = a; break;
+		case hole_b: v = b; break;
+		case hole_result: v = r; break;
+		case hole_frame: v = static_cast<std::int32_t>(value); break;
+		case hole_value:
+			std::memcpy(p, &value, 8);
+			continue;
+		case hole_target:
+			target = at + h.offset;
+			continue;
+		}
+		std::memcpy(p, &v, 4);
+	}
+	return target;
+}
+
+static bool isFusable(const IRInstruction* c)
+{
+	return c->isCompare() && c->op != ir_feq && c->op != ir_fne;
+}
+
+void StencilFunctionCompiler::compile()
+{
+	unsigned n = fn.getValueCount();
+	uses.assign(n, 0);
+	fused.assign(n, 0);
+	shadows.assign(n, 0);
+	blockOffsets.assign(fn.getBlockCount(), 0);
+
+	std::int32_t slots = static_cast<std::int32_t>(n);
+	int outgoing = 0;
+	X86ArgumentPlacer params;
+	for (IRType t : fn.params)
+		params.place(t == irt_float);
+	for (const IRBlock* b : fn.blocks) {
+		for (const IRInstruction* i : b->instructions) {
+			for (const IRInstruction* v : i->operands)
+				++uses[v->id];
+			if (i->isPhi())
+				shadows[i->id] = -8 * ++slots;
+			if (i->op == ir_call || i->op == ir_frem) {
+				X86ArgumentPlacer placer;
+				for (std::size_t k = 1; k < i->operands.size() && i->op == ir_call; ++k)
+					placer.place(i->operands[k]->type == irt_float);
+				outgoing = std::max(outgoing, hostConvention.shadow + 8 * placer.getStackCount());
+			}
+		}
+	}
+	for (const IRBlock* b : fn.blocks) {
+		std::size_t size = b->instructions.size();
+		const IRInstruction* t = b->getTerminator();
+		if (t->op == ir_condbr && size >= 2) {
+			const IRInstruction* c = b->instructions[size - 2];
+			if (c == t->operands[0] && isFusable(c) && uses[c->id] == 1)
+				fused[c->id] = 1;
+		}
+	}
+
+	// rsp is 16-byte aligned once rbp is pushed.
+	emit(stencil_enter, 0, 0, 0, (8 * slots + outgoing + 15) / 16 * 16);
+	emitParameters();
+	for (std::size_t k = 0; k < fn.blocks.size(); ++k) {
+		const IRBlock* b = fn.blocks[k];
+		next = k + 1 < fn.blocks.size() ? fn.blocks[k + 1] : nullptr;
+		blockOffsets[b->id] = code.size();
+		for (const IRInstruction* i : b->instructions)
+			emitInstruction(i);
+	}
+
+	for (const StencilPatch& p : jumps) {
+		std::int32_t rel = static_cast<std::int32_t>(blockOffsets[p.target] - (p.offset + 4));
+		std::memcpy(&code[p.offset], &rel, 4);
+	}
+}
+
+void StencilFunctionCompiler::emitParameters()
+{
+	std::vector<X86ArgumentPlace> places;
+	X86ArgumentPlacer placer;
+	for (IRType t : fn.params)
+		places.push_back(placer.place(t == irt_float));
+
+	for (const IRInstruction* i : fn.getEntryBlock()->instructions) {
+		if (i->op != ir_param || !uses[i->id])
+			continue;
+		const X86ArgumentPlace& p = places[i->integer];
+		if (p.onStack) {
+			emit(stencil_load64, 16 + hostConvention.shadow + 8 * p.index);
+			emit(stencil_store64, 0, 0, slot(i));
+		}
+		else {
+			emit((i->type == irt_float ? stencil_parameterFloat : stencil_parameter) + p.index, 0, 0, slot(i));
+		}
+	}
+}
+
+void StencilFunctionCompiler::load(const IRInstruction* v)
+{
+	if (v->type == irt_float)
+		emit(stencil_loadFloat, slot(v));
+	else
+		emit(v->type == irt_ptr ? stencil_load64 : stencil_load, slot(v));
+}
+
+void StencilFunctionCompiler::store(const IRInstruction* i)
+{
+	if (i->type == irt_float)
+		emit(stencil_storeFloat, 0, 0, slot(i));
+	else
+		emit(i->type == irt_ptr ? stencil_store64 : stencil_store, 0, 0, slot(i));
+}
+
+// Keeps chars zero-extended and bools 0 or 1.
+void StencilFunctionCompiler::normalize(IRType t)
+{
+	if (t == irt_char)
+		emit(stencil_zext8);
+	else if (t == irt_bool)
+		emit(stencil_mask1);
+}
+
+void StencilFunctionCompiler::callTo(std::size_t function)
+{
+	mod.calls.push_back({ emit(stencil_call), function });
+}
+
+void StencilFunctionCompiler::emitInstruction(const IRInstruction* i)
+{
+	if (!i->hasSideEffects() && !uses[i->id])
+		return;
+	const IRInstruction* a = i->operands.size() > 0 ? i->operands[0] : nullptr;
+	const IRInstruction* b = i->operands.size() > 1 ? i->operands[1] : nullptr;
+	switch (i->op) {
+	case ir_param:
+	case ir_phi:
+		return;
+	case ir_const: {
+		std::int64_t v = i->integer;
+		if (i->type == irt_float) {
+			float f = static_cast<float>(i->real);
+			std::uint32_t bits;
+			std::memcpy(&bits, &f, 4);
+			v = bits;
+		}
+		emit(stencil_constant, 0, 0, 0, v);
+		emit(stencil_store64, 0, 0, slot(i));
+		return;
+	}
+	case ir_global:
+		emit(stencil_constant, 0, 0, 0, static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(&mod.data[i->integer])));
+		emit(stencil_store64, 0, 0, slot(i));
+		return;
+	case ir_function:
+		mod.calls.push_back({ emit(stencil_function), static_cast<std::size_t>(i->integer) });
+		emit(stencil_store64, 0, 0, slot(i));
+		return;
+	case ir_add:
+	case ir_sub:
+	case ir_and:
+	case ir_or:
+	case ir_xor:
+	case ir_mul: {
+		static const StencilKind kinds[] = { stencil_add, stencil_sub, stencil_mul, stencil_div, stencil_rem, stencil_and, stencil_or, stencil_xor };
+		load(a);
+		emit(kinds[i->op - ir_add], 0, slot(b));
+		if (i->op == ir_add || i->op == ir_sub || i->op == ir_mul)
+			normalize(i->type);
+		return store(i);
+	}
+	case ir_mulh:
+		load(a);
+		emit(stencil_mulh, 0, slot(b));
+		return store(i);
+	case ir_div:
+	case ir_rem:
+	case ir_shl:
+	case ir_shr: {
+		// Division and right shifts see chars as signed.
+		bool narrow = i->type == irt_char && i->op != ir_shl;
+		emit(narrow && i->op != ir_shr ? stencil_loadCountSigned8 : stencil_loadCount, 0, slot(b));
+		if (narrow)
+			emit(stencil_loadSigned8, slot(a));
+		else
+			load(a);
+		emit(i->op == ir_div ? stencil_div : i->op == ir_rem ? stencil_rem : i->op == ir_shl ? stencil_shl : stencil_sar);
+		normalize(i->type);
+		return store(i);
+	}
+	case ir_neg:
+	case ir_not:
+		load(a);
+		emit(i->op == ir_neg ? stencil_neg : i->type == irt_bool ? stencil_flip : stencil_not);
+		normalize(i->type);
+		return store(i);
+	case ir_fadd:
+	case ir_fsub:
+	case ir_fmul:
+	case ir_fdiv: {
+		static const StencilKind kinds[] = { stencil_fadd, stencil_fsub, stencil_fmul, stencil_fdiv };
+		load(a);
+		emit(kinds[i->op - ir_fadd], 0, slot(b));
+		return store(i);
+	}
+	case ir_frem:
+		load(a);
+		emit(stencil_loadFloat1, 0, slot(b));
+		emit(stencil_frem, 0, 0, 0, static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(&floatRemainder)));
+		return store(i);
+	case ir_fneg:
+		load(a);
+		emit(stencil_fneg);
+		return store(i);
+	case ir_trunc:
+	case ir_zext:
+		load(a);
+		if (i->op == ir_trunc)
+			normalize(i->type);
+		return store(i);
+	case ir_itof:
+		load(a);
+		emit(stencil_itof);
+		return store(i);
+	case ir_ftoi:
+		load(a);
+		emit(stencil_ftoi);
+		return store(i);
+	case ir_load:
+		emit(stencil_loadAddress, slot(a));
+		switch (i->type) {
+		case irt_float: emit(stencil_derefFloat); break;
+		case irt_ptr: emit(stencil_deref64); break;
+		case irt_int: emit(stencil_deref); break;
+		default: emit(stencil_deref8); break;
+		}
+		return store(i);
+	case ir_store:
+		load(b);
+		emit(stencil_loadAddress, slot(a));
+		switch (b->type) {
+		case irt_float: emit(stencil_storeAtFloat); break;
+		case irt_ptr: emit(stencil_storeAt64); break;
+		case irt_int: emit(stencil_storeAt); break;
+		default: emit(stencil_storeAt8); break;
+		}
+		return;
+	case ir_call:
+		return emitCall(i);
+	case ir_br:
+		emitCopies(i->block, i->targets[0], false);
+		return jumpTo(i->targets[0]);
+	case ir_condbr:
+		return emitCondBranch(i);
+	case ir_ret:
+		load(a);
+		emit(stencil_leave);
+		return;
+	case ir_unreachable:
+		emit(stencil_trap);
+		return;
+	default:
+		break;
+	}
+	if (i->isCompare()) {
+		// Made at the branch that uses it.
+		if (fused[i->id])
+			return;
+		X86Condition c = emitCompare(i);
+		if (i->op == ir_feq || i->op == ir_fne)
+			emit(i->op == ir_feq ? stencil_setfeq : stencil_setfne);
+		else
+			emit(stencil_set + c);
+		return store(i);
+	}
+	throw std::logic_error("Unsupported instruction");
+}
+
+void StencilFunctionCompiler::emitCall(const IRInstruction* i)
+{
+	X86ArgumentPlacer placer;
+	for (std::size_t k = 1; k < i->operands.size(); ++k) {
+		const IRInstruction* a = i->operands[k];
+		X86ArgumentPlace p = placer.place(a->type == irt_float);
+		if (p.onStack)
+			emit(stencil_argumentStack, slot(a), 0, hostConvention.shadow + 8 * p.index);
+		else
+			emit((a->type == irt_float ? stencil_argumentFloat : stencil_argument) + p.index, slot(a));
+	}
+	const IRInstruction* callee = i->operands[0];
+	if (callee->op == ir_function) {
+		callTo(static_cast<std::size_t>(callee->integer));
+	}
+	else {
+		emit(stencil_callee, slot(callee));
+		emit(stencil_callIndirect);
+	}
+	if (i->type == irt_void)
+		return;
+	// Only the low byte of a narrow result is defined.
+	normalize(i->type);
+	store(i);
+}
+
+X86Condition StencilFunctionCompiler::emitCompare(const IRInstruction* c)
+{
+	const IRInstruction* a = c->operands[0];
+	const IRInstruction* b = c->operands[1];
+	if (a->type == irt_float) {
+		// As in X86FunctionCompiler, less-than tests are turned around so
+		// that unordered operands fail them.
+		if (c->op == ir_flt || c->op == ir_fle)
+			std::swap(a, b);
+		load(a);
+		emit(stencil_ucomiss, 0, slot(b));
+		switch (c->op) {
+		case ir_feq: return cc_e;
+		case ir_fne: return cc_ne;
+		case ir_flt:
+		case ir_fgt:
+			return cc_a;
+		default:
+			return cc_ae;
+		}
+	}
+	load(a);
+	emit(stencil_cmp, 0, slot(b));
+	switch (c->op) {
+	case ir_eq: return cc_e;
+	case ir_ne: return cc_ne;
+	case ir_lt: return cc_l;
+	case ir_gt: return cc_g;
+	case ir_le: return cc_le;
+	case ir_ge: return cc_ge;
+	case ir_ult: return cc_b;
+	case ir_ugt: return cc_a;
+	case ir_ule: return cc_be;
+	default: return cc_ae;
+	}
+}
+
+bool StencilFunctionCompiler::hasCopies(const IRBlock* to) const
+{
+	for (const IRInstruction* phi : to->instructions) {
+		if (!phi->isPhi())
+			break;
+		if (uses[phi->id])
+			return true;
+	}
+	return false;
+}
+
+// Copies into the phis of to along the edge from from. When both targets
+// of a branch are the same block, last picks the second edge.
+void StencilFunctionCompiler::emitCopies(const IRBlock* from, const IRBlock* to, bool last)
+{
+	std::size_t k = to->preds.size();
+	for (std::size_t n = 0; n < to->preds.size(); ++n) {
+		if (to->preds[n] == from) {
+			k = n;
+			if (!last)
+				break;
+		}
+	}
+
+	// Phis are all written at once, so a phi read by another goes through
+	// its second slot.
+	bool shadowed = false;
+	for (const IRInstruction* phi : to->instructions) {
+		if (!phi->isPhi())
+			break;
+		const IRInstruction* v = phi->operands[k];
+		shadowed = shadowed || (uses[phi->id] && v->isPhi() && v->block == to && v != phi);
+	}
+	for (const IRInstruction* phi : to->instructions) {
+		if (!phi->isPhi())
+			break;
+		if (!uses[phi->id])
+			continue;
+		emit(stencil_load64, slot(phi->operands[k]));
+		emit(stencil_store64, 0, 0, shadowed ? shadows[phi->id] : slot(phi));
+	}
+	if (!shadowed)
+		return;
+	for (const IRInstruction* phi : to->instructions) {
+		if (!phi->isPhi())
+			break;
+		if (!uses[phi->id])
+			continue;
+		emit(stencil_load64, shadows[phi->id]);
+		emit(stencil_store64, 0, 0, slot(phi));
+	}
+}
+
+void StencilFunctionCompiler::jumpTo(const IRBlock* b)
+{
+	if (b != next)
+		jumps.push_back({ emit(stencil_jump), b->id });
+}
+
+void StencilFunctionCompiler::emitCondBranch(const IRInstruction* i)
+{
+	const IRInstruction* c = i->operands[0];
+	const IRBlock* pass = i->targets[0];
+	const IRBlock* fail = i->targets[1];
+	X86Condition cc;
+	if (fused[c->id]) {
+		cc = emitCompare(c);
+	}
+	else {
+		load(c);
+		emit(stencil_test);
+		cc = cc_ne;
+	}
+
+	bool passCopies = hasCopies(pass);
+	bool failCopies = hasCopies(fail);
+	if (!passCopies && !(!failCopies && pass == next)) {
+		jumps.push_back({ emit(stencil_jcc + cc), pass->id });
+		emitCopies(i->block, fail, true);
+		return jumpTo(fail);
+	}
+	if (!failCopies) {
+		jumps.push_back({ emit(stencil_jcc + negate(cc)), fail->id });
+		emitCopies(i->block, pass, false);
+		return jumpTo(pass);
+	}
+	std::size_t other = emit(stencil_jcc + negate(cc));
+	emitCopies(i->block, pass, false);
+	jumps.push_back({ emit(stencil_jump), pass->id });
+	std::int32_t rel = static_cast<std::int32_t>(code.size() - (other + 4));
+	std::memcpy(&code[other], &rel, 4);
+	emitCopies(i->block, fail, true);
+	jumpTo(fail);
+}
+
+StencilModule::StencilModule(const IRModule& m)
+	: offsets(m.functions.size(), -1), data(m.globals.size())
+{
+	TraceSpan span("StencilModule::StencilModule");
+	for (std::size_t k = 0; k < m.globals.size(); ++k)
+		data[k] = m.globals[k].getBits();
+	StencilModuleContext context = { getStencils(), {}, data, {}, {} };
+	for (std::size_t k = 0; k < m.functions.size(); ++k) {
+		names.push_back(m.functions[k]->name);
+		if (!m.functions[k]->isDefined())
+			continue;
+		offsets[k] = static_cast<std::ptrdiff_t>(context.code.size());
+		StencilFunctionCompiler(context, *m.functions[k]).compile();
+	}
+
+	// Calls to functions without a body trap.
+	std::size_t trap = context.code.size();
+	const Stencil& s = context.stencils[stencil_trap];
+	context.code.insert(context.code.end(), s.code.begin(), s.code.end());
+	for (const StencilPatch& p : context.calls) {
+		std::size_t target = offsets[p.target] >= 0 ? static_cast<std::size_t>(offsets[p.target]) : trap;
+		std::int32_t rel = static_cast<std::int32_t>(target - (p.offset + 4));
+		std::memcpy(&context.code[p.offset], &rel, 4);
+	}
+
+	code = ExecutableMemory(context.code.size());
+	std::memcpy(code.getBase(), context.code.data(), context.code.size());
+	code.protect();
+}
+
+void* StencilModule::getFunction(std::size_t i) const
+{
+	if (offsets[i] < 0)
+		return nullptr;
+	return code.getBase() + offsets[i];
+}
+
+void* StencilModule::getFunction(const std::string& name) const
+{
+	for (std::size_t k = 0; k < names.size(); ++k) {
+		if (names[k] == name)
+			return getFunction(k);
+	}
+	return nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include "IR.h"
+#include "ExecutableMemory.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiles the functions of a module by copy and patch: each instruction
+// is made by copying precompiled machine code stencils and patching the
+// holes in them with stack slots, constants and jump targets. There is no
+// analysis beyond counting uses, so compiling costs little more than
+// reading the IR, while the code runs without the dispatch of an
+// interpreter. Every value lives in a stack slot. Functions follow the C
+// calling convention of the platform, as with X86Module.
+class StencilModule {
+public:
+	explicit StencilModule(const IRModule& m);
+
+	// Null when there is no such function or it has no body.
+	void* getFunction(const std::string& name) const;
+	void* getFunction(std::size_t i) const;
+
+	// The storage of a global.
+	void* getGlobal(std::size_t i) { return &data[i]; }
+
+	std::size_t getCodeSize() const { return code.getSize(); }
+
+private:
+	ExecutableMemory code;
+	std::vector<std::string> names;
+
+	// Where each function starts in the code, or -1 when it has no body.
+	std::vector<std::ptrdiff_t> offsets;
+
+	// A slot for each global, which the code addresses directly.
+	std::vector<std::uint64_t> data;
+};
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "Stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#else
+#include <unistd.h>
+#endif
+
+// The input holds at least a byte order mark, so the encoding is known
+// before anything is decoded.
+Stream::Stream(int fd, const std::string& name, std::size_t capacity)
+	: fd(fd), file(name, {}), buffer(std::max<std::size_t>(capacity, 1)), size(0),
+	input(std::max<std::size_t>(capacity, 4)), pending(0), encoding(enc_unknown), ended(false) {}
+
+// No token spans a newline, so handing out whole lines means the lexer
+// never meets a token cut off by the end of the buffer.
+bool Stream::refill(const char*& first, const char*& last) {
+	char* data = buffer.data();
+	std::size_t kept = first ? data + size - first : 0;
+	if (kept) {
+		std::memmove(data, first, kept);
+	}
+	size = kept;
+
+	std::size_t scanned = kept;
+	while (!ended) {
+		auto n = read(fd, input.data() + pending, static_cast<unsigned>(input.size() - pending));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			ended = true;
+		}
+		else {
+			pending += n;
+		}
+		decode();
+		if (std::memchr(buffer.data() + scanned, '\n', size - scanned)) {
+			break;
+		}
+		scanned = size;
+	}
+
+	first = buffer.data();
+	last = first + size;
+	if (!ended) {
+		while (last[-1] != '\n') {
+			--last;
+		}
+	}
+	return first != last;
+}
+
+// Moves the pending input that can be decoded to the end of the buffer. A
+// carriage return, an odd byte or the first half of a surrogate pair waits
+// for what follows it, unless the input has ended.
+void Stream::decode() {
+	const char* p = input.data();
+	std::size_t n = pending;
+	if (encoding == enc_unknown) {
+		if (n < 3 && !ended) {
+			return;
+		}
+		encoding = enc_utf8;
+		if (n >= 2 && (std::memcmp(p, "\xFF\xFE", 2) == 0 || std::memcmp(p, "\xFE\xFF", 2) == 0)) {
+			encoding = p[0] == '\xFE' ? enc_utf16be : enc_utf16le;
+			p += 2;
+			n -= 2;
+		}
+		else if (n >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+			p += 3;
+			n -= 3;
+		}
+	}
+
+	std::string text;
+	if (encoding == enc_utf8) {
+		if (!ended && n && p[n - 1] == '\r') {
+			--n;
+		}
+		text.assign(p, n);
+		normalizeNewlines(text);
+	}
+	else {
+		bool bigEndian = encoding == enc_utf16be;
+		if (!ended) {
+			n = n / 2 * 2;
+			if (n) {
+				const unsigned char* q = reinterpret_cast<const unsigned char*>(p + n - 2);
+				unsigned c = bigEndian ? (q[0] << 8 | q[1]) : (q[1] << 8 | q[0]);
+				if (c == '\r' || (c & 0xFC00) == 0xD800) {
+					n -= 2;
+				}
+			}
+		}
+		text = decodeUtf16(p, p + n, bigEndian);
+	}
+
+	std::size_t used = p + n - input.data();
+	std::memmove(input.data(), input.data() + used, pending - used);
+	pending -= used;
+	if (size + text.size() > buffer.size()) {
+		buffer.resize(std::max(buffer.size() * 2, size + text.size()));
+	}
+	std::memcpy(buffer.data() + size, text.data(), text.size());
+	size += text.size();
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+#include "File.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Input read from a file descriptor, such as a pipe or standard input, a
+// buffer at a time so that lexing can start before all of it has arrived.
+// It is decoded as File decodes a whole file: a byte order mark picks
+// UTF-8 or UTF-16, and line endings become LF. The buffer only grows for a
+// line longer than it.
+class Stream {
+public:
+	Stream(int fd, const std::string& name, std::size_t capacity = 64 * 1024);
+
+	// Names the input in locations.
+	const File& getFile() const { return file; }
+
+	// Keeps the text from first on, reads more after it and sets
+	// [first, last) to the complete lines now buffered. Returns false at
+	// the end of the input.
+	bool refill(const char*& first, const char*& last);
+
+private:
+	enum Encoding {
+		enc_unknown,
+		enc_utf8,
+		enc_utf16le,
+		enc_utf16be
+	};
+
+	void decode();
+
+	int fd;
+	File file;
+	std::vector<char> buffer;
+	std::size_t size;
+	std::vector<char> input;
+	std::size_t pending;
+	Encoding encoding;
+	bool ended;
+};
\ No newline at end of file
@@ -1,10 +1,18 @@
 #include "stdafx.h"
 #include "Symbol.h"
+#include <mutex>
 
 Symbol SymbolTable::get(const char* str) {
-	return &*symbols.insert(str).first;
+	return get(std::string(str));
 }
 
 Symbol SymbolTable::get(const std::string& str) {
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		auto iterator = symbols.find(str);
+		if (iterator != symbols.end())
+			return &*iterator;
+	}
+	std::unique_lock<std::shared_mutex> lock(mutex);
 	return &*symbols.insert(str).first;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #pragma once
+#include <shared_mutex>
 #include <string>
 #include <unordered_set>
 
@@ -10,5 +11,7 @@ public:
 	Symbol get(const std::string& str);
 
 private:
+	// Lexers on different threads may share a table.
+	std::shared_mutex mutex;
 	std::unordered_set<std::string> symbols;
 };
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "stdafx.h"
+#include "TokenCache.h"
+#include "File.h"
+#include "Lexer.h"
+#include "Diagnostics.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char magic[8] = { 'T', 'O', 'K', 'C', 'A', 'C', 'H', 'E' };
+static const std::uint32_t version = 1;
+
+struct Header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t recordSize;
+	std::uint64_t sourceHash;
+	std::uint64_t sourceSize;
+	std::uint64_t tokenCount;
+	std::uint64_t stringCount;
+	std::uint64_t stringBytes;
+};
+
+// The value holds an integer, the bits of a double or an index into the
+// string table; the attribute holds any other kind of attribute.
+struct TokenCache::Record {
+	std::uint64_t value;
+	std::int32_t line;
+	std::int32_t column;
+	std::uint8_t name;
+	std::uint8_t attribute;
+	std::uint16_t unused0;
+	std::uint32_t unused1;
+};
+
+std::uint64_t TokenCache::hash(const std::string& text) {
+	const std::uint64_t k = 0xFF51AFD7ED558CCDull;
+	std::uint64_t h = 0x9E3779B97F4A7C15ull ^ text.size();
+	const char* p = text.data();
+	std::size_t n = text.size();
+	for (; n >= 8; p += 8, n -= 8) {
+		std::uint64_t w;
+		std::memcpy(&w, p, 8);
+		h = (h ^ w) * k;
+		h ^= h >> 32;
+	}
+	if (n) {
+		std::uint64_t w = 0;
+		std::memcpy(&w, p, n);
+		h = (h ^ w) * k;
+		h ^= h >> 32;
+	}
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+std::string TokenCache::getPath(const std::string& dir, const File& f) {
+	char name[32];
+	std::snprintf(name, sizeof name, "%016llx.tok", static_cast<unsigned long long>(hash(f.getText())));
+	return dir.empty() ? name : dir + '/' + name;
+}
+
+bool TokenCache::write(const std::string& path, const File& f, SymbolTable& s, unsigned threads) {
+	TraceSpan span("TokenCache::write", path);
+	PerfPhase phase(PerfCounters::lex_phase);
+	Diagnostics diagnostics;
+	Lexer lex(s, f, diagnostics);
+	lex.prescan(threads);
+	if (diagnostics.hasErrors()) {
+		return false;
+	}
+
+	std::vector<Record> records;
+	std::vector<Symbol> strings;
+	std::unordered_map<Symbol, std::uint64_t> index;
+	auto getIndex = [&](Symbol sym) {
+		auto r = index.emplace(sym, strings.size());
+		if (r.second) {
+			strings.push_back(sym);
+		}
+		return r.first->second;
+	};
+	for (;;) {
+		Token t = lex.scan();
+		Record r = {};
+		r.name = static_cast<std::uint8_t>(t.getName());
+		r.line = t.getLocation().line;
+		r.column = t.getLocation().column;
+		switch (t.getName()) {
+		case tok_identifier:
+			r.value = getIndex(t.getIdentifier());
+			break;
+		case tok_string:
+			r.value = getIndex(t.getAttribute().strValue.symbol);
+			break;
+		case tok_binary_integer:
+		case tok_decimal_integer:
+		case tok_hexadecimal_integer:
+			r.value = static_cast<std::uint64_t>(t.getInteger());
+			r.attribute = static_cast<std::uint8_t>(t.getRadix());
+			break;
+		case tok_floating_point: {
+			double d = t.getFloatingPoint();
+			std::memcpy(&r.value, &d, sizeof d);
+			break;
+		}
+		case tok_relational_operator:
+			r.attribute = t.getRelationalOperator();
+			break;
+		case tok_arithmetic_operator:
+			r.attribute = t.getArithmeticOperator();
+			break;
+		case tok_bitwise_operator:
+			r.attribute = t.getBitwiseOperator();
+			break;
+		case tok_logical_operator:
+			r.attribute = t.getLogicalOperator();
+			break;
+		case tok_compound_assignment_operator:
+			r.attribute = t.getCompoundAssignmentOperator();
+			break;
+		case tok_boolean:
+			r.attribute = t.getBool();
+			break;
+		case tok_character:
+			r.attribute = static_cast<std::uint8_t>(t.getChar());
+			break;
+		case tok_type_specifier:
+			r.attribute = t.getTypeSpecifier();
+			break;
+		default:
+			break;
+		}
+		records.push_back(r);
+		if (!t) {
+			break;
+		}
+	}
+
+	std::vector<std::uint64_t> offsets{ 0 };
+	for (Symbol sym : strings) {
+		offsets.push_back(offsets.back() + sym->size());
+	}
+
+	Header h;
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = version;
+	h.recordSize = sizeof(Record);
+	h.sourceHash = hash(f.getText());
+	h.sourceSize = f.getText().size();
+	h.tokenCount = records.size();
+	h.stringCount = strings.size();
+	h.stringBytes = offsets.back();
+
+	// Written under another name first so that a reader never maps a
+	// partly written cache.
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof h);
+		out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+		out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(std::uint64_t));
+		for (Symbol sym : strings) {
+			out.write(sym->data(), sym->size());
+		}
+		if (!out) {
+			std::remove(temp.c_str());
+			return false;
+		}
+	}
+	if (std::rename(temp.c_str(), path.c_str()) != 0) {
+		std::remove(path.c_str());
+		if (std::rename(temp.c_str(), path.c_str()) != 0) {
+			std::remove(temp.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+TokenCache::TokenCache(const std::string& path, const File& f, SymbolTable& s)
+	: file(&f), data(nullptr), length(0), records(nullptr), count(0) {
+	TraceSpan span("TokenCache::TokenCache", path);
+#ifdef _WIN32
+	HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (h == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(h, &size) && size.QuadPart >= static_cast<LONGLONG>(sizeof(Header))) {
+		HANDLE m = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m) {
+			data = static_cast<const char*>(MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0));
+			length = static_cast<std::size_t>(size.QuadPart);
+			CloseHandle(m);
+		}
+	}
+	CloseHandle(h);
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Header))) {
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			data = static_cast<const char*>(p);
+			length = st.st_size;
+		}
+	}
+	close(fd);
+#endif
+	if (!data) {
+		return;
+	}
+
+	Header h;
+	std::memcpy(&h, data, sizeof h);
+	const std::string& text = f.getText();
+	std::uint64_t tableOffset = sizeof h + h.tokenCount * sizeof(Record);
+	if (std::memcmp(h.magic, magic, sizeof magic) != 0 || h.version != version ||
+		h.recordSize != sizeof(Record) || h.sourceSize != text.size() ||
+		h.tokenCount == 0 || h.tokenCount > length / sizeof(Record) || h.stringCount > length / 8 ||
+		tableOffset + (h.stringCount + 1) * 8 + h.stringBytes != length ||
+		h.sourceHash != hash(text)) {
+		unmap();
+		return;
+	}
+
+	const char* table = data + tableOffset;
+	const char* chars = table + (h.stringCount + 1) * 8;
+	strings.reserve(h.stringCount);
+	for (std::uint64_t i = 0; i < h.stringCount; ++i) {
+		std::uint64_t range[2];
+		std::memcpy(range, table + i * 8, sizeof range);
+		if (range[0] > range[1] || range[1] > h.stringBytes) {
+			strings.clear();
+			unmap();
+			return;
+		}
+		strings.push_back(s.get(std::string(chars + range[0], chars + range[1])));
+	}
+
+	// A cache that is cut short or damaged can still match the hash of its
+	// source, so each record is checked before get relies on it.
+	const Record* mapped = reinterpret_cast<const Record*>(data + sizeof h);
+	bool valid = mapped[h.tokenCount - 1].name == tok_eof;
+	for (std::uint64_t i = 0; valid && i < h.tokenCount; ++i) {
+		const Record& r = mapped[i];
+		switch (r.name) {
+		case tok_identifier:
+		case tok_string:
+			valid = r.value < h.stringCount;
+			break;
+		case tok_binary_integer:
+			valid = r.attribute == bin;
+			break;
+		case tok_decimal_integer:
+			valid = r.attribute == dec;
+			break;
+		case tok_hexadecimal_integer:
+			valid = r.attribute == hex;
+			break;
+		default:
+			valid = r.name <= tok_type_specifier;
+			break;
+		}
+	}
+	if (!valid) {
+		strings.clear();
+		unmap();
+		return;
+	}
+	records = mapped;
+	count = h.tokenCount;
+}
+
+TokenCache::~TokenCache() {
+	unmap();
+}
+
+void TokenCache::unmap() {
+	if (!data) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<char*>(data), length);
+#endif
+	data = nullptr;
+	records = nullptr;
+	count = 0;
+}
+
+Token TokenCache::get(std::size_t i) const {
+	assert(i < count);
+	const Record& r = records[i];
+	Location l(*file, r.line, r.column);
+	TokenName n = static_cast<TokenName>(r.name);
+	switch (n) {
+	case tok_identifier:
+		return { strings[r.value], l };
+	case tok_string:
+		return { StringAttribute{ strings[r.value] }, l };
+	case tok_binary_integer:
+	case tok_decimal_integer:
+	case tok_hexadecimal_integer:
+		return { n, static_cast<Radix>(r.attribute), static_cast<long long>(r.value), l };
+	case tok_floating_point: {
+		double d;
+		std::memcpy(&d, &r.value, sizeof d);
+		return { d, l };
+	}
+	case tok_relational_operator:
+		return { static_cast<RelationalOperator>(r.attribute), l };
+	case tok_arithmetic_operator:
+		return { static_cast<ArithmeticOperator>(r.attribute), l };
+	case tok_bitwise_operator:
+		return { static_cast<BitwiseOperator>(r.attribute), l };
+	case tok_logical_operator:
+		return { static_cast<LogicalOperator>(r.attribute), l };
+	case tok_compound_assignment_operator:
+		return { static_cast<CompoundAssignmentOperator>(r.attribute), l };
+	case tok_boolean:
+		return { r.attribute != 0, l };
+	case tok_character:
+		return { static_cast<char>(r.attribute), l };
+	case tok_type_specifier:
+		return { static_cast<TypeSpecifier>(r.attribute), l };
+	default:
+		return { n, l };
+	}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+#include "Token.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class File;
+
+// The tokens of a source file saved in a form that is mapped into memory
+// and read in place, so that unchanged sources need not be lexed again.
+//
+// A cache file holds a header, one fixed-size record per token and a table
+// of the identifiers and strings the records refer to. It is named after a
+// hash of the source text and also records that hash, so a stale cache is
+// never used. The layout is that of the machine that wrote it.
+class TokenCache {
+public:
+	// Maps the cache at path for f, interning its strings into s. The
+	// cache is unusable if the file is missing, malformed or stale.
+	TokenCache(const std::string& path, const File& f, SymbolTable& s);
+	~TokenCache();
+
+	TokenCache(const TokenCache&) = delete;
+	TokenCache& operator=(const TokenCache&) = delete;
+
+	explicit operator bool() const { return records != nullptr; }
+
+	// Number of tokens, including the final tok_eof.
+	std::size_t size() const { return count; }
+	Token get(std::size_t i) const;
+
+	static std::uint64_t hash(const std::string& text);
+
+	// The cache file for f in directory dir.
+	static std::string getPath(const std::string& dir, const File& f);
+
+	// Lexes f on the given number of threads and saves its tokens at
+	// path. Nothing is saved if f has lexical errors, since those would not
+	// be reported when reading the cache.
+	static bool write(const std::string& path, const File& f, SymbolTable& s, unsigned threads = 0);
+
+private:
+	struct Record;
+
+	void unmap();
+
+	const File* file;
+	const char* data;
+	std::size_t length;
+	const Record* records;
+	std::size_t count;
+	std::vector<Symbol> strings;
+};
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "TokenPipe.h"
+#include "MemoryProfile.h"
+#include <algorithm>
+#include <thread>
+
+static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+	std::size_t p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+TokenPipe::TokenPipe(std::size_t capacity)
+	: ring(roundUpToPowerOfTwo(capacity)), mask(ring.size() - 1), cancelled(false),
+	head(0), cachedTail(0), tail(0), cachedHead(0) {
+	if (MemoryProfile::isEnabled()) {
+		MemoryProfile::count(MemoryProfile::token_buffers, 0, ring.size() * sizeof(Token));
+	}
+}
+
+bool TokenPipe::push(const Token* tokens, std::size_t n) {
+	while (n) {
+		std::size_t t = tail.load(std::memory_order_relaxed);
+		std::size_t free = ring.size() - (t - cachedHead);
+		if (free == 0) {
+			cachedHead = head.load(std::memory_order_acquire);
+			free = ring.size() - (t - cachedHead);
+		}
+		if (free == 0) {
+			if (cancelled.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+		std::size_t k = std::min(n, free);
+		for (std::size_t i = 0; i < k; ++i) {
+			ring[(t + i) & mask] = tokens[i];
+		}
+		tail.store(t + k, std::memory_order_release);
+		tokens += k;
+		n -= k;
+	}
+	return true;
+}
+
+Token TokenPipe::pop() {
+	std::size_t h = head.load(std::memory_order_relaxed);
+	while (h == cachedTail) {
+		cachedTail = tail.load(std::memory_order_acquire);
+		if (h == cachedTail) {
+			std::this_thread::yield();
+		}
+	}
+	Token t = ring[h & mask];
+	head.store(h + 1, std::memory_order_release);
+	return t;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include "Token.h"
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// A lock-free ring buffer that hands tokens from one producer thread to one
+// consumer thread. Each side only writes its own index and rereads the
+// other's when its cached copy says the ring is full or empty.
+class TokenPipe {
+public:
+	explicit TokenPipe(std::size_t capacity = 4096);
+
+	// Appends n tokens, waiting while the ring is full. Returns false if the
+	// consumer has given up.
+	bool push(const Token* tokens, std::size_t n);
+
+	// Removes the next token, waiting until there is one.
+	Token pop();
+
+	// Called by the consumer to release a producer waiting on a full ring.
+	void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+private:
+	std::vector<Token> ring;
+	std::size_t mask;
+	std::atomic<bool> cancelled;
+
+	// Kept on separate cache lines so that the two threads do not contend.
+	alignas(64) std::atomic<std::size_t> head;
+	std::size_t cachedTail;
+	alignas(64) std::atomic<std::size_t> tail;
+	std::size_t cachedHead;
+};
\ No newline at end of file
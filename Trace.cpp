@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Trace::enabled(false);
+
+struct TraceEvent {
+	const char* name;
+	std::string detail;
+	long long begin;
+	long long end;
+};
+
+// The events of one thread. Buffers belong to the recorder so that they
+// outlive the threads that fill them.
+struct TraceBuffer {
+	unsigned thread;
+	std::vector<TraceEvent> events;
+};
+
+static std::mutex traceMutex;
+static std::string tracePath;
+static std::chrono::steady_clock::time_point traceEpoch;
+static std::vector<std::unique_ptr<TraceBuffer>> traceBuffers;
+
+// Bumped by each start so that threads drop buffers from an earlier one.
+static unsigned traceGeneration;
+static thread_local TraceBuffer* localBuffer;
+static thread_local unsigned localGeneration;
+
+void Trace::start(const std::string& path) {
+	std::lock_guard<std::mutex> lock(traceMutex);
+	tracePath = path;
+	traceEpoch = std::chrono::steady_clock::now();
+	traceBuffers.clear();
+	++traceGeneration;
+	enabled.store(true, std::memory_order_release);
+}
+
+long long Trace::now() {
+	auto d = std::chrono::steady_clock::now() - traceEpoch;
+	return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+void Trace::record(const char* name, const std::string& detail, long long begin, long long end) {
+	if (!isEnabled()) {
+		return;
+	}
+	if (!localBuffer || localGeneration != traceGeneration) {
+		std::lock_guard<std::mutex> lock(traceMutex);
+		traceBuffers.emplace_back(new TraceBuffer{ static_cast<unsigned>(traceBuffers.size() + 1), {} });
+		localBuffer = traceBuffers.back().get();
+		localGeneration = traceGeneration;
+	}
+	localBuffer->events.push_back({ name, detail, begin, end });
+}
+
+static void writeString(std::FILE* f, const char* s) {
+	std::fputc('"', f);
+	for (; *s; ++s) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			std::fputc('\\', f);
+			std::fputc(c, f);
+		}
+		else if (c < 0x20) {
+			std::fprintf(f, "\\u%04x", c);
+		}
+		else {
+			std::fputc(c, f);
+		}
+	}
+	std::fputc('"', f);
+}
+
+bool Trace::finish() {
+	if (!enabled.exchange(false)) {
+		return true;
+	}
+	std::lock_guard<std::mutex> lock(traceMutex);
+	std::FILE* f = std::fopen(tracePath.c_str(), "w");
+	if (!f) {
+		traceBuffers.clear();
+		return false;
+	}
+	std::fputs("{\"traceEvents\":[", f);
+	const char* separator = "\n";
+	for (const auto& b : traceBuffers) {
+		for (const TraceEvent& e : b->events) {
+			std::fputs(separator, f);
+			std::fputs("{\"name\":", f);
+			writeString(f, e.name);
+			std::fprintf(f, ",\"cat\":\"compile\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld",
+				b->thread, e.begin, e.end - e.begin);
+			if (!e.detail.empty()) {
+				std::fputs(",\"args\":{\"detail\":", f);
+				writeString(f, e.detail.c_str());
+				std::fputc('}', f);
+			}
+			std::fputc('}', f);
+			separator = ",\n";
+		}
+	}
+	std::fputs("\n]}\n", f);
+	bool ok = std::fclose(f) == 0;
+	traceBuffers.clear();
+	return ok;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+// Records spans of work in the Chrome trace-event format, which
+// chrome://tracing and Perfetto can load. Nothing is recorded until start
+// is called; until then a span costs one flag test.
+class Trace {
+public:
+	// Begins recording events for the file at path. Call it before starting
+	// the threads whose work should be recorded.
+	static void start(const std::string& path);
+
+	// Stops recording and writes the events. Call it once the threads that
+	// record spans are done. Returns false if the file could not be written.
+	static bool finish();
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Microseconds since recording began.
+	static long long now();
+
+	// Adds a span to the calling thread's events.
+	static void record(const char* name, const std::string& detail, long long begin, long long end);
+
+private:
+	static std::atomic<bool> enabled;
+};
+
+// Records the time between its construction and destruction.
+class TraceSpan {
+public:
+	explicit TraceSpan(const char* name)
+		: name(name), begin(Trace::isEnabled() ? Trace::now() : -1) {}
+
+	TraceSpan(const char* name, const std::string& d)
+		: TraceSpan(name) { setDetail(d); }
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	~TraceSpan() {
+		if (begin >= 0) {
+			Trace::record(name, detail, begin, Trace::now());
+		}
+	}
+
+	// Names what the span works on, such as a file or a function.
+	void setDetail(const std::string& d) {
+		if (begin >= 0) {
+			detail = d;
+		}
+	}
+
+private:
+	const char* name;
+	std::string detail;
+	long long begin;
+};
\ No newline at end of file
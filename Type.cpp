@@ -1,15 +1,16 @@
 #include "stdafx.h"
 #include "Type.h"
+#include "Casting.h"
 
 bool Type::isReferenceTo(const Type* t) {
-	if (const ReferenceType* r = dynamic_cast<const ReferenceType*>(this)) {
+	if (const ReferenceType* r = dyn_cast<ReferenceType>(this)) {
 		return areSame(r->getObjectType(), t);
 	}
 	return false;
 }
 
 bool Type::isPointerTo(const Type* t) {
-	if (const PointerType* p = dynamic_cast<const PointerType*>(this)) {
+	if (const PointerType* p = dyn_cast<PointerType>(this)) {
 		return areSame(p->getElementType(), t);
 	}
 	return false;
@@ -32,7 +33,7 @@ bool Type::isNumeric() const {
 }
 
 Type* Type::getObjectType() const {
-	if (const ReferenceType* r = dynamic_cast<const ReferenceType*>(this)) {
+	if (const ReferenceType* r = dyn_cast<ReferenceType>(this)) {
 		return r->getObjectType();
 	}
 	return const_cast<Type*>(this);
@@ -71,10 +72,10 @@ bool areSame(const Type* t1, const Type* t2) {
 	case Type::float_kind:
 		return true;
 	case Type::pointer_kind:
-		return areSamePointers(static_cast<const PointerType*>(t1), static_cast<const PointerType*>(t2));
+		return areSamePointers(cast<PointerType>(t1), cast<PointerType>(t2));
 	case Type::reference_kind:
-		return areSameReferences(static_cast<const ReferenceType*>(t1), static_cast<const ReferenceType*>(t2));
+		return areSameReferences(cast<ReferenceType>(t1), cast<ReferenceType>(t2));
 	case Type::function_kind:
-		return areSameFunctions(static_cast<const FunctionType*>(t1), static_cast<const FunctionType*>(t2));
+		return areSameFunctions(cast<FunctionType>(t1), cast<FunctionType>(t2));
 	}
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
-#include <vector>
+#include "SmallVector.h"
+#include "MemoryProfile.h"
 
 class Type {
 public:
@@ -15,9 +16,12 @@ public:
 
 protected:
 	Type(Kind k)
-		: kind(k) {}
+		: kind(k) { MemoryProfile::countNode(MemoryProfile::type_nodes, k); }
 
 public:
+	static void* operator new(std::size_t n) { return MemoryProfile::allocate(n); }
+	static void operator delete(void* p) { ::operator delete(p); }
+
 	virtual ~Type() = default;
 
 	Kind getKind() const { return kind; }
@@ -42,32 +46,42 @@ private:
 	Kind kind;
 };
 
-using TypeList = std::vector<Type*>;
+using TypeList = SmallVector<Type*, 4>;
 
 struct BoolType : Type {
 	BoolType()
 		: Type(bool_kind) {}
+
+	static bool classof(const Type* n) { return n->getKind() == bool_kind; }
 };
 
 struct CharType : Type {
 	CharType()
 		: Type(char_kind) {}
+
+	static bool classof(const Type* n) { return n->getKind() == char_kind; }
 };
 
 struct IntType : Type {
 	IntType()
 		: Type(int_kind) {}
+
+	static bool classof(const Type* n) { return n->getKind() == int_kind; }
 };
 
 struct FloatType : Type {
 	FloatType()
 		: Type(float_kind) {}
+
+	static bool classof(const Type* n) { return n->getKind() == float_kind; }
 };
 
 struct PointerType : Type {
 	PointerType()
 		: Type(pointer_kind) {}
 
+	static bool classof(const Type* n) { return n->getKind() == pointer_kind; }
+
 	Type* getElementType() const { return element; }
 
 	Type* element;
@@ -77,6 +91,8 @@ struct ReferenceType : Type {
 	ReferenceType(Type* t)
 		: Type(reference_kind), element(t) {}
 
+	static bool classof(const Type* n) { return n->getKind() == reference_kind; }
+
 	Type* getObjectType() const { return element; }
 
 	Type* element;
@@ -86,6 +102,8 @@ struct FunctionType : Type {
 	FunctionType(const TypeList& p, Type* r)
 		: Type(function_kind), params(p), returnType(r) {}
 
+	static bool classof(const Type* n) { return n->getKind() == function_kind; }
+
 	const TypeList& getParamTypes() const { return params; }
 	TypeList& getParamTypes() { return params; }
 	Type* getReturnType() const { return returnType; }
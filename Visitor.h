@@ -0,0 +1,272 @@
+#pragma once
+#include "Casting.h"
+#include "Type.h"
+#include "Expression.h"
+#include "Statement.h"
+#include "Declaration.h"
+
+// Visitors dispatch on the kind of a node to a member of the derived class
+// without virtual calls (the derived class passes itself as Derived). A
+// member that the derived class does not provide falls back to the one for
+// the base class of the node, ending with visitType, visitExpression,
+// visitStatement or visitDeclaration, which do nothing by default.
+
+template<typename Derived, typename Result = void>
+class TypeVisitor {
+public:
+	Result visit(const Type* t) {
+		switch (t->getKind()) {
+		case Type::bool_kind:
+			return derived().visitBoolType(cast<BoolType>(t));
+		case Type::char_kind:
+			return derived().visitCharType(cast<CharType>(t));
+		case Type::int_kind:
+			return derived().visitIntType(cast<IntType>(t));
+		case Type::float_kind:
+			return derived().visitFloatType(cast<FloatType>(t));
+		case Type::pointer_kind:
+			return derived().visitPointerType(cast<PointerType>(t));
+		case Type::reference_kind:
+			return derived().visitReferenceType(cast<ReferenceType>(t));
+		case Type::function_kind:
+			return derived().visitFunctionType(cast<FunctionType>(t));
+		}
+		return derived().visitType(t);
+	}
+
+	Result visitBoolType(const BoolType* t) { return derived().visitType(t); }
+	Result visitCharType(const CharType* t) { return derived().visitType(t); }
+	Result visitIntType(const IntType* t) { return derived().visitType(t); }
+	Result visitFloatType(const FloatType* t) { return derived().visitType(t); }
+	Result visitPointerType(const PointerType* t) { return derived().visitType(t); }
+	Result visitReferenceType(const ReferenceType* t) { return derived().visitType(t); }
+	Result visitFunctionType(const FunctionType* t) { return derived().visitType(t); }
+	Result visitType(const Type*) { return Result(); }
+
+private:
+	Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+template<typename Derived, typename Result = void>
+class ExpressionVisitor {
+public:
+	Result visit(const Expression* e) {
+		switch (e->getKind()) {
+		case Expression::bool_kind:
+			return derived().visitBoolExpression(cast<BoolExpression>(e));
+		case Expression::int_kind:
+			return derived().visitIntExpression(cast<IntExpression>(e));
+		case Expression::float_kind:
+			return derived().visitFloatExpression(cast<FloatExpression>(e));
+		case Expression::id_kind:
+			return derived().visitIdExpression(cast<IdExpression>(e));
+		case Expression::unop_kind:
+			return derived().visitUnopExpression(cast<UnopExpression>(e));
+		case Expression::binop_kind:
+			return derived().visitBinopExpression(cast<BinopExpression>(e));
+		case Expression::call_kind:
+			return derived().visitCallExpression(cast<CallExpression>(e));
+		case Expression::index_kind:
+			return derived().visitIndexExpression(cast<IndexExpression>(e));
+		case Expression::cast_kind:
+			return derived().visitCastExpression(cast<CastExpression>(e));
+		case Expression::assign_kind:
+			return derived().visitAssignmentExpression(cast<AssignmentExpression>(e));
+		case Expression::cond_kind:
+			return derived().visitConditionalExpression(cast<ConditionalExpression>(e));
+		case Expression::conv_kind:
+			return derived().visitConversionExpression(cast<ConversionExpression>(e));
+		default:
+			return derived().visitExpression(e);
+		}
+	}
+
+	Result visitBoolExpression(const BoolExpression* e) { return derived().visitExpression(e); }
+	Result visitIntExpression(const IntExpression* e) { return derived().visitExpression(e); }
+	Result visitFloatExpression(const FloatExpression* e) { return derived().visitExpression(e); }
+	Result visitIdExpression(const IdExpression* e) { return derived().visitExpression(e); }
+	Result visitUnopExpression(const UnopExpression* e) { return derived().visitExpression(e); }
+	Result visitBinopExpression(const BinopExpression* e) { return derived().visitExpression(e); }
+	Result visitCallExpression(const CallExpression* e) { return derived().visitPostfixExpression(e); }
+	Result visitIndexExpression(const IndexExpression* e) { return derived().visitPostfixExpression(e); }
+	Result visitPostfixExpression(const PostfixExpression* e) { return derived().visitExpression(e); }
+	Result visitCastExpression(const CastExpression* e) { return derived().visitExpression(e); }
+	Result visitAssignmentExpression(const AssignmentExpression* e) { return derived().visitExpression(e); }
+	Result visitConditionalExpression(const ConditionalExpression* e) { return derived().visitExpression(e); }
+	Result visitConversionExpression(const ConversionExpression* e) { return derived().visitExpression(e); }
+	Result visitExpression(const Expression*) { return Result(); }
+
+private:
+	Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+template<typename Derived, typename Result = void>
+class StatementVisitor {
+public:
+	Result visit(const Statement* s) {
+		switch (s->getKind()) {
+		case Statement::block_kind:
+			return derived().visitBlockStatement(cast<BlockStatement>(s));
+		case Statement::when_kind:
+			return derived().visitWhenStatement(cast<WhenStatement>(s));
+		case Statement::if_kind:
+			return derived().visitIfStatement(cast<IfStatement>(s));
+		case Statement::while_kind:
+			return derived().visitWhileStatement(cast<WhileStatement>(s));
+		case Statement::break_kind:
+			return derived().visitBreakStatement(cast<BreakStatement>(s));
+		case Statement::cont_kind:
+			return derived().visitContinueStatement(cast<ContinueStatement>(s));
+		case Statement::ret_kind:
+			return derived().visitReturnStatement(cast<ReturnStatement>(s));
+		case Statement::decl_kind:
+			return derived().visitDeclareStatement(cast<DeclareStatement>(s));
+		case Statement::expr_kind:
+			return derived().visitExpressionStatement(cast<ExpressionStatement>(s));
+		}
+		return derived().visitStatement(s);
+	}
+
+	Result visitBlockStatement(const BlockStatement* s) { return derived().visitStatement(s); }
+	Result visitWhenStatement(const WhenStatement* s) { return derived().visitStatement(s); }
+	Result visitIfStatement(const IfStatement* s) { return derived().visitStatement(s); }
+	Result visitWhileStatement(const WhileStatement* s) { return derived().visitStatement(s); }
+	Result visitBreakStatement(const BreakStatement* s) { return derived().visitStatement(s); }
+	Result visitContinueStatement(const ContinueStatement* s) { return derived().visitStatement(s); }
+	Result visitReturnStatement(const ReturnStatement* s) { return derived().visitStatement(s); }
+	Result visitDeclareStatement(const DeclareStatement* s) { return derived().visitStatement(s); }
+	Result visitExpressionStatement(const ExpressionStatement* s) { return derived().visitStatement(s); }
+	Result visitStatement(const Statement*) { return Result(); }
+
+private:
+	Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+template<typename Derived, typename Result = void>
+class DeclarationVisitor {
+public:
+	Result visit(const Declaration* d) {
+		switch (d->getKind()) {
+		case Declaration::program_kind:
+			return derived().visitProgramDeclaration(cast<ProgramDeclaration>(d));
+		case Declaration::variable_kind:
+			return derived().visitVariableDeclaration(cast<VariableDeclaration>(d));
+		case Declaration::constant_kind:
+			return derived().visitConstantDeclaration(cast<ConstantDeclaration>(d));
+		case Declaration::value_kind:
+			return derived().visitValueDeclaration(cast<ValueDeclaration>(d));
+		case Declaration::parameter_kind:
+			return derived().visitParameterDeclaration(cast<ParameterDeclaration>(d));
+		case Declaration::function_kind:
+			return derived().visitFunctionDeclaration(cast<FunctionDeclaration>(d));
+		}
+		return derived().visitDeclaration(d);
+	}
+
+	Result visitProgramDeclaration(const ProgramDeclaration* d) { return derived().visitDeclaration(d); }
+	Result visitVariableDeclaration(const VariableDeclaration* d) { return derived().visitObjectDeclaration(d); }
+	Result visitConstantDeclaration(const ConstantDeclaration* d) { return derived().visitObjectDeclaration(d); }
+	Result visitValueDeclaration(const ValueDeclaration* d) { return derived().visitObjectDeclaration(d); }
+	Result visitParameterDeclaration(const ParameterDeclaration* d) { return derived().visitObjectDeclaration(d); }
+	Result visitObjectDeclaration(const ObjectDeclaration* d) { return derived().visitTypedDeclaration(d); }
+	Result visitFunctionDeclaration(const FunctionDeclaration* d) { return derived().visitTypedDeclaration(d); }
+	Result visitTypedDeclaration(const TypedDeclaration* d) { return derived().visitDeclaration(d); }
+	Result visitDeclaration(const Declaration*) { return Result(); }
+
+private:
+	Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+// Calls f with the field that holds each operand of an expression, in
+// order. A pass that owns the tree may replace an operand through it;
+// readers take the operand by value. The visitors take nodes as const, so
+// the fields are reached through a cast.
+template<typename F>
+class OperandVisitor : public ExpressionVisitor<OperandVisitor<F>> {
+public:
+	OperandVisitor(F& f)
+		: f(f) {}
+
+	void visitUnopExpression(const UnopExpression* e) { f(edit(e)->arg); }
+	void visitBinopExpression(const BinopExpression* e) {
+		f(edit(e)->lhs);
+		f(edit(e)->rhs);
+	}
+	void visitPostfixExpression(const PostfixExpression* e) {
+		f(edit(e)->base);
+		for (Expression*& a : edit(e)->getArguments())
+			f(a);
+	}
+	void visitCastExpression(const CastExpression* e) { f(edit(e)->source); }
+	void visitAssignmentExpression(const AssignmentExpression* e) {
+		f(edit(e)->lhs);
+		f(edit(e)->rhs);
+	}
+	void visitConditionalExpression(const ConditionalExpression* e) {
+		f(edit(e)->condition);
+		f(edit(e)->pass);
+		f(edit(e)->fail);
+	}
+	void visitConversionExpression(const ConversionExpression* e) { f(edit(e)->source); }
+
+private:
+	template<typename T>
+	static T* edit(const T* n) { return const_cast<T*>(n); }
+
+	F& f;
+};
+
+// Calls onExpression with the field that holds each expression directly
+// inside a statement, and onStatement with the field that holds each
+// statement, in order. The initializer of a declared object counts as an
+// expression of its declaration statement.
+template<typename E, typename S>
+class ChildVisitor : public StatementVisitor<ChildVisitor<E, S>> {
+public:
+	ChildVisitor(E& e, S& s)
+		: onExpression(e), onStatement(s) {}
+
+	void visitBlockStatement(const BlockStatement* s) {
+		for (Statement*& c : edit(s)->getStatements())
+			onStatement(c);
+	}
+	void visitWhenStatement(const WhenStatement* s) {
+		onExpression(edit(s)->condition);
+		onStatement(edit(s)->body);
+	}
+	void visitIfStatement(const IfStatement* s) {
+		onExpression(edit(s)->condition);
+		onStatement(edit(s)->pass);
+		onStatement(edit(s)->fail);
+	}
+	void visitWhileStatement(const WhileStatement* s) {
+		onExpression(edit(s)->condition);
+		onStatement(edit(s)->body);
+	}
+	void visitReturnStatement(const ReturnStatement* s) { onExpression(edit(s)->val); }
+	void visitDeclareStatement(const DeclareStatement* s) {
+		ObjectDeclaration* o = dyn_cast<ObjectDeclaration>(s->getDeclaration());
+		if (o && o->getInit())
+			onExpression(o->getInit());
+	}
+	void visitExpressionStatement(const ExpressionStatement* s) { onExpression(edit(s)->expression); }
+
+private:
+	template<typename T>
+	static T* edit(const T* n) { return const_cast<T*>(n); }
+
+	E& onExpression;
+	S& onStatement;
+};
+
+template<typename F>
+void visitOperands(const Expression* e, F f)
+{
+	OperandVisitor<F>(f).visit(e);
+}
+
+template<typename E, typename S>
+void visitChildren(const Statement* s, E onExpression, S onStatement)
+{
+	ChildVisitor<E, S>(onExpression, onStatement).visit(s);
+}
\ No newline at end of file
@@ -0,0 +1,447 @@
+#include "stdafx.h"
+#include "X86Assembler.h"
+
+#include <cassert>
+#include <cstring>
+
+#ifdef _WIN32
+static const X86Register intArgs[] = { reg_rcx, reg_rdx, reg_r8, reg_r9 };
+const X86CallingConvention hostConvention = { intArgs, 4, 4, true, 32 };
+#else
+static const X86Register intArgs[] = { reg_rdi, reg_rsi, reg_rdx, reg_rcx, reg_r8, reg_r9 };
+const X86CallingConvention hostConvention = { intArgs, 6, 8, false, 0 };
+#endif
+
+X86ArgumentPlace X86ArgumentPlacer::place(bool isFloat)
+{
+	const X86CallingConvention& c = hostConvention;
+	int index = c.positional ? count : isFloat ? floats++ : ints++;
+	++count;
+	if (index >= (isFloat ? c.floatArgCount : c.intArgCount))
+		return { true, stack++ };
+	return { false, isFloat ? index : c.intArgs[index] };
+}
+
+static bool isByte(std::int64_t v)
+{
+	return v >= -128 && v <= 127;
+}
+
+// spl, bpl, sil and dil need a REX prefix, without which the same numbers
+// name ah, ch, dh and bh.
+static bool needsRex(int byteReg)
+{
+	return byteReg >= reg_rsp && byteReg <= reg_rdi;
+}
+
+int X86Assembler::makeLabel()
+{
+	labels.push_back(-1);
+	return static_cast<int>(labels.size() - 1);
+}
+
+void X86Assembler::bind(int label)
+{
+	assert(labels[label] < 0);
+	labels[label] = static_cast<std::ptrdiff_t>(code.size());
+}
+
+void X86Assembler::resolve()
+{
+	for (const Fixup& f : fixups) {
+		assert(labels[f.label] >= 0);
+		std::int32_t rel = static_cast<std::int32_t>(labels[f.label] - static_cast<std::ptrdiff_t>(f.offset + 4));
+		std::memcpy(&code[f.offset], &rel, 4);
+	}
+	fixups.clear();
+}
+
+void X86Assembler::dword(std::uint32_t d)
+{
+	for (int i = 0; i < 4; ++i)
+		byte(static_cast<std::uint8_t>(d >> (8 * i)));
+}
+
+void X86Assembler::qword(std::uint64_t q)
+{
+	for (int i = 0; i < 8; ++i)
+		byte(static_cast<std::uint8_t>(q >> (8 * i)));
+}
+
+void X86Assembler::rex(bool wide, int reg, int base, bool byteRegs)
+{
+	std::uint8_t r = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1);
+	if (r != 0x40 || byteRegs)
+		byte(r);
+}
+
+void X86Assembler::modrm(int reg, int rm)
+{
+	byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void X86Assembler::modrm(int reg, X86Memory m)
+{
+	int base = m.base & 7;
+	int mod = m.disp == 0 && base != reg_rbp ? 0 : isByte(m.disp) ? 1 : 2;
+	byte(static_cast<std::uint8_t>(mod << 6 | (reg & 7) << 3 | base));
+	if (base == reg_rsp)
+		byte(0x24);
+	if (mod == 1)
+		byte(static_cast<std::uint8_t>(m.disp));
+	else if (mod == 2)
+		dword(static_cast<std::uint32_t>(m.disp));
+}
+
+void X86Assembler::op(std::uint8_t o, bool wide, int reg, int rm, bool byteRegs)
+{
+	rex(wide, reg, rm, byteRegs);
+	byte(o);
+	modrm(reg, rm);
+}
+
+void X86Assembler::op(std::uint8_t o, bool wide, int reg, X86Memory m)
+{
+	rex(wide, reg, m.base);
+	byte(o);
+	modrm(reg, m);
+}
+
+void X86Assembler::op2(std::uint8_t o, bool wide, int reg, int rm, bool byteRegs)
+{
+	rex(wide, reg, rm, byteRegs);
+	byte(0x0F);
+	byte(o);
+	modrm(reg, rm);
+}
+
+void X86Assembler::op2(std::uint8_t o, bool wide, int reg, X86Memory m)
+{
+	rex(wide, reg, m.base);
+	byte(0x0F);
+	byte(o);
+	modrm(reg, m);
+}
+
+void X86Assembler::sseOp(std::uint8_t prefix, std::uint8_t o, bool wide, int reg, int rm)
+{
+	if (prefix)
+		byte(prefix);
+	op2(o, wide, reg, rm);
+}
+
+void X86Assembler::sseOp(std::uint8_t prefix, std::uint8_t o, bool wide, int reg, X86Memory m)
+{
+	if (prefix)
+		byte(prefix);
+	op2(o, wide, reg, m);
+}
+
+void X86Assembler::fixup(int label)
+{
+	fixups.push_back({ code.size(), label });
+	dword(0);
+}
+
+void X86Assembler::mov(X86Register d, X86Register s, bool wide)
+{
+	op(0x8B, wide, d, s);
+}
+
+void X86Assembler::mov(X86Register d, std::int64_t imm, bool wide)
+{
+	// The 32-bit forms clear the upper half of the register.
+	if (!wide || (imm >= 0 && imm <= 0xFFFFFFFFLL)) {
+		rex(false, 0, d);
+		byte(0xB8 + (d & 7));
+		dword(static_cast<std::uint32_t>(imm));
+	}
+	else if (imm >= INT32_MIN && imm <= INT32_MAX) {
+		op(0xC7, true, 0, d);
+		dword(static_cast<std::uint32_t>(imm));
+	}
+	else {
+		rex(true, 0, d);
+		byte(0xB8 + (d & 7));
+		qword(static_cast<std::uint64_t>(imm));
+	}
+}
+
+void X86Assembler::load(X86Register d, X86Memory m, bool wide)
+{
+	op(0x8B, wide, d, m);
+}
+
+void X86Assembler::loadByte(X86Register d, X86Memory m)
+{
+	op2(0xB6, false, d, m);
+}
+
+void X86Assembler::store(X86Memory m, X86Register s, bool wide)
+{
+	op(0x89, wide, s, m);
+}
+
+void X86Assembler::storeByte(X86Memory m, X86Register s)
+{
+	rex(false, s, m.base, needsRex(s));
+	byte(0x88);
+	modrm(s, m);
+}
+
+void X86Assembler::store(X86Memory m, std::int32_t imm, bool wide)
+{
+	op(0xC7, wide, 0, m);
+	dword(static_cast<std::uint32_t>(imm));
+}
+
+void X86Assembler::lea(X86Register d, X86Memory m)
+{
+	op(0x8D, true, d, m);
+}
+
+void X86Assembler::leaLabel(X86Register d, int label)
+{
+	rex(true, d, 0);
+	byte(0x8D);
+	byte(0x05 | (d & 7) << 3);
+	fixup(label);
+}
+
+void X86Assembler::movzxByte(X86Register d, X86Register s)
+{
+	op2(0xB6, false, d, s, needsRex(s));
+}
+
+void X86Assembler::movsxByte(X86Register d, X86Register s)
+{
+	op2(0xBE, false, d, s, needsRex(s));
+}
+
+void X86Assembler::arith(X86Arith o, X86Register d, X86Register s, bool wide)
+{
+	op(static_cast<std::uint8_t>(o * 8 + 3), wide, d, s);
+}
+
+void X86Assembler::arith(X86Arith o, X86Register d, X86Memory m, bool wide)
+{
+	op(static_cast<std::uint8_t>(o * 8 + 3), wide, d, m);
+}
+
+void X86Assembler::arith(X86Arith o, X86Register d, std::int32_t imm, bool wide)
+{
+	if (isByte(imm)) {
+		op(0x83, wide, o, d);
+		byte(static_cast<std::uint8_t>(imm));
+	}
+	else {
+		op(0x81, wide, o, d);
+		dword(static_cast<std::uint32_t>(imm));
+	}
+}
+
+void X86Assembler::imul(X86Register d, X86Register s)
+{
+	op2(0xAF, false, d, s);
+}
+
+void X86Assembler::imul(X86Register d, X86Memory m)
+{
+	op2(0xAF, false, d, m);
+}
+
+void X86Assembler::imul(X86Register d, X86Register s, std::int32_t imm)
+{
+	if (isByte(imm)) {
+		op(0x6B, false, d, s);
+		byte(static_cast<std::uint8_t>(imm));
+	}
+	else {
+		op(0x69, false, d, s);
+		dword(static_cast<std::uint32_t>(imm));
+	}
+}
+
+void X86Assembler::imul(X86Register r)
+{
+	op(0xF7, false, 5, r);
+}
+
+void X86Assembler::imul(X86Memory m)
+{
+	op(0xF7, false, 5, m);
+}
+
+void X86Assembler::neg(X86Register r)
+{
+	op(0xF7, false, 3, r);
+}
+
+void X86Assembler::not_(X86Register r)
+{
+	op(0xF7, false, 2, r);
+}
+
+void X86Assembler::shl(X86Register r)
+{
+	op(0xD3, false, 4, r);
+}
+
+void X86Assembler::sar(X86Register r)
+{
+	op(0xD3, false, 7, r);
+}
+
+void X86Assembler::shl(X86Register r, std::uint8_t n)
+{
+	op(0xC1, false, 4, r);
+	byte(n);
+}
+
+void X86Assembler::sar(X86Register r, std::uint8_t n)
+{
+	op(0xC1, false, 7, r);
+	byte(n);
+}
+
+void X86Assembler::cdq()
+{
+	byte(0x99);
+}
+
+void X86Assembler::idiv(X86Register r)
+{
+	op(0xF7, false, 7, r);
+}
+
+void X86Assembler::idiv(X86Memory m)
+{
+	op(0xF7, false, 7, m);
+}
+
+void X86Assembler::test(X86Register a, X86Register b)
+{
+	op(0x85, false, b, a);
+}
+
+void X86Assembler::setcc(X86Condition c, X86Register d)
+{
+	op2(static_cast<std::uint8_t>(0x90 + c), false, 0, d, needsRex(d));
+}
+
+void X86Assembler::jmp(int label)
+{
+	byte(0xE9);
+	fixup(label);
+}
+
+void X86Assembler::jcc(X86Condition c, int label)
+{
+	byte(0x0F);
+	byte(static_cast<std::uint8_t>(0x80 + c));
+	fixup(label);
+}
+
+void X86Assembler::call(int label)
+{
+	byte(0xE8);
+	fixup(label);
+}
+
+void X86Assembler::call(X86Register r)
+{
+	op(0xFF, false, 2, r);
+}
+
+void X86Assembler::ret()
+{
+	byte(0xC3);
+}
+
+void X86Assembler::push(X86Register r)
+{
+	rex(false, 0, r);
+	byte(0x50 + (r & 7));
+}
+
+void X86Assembler::pop(X86Register r)
+{
+	rex(false, 0, r);
+	byte(0x58 + (r & 7));
+}
+
+void X86Assembler::ud2()
+{
+	byte(0x0F);
+	byte(0x0B);
+}
+
+void X86Assembler::movss(int d, int s)
+{
+	sseOp(0xF3, 0x10, false, d, s);
+}
+
+void X86Assembler::movss(int d, X86Memory m)
+{
+	sseOp(0xF3, 0x10, false, d, m);
+}
+
+void X86Assembler::movss(X86Memory m, int s)
+{
+	sseOp(0xF3, 0x11, false, s, m);
+}
+
+void X86Assembler::sse(X86Sse o, int d, int s)
+{
+	sseOp(0xF3, static_cast<std::uint8_t>(o), false, d, s);
+}
+
+void X86Assembler::sse(X86Sse o, int d, X86Memory m)
+{
+	sseOp(0xF3, static_cast<std::uint8_t>(o), false, d, m);
+}
+
+void X86Assembler::ucomiss(int a, int b)
+{
+	sseOp(0, 0x2E, false, a, b);
+}
+
+void X86Assembler::ucomiss(int a, X86Memory m)
+{
+	sseOp(0, 0x2E, false, a, m);
+}
+
+void X86Assembler::xorps(int d, int s)
+{
+	sseOp(0, 0x57, false, d, s);
+}
+
+void X86Assembler::cvtsi2ss(int d, X86Register s)
+{
+	sseOp(0xF3, 0x2A, false, d, s);
+}
+
+void X86Assembler::cvtsi2ss(int d, X86Memory m)
+{
+	sseOp(0xF3, 0x2A, false, d, m);
+}
+
+void X86Assembler::cvttss2si(X86Register d, int s)
+{
+	sseOp(0xF3, 0x2C, false, d, s);
+}
+
+void X86Assembler::cvttss2si(X86Register d, X86Memory m)
+{
+	sseOp(0xF3, 0x2C, false, d, m);
+}
+
+void X86Assembler::movd(int d, X86Register s)
+{
+	sseOp(0x66, 0x6E, false, d, s);
+}
+
+void X86Assembler::movd(X86Register d, int s)
+{
+	sseOp(0x66, 0x7E, false, s, d);
+}
\ No newline at end of file
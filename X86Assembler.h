@@ -0,0 +1,215 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// General purpose registers, numbered as in the instruction encoding.
+enum X86Register {
+	reg_rax,
+	reg_rcx,
+	reg_rdx,
+	reg_rbx,
+	reg_rsp,
+	reg_rbp,
+	reg_rsi,
+	reg_rdi,
+	reg_r8,
+	reg_r9,
+	reg_r10,
+	reg_r11,
+	reg_r12,
+	reg_r13,
+	reg_r14,
+	reg_r15
+};
+
+// Condition codes, numbered as in the encoding of jcc and setcc.
+enum X86Condition {
+	cc_o,
+	cc_no,
+	cc_b,
+	cc_ae,
+	cc_e,
+	cc_ne,
+	cc_be,
+	cc_a,
+	cc_s,
+	cc_ns,
+	cc_p,
+	cc_np,
+	cc_l,
+	cc_ge,
+	cc_le,
+	cc_g
+};
+
+inline X86Condition negate(X86Condition c) { return static_cast<X86Condition>(c ^ 1); }
+
+// The operations that share the encodings of add.
+enum X86Arith {
+	arith_add = 0,
+	arith_or = 1,
+	arith_and = 4,
+	arith_sub = 5,
+	arith_xor = 6,
+	arith_cmp = 7
+};
+
+// Scalar single precision operations.
+enum X86Sse {
+	sse_add = 0x58,
+	sse_mul = 0x59,
+	sse_sub = 0x5C,
+	sse_div = 0x5E
+};
+
+// A memory operand [base + disp].
+struct X86Memory {
+	X86Register base;
+	std::int32_t disp;
+};
+
+// How the platform's C calling convention passes arguments.
+struct X86CallingConvention {
+	const X86Register* intArgs;
+	int intArgCount;
+	int floatArgCount;
+
+	// Win64 gives the k-th argument the k-th register of its kind.
+	bool positional;
+
+	// Bytes the caller reserves above the stack arguments.
+	int shadow;
+};
+
+extern const X86CallingConvention hostConvention;
+
+// Where an argument is passed: in a register, given as an X86Register or
+// an XMM number, or in the 8-byte stack slot with that number.
+struct X86ArgumentPlace {
+	bool onStack;
+	int index;
+};
+
+// Places the arguments of one call, in order, by the host convention.
+class X86ArgumentPlacer {
+public:
+	X86ArgumentPlacer()
+		: ints(0), floats(0), count(0), stack(0) {}
+
+	X86ArgumentPlace place(bool isFloat);
+
+	int getStackCount() const { return stack; }
+
+private:
+	int ints;
+	int floats;
+	int count;
+	int stack;
+};
+
+// Encodes x86-64 instructions into a buffer. Integer operations are 32 bits
+// wide unless wide is set. XMM registers are given by number. Jumps go to
+// labels, which may be bound before or after the jump.
+class X86Assembler {
+public:
+	const std::vector<std::uint8_t>& getCode() const { return code; }
+	std::size_t getOffset() const { return code.size(); }
+
+	// Labels
+	int makeLabel();
+	void bind(int label);
+	bool isBound(int label) const { return labels[label] >= 0; }
+	std::size_t getLabelOffset(int label) const { return labels[label]; }
+
+	// Patches the jumps and calls to their labels. Call once every label
+	// used is bound.
+	void resolve();
+
+	// Moves
+	void mov(X86Register d, X86Register s, bool wide = false);
+	void mov(X86Register d, std::int64_t imm, bool wide = false);
+	void load(X86Register d, X86Memory m, bool wide = false);
+	void loadByte(X86Register d, X86Memory m);
+	void store(X86Memory m, X86Register s, bool wide = false);
+	void storeByte(X86Memory m, X86Register s);
+	void store(X86Memory m, std::int32_t imm, bool wide = false);
+	void lea(X86Register d, X86Memory m);
+	void leaLabel(X86Register d, int label);
+	void movzxByte(X86Register d, X86Register s);
+	void movsxByte(X86Register d, X86Register s);
+
+	// Integer arithmetic
+	void arith(X86Arith op, X86Register d, X86Register s, bool wide = false);
+	void arith(X86Arith op, X86Register d, X86Memory m, bool wide = false);
+	void arith(X86Arith op, X86Register d, std::int32_t imm, bool wide = false);
+	void imul(X86Register d, X86Register s);
+	void imul(X86Register d, X86Memory m);
+	void imul(X86Register d, X86Register s, std::int32_t imm);
+	void imul(X86Register r); // edx:eax = eax * r
+	void imul(X86Memory m);
+	void neg(X86Register r);
+	void not_(X86Register r);
+	void shl(X86Register r);
+	void sar(X86Register r);
+	void shl(X86Register r, std::uint8_t n);
+	void sar(X86Register r, std::uint8_t n);
+	void cdq();
+	void idiv(X86Register r);
+	void idiv(X86Memory m);
+	void test(X86Register a, X86Register b);
+	void setcc(X86Condition c, X86Register d);
+
+	// Control
+	void jmp(int label);
+	void jcc(X86Condition c, int label);
+	void call(int label);
+	void call(X86Register r);
+	void ret();
+	void push(X86Register r);
+	void pop(X86Register r);
+	void ud2();
+
+	// Scalar floats
+	void movss(int d, int s);
+	void movss(int d, X86Memory m);
+	void movss(X86Memory m, int s);
+	void sse(X86Sse op, int d, int s);
+	void sse(X86Sse op, int d, X86Memory m);
+	void ucomiss(int a, int b);
+	void ucomiss(int a, X86Memory m);
+	void xorps(int d, int s);
+	void cvtsi2ss(int d, X86Register s);
+	void cvtsi2ss(int d, X86Memory m);
+	void cvttss2si(X86Register d, int s);
+	void cvttss2si(X86Register d, X86Memory m);
+	void movd(int d, X86Register s);
+	void movd(X86Register d, int s);
+
+private:
+	void byte(std::uint8_t b) { code.push_back(b); }
+	void dword(std::uint32_t d);
+	void qword(std::uint64_t q);
+	void rex(bool wide, int reg, int base, bool byteRegs = false);
+	void modrm(int reg, int rm);
+	void modrm(int reg, X86Memory m);
+	void op(std::uint8_t o, bool wide, int reg, int rm, bool byteRegs = false);
+	void op(std::uint8_t o, bool wide, int reg, X86Memory m);
+	void op2(std::uint8_t o, bool wide, int reg, int rm, bool byteRegs = false);
+	void op2(std::uint8_t o, bool wide, int reg, X86Memory m);
+	void sseOp(std::uint8_t prefix, std::uint8_t o, bool wide, int reg, int rm);
+	void sseOp(std::uint8_t prefix, std::uint8_t o, bool wide, int reg, X86Memory m);
+	void fixup(int label);
+
+	std::vector<std::uint8_t> code;
+	std::vector<std::ptrdiff_t> labels;
+
+	// Places that hold a 32-bit displacement to a label, measured from the
+	// end of the displacement.
+	struct Fixup {
+		std::size_t offset;
+		int label;
+	};
+
+	std::vector<Fixup> fixups;
+};
\ No newline at end of file
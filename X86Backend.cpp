@@ -0,0 +1,1209 @@
+#include "stdafx.h"
+#include "X86Backend.h"
+#include "X86Assembler.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// The registers that the code generator gives to values. rax, rcx, rdx, r10 and r11
+// are never given to values: rax, rcx and rdx serve division, shifts and
+// results, r10 holds the target of an indirect call and r11 breaks cycles
+// of moves. Two XMM registers are kept in the same way.
+struct X86ABI {
+	// Caller-saved registers first.
+	const X86Register* registers;
+	int registerCount;
+	int callerSavedCount;
+
+	int xmmCount;
+	int xmmScratch[2];
+};
+
+#ifdef _WIN32
+static const X86Register registers[] = { reg_r8, reg_r9, reg_rbx, reg_rsi, reg_rdi, reg_r12, reg_r13, reg_r14, reg_r15 };
+static const X86ABI abi = { registers, 9, 2, 4, { 4, 5 } };
+#else
+static const X86Register registers[] = { reg_rsi, reg_rdi, reg_r8, reg_r9, reg_rbx, reg_r12, reg_r13, reg_r14, reg_r15 };
+static const X86ABI abi = { registers, 9, 4, 14, { 14, 15 } };
+#endif
+
+static bool isCalleeSaved(X86Register r)
+{
+	for (int k = abi.callerSavedCount; k < abi.registerCount; ++k) {
+		if (abi.registers[k] == r)
+			return true;
+	}
+	return false;
+}
+
+// frem has no instruction of its own.
+static float floatRemainder(float a, float b)
+{
+	return std::fmod(a, b);
+}
+
+// Where a value is, or how to make it.
+struct X86Location {
+	enum Kind {
+		none,
+		gpr,
+		xmm,
+		stack, // [reg + offset]
+		imm,
+		label // the address of code
+	};
+
+	Kind kind;
+	int reg;
+	std::int32_t offset;
+	std::int64_t value;
+
+	X86Memory getMemory() const { return { static_cast<X86Register>(reg), offset }; }
+
+	bool isSameStorage(const X86Location& l) const {
+		if (kind != l.kind || (kind != gpr && kind != xmm && kind != stack))
+			return false;
+		return reg == l.reg && (kind != stack || offset == l.offset);
+	}
+};
+
+static X86Location inGpr(X86Register r) { return { X86Location::gpr, r, 0, 0 }; }
+static X86Location inXmm(int x) { return { X86Location::xmm, x, 0, 0 }; }
+static X86Location onStack(X86Register base, std::int32_t offset) { return { X86Location::stack, base, offset, 0 }; }
+
+// A copy that is part of a parallel move: all sources are read before any
+// destination is written.
+struct X86Move {
+	X86Location dst;
+	X86Location src;
+	bool wide;
+};
+
+// State shared by the functions of a module.
+struct X86ModuleContext {
+	X86Assembler& as;
+	const IRModule& module;
+	std::vector<int> functions;
+	int undefined;
+	std::uint64_t* data;
+};
+
+// Compiles one function:
+//  1. numbers the instructions in layout order;
+//  2. finds the live interval of each value by walking back from its uses
+//     to its definition;
+//  3. gives each interval a register by linear scan, or a stack slot when
+//     none is free; an interval that spans a call gets a callee-saved
+//     register;
+//  4. selects instructions, resolving phis with parallel moves on the
+//     edges into their blocks.
+// Constants and addresses are not allocated but remade where they are
+// used, and a comparison that only feeds the branch after it sets the flags
+// for that branch.
+class X86FunctionCompiler {
+public:
+	X86FunctionCompiler(X86ModuleContext& m, const IRFunction& f);
+
+	void compile();
+
+private:
+	void findUses();
+	void number();
+	void buildIntervals();
+	void extend(const IRInstruction* v, unsigned p);
+	void allocate();
+	bool crossesCall(const IRInstruction* v) const;
+
+	void emitPrologue();
+	void emitEpilogue();
+	void emit(const IRInstruction* i);
+	void emitBinary(const IRInstruction* i, X86Arith op);
+	void emitMul(const IRInstruction* i);
+	void emitMulHigh(const IRInstruction* i);
+	void emitDivision(const IRInstruction* i);
+	void emitShift(const IRInstruction* i);
+	void emitFloat(const IRInstruction* i, X86Sse op);
+	void emitFloatNeg(const IRInstruction* i);
+	void emitConversion(const IRInstruction* i);
+	void emitLoad(const IRInstruction* i);
+	void emitStore(const IRInstruction* i);
+	void emitCall(const IRInstruction* i, const X86Location& callee, int first);
+	void emitBranch(const IRInstruction* i);
+	void emitCondBranch(const IRInstruction* i);
+	void emitReturn(const IRInstruction* i);
+	X86Condition emitCompare(const IRInstruction* c);
+	void jumpTo(const IRBlock* b);
+
+	void edgeMoves(const IRBlock* from, const IRBlock* to, bool last, std::vector<X86Move>& moves);
+	void move(std::vector<X86Move> moves);
+	void emitMove(const X86Location& dst, const X86Location& src, bool wide);
+
+	X86Location where(const IRInstruction* v) const;
+	void toGpr(X86Register r, const IRInstruction* v);
+	void toXmm(int x, const IRInstruction* v);
+	void fromGpr(const IRInstruction* v, X86Register r);
+	void fromXmm(const IRInstruction* v, int x);
+	X86Register resultGpr(const IRInstruction* i, const IRInstruction* avoid) const;
+	int resultXmm(const IRInstruction* i, const IRInstruction* avoid) const;
+	void normalize(IRType t, X86Register r);
+	void arithWith(X86Arith op, X86Register r, const IRInstruction* v);
+
+	static bool isRematerialized(const IRInstruction* v) {
+		return v->op == ir_const || v->op == ir_global || v->op == ir_function;
+	}
+
+	static bool isWide(const IRInstruction* v) { return v->type == irt_ptr; }
+
+	X86ModuleContext& mod;
+	X86Assembler& as;
+	const IRFunction& fn;
+
+	// Uses of each value, as (user, operand number) pairs grouped by value.
+	struct Use {
+		const IRInstruction* user;
+		unsigned operand;
+	};
+
+	std::vector<unsigned> useStart;
+	std::vector<Use> uses;
+
+	// By instruction number.
+	std::vector<unsigned> position;
+	std::vector<unsigned> start;
+	std::vector<unsigned> end;
+	std::vector<char> fused;
+	std::vector<char> allocated;
+	std::vector<X86Location> locations;
+
+	// By block number.
+	std::vector<unsigned> blockStart;
+	std::vector<unsigned> blockEnd;
+	std::vector<int> labels;
+	std::vector<std::size_t> layout;
+
+	std::vector<unsigned> calls;
+	const IRBlock* next;
+	unsigned slots;
+	unsigned outgoing;
+	std::vector<X86Register> saved;
+};
+
+X86FunctionCompiler::X86FunctionCompiler(X86ModuleContext& m, const IRFunction& f)
+	: mod(m), as(m.as), fn(f), next(nullptr), slots(0), outgoing(0) {}
+
+void X86FunctionCompiler::compile()
+{
+	findUses();
+	number();
+	buildIntervals();
+	allocate();
+
+	emitPrologue();
+	for (std::size_t k = 0; k < fn.blocks.size(); ++k) {
+		const IRBlock* b = fn.blocks[k];
+		next = k + 1 < fn.blocks.size() ? fn.blocks[k + 1] : nullptr;
+		as.bind(labels[b->id]);
+		for (const IRInstruction* i : b->instructions)
+			emit(i);
+	}
+}
+
+void X86FunctionCompiler::findUses()
+{
+	std::vector<unsigned> counts(fn.getValueCount() + 1);
+	for (const IRBlock* b : fn.blocks) {
+		for (const IRInstruction* i : b->instructions) {
+			for (const IRInstruction* v : i->operands)
+				++counts[v->id + 1];
+		}
+	}
+	for (std::size_t k = 1; k < counts.size(); ++k)
+		counts[k] += counts[k - 1];
+	useStart = counts;
+	uses.resize(counts.back());
+	for (const IRBlock* b : fn.blocks) {
+		for (const IRInstruction* i : b->instructions) {
+			for (unsigned k = 0; k < i->operands.size(); ++k)
+				uses[counts[i->operands[k]->id]++] = { i, k };
+		}
+	}
+}
+
+static bool isFusable(const IRInstruction* c)
+{
+	// Float equality needs two flags, so it keeps its own value.
+	return c->isCompare() && c->op != ir_feq && c->op != ir_fne;
+}
+
+void X86FunctionCompiler::number()
+{
+	unsigned n = fn.getValueCount();
+	position.assign(n, 0);
+	fused.assign(n, 0);
+	blockStart.assign(fn.getBlockCount(), 0);
+	blockEnd.assign(fn.getBlockCount(), 0);
+	labels.assign(fn.getBlockCount(), -1);
+
+	unsigned p = 0;
+	for (const IRBlock* b : fn.blocks) {
+		labels[b->id] = as.makeLabel();
+		blockStart[b->id] = p;
+		for (const IRInstruction* i : b->instructions) {
+			position[i->id] = p;
+			p += 2;
+			if (i->op == ir_call || i->op == ir_frem)
+				calls.push_back(position[i->id]);
+		}
+		const IRInstruction* t = b->getTerminator();
+		blockEnd[b->id] = position[t->id];
+
+		// The flags of a comparison right before the branch that is its only
+		// use are still set at the branch, so the comparison is made there.
+		std::size_t size = b->instructions.size();
+		if (t->op == ir_condbr && size >= 2) {
+			const IRInstruction* c = b->instructions[size - 2];
+			if (c == t->operands[0] && isFusable(c) && useStart[c->id + 1] - useStart[c->id] == 1) {
+				fused[c->id] = 1;
+				position[c->id] = position[t->id];
+			}
+		}
+	}
+
+	// Stack space for the arguments of calls.
+	for (const IRBlock* b : fn.blocks) {
+		for (const IRInstruction* i : b->instructions) {
+			if (i->op != ir_call)
+				continue;
+			X86ArgumentPlacer placer;
+			for (std::size_t k = 1; k < i->operands.size(); ++k)
+				placer.place(i->operands[k]->type == irt_float);
+			outgoing = std::max(outgoing, static_cast<unsigned>(hostConvention.shadow + 8 * placer.getStackCount()));
+		}
+	}
+	if (!calls.empty())
+		outgoing = std::max(outgoing, static_cast<unsigned>(hostConvention.shadow));
+}
+
+void X86FunctionCompiler::extend(const IRInstruction* v, unsigned p)
+{
+	start[v->id] = std::min(start[v->id], p);
+	end[v->id] = std::max(end[v->id], p);
+}
+
+void X86FunctionCompiler::buildIntervals()
+{
+	unsigned n = fn.getValueCount();
+	start.assign(n, 0);
+	end.assign(n, 0);
+	allocated.assign(n, 0);
+
+	// The last value whose liveness reached each block.
+	std::vector<unsigned> stamp(fn.getBlockCount(), 0);
+	std::vector<const IRBlock*> work;
+
+	for (const IRBlock* b : fn.blocks) {
+		for (const IRInstruction* v : b->instructions) {
+			bool used = useStart[v->id + 1] > useStart[v->id];
+			if (v->type == irt_void || !used || isRematerialized(v) || fused[v->id])
+				continue;
+			allocated[v->id] = 1;
+			start[v->id] = end[v->id] = v->isPhi() ? blockStart[b->id] : position[v->id];
+
+			// A phi is written at the end of each predecessor.
+			if (v->isPhi()) {
+				for (const IRBlock* p : b->preds)
+					extend(v, blockEnd[p->id]);
+			}
+
+			// Walk back from each use to the definition. The value is live
+			// out of every block on the way and into all but the first.
+			for (unsigned u = useStart[v->id]; u < useStart[v->id + 1]; ++u) {
+				const IRInstruction* user = uses[u].user;
+				const IRBlock* from;
+				if (user->isPhi()) {
+					from = user->block->preds[uses[u].operand];
+					extend(v, blockEnd[from->id]);
+					if (from == b)
+						continue;
+				}
+				else {
+					extend(v, position[user->id]);
+					from = user->block;
+					if (from == b)
+						continue;
+				}
+				work.push_back(from);
+				while (!work.empty()) {
+					const IRBlock* w = work.back();
+					work.pop_back();
+					if (stamp[w->id] == v->id + 1)
+						continue;
+					stamp[w->id] = v->id + 1;
+					extend(v, blockStart[w->id]);
+					for (const IRBlock* p : w->preds) {
+						extend(v, blockEnd[p->id]);
+						if (p != b && stamp[p->id] != v->id + 1)
+							work.push_back(p);
+					}
+				}
+			}
+		}
+	}
+}
+
+bool X86FunctionCompiler::crossesCall(const IRInstruction* v) const
+{
+	auto c = std::upper_bound(calls.begin(), calls.end(), start[v->id]);
+	return c != calls.end() && *c < end[v->id];
+}
+
+void X86FunctionCompiler::allocate()
+{
+	locations.assign(fn.getValueCount(), { X86Location::none, 0, 0, 0 });
+
+	std::vector<const IRInstruction*> order;
+	for (const IRBlock* b : fn.blocks) {
+		for (const IRInstruction* v : b->instructions) {
+			if (allocated[v->id])
+				order.push_back(v);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [this](const IRInstruction* a, const IRInstruction* b) {
+		return start[a->id] < start[b->id];
+	});
+
+	std::vector<const IRInstruction*> active;
+	std::vector<char> busy(16), busyXmm(16);
+	std::vector<char> used(16);
+	std::vector<int> spill;
+
+	for (const IRInstruction* v : order) {
+		// Free the registers of the intervals that have ended.
+		std::size_t kept = 0;
+		for (const IRInstruction* a : active) {
+			if (end[a->id] <= start[v->id]) {
+				const X86Location& l = locations[a->id];
+				(l.kind == X86Location::gpr ? busy : busyXmm)[l.reg] = 0;
+			}
+			else {
+				active[kept++] = a;
+			}
+		}
+		active.resize(kept);
+
+		bool isFloat = v->type == irt_float;
+		bool call = crossesCall(v);
+		int reg = -1;
+		if (isFloat) {
+			// Every XMM register is lost across a call.
+			for (int x = 0; x < abi.xmmCount && !call; ++x) {
+				if (!busyXmm[x]) {
+					reg = x;
+					break;
+				}
+			}
+		}
+		else {
+			for (int k = call ? abi.callerSavedCount : 0; k < abi.registerCount; ++k) {
+				if (!busy[abi.registers[k]]) {
+					reg = abi.registers[k];
+					break;
+				}
+			}
+		}
+
+		if (reg < 0 && !(isFloat && call)) {
+			// Take the register of the interval that ends last, if that is
+			// later than this one.
+			const IRInstruction* victim = nullptr;
+			for (const IRInstruction* a : active) {
+				const X86Location& l = locations[a->id];
+				if (isFloat ? l.kind != X86Location::xmm : l.kind != X86Location::gpr)
+					continue;
+				if (!isFloat && call && !isCalleeSaved(static_cast<X86Register>(l.reg)))
+					continue;
+				if (!victim || end[a->id] > end[victim->id])
+					victim = a;
+			}
+			if (victim && end[victim->id] > end[v->id]) {
+				reg = locations[victim->id].reg;
+				locations[victim->id] = onStack(reg_rbp, static_cast<std::int32_t>(slots++));
+				active.erase(std::find(active.begin(), active.end(), victim));
+			}
+		}
+
+		if (reg < 0) {
+			locations[v->id] = onStack(reg_rbp, static_cast<std::int32_t>(slots++));
+			continue;
+		}
+		if (isFloat) {
+			locations[v->id] = inXmm(reg);
+			busyXmm[reg] = 1;
+		}
+		else {
+			locations[v->id] = inGpr(static_cast<X86Register>(reg));
+			busy[reg] = 1;
+			used[reg] = 1;
+		}
+		active.push_back(v);
+	}
+
+	for (int k = abi.callerSavedCount; k < abi.registerCount; ++k) {
+		if (used[abi.registers[k]])
+			saved.push_back(abi.registers[k]);
+	}
+
+	// Slots go below the saved registers; their numbers become offsets.
+	std::int32_t base = static_cast<std::int32_t>(8 * saved.size());
+	for (X86Location& l : locations) {
+		if (l.kind == X86Location::stack)
+			l.offset = -(base + 8 * (l.offset + 1));
+	}
+}
+
+X86Location X86FunctionCompiler::where(const IRInstruction* v) const
+{
+	switch (v->op) {
+	case ir_const: {
+		X86Location l = { X86Location::imm, 0, 0, v->integer };
+		if (v->type == irt_float) {
+			float f = static_cast<float>(v->real);
+			std::uint32_t bits;
+			std::memcpy(&bits, &f, 4);
+			l.value = bits;
+		}
+		return l;
+	}
+	case ir_global:
+		return { X86Location::imm, 0, 0, static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(mod.data + v->integer)) };
+	case ir_function: {
+		int label = mod.functions[v->integer];
+		return { X86Location::label, label < 0 ? mod.undefined : label, 0, 0 };
+	}
+	default:
+		return locations[v->id];
+	}
+}
+
+void X86FunctionCompiler::emitMove(const X86Location& dst, const X86Location& src, bool wide)
+{
+	if (dst.isSameStorage(src))
+		return;
+	X86Register d = static_cast<X86Register>(dst.reg);
+	X86Register s = static_cast<X86Register>(src.reg);
+	switch (dst.kind) {
+	case X86Location::gpr:
+		switch (src.kind) {
+		case X86Location::gpr: return as.mov(d, s, wide);
+		case X86Location::xmm: return as.movd(d, src.reg);
+		case X86Location::stack: return as.load(d, src.getMemory(), wide);
+		case X86Location::imm: return as.mov(d, src.value, wide);
+		case X86Location::label: return as.leaLabel(d, src.reg);
+		default: break;
+		}
+		break;
+	case X86Location::xmm:
+		switch (src.kind) {
+		case X86Location::gpr: return as.movd(dst.reg, s);
+		case X86Location::xmm: return as.movss(dst.reg, src.reg);
+		case X86Location::stack: return as.movss(dst.reg, src.getMemory());
+		case X86Location::imm:
+			as.mov(reg_rax, src.value);
+			return as.movd(dst.reg, reg_rax);
+		default: break;
+		}
+		break;
+	case X86Location::stack:
+		switch (src.kind) {
+		case X86Location::gpr: return as.store(dst.getMemory(), s, wide);
+		case X86Location::xmm: return as.movss(dst.getMemory(), src.reg);
+		case X86Location::stack:
+			as.load(reg_rax, src.getMemory(), true);
+			return as.store(dst.getMemory(), reg_rax, true);
+		case X86Location::imm:
+			if (!wide || (src.value >= INT32_MIN && src.value <= INT32_MAX))
+				return as.store(dst.getMemory(), static_cast<std::int32_t>(src.value), wide);
+			as.mov(reg_rax, src.value, true);
+			return as.store(dst.getMemory(), reg_rax, true);
+		case X86Location::label:
+			as.leaLabel(reg_rax, src.reg);
+			return as.store(dst.getMemory(), reg_rax, true);
+		default: break;
+		}
+		break;
+	default:
+		break;
+	}
+	throw std::logic_error("Invalid move");
+}
+
+// Emits the moves that are not blocked by a later read of their
+// destination; when only cycles are left, one destination is saved in a
+// scratch register and its readers read that instead.
+void X86FunctionCompiler::move(std::vector<X86Move> moves)
+{
+	moves.erase(std::remove_if(moves.begin(), moves.end(), [](const X86Move& m) {
+		return m.dst.isSameStorage(m.src);
+	}), moves.end());
+
+	while (!moves.empty()) {
+		bool progress = false;
+		for (std::size_t k = 0; k < moves.size(); ++k) {
+			bool blocked = false;
+			for (std::size_t j = 0; j < moves.size() && !blocked; ++j)
+				blocked = j != k && moves[j].src.isSameStorage(moves[k].dst);
+			if (blocked)
+				continue;
+			emitMove(moves[k].dst, moves[k].src, moves[k].wide);
+			moves.erase(moves.begin() + k);
+			progress = true;
+			break;
+		}
+		if (progress)
+			continue;
+
+		X86Location blocked = moves.front().dst;
+		X86Location scratch = blocked.kind == X86Location::xmm ? inXmm(abi.xmmScratch[1]) : inGpr(reg_r11);
+		emitMove(scratch, blocked, true);
+		for (X86Move& m : moves) {
+			if (m.src.isSameStorage(blocked))
+				m.src = scratch;
+		}
+	}
+}
+
+void X86FunctionCompiler::toGpr(X86Register r, const IRInstruction* v)
+{
+	emitMove(inGpr(r), where(v), isWide(v));
+}
+
+void X86FunctionCompiler::toXmm(int x, const IRInstruction* v)
+{
+	emitMove(inXmm(x), where(v), false);
+}
+
+void X86FunctionCompiler::fromGpr(const IRInstruction* v, X86Register r)
+{
+	const X86Location& l = locations[v->id];
+	if (l.kind != X86Location::none)
+		emitMove(l, inGpr(r), isWide(v));
+}
+
+void X86FunctionCompiler::fromXmm(const IRInstruction* v, int x)
+{
+	const X86Location& l = locations[v->id];
+	if (l.kind != X86Location::none)
+		emitMove(l, inXmm(x), false);
+}
+
+// The register to compute i in: its own, unless the operand that is read
+// after the first one lives there.
+X86Register X86FunctionCompiler::resultGpr(const IRInstruction* i, const IRInstruction* avoid) const
+{
+	const X86Location& l = locations[i->id];
+	if (l.kind != X86Location::gpr)
+		return reg_rax;
+	if (avoid && where(avoid).isSameStorage(l))
+		return reg_rax;
+	return static_cast<X86Register>(l.reg);
+}
+
+int X86FunctionCompiler::resultXmm(const IRInstruction* i, const IRInstruction* avoid) const
+{
+	const X86Location& l = locations[i->id];
+	if (l.kind != X86Location::xmm)
+		return abi.xmmScratch[0];
+	if (avoid && where(avoid).isSameStorage(l))
+		return abi.xmmScratch[0];
+	return l.reg;
+}
+
+// Keeps chars zero-extended and bools 0 or 1 in their registers.
+void X86FunctionCompiler::normalize(IRType t, X86Register r)
+{
+	if (t == irt_char)
+		as.movzxByte(r, r);
+	else if (t == irt_bool)
+		as.arith(arith_and, r, 1);
+}
+
+void X86FunctionCompiler::arithWith(X86Arith op, X86Register r, const IRInstruction* v)
+{
+	X86Location l = where(v);
+	switch (l.kind) {
+	case X86Location::imm: return as.arith(op, r, static_cast<std::int32_t>(l.value));
+	case X86Location::gpr: return as.arith(op, r, static_cast<X86Register>(l.reg));
+	case X86Location::stack: return as.arith(op, r, l.getMemory());
+	default: throw std::logic_error("Invalid operand");
+	}
+}
+
+void X86FunctionCompiler::emitPrologue()
+{
+	as.push(reg_rbp);
+	as.mov(reg_rbp, reg_rsp, true);
+	for (X86Register r : saved)
+		as.push(r);
+
+	// Keep the stack aligned to 16 bytes at calls.
+	unsigned pushed = static_cast<unsigned>(8 * saved.size());
+	unsigned frame = (pushed + 8 * slots + outgoing + 15) / 16 * 16 - pushed;
+	if (frame)
+		as.arith(arith_sub, reg_rsp, static_cast<std::int32_t>(frame), true);
+
+	// Move the arguments to where the parameters were allocated.
+	std::vector<X86Move> moves;
+	X86ArgumentPlacer placer;
+	const IRBlock* entry = fn.getEntryBlock();
+	for (std::size_t k = 0; k < fn.params.size(); ++k) {
+		bool f = fn.params[k] == irt_float;
+		X86ArgumentPlace a = placer.place(f);
+		X86Location src;
+		if (a.onStack)
+			src = onStack(reg_rbp, 16 + hostConvention.shadow + 8 * a.index);
+		else
+			src = f ? inXmm(a.index) : inGpr(static_cast<X86Register>(a.index));
+		for (const IRInstruction* i : entry->instructions) {
+			if (i->op == ir_param && i->integer == static_cast<std::int64_t>(k) && locations[i->id].kind != X86Location::none)
+				moves.push_back({ locations[i->id], src, fn.params[k] == irt_ptr });
+		}
+	}
+	move(moves);
+}
+
+void X86FunctionCompiler::emitEpilogue()
+{
+	if (!saved.empty())
+		as.lea(reg_rsp, { reg_rbp, -static_cast<std::int32_t>(8 * saved.size()) });
+	else
+		as.mov(reg_rsp, reg_rbp, true);
+	for (auto r = saved.rbegin(); r != saved.rend(); ++r)
+		as.pop(*r);
+	as.pop(reg_rbp);
+	as.ret();
+}
+
+void X86FunctionCompiler::emit(const IRInstruction* i)
+{
+	// Pure values that nothing reads are left out.
+	if (!i->hasSideEffects() && locations[i->id].kind == X86Location::none && !fused[i->id])
+		return;
+	switch (i->op) {
+	case ir_const:
+	case ir_param:
+	case ir_global:
+	case ir_function:
+	case ir_phi:
+		return;
+	case ir_add: return emitBinary(i, arith_add);
+	case ir_sub: return emitBinary(i, arith_sub);
+	case ir_and: return emitBinary(i, arith_and);
+	case ir_or: return emitBinary(i, arith_or);
+	case ir_xor: return emitBinary(i, arith_xor);
+	case ir_mul: return emitMul(i);
+	case ir_mulh: return emitMulHigh(i);
+	case ir_div:
+	case ir_rem:
+		return emitDivision(i);
+	case ir_shl:
+	case ir_shr:
+		return emitShift(i);
+	case ir_neg:
+	case ir_not: {
+		X86Register w = resultGpr(i, nullptr);
+		toGpr(w, i->operands[0]);
+		if (i->op == ir_neg)
+			as.neg(w);
+		else if (i->type == irt_bool)
+			as.arith(arith_xor, w, 1);
+		else
+			as.not_(w);
+		normalize(i->type, w);
+		return fromGpr(i, w);
+	}
+	case ir_fadd: return emitFloat(i, sse_add);
+	case ir_fsub: return emitFloat(i, sse_sub);
+	case ir_fmul: return emitFloat(i, sse_mul);
+	case ir_fdiv: return emitFloat(i, sse_div);
+	case ir_frem: {
+		X86Location callee = { X86Location::imm, 0, 0, static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(&floatRemainder)) };
+		return emitCall(i, callee, 0);
+	}
+	case ir_fneg: return emitFloatNeg(i);
+	case ir_trunc:
+	case ir_zext:
+	case ir_itof:
+	case ir_ftoi:
+		return emitConversion(i);
+	case ir_load: return emitLoad(i);
+	case ir_store: return emitStore(i);
+	case ir_call: {
+		const IRInstruction* callee = i->operands[0];
+		return emitCall(i, where(callee), 1);
+	}
+	case ir_br: return emitBranch(i);
+	case ir_condbr: return emitCondBranch(i);
+	case ir_ret: return emitReturn(i);
+	case ir_unreachable: return as.ud2();
+	default:
+		break;
+	}
+	if (i->isCompare()) {
+		// Made at the branch that uses it.
+		if (fused[i->id])
+			return;
+		X86Condition c = emitCompare(i);
+		if (i->op == ir_feq || i->op == ir_fne) {
+			as.setcc(i->op == ir_feq ? cc_np : cc_p, reg_rcx);
+			as.setcc(c, reg_rax);
+			as.arith(i->op == ir_feq ? arith_and : arith_or, reg_rax, reg_rcx);
+		}
+		else {
+			as.setcc(c, reg_rax);
+		}
+		as.movzxByte(reg_rax, reg_rax);
+		return fromGpr(i, reg_rax);
+	}
+	throw std::logic_error("Unsupported instruction");
+}
+
+void X86FunctionCompiler::emitBinary(const IRInstruction* i, X86Arith op)
+{
+	X86Register w = resultGpr(i, i->operands[1]);
+	toGpr(w, i->operands[0]);
+	arithWith(op, w, i->operands[1]);
+	if (op == arith_add || op == arith_sub)
+		normalize(i->type, w);
+	fromGpr(i, w);
+}
+
+void X86FunctionCompiler::emitMul(const IRInstruction* i)
+{
+	X86Register w = resultGpr(i, i->operands[1]);
+	X86Location b = where(i->operands[1]);
+	if (b.kind == X86Location::imm) {
+		X86Location a = where(i->operands[0]);
+		X86Register s = a.kind == X86Location::gpr ? static_cast<X86Register>(a.reg) : w;
+		toGpr(s, i->operands[0]);
+		as.imul(w, s, static_cast<std::int32_t>(b.value));
+	}
+	else {
+		toGpr(w, i->operands[0]);
+		if (b.kind == X86Location::gpr)
+			as.imul(w, static_cast<X86Register>(b.reg));
+		else
+			as.imul(w, b.getMemory());
+	}
+	normalize(i->type, w);
+	fromGpr(i, w);
+}
+
+void X86FunctionCompiler::emitMulHigh(const IRInstruction* i)
+{
+	toGpr(reg_rax, i->operands[0]);
+	X86Location b = where(i->operands[1]);
+	if (b.kind == X86Location::gpr) {
+		as.imul(static_cast<X86Register>(b.reg));
+	}
+	else if (b.kind == X86Location::imm) {
+		toGpr(reg_rcx, i->operands[1]);
+		as.imul(reg_rcx);
+	}
+	else {
+		as.imul(b.getMemory());
+	}
+	fromGpr(i, reg_rdx);
+}
+
+void X86FunctionCompiler::emitDivision(const IRInstruction* i)
+{
+	bool narrow = i->type != irt_int;
+	toGpr(reg_rax, i->operands[0]);
+	X86Location b = where(i->operands[1]);
+	if (narrow)
+		as.movsxByte(reg_rax, reg_rax);
+	as.cdq();
+	if (b.kind == X86Location::imm || narrow) {
+		toGpr(reg_rcx, i->operands[1]);
+		if (narrow)
+			as.movsxByte(reg_rcx, reg_rcx);
+		as.idiv(reg_rcx);
+	}
+	else if (b.kind == X86Location::gpr) {
+		as.idiv(static_cast<X86Register>(b.reg));
+	}
+	else {
+		as.idiv(b.getMemory());
+	}
+	X86Register r = i->op == ir_div ? reg_rax : reg_rdx;
+	normalize(i->type, r);
+	fromGpr(i, r);
+}
+
+void X86FunctionCompiler::emitShift(const IRInstruction* i)
+{
+	X86Location b = where(i->operands[1]);
+	if (b.kind != X86Location::imm)
+		toGpr(reg_rcx, i->operands[1]);
+	X86Register w = resultGpr(i, nullptr);
+	toGpr(w, i->operands[0]);
+	if (i->op == ir_shr && i->type == irt_char)
+		as.movsxByte(w, w);
+	if (b.kind == X86Location::imm) {
+		std::uint8_t n = static_cast<std::uint8_t>(b.value & 31);
+		if (i->op == ir_shl)
+			as.shl(w, n);
+		else
+			as.sar(w, n);
+	}
+	else if (i->op == ir_shl) {
+		as.shl(w);
+	}
+	else {
+		as.sar(w);
+	}
+	normalize(i->type, w);
+	fromGpr(i, w);
+}
+
+void X86FunctionCompiler::emitFloat(const IRInstruction* i, X86Sse op)
+{
+	int x = resultXmm(i, i->operands[1]);
+	toXmm(x, i->operands[0]);
+	X86Location b = where(i->operands[1]);
+	if (b.kind == X86Location::xmm) {
+		as.sse(op, x, b.reg);
+	}
+	else if (b.kind == X86Location::stack) {
+		as.sse(op, x, b.getMemory());
+	}
+	else {
+		toXmm(abi.xmmScratch[1], i->operands[1]);
+		as.sse(op, x, abi.xmmScratch[1]);
+	}
+	fromXmm(i, x);
+}
+
+void X86FunctionCompiler::emitFloatNeg(const IRInstruction* i)
+{
+	int x = resultXmm(i, nullptr);
+	toXmm(x, i->operands[0]);
+	as.mov(reg_rax, 0x80000000LL);
+	as.movd(abi.xmmScratch[1], reg_rax);
+	as.xorps(x, abi.xmmScratch[1]);
+	fromXmm(i, x);
+}
+
+void X86FunctionCompiler::emitConversion(const IRInstruction* i)
+{
+	const IRInstruction* v = i->operands[0];
+	X86Location l = where(v);
+	switch (i->op) {
+	case ir_trunc:
+	case ir_zext: {
+		// Narrow values are already zero-extended.
+		X86Register w = resultGpr(i, nullptr);
+		toGpr(w, v);
+		if (i->op == ir_trunc)
+			normalize(i->type, w);
+		return fromGpr(i, w);
+	}
+	case ir_itof: {
+		int x = resultXmm(i, nullptr);
+		if (l.kind == X86Location::gpr) {
+			as.cvtsi2ss(x, static_cast<X86Register>(l.reg));
+		}
+		else if (l.kind == X86Location::stack) {
+			as.cvtsi2ss(x, l.getMemory());
+		}
+		else {
+			toGpr(reg_rax, v);
+			as.cvtsi2ss(x, reg_rax);
+		}
+		return fromXmm(i, x);
+	}
+	default: {
+		X86Register w = resultGpr(i, nullptr);
+		if (l.kind == X86Location::xmm) {
+			as.cvttss2si(w, l.reg);
+		}
+		else if (l.kind == X86Location::stack) {
+			as.cvttss2si(w, l.getMemory());
+		}
+		else {
+			toXmm(abi.xmmScratch[1], v);
+			as.cvttss2si(w, abi.xmmScratch[1]);
+		}
+		return fromGpr(i, w);
+	}
+	}
+}
+
+void X86FunctionCompiler::emitLoad(const IRInstruction* i)
+{
+	toGpr(reg_r11, i->operands[0]);
+	X86Memory m = { reg_r11, 0 };
+	if (i->type == irt_float) {
+		int x = resultXmm(i, nullptr);
+		as.movss(x, m);
+		return fromXmm(i, x);
+	}
+	X86Register w = resultGpr(i, nullptr);
+	if (i->type == irt_bool || i->type == irt_char)
+		as.loadByte(w, m);
+	else
+		as.load(w, m, isWide(i));
+	fromGpr(i, w);
+}
+
+void X86FunctionCompiler::emitStore(const IRInstruction* i)
+{
+	const IRInstruction* v = i->operands[1];
+	toGpr(reg_r11, i->operands[0]);
+	X86Memory m = { reg_r11, 0 };
+	if (v->type == irt_float) {
+		toXmm(abi.xmmScratch[0], v);
+		return as.movss(m, abi.xmmScratch[0]);
+	}
+	toGpr(reg_rax, v);
+	if (v->type == irt_bool || v->type == irt_char)
+		as.storeByte(m, reg_rax);
+	else
+		as.store(m, reg_rax, isWide(v));
+}
+
+// Arguments start at operand first of i.
+void X86FunctionCompiler::emitCall(const IRInstruction* i, const X86Location& callee, int first)
+{
+	std::vector<X86Move> moves;
+	X86ArgumentPlacer placer;
+	for (std::size_t k = first; k < i->operands.size(); ++k) {
+		const IRInstruction* a = i->operands[k];
+		bool f = a->type == irt_float;
+		X86ArgumentPlace p = placer.place(f);
+		X86Location dst;
+		if (p.onStack)
+			dst = onStack(reg_rsp, hostConvention.shadow + 8 * p.index);
+		else
+			dst = f ? inXmm(p.index) : inGpr(static_cast<X86Register>(p.index));
+		moves.push_back({ dst, where(a), isWide(a) });
+	}
+	if (callee.kind != X86Location::label)
+		moves.push_back({ inGpr(reg_r10), callee, true });
+	move(moves);
+	if (callee.kind == X86Location::label)
+		as.call(callee.reg);
+	else
+		as.call(reg_r10);
+
+	if (i->type == irt_float) {
+		fromXmm(i, 0);
+	}
+	else if (i->type != irt_void) {
+		// Only the low byte of a narrow result is defined.
+		normalize(i->type, reg_rax);
+		fromGpr(i, reg_rax);
+	}
+}
+
+X86Condition X86FunctionCompiler::emitCompare(const IRInstruction* c)
+{
+	const IRInstruction* a = c->operands[0];
+	const IRInstruction* b = c->operands[1];
+	if (a->type == irt_float) {
+		// ucomiss sets the flags as an unsigned comparison would; less-than
+		// tests are turned around so that unordered operands fail them.
+		bool swap = c->op == ir_flt || c->op == ir_fle;
+		if (swap)
+			std::swap(a, b);
+		X86Location la = where(a);
+		int x = la.kind == X86Location::xmm ? la.reg : abi.xmmScratch[0];
+		toXmm(x, a);
+		X86Location lb = where(b);
+		if (lb.kind == X86Location::xmm) {
+			as.ucomiss(x, lb.reg);
+		}
+		else if (lb.kind == X86Location::stack) {
+			as.ucomiss(x, lb.getMemory());
+		}
+		else {
+			toXmm(abi.xmmScratch[1], b);
+			as.ucomiss(x, abi.xmmScratch[1]);
+		}
+		switch (c->op) {
+		case ir_feq: return cc_e;
+		case ir_fne: return cc_ne;
+		case ir_flt:
+		case ir_fgt:
+			return cc_a;
+		default:
+			return cc_ae;
+		}
+	}
+
+	X86Location la = where(a);
+	X86Register r = la.kind == X86Location::gpr ? static_cast<X86Register>(la.reg) : reg_rax;
+	toGpr(r, a);
+	arithWith(arith_cmp, r, b);
+	switch (c->op) {
+	case ir_eq: return cc_e;
+	case ir_ne: return cc_ne;
+	case ir_lt: return cc_l;
+	case ir_gt: return cc_g;
+	case ir_le: return cc_le;
+	case ir_ge: return cc_ge;
+	case ir_ult: return cc_b;
+	case ir_ugt: return cc_a;
+	case ir_ule: return cc_be;
+	default: return cc_ae;
+	}
+}
+
+// The moves into the phis of to along the edge from from. When both
+// targets of a branch are the same block, last picks the second edge.
+void X86FunctionCompiler::edgeMoves(const IRBlock* from, const IRBlock* to, bool last, std::vector<X86Move>& moves)
+{
+	std::size_t k = to->preds.size();
+	for (std::size_t n = 0; n < to->preds.size(); ++n) {
+		if (to->preds[n] == from) {
+			k = n;
+			if (!last)
+				break;
+		}
+	}
+	for (const IRInstruction* phi : to->instructions) {
+		if (!phi->isPhi())
+			break;
+		if (locations[phi->id].kind == X86Location::none)
+			continue;
+		moves.push_back({ locations[phi->id], where(phi->operands[k]), isWide(phi) });
+	}
+}
+
+void X86FunctionCompiler::jumpTo(const IRBlock* b)
+{
+	if (b != next)
+		as.jmp(labels[b->id]);
+}
+
+void X86FunctionCompiler::emitBranch(const IRInstruction* i)
+{
+	std::vector<X86Move> moves;
+	edgeMoves(i->block, i->targets[0], false, moves);
+	move(moves);
+	jumpTo(i->targets[0]);
+}
+
+void X86FunctionCompiler::emitCondBranch(const IRInstruction* i)
+{
+	const IRInstruction* c = i->operands[0];
+	const IRBlock* pass = i->targets[0];
+	const IRBlock* fail = i->targets[1];
+	X86Condition cc;
+	if (fused[c->id]) {
+		cc = emitCompare(c);
+	}
+	else {
+		X86Location l = where(c);
+		if (l.kind == X86Location::imm) {
+			std::vector<X86Move> moves;
+			const IRBlock* target = l.value ? pass : fail;
+			edgeMoves(i->block, target, !l.value, moves);
+			move(moves);
+			return jumpTo(target);
+		}
+		X86Register r = l.kind == X86Location::gpr ? static_cast<X86Register>(l.reg) : reg_rax;
+		toGpr(r, c);
+		as.test(r, r);
+		cc = cc_ne;
+	}
+
+	std::vector<X86Move> passMoves, failMoves;
+	edgeMoves(i->block, pass, false, passMoves);
+	edgeMoves(i->block, fail, true, failMoves);
+	if (passMoves.empty() && !(failMoves.empty() && pass == next)) {
+		as.jcc(cc, labels[pass->id]);
+		move(failMoves);
+		return jumpTo(fail);
+	}
+	if (failMoves.empty()) {
+		as.jcc(negate(cc), labels[fail->id]);
+		move(passMoves);
+		return jumpTo(pass);
+	}
+	int other = as.makeLabel();
+	as.jcc(negate(cc), other);
+	move(passMoves);
+	as.jmp(labels[pass->id]);
+	as.bind(other);
+	move(failMoves);
+	jumpTo(fail);
+}
+
+void X86FunctionCompiler::emitReturn(const IRInstruction* i)
+{
+	const IRInstruction* v = i->operands[0];
+	if (v->type == irt_float)
+		toXmm(0, v);
+	else
+		toGpr(reg_rax, v);
+	emitEpilogue();
+}
+
+X86Module::X86Module(const IRModule& m)
+	: offsets(m.functions.size(), -1), data(m.globals.size())
+{
+	TraceSpan span("X86Module::X86Module");
+	for (std::size_t k = 0; k < m.globals.size(); ++k)
+		data[k] = m.globals[k].getBits();
+	X86Assembler as;
+	X86ModuleContext context = { as, m, std::vector<int>(m.functions.size(), -1), as.makeLabel(), data.data() };
+	for (std::size_t k = 0; k < m.functions.size(); ++k) {
+		names.push_back(m.functions[k]->name);
+		if (m.functions[k]->isDefined())
+			context.functions[k] = as.makeLabel();
+	}
+
+	for (std::size_t k = 0; k < m.functions.size(); ++k) {
+		const IRFunction& f = *m.functions[k];
+		if (!f.isDefined())
+			continue;
+		TraceSpan function("X86FunctionCompiler::compile", f.name);
+		as.bind(context.functions[k]);
+		X86FunctionCompiler(context, f).compile();
+	}
+
+	// Calls to functions without a body trap.
+	as.bind(context.undefined);
+	as.ud2();
+	as.resolve();
+
+	const std::vector<std::uint8_t>& bytes = as.getCode();
+	code = ExecutableMemory(bytes.size());
+	std::memcpy(code.getBase(), bytes.data(), bytes.size());
+	code.protect();
+	for (std::size_t k = 0; k < m.functions.size(); ++k) {
+		if (context.functions[k] >= 0)
+			offsets[k] = static_cast<std::ptrdiff_t>(as.getLabelOffset(context.functions[k]));
+	}
+}
+
+void* X86Module::getFunction(std::size_t i) const
+{
+	if (offsets[i] < 0)
+		return nullptr;
+	return code.getBase() + offsets[i];
+}
+
+void* X86Module::getFunction(const std::string& name) const
+{
+	for (std::size_t k = 0; k < names.size(); ++k) {
+		if (names[k] == name)
+			return getFunction(k);
+	}
+	return nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include "IR.h"
+#include "ExecutableMemory.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiles the functions of a module straight to x86-64 machine code in
+// executable memory, without LLVM. Registers are given out by linear scan
+// over live intervals and each instruction is selected once, so this is a
+// fast first tier rather than an optimizing one. Functions follow the C
+// calling convention of the platform and can be called through a pointer
+// of the matching type.
+class X86Module {
+public:
+	explicit X86Module(const IRModule& m);
+
+	// Null when there is no such function or it has no body.
+	void* getFunction(const std::string& name) const;
+	void* getFunction(std::size_t i) const;
+
+	// The storage of a global.
+	void* getGlobal(std::size_t i) { return &data[i]; }
+
+	std::size_t getCodeSize() const { return code.getSize(); }
+
+private:
+	ExecutableMemory code;
+	std::vector<std::string> names;
+
+	// Where each function starts in the code, or -1 when it has no body.
+	std::vector<std::ptrdiff_t> offsets;
+
+	// A slot for each global, which the code addresses directly.
+	std::vector<std::uint64_t> data;
+};
\ No newline at end of file
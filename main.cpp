@@ -3,11 +3,139 @@
 #include "Lexer.h"
 #include "Parser.h"
 #include "Declaration.h"
+#include "DeadCode.h"
+#include "ConstantEvaluator.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include "MemoryProfile.h"
+#include "IRGen.h"
+#include "IRInline.h"
+#include "IRDivision.h"
+#include "IRLoopOpt.h"
+#include "IRValueNumbering.h"
+#include "X86Backend.h"
+#include "StencilJIT.h"
+#include "CBackend.h"
+#include "Casting.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+// Lowers the program to the SSA form and improves it for the backends.
+static std::unique_ptr<IRModule> lower(Declaration* d)
+{
+	PerfPhase phase(PerfCounters::codegen_phase);
+	MemoryPhase memory("lowering");
+	std::unique_ptr<IRModule> m = lowerProgram(cast<ProgramDeclaration>(d));
+	inlineCalls(*m);
+	reduceDivisions(*m);
+	optimizeLoops(*m);
+	numberValues(*m);
+	return m;
+}
+
+// Compiles m to machine code with a Module of the chosen tier, and calls
+// the function with the given name if it has no parameters.
+template <class Module>
+static int run(const IRModule& m, const char* name)
+{
+	std::unique_ptr<Module> x;
+	{
+		PerfPhase phase(PerfCounters::codegen_phase);
+		MemoryPhase memory("machine code");
+		x.reset(new Module(m));
+	}
+	for (std::size_t i = 0; i < m.functions.size(); ++i) {
+		const IRFunction& f = *m.functions[i];
+		if (f.name != name || !f.params.empty() || !x->getFunction(i))
+			continue;
+		if (f.result == irt_float)
+			std::cout << reinterpret_cast<float (*)()>(x->getFunction(i))() << '\n';
+		else if (f.result == irt_int)
+			std::cout << reinterpret_cast<int (*)()>(x->getFunction(i))() << '\n';
+		else if (f.result == irt_bool || f.result == irt_char)
+			std::cout << static_cast<int>(reinterpret_cast<unsigned char (*)()>(x->getFunction(i))()) << '\n';
+		return 0;
+	}
+	std::cerr << "No function " << name << " without parameters\n";
+	return 1;
+}
+
+// The trace is written at exit, so that it holds every phase however
+// main returns.
+static void finishTrace()
+{
+	Trace::finish();
+}
+
+static void reportCounters()
+{
+	PerfCounters::report(std::cerr);
+}
 
 int main() {
+	// Set COMPILER_TRACE to a file name to record a trace of the compile.
+	if (const char* trace = std::getenv("COMPILER_TRACE")) {
+		Trace::start(trace);
+		std::atexit(finishTrace);
+	}
+	// Set COMPILER_COUNTERS to report hardware counters for each phase
+	// when the program exits.
+	if (std::getenv("COMPILER_COUNTERS")) {
+		PerfCounters::start();
+		std::atexit(reportCounters);
+	}
+	// Set COMPILER_MEMORY to report memory use when the program exits.
+	if (std::getenv("COMPILER_MEMORY")) {
+		MemoryProfile::start();
+	}
 	File input("testFile.txt");
+	if (!input.isOpen()) {
+		std::cerr << input.getPath() << ": error: Cannot read the file\n";
+		return 1;
+	}
 	SymbolTable syms;
 	Parser p(syms, input);
 	Declaration* d = p.parseProgram();
+	if (p.getDiagnostics().hasErrors()) {
+		std::cerr << p.getDiagnostics();
+		return 1;
+	}
+	// Fold the calls that can be run now, then drop the code that cannot
+	// run. The entry point is the function named by COMPILER_RUN, or main.
+	{
+		MemoryPhase memory("constant calls");
+		evaluateConstantCalls(cast<ProgramDeclaration>(d));
+	}
+	const char* entry = std::getenv("COMPILER_RUN");
+	{
+		MemoryPhase memory("dead code");
+		removeDeadCode(cast<ProgramDeclaration>(d), entry ? entry : "main");
+	}
 	d->debug();
+	// Set COMPILER_IR to print the SSA form of the program as well.
+	if (std::getenv("COMPILER_IR")) {
+		std::unique_ptr<IRModule> m = lower(d);
+		std::cout << *m;
+		if (!verify(*m, std::cerr)) {
+			return 1;
+		}
+	}
+	// Set COMPILER_C to a file name to write the program as C source.
+	if (const char* path = std::getenv("COMPILER_C")) {
+		PerfPhase phase(PerfCounters::codegen_phase);
+		MemoryPhase memory("C source");
+		std::ofstream os(path);
+		writeCProgram(cast<ProgramDeclaration>(d), os);
+	}
+	// Set COMPILER_RUN to the name of a function without parameters to
+	// compile the program to machine code and call it. Set COMPILER_STENCILS
+	// as well to compile by copy and patch instead.
+	if (const char* name = std::getenv("COMPILER_RUN")) {
+		std::unique_ptr<IRModule> m = lower(d);
+		if (std::getenv("COMPILER_STENCILS")) {
+			return run<StencilModule>(*m, name);
+		}
+		return run<X86Module>(*m, name);
+	}
 }
\ No newline at end of file